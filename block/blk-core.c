@@ -148,6 +148,7 @@ void blk_rq_init(struct request_queue *q, struct request *rq)
 	rq->ref_count = 1;
 	rq->start_time = jiffies;
 	set_start_time_ns(rq);
+	blk_latency_hist_init_rq(rq);
 	rq->part = NULL;
 }
 EXPORT_SYMBOL(blk_rq_init);
@@ -739,6 +740,8 @@ blk_init_allocated_queue(struct request_queue *q, request_fn_proc *rfn,
 
 	q->sg_reserved_size = INT_MAX;
 
+	blk_latency_hist_init(q);
+
 	/* init elevator */
 	if (elevator_init(q, NULL))
 		return NULL;
@@ -2229,6 +2232,7 @@ void blk_start_request(struct request *req)
 	if (unlikely(blk_bidi_rq(req)))
 		req->next_rq->resid_len = blk_rq_bytes(req->next_rq);
 
+	blk_latency_hist_start(req);
 	blk_add_timer(req);
 }
 EXPORT_SYMBOL(blk_start_request);
@@ -2446,6 +2450,7 @@ static void blk_finish_request(struct request *req, int error)
 
 
 	blk_account_io_done(req);
+	blk_latency_hist_done(req);
 
 	if (req->end_io)
 		req->end_io(req, error);
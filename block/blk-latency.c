@@ -0,0 +1,210 @@
+/*
+ * Request completion latency histograms
+ *
+ * Every fs request completing on a request based queue is accounted in
+ * a per-cpu histogram, by operation and size class, from allocation of
+ * the request to its completion, so that time spent in the I/O
+ * scheduler is included.  Updates happen under the queue lock with
+ * interrupts off and touch only this cpu's counters.
+ *
+ * Buckets are half a power of two of nanoseconds wide, and percentiles
+ * are reported as the upper bound of the bucket they fall into.
+ */
+
+#include <linux/kernel.h>
+#include <linux/blkdev.h>
+#include <linux/percpu.h>
+#include <linux/math64.h>
+#include <linux/bitops.h>
+
+#include "blk.h"
+
+enum {
+	BLK_LAT_READ,
+	BLK_LAT_WRITE,
+	BLK_LAT_OTHER,		/* discard and empty flush */
+	BLK_LAT_NR_OPS,
+};
+
+/* <= 4k, <= 32k, <= 256k, larger */
+#define BLK_LAT_NR_SIZES	4
+
+/* bucket 0 is below 2^10 ns, the last one is from 2^32 ns up */
+#define BLK_LAT_MIN_SHIFT	10
+#define BLK_LAT_NR_BUCKETS	46
+
+struct blk_latency_hist {
+	unsigned long buckets[BLK_LAT_NR_OPS][BLK_LAT_NR_SIZES]
+			     [BLK_LAT_NR_BUCKETS];
+	u64 total_ns[BLK_LAT_NR_OPS][BLK_LAT_NR_SIZES];
+};
+
+static const char * const blk_lat_op_names[BLK_LAT_NR_OPS] = {
+	"read", "write", "other",
+};
+
+static const char * const blk_lat_size_names[BLK_LAT_NR_SIZES] = {
+	"4k", "32k", "256k", "large",
+};
+
+static int blk_lat_size_class(unsigned int bytes)
+{
+	if (bytes <= (4 << 10))
+		return 0;
+	if (bytes <= (32 << 10))
+		return 1;
+	if (bytes <= (256 << 10))
+		return 2;
+	return 3;
+}
+
+static int blk_lat_bucket(u64 ns)
+{
+	int order, idx;
+
+	if (ns < (1ULL << BLK_LAT_MIN_SHIFT))
+		return 0;
+
+	order = fls64(ns) - 1;
+	idx = 1 + (order - BLK_LAT_MIN_SHIFT) * 2 +
+		((ns >> (order - 1)) & 1);
+	return min(idx, BLK_LAT_NR_BUCKETS - 1);
+}
+
+/* Upper bound of bucket idx, in ns */
+static u64 blk_lat_bucket_limit(int idx)
+{
+	int order;
+
+	if (!idx)
+		return 1ULL << BLK_LAT_MIN_SHIFT;
+
+	order = BLK_LAT_MIN_SHIFT + (idx - 1) / 2;
+	return (1ULL << order) + ((u64)((idx - 1) % 2 + 1) << (order - 1));
+}
+
+void blk_latency_hist_init(struct request_queue *q)
+{
+	/* the histograms are optional, the queue works without them */
+	q->latency_hist = alloc_percpu(struct blk_latency_hist);
+}
+
+void blk_latency_hist_exit(struct request_queue *q)
+{
+	free_percpu(q->latency_hist);
+	q->latency_hist = NULL;
+}
+
+/*
+ * queue lock must be held
+ */
+void blk_latency_hist_done(struct request *rq)
+{
+	struct blk_latency_hist __percpu *hist = rq->q->latency_hist;
+	s64 ns;
+	int op, size;
+
+	if (!hist || rq->cmd_type != REQ_TYPE_FS ||
+	    (rq->cmd_flags & REQ_FLUSH_SEQ))
+		return;
+
+	ns = ktime_to_ns(ktime_get()) - rq->lat_start_ns;
+	if (ns < 0)
+		ns = 0;
+
+	if ((rq->cmd_flags & REQ_DISCARD) || !rq->lat_bytes)
+		op = BLK_LAT_OTHER;
+	else if (rq_data_dir(rq) == WRITE)
+		op = BLK_LAT_WRITE;
+	else
+		op = BLK_LAT_READ;
+	size = blk_lat_size_class(rq->lat_bytes);
+
+	this_cpu_inc(hist->buckets[op][size][blk_lat_bucket(ns)]);
+	this_cpu_add(hist->total_ns[op][size], ns);
+}
+
+/* Latency in us below which permille of the nr samples fall */
+static u64 blk_lat_percentile(unsigned long *buckets, unsigned long nr,
+			      int permille)
+{
+	u64 target, seen = 0;
+	int idx;
+
+	if (!nr)
+		return 0;
+
+	target = div_u64((u64)nr * permille + 999, 1000);
+	for (idx = 0; idx < BLK_LAT_NR_BUCKETS - 1; idx++) {
+		seen += buckets[idx];
+		if (seen >= target)
+			break;
+	}
+	return div_u64(blk_lat_bucket_limit(idx), NSEC_PER_USEC);
+}
+
+ssize_t blk_latency_hist_show(struct request_queue *q, char *page)
+{
+	unsigned long buckets[BLK_LAT_NR_BUCKETS];
+	struct blk_latency_hist *hist;
+	unsigned long nr;
+	u64 total_ns;
+	ssize_t len;
+	int op, size, idx, cpu;
+
+	if (!q->latency_hist)
+		return -EINVAL;
+
+	len = sprintf(page, "%-6s %-6s %10s %10s %10s %10s %10s\n",
+		      "op", "size", "count", "mean_us", "p50_us", "p99_us",
+		      "p999_us");
+
+	for (op = 0; op < BLK_LAT_NR_OPS; op++) {
+		for (size = 0; size < BLK_LAT_NR_SIZES; size++) {
+			memset(buckets, 0, sizeof(buckets));
+			total_ns = 0;
+			for_each_possible_cpu(cpu) {
+				hist = per_cpu_ptr(q->latency_hist, cpu);
+				for (idx = 0; idx < BLK_LAT_NR_BUCKETS; idx++)
+					buckets[idx] +=
+						hist->buckets[op][size][idx];
+				total_ns += hist->total_ns[op][size];
+			}
+
+			nr = 0;
+			for (idx = 0; idx < BLK_LAT_NR_BUCKETS; idx++)
+				nr += buckets[idx];
+
+			len += sprintf(page + len,
+				"%-6s %-6s %10lu %10llu %10llu %10llu %10llu\n",
+				blk_lat_op_names[op], blk_lat_size_names[size],
+				nr,
+				nr ? div64_u64(total_ns, (u64)nr *
+					       NSEC_PER_USEC) : 0,
+				blk_lat_percentile(buckets, nr, 500),
+				blk_lat_percentile(buckets, nr, 990),
+				blk_lat_percentile(buckets, nr, 999));
+		}
+	}
+
+	return len;
+}
+
+/*
+ * Any write resets the histograms.  Completions racing with the reset
+ * may survive it, which is fine for statistics.
+ */
+ssize_t blk_latency_hist_store(struct request_queue *q, const char *page,
+			       size_t count)
+{
+	int cpu;
+
+	if (!q->latency_hist)
+		return -EINVAL;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(q->latency_hist, cpu), 0,
+		       sizeof(struct blk_latency_hist));
+
+	return count;
+}
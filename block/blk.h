@@ -2,6 +2,7 @@
 #define BLK_INTERNAL_H
 
 #include <linux/idr.h>
+#include <linux/ktime.h>
 
 /* Amount of time in which a process may batch requests */
 #define BLK_BATCH_TIME	(HZ/50UL)
@@ -231,4 +232,29 @@ static inline int blk_throtl_init(struct request_queue *q) { return 0; }
 static inline void blk_throtl_exit(struct request_queue *q) { }
 #endif /* CONFIG_BLK_DEV_THROTTLING */
 
+#ifdef CONFIG_BLK_DEV_LATENCY_HIST
+extern void blk_latency_hist_init(struct request_queue *q);
+extern void blk_latency_hist_exit(struct request_queue *q);
+extern void blk_latency_hist_done(struct request *rq);
+extern ssize_t blk_latency_hist_show(struct request_queue *q, char *page);
+extern ssize_t blk_latency_hist_store(struct request_queue *q,
+				      const char *page, size_t count);
+
+static inline void blk_latency_hist_init_rq(struct request *rq)
+{
+	rq->lat_start_ns = ktime_to_ns(ktime_get());
+}
+
+static inline void blk_latency_hist_start(struct request *rq)
+{
+	rq->lat_bytes = blk_rq_bytes(rq);
+}
+#else /* CONFIG_BLK_DEV_LATENCY_HIST */
+static inline void blk_latency_hist_init(struct request_queue *q) { }
+static inline void blk_latency_hist_exit(struct request_queue *q) { }
+static inline void blk_latency_hist_done(struct request *rq) { }
+static inline void blk_latency_hist_init_rq(struct request *rq) { }
+static inline void blk_latency_hist_start(struct request *rq) { }
+#endif /* CONFIG_BLK_DEV_LATENCY_HIST */
+
 #endif /* BLK_INTERNAL_H */
@@ -30,6 +30,11 @@
 #include <linux/suspend.h>
 #include <linux/cpuidle.h>
 #include <linux/timer.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/srcu.h>
+#include <linux/rculist.h>
 
 #include "../base.h"
 #include "power.h"
@@ -64,6 +69,29 @@ struct dpm_watchdog {
 
 static int async_error;
 
+/*
+ * A PM dependency of a consumer device on a supplier device other than its
+ * parent.  The consumer is resumed after and suspended before the supplier,
+ * like a child of it.  The lists are changed under dpm_list_mtx and walked
+ * either under it or, by the suspend and resume callbacks which wait for
+ * other devices, under dpm_dep_srcu.
+ */
+struct dpm_dependency {
+	struct device		*supplier;
+	struct device		*consumer;
+	struct list_head	s_node;		/* in supplier's consumers */
+	struct list_head	c_node;		/* in consumer's suppliers */
+	struct list_head	free_node;	/* dependencies being dropped */
+};
+
+DEFINE_STATIC_SRCU(dpm_dep_srcu);
+
+/* Generation of dev->power.dep_visit marks, under dpm_list_mtx */
+static unsigned int dpm_dep_visit;
+
+/* Duration of the resume phases of the last system resume, in usecs */
+static int dpm_resume_noirq_us, dpm_resume_early_us, dpm_resume_us;
+
 /**
  * device_pm_sleep_init - Initialize system suspend-related device fields.
  * @dev: Device object being initialized.
@@ -76,6 +104,8 @@ void device_pm_sleep_init(struct device *dev)
 	complete_all(&dev->power.completion);
 	dev->power.wakeup = NULL;
 	INIT_LIST_HEAD(&dev->power.entry);
+	INIT_LIST_HEAD(&dev->power.suppliers);
+	INIT_LIST_HEAD(&dev->power.consumers);
 }
 
 /**
@@ -110,18 +140,61 @@ void device_pm_add(struct device *dev)
 	mutex_unlock(&dpm_list_mtx);
 }
 
+/*
+ * Unlink @dep and queue it on @free for dpm_dependencies_free(); called
+ * with dpm_list_mtx held.
+ */
+static void dpm_dependency_unlink(struct dpm_dependency *dep,
+				  struct list_head *free)
+{
+	list_del_rcu(&dep->s_node);
+	list_del_rcu(&dep->c_node);
+	list_add_tail(&dep->free_node, free);
+}
+
+/* Free unlinked dependencies once no waiter can be looking at them. */
+static void dpm_dependencies_free(struct list_head *free)
+{
+	struct dpm_dependency *dep, *tmp;
+
+	if (list_empty(free))
+		return;
+
+	synchronize_srcu(&dpm_dep_srcu);
+	list_for_each_entry_safe(dep, tmp, free, free_node) {
+		put_device(dep->supplier);
+		put_device(dep->consumer);
+		kfree(dep);
+	}
+}
+
+/* Unlink all dependencies of @dev, in both directions. */
+static void dpm_drop_dependencies(struct device *dev, struct list_head *free)
+{
+	struct dpm_dependency *dep, *tmp;
+
+	list_for_each_entry_safe(dep, tmp, &dev->power.suppliers, c_node)
+		dpm_dependency_unlink(dep, free);
+	list_for_each_entry_safe(dep, tmp, &dev->power.consumers, s_node)
+		dpm_dependency_unlink(dep, free);
+}
+
 /**
  * device_pm_remove - Remove a device from the PM core's list of active devices.
  * @dev: Device to be removed from the list.
  */
 void device_pm_remove(struct device *dev)
 {
+	LIST_HEAD(free);
+
 	pr_debug("PM: Removing info for %s:%s\n",
 		 dev->bus ? dev->bus->name : "No Bus", dev_name(dev));
 	complete_all(&dev->power.completion);
 	mutex_lock(&dpm_list_mtx);
 	list_del_init(&dev->power.entry);
+	dpm_drop_dependencies(dev, &free);
 	mutex_unlock(&dpm_list_mtx);
+	dpm_dependencies_free(&free);
 	device_wakeup_disable(dev);
 	pm_runtime_remove(dev);
 }
@@ -165,6 +238,133 @@ void device_pm_move_last(struct device *dev)
 	list_move_tail(&dev->power.entry, &dpm_list);
 }
 
+static bool __dpm_depends_on(struct device *dev, struct device *target,
+			     unsigned int visit)
+{
+	struct dpm_dependency *dep;
+
+	for (; dev; dev = dev->parent) {
+		if (dev == target)
+			return true;
+		/* everything reachable from here has been looked at */
+		if (dev->power.dep_visit == visit)
+			return false;
+		dev->power.dep_visit = visit;
+		list_for_each_entry(dep, &dev->power.suppliers, c_node)
+			if (__dpm_depends_on(dep->supplier, target, visit))
+				return true;
+	}
+	return false;
+}
+
+/*
+ * Whether @dev has to wait for @target, through parents or suppliers.
+ * Each device is looked at once.  Called with dpm_list_mtx held.
+ */
+static bool dpm_depends_on(struct device *dev, struct device *target)
+{
+	if (!++dpm_dep_visit)
+		++dpm_dep_visit;
+	return __dpm_depends_on(dev, target, dpm_dep_visit);
+}
+
+static int dpm_reorder_child(struct device *dev, void *unused);
+
+/*
+ * Move @dev and everything that depends on it to the end of dpm_list, so
+ * that they come after a new supplier of @dev.
+ */
+static void dpm_reorder_to_tail(struct device *dev)
+{
+	struct dpm_dependency *dep;
+
+	/* not, or no longer, on dpm_list */
+	if (list_empty(&dev->power.entry))
+		return;
+
+	device_pm_move_last(dev);
+	device_for_each_child(dev, NULL, dpm_reorder_child);
+	list_for_each_entry(dep, &dev->power.consumers, s_node)
+		dpm_reorder_to_tail(dep->consumer);
+}
+
+static int dpm_reorder_child(struct device *dev, void *unused)
+{
+	dpm_reorder_to_tail(dev);
+	return 0;
+}
+
+/**
+ * device_pm_add_supplier - Make a device's PM transitions depend on another.
+ * @consumer: Device that depends on @supplier.
+ * @supplier: Device that has to be active for @consumer to be.
+ *
+ * Make the PM core resume @consumer after and suspend it before @supplier,
+ * in addition to the ordering between parents and children, so that the
+ * devices can be handled asynchronously.  Must not be called from PM
+ * callbacks or during a system sleep transition.
+ */
+int device_pm_add_supplier(struct device *consumer, struct device *supplier)
+{
+	struct dpm_dependency *dep;
+	int error = 0;
+
+	if (!consumer || !supplier || consumer == supplier)
+		return -EINVAL;
+
+	dep = kzalloc(sizeof(*dep), GFP_KERNEL);
+	if (!dep)
+		return -ENOMEM;
+
+	mutex_lock(&dpm_list_mtx);
+	if (list_empty(&consumer->power.entry) ||
+	    list_empty(&supplier->power.entry)) {
+		error = -ENODEV;
+		goto out;
+	}
+	if (consumer->power.is_prepared || supplier->power.is_prepared) {
+		error = -EBUSY;
+		goto out;
+	}
+	if (dpm_depends_on(supplier, consumer)) {
+		error = -EINVAL;
+		goto out;
+	}
+
+	dep->supplier = get_device(supplier);
+	dep->consumer = get_device(consumer);
+	list_add_tail_rcu(&dep->s_node, &supplier->power.consumers);
+	list_add_tail_rcu(&dep->c_node, &consumer->power.suppliers);
+	dpm_reorder_to_tail(consumer);
+	dep = NULL;
+ out:
+	mutex_unlock(&dpm_list_mtx);
+	kfree(dep);
+	return error;
+}
+EXPORT_SYMBOL_GPL(device_pm_add_supplier);
+
+/**
+ * device_pm_remove_supplier - Drop a dependency added by device_pm_add_supplier.
+ * @consumer: Device that depends on @supplier.
+ * @supplier: Device @consumer depends on.
+ */
+void device_pm_remove_supplier(struct device *consumer, struct device *supplier)
+{
+	struct dpm_dependency *dep;
+	LIST_HEAD(free);
+
+	mutex_lock(&dpm_list_mtx);
+	list_for_each_entry(dep, &consumer->power.suppliers, c_node)
+		if (dep->supplier == supplier) {
+			dpm_dependency_unlink(dep, &free);
+			break;
+		}
+	mutex_unlock(&dpm_list_mtx);
+	dpm_dependencies_free(&free);
+}
+EXPORT_SYMBOL_GPL(device_pm_remove_supplier);
+
 static ktime_t initcall_debug_start(struct device *dev)
 {
 	ktime_t calltime = ktime_set(0, 0);
@@ -217,6 +417,38 @@ static void dpm_wait_for_children(struct device *dev, bool async)
        device_for_each_child(dev, &async, dpm_wait_fn);
 }
 
+/*
+ * Devices may be removed while others wait for them, so the dependency
+ * lists are walked under dpm_dep_srcu rather than dpm_list_mtx, which the
+ * PM core takes between devices.
+ */
+static void dpm_wait_for_suppliers(struct device *dev, bool async)
+{
+	struct dpm_dependency *dep;
+	int idx;
+
+	idx = srcu_read_lock(&dpm_dep_srcu);
+	list_for_each_entry_rcu(dep, &dev->power.suppliers, c_node)
+		dpm_wait(dep->supplier, async);
+	srcu_read_unlock(&dpm_dep_srcu, idx);
+}
+
+static void dpm_wait_for_consumers(struct device *dev, bool async)
+{
+	struct dpm_dependency *dep;
+	int idx;
+
+	idx = srcu_read_lock(&dpm_dep_srcu);
+	list_for_each_entry_rcu(dep, &dev->power.consumers, s_node)
+		dpm_wait(dep->consumer, async);
+	srcu_read_unlock(&dpm_dep_srcu, idx);
+}
+
+static u32 dpm_elapsed_us(ktime_t start)
+{
+	return ktime_to_us(ktime_sub(ktime_get(), start));
+}
+
 /**
  * pm_op - Return the PM operation appropriate for given PM event.
  * @ops: PM operations to choose from.
@@ -355,7 +587,7 @@ static void pm_dev_err(struct device *dev, pm_message_t state, char *info,
 		dev_name(dev), pm_verb(state.event), info, error);
 }
 
-static void dpm_show_time(ktime_t starttime, pm_message_t state, char *info)
+static int dpm_show_time(ktime_t starttime, pm_message_t state, char *info)
 {
 	ktime_t calltime;
 	u64 usecs64;
@@ -370,6 +602,7 @@ static void dpm_show_time(ktime_t starttime, pm_message_t state, char *info)
 	pr_info("PM: %s%s%s of devices complete after %ld.%03ld msecs\n",
 		info ?: "", info ? " " : "", pm_verb(state.event),
 		usecs / USEC_PER_MSEC, usecs % USEC_PER_MSEC);
+	return usecs;
 }
 
 static int dpm_run_callback(pm_callback_t cb, struct device *dev,
@@ -457,10 +690,12 @@ static int device_resume_noirq(struct device *dev, pm_message_t state)
 	pm_callback_t callback = NULL;
 	char *info = NULL;
 	int error = 0;
+	ktime_t calltime;
 
 	TRACE_DEVICE(dev);
 	TRACE_RESUME(0);
 
+	dev->power.resume_noirq_us = 0;
 	if (dev->power.syscore)
 		goto Out;
 
@@ -483,7 +718,9 @@ static int device_resume_noirq(struct device *dev, pm_message_t state)
 		callback = pm_noirq_op(dev->driver->pm, state);
 	}
 
+	calltime = ktime_get();
 	error = dpm_run_callback(callback, dev, state, info);
+	dev->power.resume_noirq_us = dpm_elapsed_us(calltime);
 
  Out:
 	TRACE_RESUME(error);
@@ -522,7 +759,7 @@ static void dpm_resume_noirq(pm_message_t state)
 		put_device(dev);
 	}
 	mutex_unlock(&dpm_list_mtx);
-	dpm_show_time(starttime, state, "noirq");
+	dpm_resume_noirq_us = dpm_show_time(starttime, state, "noirq");
 	resume_device_irqs();
 	cpuidle_resume();
 }
@@ -539,10 +776,12 @@ static int device_resume_early(struct device *dev, pm_message_t state)
 	pm_callback_t callback = NULL;
 	char *info = NULL;
 	int error = 0;
+	ktime_t calltime;
 
 	TRACE_DEVICE(dev);
 	TRACE_RESUME(0);
 
+	dev->power.resume_early_us = 0;
 	if (dev->power.syscore)
 		goto Out;
 
@@ -565,7 +804,9 @@ static int device_resume_early(struct device *dev, pm_message_t state)
 		callback = pm_late_early_op(dev->driver->pm, state);
 	}
 
+	calltime = ktime_get();
 	error = dpm_run_callback(callback, dev, state, info);
+	dev->power.resume_early_us = dpm_elapsed_us(calltime);
 
  Out:
 	TRACE_RESUME(error);
@@ -603,7 +844,7 @@ static void dpm_resume_early(pm_message_t state)
 		put_device(dev);
 	}
 	mutex_unlock(&dpm_list_mtx);
-	dpm_show_time(starttime, state, "early");
+	dpm_resume_early_us = dpm_show_time(starttime, state, "early");
 }
 
 /**
@@ -629,15 +870,21 @@ static int device_resume(struct device *dev, pm_message_t state, bool async)
 	char *info = NULL;
 	int error = 0;
 	struct dpm_watchdog wd;
+	ktime_t calltime;
 
 	TRACE_DEVICE(dev);
 	TRACE_RESUME(0);
 
+	dev->power.resume_wait_us = 0;
+	dev->power.resume_us = 0;
 	if (dev->power.syscore)
 		goto Complete;
 
+	calltime = ktime_get();
 	dpm_wait(dev->parent, async);
+	dpm_wait_for_suppliers(dev, async);
 	device_lock(dev);
+	dev->power.resume_wait_us = dpm_elapsed_us(calltime);
 
 	/*
 	 * This is a fib.  But we'll allow new children to be added below
@@ -691,7 +938,9 @@ static int device_resume(struct device *dev, pm_message_t state, bool async)
 	}
 
  End:
+	calltime = ktime_get();
 	error = dpm_run_callback(callback, dev, state, info);
+	dev->power.resume_us = dpm_elapsed_us(calltime);
 	dev->power.is_suspended = false;
 
  Unlock:
@@ -773,7 +1022,7 @@ void dpm_resume(pm_message_t state)
 	}
 	mutex_unlock(&dpm_list_mtx);
 	async_synchronize_full();
-	dpm_show_time(starttime, state, NULL);
+	dpm_resume_us = dpm_show_time(starttime, state, NULL);
 }
 
 /**
@@ -1117,6 +1366,7 @@ static int __device_suspend(struct device *dev, pm_message_t state, bool async)
 	struct dpm_watchdog wd;
 
 	dpm_wait_for_children(dev, async);
+	dpm_wait_for_consumers(dev, async);
 
 	if (async_error)
 		goto Complete;
@@ -1441,3 +1691,51 @@ void dpm_for_each_dev(void *data, void (*fn)(struct device *, void *))
 	device_pm_unlock();
 }
 EXPORT_SYMBOL_GPL(dpm_for_each_dev);
+
+#ifdef CONFIG_DEBUG_FS
+/*
+ * Per-device timings of the last system resume, in dpm_list order.  "wait"
+ * is the time spent waiting for the parent and suppliers of the device
+ * before its ->resume() callback could run; a device with a long wait and
+ * a short callback of its own is held up by a dependency.
+ */
+static int dpm_resume_times_show(struct seq_file *m, void *unused)
+{
+	struct device *dev;
+
+	seq_puts(m, "device\tasync\twait_us\tnoirq_us\tearly_us\tresume_us\n");
+
+	mutex_lock(&dpm_list_mtx);
+	list_for_each_entry(dev, &dpm_list, power.entry)
+		seq_printf(m, "%s\t%d\t%u\t%u\t%u\t%u\n", dev_name(dev),
+			   is_async(dev), dev->power.resume_wait_us,
+			   dev->power.resume_noirq_us,
+			   dev->power.resume_early_us, dev->power.resume_us);
+	mutex_unlock(&dpm_list_mtx);
+
+	seq_printf(m, "total\t-\t-\t%d\t%d\t%d\n", dpm_resume_noirq_us,
+		   dpm_resume_early_us, dpm_resume_us);
+	return 0;
+}
+
+static int dpm_resume_times_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dpm_resume_times_show, NULL);
+}
+
+static const struct file_operations dpm_resume_times_fops = {
+	.owner = THIS_MODULE,
+	.open = dpm_resume_times_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static int __init dpm_debugfs_init(void)
+{
+	debugfs_create_file("resume_times", S_IRUGO, NULL, NULL,
+			    &dpm_resume_times_fops);
+	return 0;
+}
+late_initcall(dpm_debugfs_init);
+#endif /* CONFIG_DEBUG_FS */
@@ -342,7 +342,7 @@ static ssize_t wakeup_count_show(struct device *dev,
 
 	spin_lock_irq(&dev->power.lock);
 	if (dev->power.wakeup) {
-		count = dev->power.wakeup->event_count;
+		count = atomic_long_read(&dev->power.wakeup->event_count);
 		enabled = true;
 	}
 	spin_unlock_irq(&dev->power.lock);
@@ -377,7 +377,7 @@ static ssize_t wakeup_abort_count_show(struct device *dev,
 
 	spin_lock_irq(&dev->power.lock);
 	if (dev->power.wakeup) {
-		count = dev->power.wakeup->wakeup_count;
+		count = atomic_long_read(&dev->power.wakeup->wakeup_count);
 		enabled = true;
 	}
 	spin_unlock_irq(&dev->power.lock);
@@ -404,12 +404,17 @@ static void wakeup_source_activate(struct wakeup_source *ws)
  * wakeup_source_report_event - Report wakeup event using the given source.
  * @ws: Wakeup source to report the event for.
  */
-static void wakeup_source_report_event(struct wakeup_source *ws)
+static void wakeup_source_count_event(struct wakeup_source *ws)
 {
-	ws->event_count++;
+	atomic_long_inc(&ws->event_count);
 	/* This is racy, but the counter is approximate anyway. */
 	if (events_check_enabled)
-		ws->wakeup_count++;
+		atomic_long_inc(&ws->wakeup_count);
+}
+
+static void wakeup_source_report_event(struct wakeup_source *ws)
+{
+	wakeup_source_count_event(ws);
 
 	if (!ws->active)
 		wakeup_source_activate(ws);
@@ -428,6 +433,17 @@ void __pm_stay_awake(struct wakeup_source *ws)
 	if (!ws)
 		return;
 
+	/*
+	 * If @ws is active without a timeout, all that is left to do is to
+	 * count the event.  A __pm_relax() racing with this may deactivate
+	 * @ws right after the check, which is the same as it running after
+	 * this function.
+	 */
+	if (ACCESS_ONCE(ws->active) && !ACCESS_ONCE(ws->timer_expires)) {
+		wakeup_source_count_event(ws);
+		return;
+	}
+
 	spin_lock_irqsave(&ws->lock, flags);
 
 	wakeup_source_report_event(ws);
@@ -844,8 +860,9 @@ static int print_wakeup_source_stats(struct seq_file *m,
 
 	ret = seq_printf(m, "%-12s\t%lu\t\t%lu\t\t%lu\t\t%lu\t\t"
 			"%lld\t\t%lld\t\t%lld\t\t%lld\t\t%lld\n",
-			ws->name, active_count, ws->event_count,
-			ws->wakeup_count, ws->expire_count,
+			ws->name, active_count,
+			atomic_long_read(&ws->event_count),
+			atomic_long_read(&ws->wakeup_count), ws->expire_count,
 			ktime_to_ms(active_time), ktime_to_ms(total_time),
 			ktime_to_ms(max_time), ktime_to_ms(ws->last_time),
 			ktime_to_ms(prevent_sleep_time));
@@ -0,0 +1,334 @@
+/*
+ * drivers/cpufreq/cc_hotplug.c
+ *
+ * Predictive cpu hotplug driven by runqueue concurrency.
+ *
+ * Bringing a core online takes milliseconds, so a driver that waits for
+ * the load of the online cores to rise brings them up after the burst
+ * that needed them has started.  This driver samples every sample_ms the
+ * concurrency of the online cpus (the decayed average number of runnable
+ * tasks, see kernel/sched/consolidation.c) and the current number of
+ * runnable tasks.  The demand is predicted as the higher of the two plus
+ * the rise of the concurrency since the previous sample, and as many cpus
+ * are brought up at once as needed for none of them to have more than
+ * up_threshold percent of a task.  An input event is taken as a demand
+ * for input_boost_cpus cpus for input_boost_ms, so that the cores are up
+ * by the time the frames following a touch are rendered.
+ *
+ * A cpu is only taken down once the predicted demand would have fit in
+ * one cpu less at down_threshold percent for down_hold_ms, one cpu at a
+ * time, so that the short gaps between bursts do not make cores bounce.
+ *
+ * The driver does not run while the MSM hotplug driver manages the cpus.
+ *
+ * tools/power/hotplug/hotplug_replay replays input and load traces
+ * through this policy and a load average driven one.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/cpu.h>
+#include <linux/init.h>
+#include <linux/input.h>
+#include <linux/jiffies.h>
+#include <linux/msm_hotplug.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+
+#define CC_HOTPLUG		"cc_hotplug"
+#define CC_SCALE		(1UL << CPU_CONCURRENCY_SHIFT)
+#define START_DELAY		(30 * HZ)
+
+static bool enabled = true;
+static unsigned int min_cpus = 1;
+static unsigned int max_cpus = NR_CPUS;
+static unsigned int sample_ms = 20;
+static unsigned int up_threshold = 90;
+static unsigned int down_threshold = 60;
+static unsigned int down_hold_ms = 500;
+static unsigned int input_boost_cpus = 2;
+static unsigned int input_boost_ms = 500;
+static unsigned int debug;
+
+module_param(min_cpus, uint, 0644);
+module_param(max_cpus, uint, 0644);
+module_param(sample_ms, uint, 0644);
+module_param(up_threshold, uint, 0644);
+module_param(down_threshold, uint, 0644);
+module_param(down_hold_ms, uint, 0644);
+module_param(input_boost_cpus, uint, 0644);
+module_param(input_boost_ms, uint, 0644);
+module_param(debug, uint, 0644);
+
+#define dprintk(msg...)		\
+do {				\
+	if (debug)		\
+		pr_info(msg);	\
+} while (0)
+
+static struct workqueue_struct *cc_hotplug_wq;
+static struct delayed_work cc_hotplug_work;
+
+/* Only touched by cc_hotplug_work */
+static unsigned long prev_cc;
+static unsigned long below_since;
+
+static unsigned long boost_until;
+
+static void cc_hotplug_queue(unsigned long delay)
+{
+	mod_delayed_work(cc_hotplug_wq, &cc_hotplug_work, delay);
+}
+
+/* Predicted number of runnable tasks, scaled by CC_SCALE */
+static unsigned long cc_hotplug_demand(void)
+{
+	unsigned long cc = 0, nr, demand;
+	unsigned int cpu;
+
+	for_each_online_cpu(cpu)
+		cc += cpu_concurrency(cpu);
+
+	/* not counting ourselves */
+	nr = nr_running();
+	nr = nr ? (nr - 1) * CC_SCALE : 0;
+
+	demand = max(cc, nr);
+	if (cc > prev_cc)
+		demand += cc - prev_cc;
+	prev_cc = cc;
+	return demand;
+}
+
+/* Cpus needed for @demand not to exceed @pct percent of a task on each */
+static unsigned int cc_hotplug_cpus(unsigned long demand, unsigned int pct)
+{
+	return DIV_ROUND_UP(demand * 100, max(pct, 1U) * CC_SCALE);
+}
+
+static void __ref cc_hotplug_up(unsigned int target)
+{
+	unsigned int cpu;
+
+	for_each_present_cpu(cpu) {
+		if (num_online_cpus() >= target)
+			break;
+		if (!cpu_online(cpu))
+			cpu_up(cpu);
+	}
+}
+
+/* Take down the least busy cpu other than the boot cpu */
+static void cc_hotplug_down(void)
+{
+	unsigned long cc, min_cc = ULONG_MAX;
+	unsigned int cpu, victim = 0;
+
+	for_each_online_cpu(cpu) {
+		if (!cpu)
+			continue;
+		cc = cpu_concurrency(cpu);
+		if (cc < min_cc) {
+			min_cc = cc;
+			victim = cpu;
+		}
+	}
+	if (victim)
+		cpu_down(victim);
+}
+
+static void cc_hotplug_work_fn(struct work_struct *work)
+{
+	unsigned int online = num_online_cpus();
+	unsigned int lo = max(min_cpus, 1U);
+	unsigned int hi = min_t(unsigned int, max_cpus, nr_cpu_ids);
+	unsigned int up, keep;
+	unsigned long demand;
+	bool boosted;
+
+	/* it may have been probed after we were enabled */
+	if (msm_hotplug_running()) {
+		pr_warn("%s: msm_hotplug is running, disabling\n",
+			CC_HOTPLUG);
+		enabled = false;
+		return;
+	}
+
+	demand = cc_hotplug_demand();
+	boosted = time_before(jiffies, ACCESS_ONCE(boost_until));
+
+	up = cc_hotplug_cpus(demand, up_threshold);
+	keep = cc_hotplug_cpus(demand, down_threshold);
+	if (boosted) {
+		up = max(up, input_boost_cpus);
+		keep = max(keep, input_boost_cpus);
+	}
+	up = clamp(up, lo, hi);
+	keep = clamp(keep, lo, hi);
+
+	if (up > online) {
+		dprintk("%s: demand %lu/%lu, %u -> %u cpus%s\n", CC_HOTPLUG,
+			demand, CC_SCALE, online, up, boosted ? " (boost)" : "");
+		cc_hotplug_up(up);
+		below_since = 0;
+	} else if (online > hi) {
+		cc_hotplug_down();
+		below_since = 0;
+	} else if (keep < online) {
+		if (!below_since) {
+			below_since = jiffies;
+		} else if (time_after_eq(jiffies, below_since +
+					 msecs_to_jiffies(down_hold_ms))) {
+			dprintk("%s: demand %lu/%lu, %u -> %u cpus\n",
+				CC_HOTPLUG, demand, CC_SCALE, online,
+				online - 1);
+			cc_hotplug_down();
+			/* hold again before the next one */
+			below_since = jiffies;
+		}
+	} else {
+		below_since = 0;
+	}
+
+	cc_hotplug_queue(msecs_to_jiffies(max(sample_ms, 1U)));
+}
+
+static void cc_hotplug_input_event(struct input_handle *handle,
+				   unsigned int type, unsigned int code,
+				   int value)
+{
+	if (!enabled || !input_boost_ms)
+		return;
+
+	boost_until = jiffies + msecs_to_jiffies(input_boost_ms);
+	if (num_online_cpus() < input_boost_cpus)
+		cc_hotplug_queue(0);
+}
+
+static int cc_hotplug_input_connect(struct input_handler *handler,
+				    struct input_dev *dev,
+				    const struct input_device_id *id)
+{
+	struct input_handle *handle;
+	int err;
+
+	handle = kzalloc(sizeof(*handle), GFP_KERNEL);
+	if (!handle)
+		return -ENOMEM;
+
+	handle->dev = dev;
+	handle->handler = handler;
+	handle->name = CC_HOTPLUG;
+
+	err = input_register_handle(handle);
+	if (err)
+		goto err_free;
+
+	err = input_open_device(handle);
+	if (err)
+		goto err_unregister;
+
+	return 0;
+
+err_unregister:
+	input_unregister_handle(handle);
+err_free:
+	kfree(handle);
+	return err;
+}
+
+static void cc_hotplug_input_disconnect(struct input_handle *handle)
+{
+	input_close_device(handle);
+	input_unregister_handle(handle);
+	kfree(handle);
+}
+
+/* Touchscreens, touchpads and keys */
+static const struct input_device_id cc_hotplug_ids[] = {
+	{
+		.flags = INPUT_DEVICE_ID_MATCH_EVBIT |
+			 INPUT_DEVICE_ID_MATCH_ABSBIT,
+		.evbit = { BIT_MASK(EV_ABS) },
+		.absbit = { [BIT_WORD(ABS_MT_POSITION_X)] =
+			    BIT_MASK(ABS_MT_POSITION_X) |
+			    BIT_MASK(ABS_MT_POSITION_Y) },
+	},
+	{
+		.flags = INPUT_DEVICE_ID_MATCH_KEYBIT |
+			 INPUT_DEVICE_ID_MATCH_ABSBIT,
+		.keybit = { [BIT_WORD(BTN_TOUCH)] = BIT_MASK(BTN_TOUCH) },
+		.absbit = { [BIT_WORD(ABS_X)] =
+			    BIT_MASK(ABS_X) | BIT_MASK(ABS_Y) },
+	},
+	{
+		.flags = INPUT_DEVICE_ID_MATCH_EVBIT,
+		.evbit = { BIT_MASK(EV_KEY) },
+	},
+	{ },
+};
+
+static struct input_handler cc_hotplug_input_handler = {
+	.event		= cc_hotplug_input_event,
+	.connect	= cc_hotplug_input_connect,
+	.disconnect	= cc_hotplug_input_disconnect,
+	.name		= CC_HOTPLUG,
+	.id_table	= cc_hotplug_ids,
+};
+
+static int cc_hotplug_set_enabled(const char *val,
+				  const struct kernel_param *kp)
+{
+	bool enable = true;
+	int ret;
+
+	/* no value means "on", as for any bool parameter */
+	if (val && strtobool(val, &enable))
+		return -EINVAL;
+	if (enable && msm_hotplug_running())
+		return -EBUSY;
+
+	ret = param_set_bool(val, kp);
+	if (ret || !cc_hotplug_wq)
+		return ret;
+
+	if (enabled) {
+		below_since = 0;
+		cc_hotplug_queue(0);
+	} else {
+		cancel_delayed_work_sync(&cc_hotplug_work);
+	}
+	return 0;
+}
+
+static struct kernel_param_ops cc_hotplug_enabled_ops = {
+	.set = cc_hotplug_set_enabled,
+	.get = param_get_bool,
+};
+module_param_cb(enabled, &cc_hotplug_enabled_ops, &enabled, 0644);
+
+static int __init cc_hotplug_init(void)
+{
+	int ret;
+
+	cc_hotplug_wq = alloc_workqueue(CC_HOTPLUG, WQ_UNBOUND | WQ_HIGHPRI |
+					WQ_FREEZABLE, 1);
+	if (!cc_hotplug_wq)
+		return -ENOMEM;
+
+	INIT_DELAYED_WORK(&cc_hotplug_work, cc_hotplug_work_fn);
+
+	ret = input_register_handler(&cc_hotplug_input_handler);
+	if (ret)
+		pr_warn("%s: no input boost: %d\n", CC_HOTPLUG, ret);
+
+	if (enabled)
+		queue_delayed_work(cc_hotplug_wq, &cc_hotplug_work, START_DELAY);
+	return 0;
+}
+late_initcall(cc_hotplug_init);
@@ -0,0 +1,157 @@
+/*
+ * drivers/cpufreq/cpufreq_fake.c
+ *
+ * Fake cpufreq driver for exercising governors in virtual machines,
+ * where no real frequency control is available.  It exposes a fixed
+ * frequency table, records the frequency a governor asks for and sends
+ * the usual transition notifications, optionally after sleeping for a
+ * configurable switching latency.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#define pr_fmt(fmt)	KBUILD_MODNAME ": " fmt
+
+#include <linux/cpufreq.h>
+#include <linux/delay.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+
+static struct cpufreq_frequency_table fake_freq_table[] = {
+	{ 0,  400000 },
+	{ 1,  600000 },
+	{ 2,  800000 },
+	{ 3, 1000000 },
+	{ 4, 1200000 },
+	{ 5, 1400000 },
+	{ 6, 1600000 },
+	{ 7, 1800000 },
+	{ 8, 2000000 },
+	{ 9, CPUFREQ_TABLE_END },
+};
+
+static DEFINE_PER_CPU(unsigned int, fake_cur_freq);
+
+/* Switching latency in us, also reported as the transition latency */
+static unsigned int transition_delay_us;
+module_param(transition_delay_us, uint, 0644);
+MODULE_PARM_DESC(transition_delay_us, "time a frequency switch takes (us)");
+
+/* Scale all cpus together instead of one policy per cpu */
+static bool shared;
+module_param(shared, bool, 0444);
+MODULE_PARM_DESC(shared, "one frequency domain for all cpus");
+
+static int fake_verify_speed(struct cpufreq_policy *policy)
+{
+	return cpufreq_frequency_table_verify(policy, fake_freq_table);
+}
+
+static unsigned int fake_get_speed(unsigned int cpu)
+{
+	return per_cpu(fake_cur_freq, cpu);
+}
+
+static int fake_set_target(struct cpufreq_policy *policy,
+			   unsigned int target_freq, unsigned int relation)
+{
+	struct cpufreq_freqs freqs;
+	unsigned int index, cpu, delay;
+	int ret;
+
+	ret = cpufreq_frequency_table_target(policy, fake_freq_table,
+					     target_freq, relation, &index);
+	if (ret)
+		return ret;
+
+	freqs.old = per_cpu(fake_cur_freq, policy->cpu);
+	freqs.new = fake_freq_table[index].frequency;
+	if (freqs.old == freqs.new)
+		return 0;
+
+	cpufreq_notify_transition(policy, &freqs, CPUFREQ_PRECHANGE);
+
+	delay = ACCESS_ONCE(transition_delay_us);
+	if (delay)
+		usleep_range(delay, delay + delay / 8 + 1);
+
+	for_each_cpu(cpu, policy->cpus)
+		per_cpu(fake_cur_freq, cpu) = freqs.new;
+
+	cpufreq_notify_transition(policy, &freqs, CPUFREQ_POSTCHANGE);
+
+	return 0;
+}
+
+static int fake_cpufreq_init(struct cpufreq_policy *policy)
+{
+	unsigned int cpu;
+	int ret;
+
+	ret = cpufreq_frequency_table_cpuinfo(policy, fake_freq_table);
+	if (ret) {
+		pr_err("invalid frequency table: %d\n", ret);
+		return ret;
+	}
+
+	policy->cpuinfo.transition_latency =
+		transition_delay_us * NSEC_PER_USEC;
+	if (shared)
+		cpumask_setall(policy->cpus);
+
+	/* start from the lowest frequency, like an idle system would */
+	for_each_cpu(cpu, policy->cpus)
+		if (!per_cpu(fake_cur_freq, cpu))
+			per_cpu(fake_cur_freq, cpu) = policy->cpuinfo.min_freq;
+	policy->cur = per_cpu(fake_cur_freq, policy->cpu);
+
+	cpufreq_frequency_table_get_attr(fake_freq_table, policy->cpu);
+
+	return 0;
+}
+
+static int fake_cpufreq_exit(struct cpufreq_policy *policy)
+{
+	cpufreq_frequency_table_put_attr(policy->cpu);
+
+	return 0;
+}
+
+static struct freq_attr *fake_cpufreq_attr[] = {
+	&cpufreq_freq_attr_scaling_available_freqs,
+	NULL,
+};
+
+static struct cpufreq_driver fake_cpufreq_driver = {
+	.verify = fake_verify_speed,
+	.target = fake_set_target,
+	.get = fake_get_speed,
+	.init = fake_cpufreq_init,
+	.exit = fake_cpufreq_exit,
+	.name = "fake",
+	.owner = THIS_MODULE,
+	.attr = fake_cpufreq_attr,
+};
+
+static int __init fake_cpufreq_module_init(void)
+{
+	return cpufreq_register_driver(&fake_cpufreq_driver);
+}
+module_init(fake_cpufreq_module_init);
+
+static void __exit fake_cpufreq_module_exit(void)
+{
+	cpufreq_unregister_driver(&fake_cpufreq_driver);
+}
+module_exit(fake_cpufreq_module_exit);
+
+MODULE_DESCRIPTION("Fake cpufreq driver for governor testing");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,454 @@
+/*
+ * drivers/cpufreq/cpufreq_schedutil.c
+ *
+ * CPUFreq governor driven by the scheduler's load tracking.
+ *
+ * Rather than sampling idle time from a per-cpu timer, the governor
+ * registers a callback that the fair scheduling class runs whenever it
+ * refreshes the runnable average of a cpu (enqueue, dequeue, tick and
+ * idle transitions).  The callback runs under the runqueue lock, so it
+ * only picks a frequency, subject to a rate limit, and queues an
+ * irq_work; the irq_work wakes a SCHED_FIFO kthread which talks to the
+ * cpufreq driver.
+ *
+ * This software is licensed under the terms of the GNU General Public
+ * License version 2, as published by the Free Software Foundation, and
+ * may be copied, distributed, and modified under those terms.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <linux/cpu.h>
+#include <linux/cpufreq.h>
+#include <linux/cpumask.h>
+#include <linux/irq_work.h>
+#include <linux/kthread.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/rwsem.h>
+#include <linux/sched.h>
+#include <linux/sched/rt.h>
+#include <linux/slab.h>
+
+#define CREATE_TRACE_POINTS
+#include <trace/events/cpufreq_schedutil.h>
+
+/*
+ * Minimum time between two frequency requests.  Requests made while a
+ * change is still in flight are dropped as well; the next load update
+ * after it completes picks up where they left off.
+ */
+#define DEFAULT_RATE_LIMIT_US	(2 * USEC_PER_MSEC)
+
+struct sugov_policy {
+	struct cpufreq_policy *policy;
+
+	raw_spinlock_t update_lock;	/* protects the next 4 fields */
+	u64 last_freq_update_time;
+	unsigned int next_freq;
+	bool work_in_progress;
+	bool need_freq_update;
+
+	struct irq_work irq_work;
+	struct mutex work_lock;		/* serializes frequency changes */
+	struct rw_semaphore enable_sem;
+	int governor_enabled;
+};
+
+struct sugov_cpu {
+	struct update_util_data update_util;
+	struct sugov_policy *sg_policy;
+
+	/* written under sg_policy->update_lock */
+	unsigned long util;
+	unsigned long max;
+	u64 last_update;
+};
+
+/* sugov_policy is used from the cpu the cpufreq policy is managed on */
+static DEFINE_PER_CPU(struct sugov_policy, sugov_policy);
+static DEFINE_PER_CPU(struct sugov_cpu, sugov_cpu);
+
+/* realtime thread handles frequency scaling */
+static struct task_struct *sugov_task;
+static cpumask_t sugov_cpumask;
+static DEFINE_SPINLOCK(sugov_cpumask_lock);
+static DEFINE_MUTEX(gov_lock);
+
+static unsigned int sugov_rate_limit_us = DEFAULT_RATE_LIMIT_US;
+static u64 sugov_rate_limit_ns = DEFAULT_RATE_LIMIT_US * NSEC_PER_USEC;
+static int sugov_usage_count;
+
+static bool sugov_should_update_freq(struct sugov_policy *sg_policy, u64 time)
+{
+	s64 delta_ns;
+
+	if (sg_policy->work_in_progress)
+		return false;
+
+	if (unlikely(sg_policy->need_freq_update)) {
+		sg_policy->need_freq_update = false;
+		return true;
+	}
+
+	delta_ns = time - sg_policy->last_freq_update_time;
+	return delta_ns >= ACCESS_ONCE(sugov_rate_limit_ns);
+}
+
+/*
+ * The runnable average is not frequency invariant: a cpu that is busy
+ * 100% of the time at a low frequency reports the same utilization as
+ * one busy 100% at the maximum.  So scale the current frequency by the
+ * utilization, with 25% headroom, which keeps a fully busy cpu stepping
+ * up and lets a mostly idle one fall to the frequency it needs.
+ */
+static unsigned int sugov_next_freq(struct sugov_policy *sg_policy, u64 time)
+{
+	struct cpufreq_policy *policy = sg_policy->policy;
+	unsigned long util = 0, max = 1;
+	unsigned int freq, j;
+
+	for_each_cpu(j, policy->cpus) {
+		struct sugov_cpu *j_sg_cpu = &per_cpu(sugov_cpu, j);
+		s64 delta_ns;
+
+		/*
+		 * A cpu that has not updated its load for more than a tick
+		 * is idle with its tick stopped; its stale utilization
+		 * should not hold the policy up.
+		 */
+		delta_ns = time - j_sg_cpu->last_update;
+		if (delta_ns > TICK_NSEC)
+			continue;
+
+		if (j_sg_cpu->util * max > util * j_sg_cpu->max) {
+			util = j_sg_cpu->util;
+			max = j_sg_cpu->max;
+		}
+	}
+
+	freq = policy->cur + (policy->cur >> 2);
+	freq = div_u64((u64)freq * util, max);
+
+	if (freq > policy->max)
+		freq = policy->max;
+	if (freq < policy->min)
+		freq = policy->min;
+
+	trace_cpufreq_schedutil_request(policy->cpu, util, max, policy->cur,
+					freq);
+	return freq;
+}
+
+static void sugov_update_commit(struct sugov_policy *sg_policy, u64 time,
+				unsigned int next_freq)
+{
+	sg_policy->last_freq_update_time = time;
+
+	if (next_freq == sg_policy->policy->cur)
+		return;
+
+	sg_policy->next_freq = next_freq;
+	sg_policy->work_in_progress = true;
+	irq_work_queue(&sg_policy->irq_work);
+}
+
+/*
+ * Called from the scheduler with the runqueue lock held and interrupts
+ * off, so nothing in here may sleep or wake up a task.
+ */
+static void sugov_update_util(struct update_util_data *hook, u64 time,
+			      unsigned long util, unsigned long max)
+{
+	struct sugov_cpu *sg_cpu = container_of(hook, struct sugov_cpu,
+						update_util);
+	struct sugov_policy *sg_policy = sg_cpu->sg_policy;
+
+	raw_spin_lock(&sg_policy->update_lock);
+
+	sg_cpu->util = util;
+	sg_cpu->max = max;
+	sg_cpu->last_update = time;
+
+	if (sugov_should_update_freq(sg_policy, time))
+		sugov_update_commit(sg_policy, time,
+				    sugov_next_freq(sg_policy, time));
+
+	raw_spin_unlock(&sg_policy->update_lock);
+}
+
+static void sugov_irq_work(struct irq_work *irq_work)
+{
+	struct sugov_policy *sg_policy = container_of(irq_work,
+						      struct sugov_policy,
+						      irq_work);
+	unsigned long flags;
+
+	spin_lock_irqsave(&sugov_cpumask_lock, flags);
+	cpumask_set_cpu(sg_policy->policy->cpu, &sugov_cpumask);
+	spin_unlock_irqrestore(&sugov_cpumask_lock, flags);
+
+	wake_up_process(sugov_task);
+}
+
+static int cpufreq_schedutil_task(void *data)
+{
+	struct sugov_policy *sg_policy;
+	unsigned int cpu, next_freq;
+	unsigned long flags;
+	cpumask_t tmp_mask;
+
+	while (1) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		spin_lock_irqsave(&sugov_cpumask_lock, flags);
+
+		if (cpumask_empty(&sugov_cpumask)) {
+			spin_unlock_irqrestore(&sugov_cpumask_lock, flags);
+			schedule();
+
+			if (kthread_should_stop())
+				break;
+
+			spin_lock_irqsave(&sugov_cpumask_lock, flags);
+		}
+
+		set_current_state(TASK_RUNNING);
+		tmp_mask = sugov_cpumask;
+		cpumask_clear(&sugov_cpumask);
+		spin_unlock_irqrestore(&sugov_cpumask_lock, flags);
+
+		for_each_cpu(cpu, &tmp_mask) {
+			sg_policy = &per_cpu(sugov_policy, cpu);
+
+			/*
+			 * Not a trylock: a request must always end with
+			 * work_in_progress cleared, or the policy would
+			 * never be updated again.
+			 */
+			down_read(&sg_policy->enable_sem);
+			if (!sg_policy->governor_enabled) {
+				up_read(&sg_policy->enable_sem);
+				continue;
+			}
+
+			next_freq = ACCESS_ONCE(sg_policy->next_freq);
+			mutex_lock(&sg_policy->work_lock);
+			__cpufreq_driver_target(sg_policy->policy, next_freq,
+						CPUFREQ_RELATION_L);
+			mutex_unlock(&sg_policy->work_lock);
+			trace_cpufreq_schedutil_setspeed(cpu, next_freq,
+				sg_policy->policy->cur,
+				local_clock() -
+				ACCESS_ONCE(sg_policy->last_freq_update_time));
+
+			raw_spin_lock_irqsave(&sg_policy->update_lock, flags);
+			sg_policy->work_in_progress = false;
+			raw_spin_unlock_irqrestore(&sg_policy->update_lock,
+						   flags);
+
+			up_read(&sg_policy->enable_sem);
+		}
+	}
+
+	return 0;
+}
+
+static ssize_t show_rate_limit_us(struct kobject *kobj,
+				  struct attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", sugov_rate_limit_us);
+}
+
+static ssize_t store_rate_limit_us(struct kobject *kobj,
+				   struct attribute *attr, const char *buf,
+				   size_t count)
+{
+	unsigned int val;
+	int ret;
+
+	ret = kstrtouint(buf, 0, &val);
+	if (ret < 0)
+		return ret;
+
+	sugov_rate_limit_us = val;
+	ACCESS_ONCE(sugov_rate_limit_ns) = (u64)val * NSEC_PER_USEC;
+	return count;
+}
+
+define_one_global_rw(rate_limit_us);
+
+static struct attribute *schedutil_attributes[] = {
+	&rate_limit_us.attr,
+	NULL,
+};
+
+static struct attribute_group schedutil_attr_group = {
+	.attrs = schedutil_attributes,
+	.name = "schedutil",
+};
+
+static void sugov_start(struct cpufreq_policy *policy)
+{
+	struct sugov_policy *sg_policy = &per_cpu(sugov_policy, policy->cpu);
+	unsigned int j;
+
+	down_write(&sg_policy->enable_sem);
+	sg_policy->policy = policy;
+	sg_policy->last_freq_update_time = 0;
+	sg_policy->next_freq = policy->cur;
+	sg_policy->work_in_progress = false;
+	sg_policy->need_freq_update = false;
+	sg_policy->governor_enabled = 1;
+	up_write(&sg_policy->enable_sem);
+
+	for_each_cpu(j, policy->cpus) {
+		struct sugov_cpu *sg_cpu = &per_cpu(sugov_cpu, j);
+
+		sg_cpu->sg_policy = sg_policy;
+		sg_cpu->util = 0;
+		sg_cpu->max = 0;
+		sg_cpu->last_update = 0;
+		cpufreq_add_update_util_hook(j, &sg_cpu->update_util,
+					     sugov_update_util);
+	}
+}
+
+static void sugov_stop(struct cpufreq_policy *policy)
+{
+	struct sugov_policy *sg_policy = &per_cpu(sugov_policy, policy->cpu);
+	unsigned int j;
+
+	for_each_cpu(j, policy->cpus)
+		cpufreq_remove_update_util_hook(j);
+
+	/* no update_util callback can be running or start after this */
+	synchronize_sched();
+	irq_work_sync(&sg_policy->irq_work);
+
+	down_write(&sg_policy->enable_sem);
+	sg_policy->governor_enabled = 0;
+	up_write(&sg_policy->enable_sem);
+}
+
+static void sugov_limits(struct cpufreq_policy *policy)
+{
+	struct sugov_policy *sg_policy = &per_cpu(sugov_policy, policy->cpu);
+	unsigned long flags;
+
+	mutex_lock(&sg_policy->work_lock);
+	if (policy->max < policy->cur)
+		__cpufreq_driver_target(policy, policy->max,
+					CPUFREQ_RELATION_H);
+	else if (policy->min > policy->cur)
+		__cpufreq_driver_target(policy, policy->min,
+					CPUFREQ_RELATION_L);
+	mutex_unlock(&sg_policy->work_lock);
+
+	/* re-evaluate against the new limits on the next load update */
+	raw_spin_lock_irqsave(&sg_policy->update_lock, flags);
+	sg_policy->need_freq_update = true;
+	raw_spin_unlock_irqrestore(&sg_policy->update_lock, flags);
+}
+
+static int cpufreq_governor_schedutil(struct cpufreq_policy *policy,
+				      unsigned int event)
+{
+	int rc = 0;
+
+	switch (event) {
+	case CPUFREQ_GOV_POLICY_INIT:
+		mutex_lock(&gov_lock);
+		if (!sugov_usage_count)
+			rc = sysfs_create_group(cpufreq_global_kobject,
+						&schedutil_attr_group);
+		if (!rc)
+			sugov_usage_count++;
+		mutex_unlock(&gov_lock);
+		break;
+
+	case CPUFREQ_GOV_POLICY_EXIT:
+		mutex_lock(&gov_lock);
+		if (!--sugov_usage_count)
+			sysfs_remove_group(cpufreq_global_kobject,
+					   &schedutil_attr_group);
+		mutex_unlock(&gov_lock);
+		break;
+
+	case CPUFREQ_GOV_START:
+		mutex_lock(&gov_lock);
+		sugov_start(policy);
+		mutex_unlock(&gov_lock);
+		break;
+
+	case CPUFREQ_GOV_STOP:
+		mutex_lock(&gov_lock);
+		sugov_stop(policy);
+		mutex_unlock(&gov_lock);
+		break;
+
+	case CPUFREQ_GOV_LIMITS:
+		sugov_limits(policy);
+		break;
+	}
+
+	return rc;
+}
+
+#ifndef CONFIG_CPU_FREQ_DEFAULT_GOV_SCHEDUTIL
+static
+#endif
+struct cpufreq_governor cpufreq_gov_schedutil = {
+	.name = "schedutil",
+	.governor = cpufreq_governor_schedutil,
+	.owner = THIS_MODULE,
+};
+
+static int __init cpufreq_schedutil_init(void)
+{
+	struct sched_param param = { .sched_priority = MAX_RT_PRIO-1 };
+	struct sugov_policy *sg_policy;
+	unsigned int i;
+
+	for_each_possible_cpu(i) {
+		sg_policy = &per_cpu(sugov_policy, i);
+		raw_spin_lock_init(&sg_policy->update_lock);
+		init_irq_work(&sg_policy->irq_work, sugov_irq_work);
+		init_rwsem(&sg_policy->enable_sem);
+		mutex_init(&sg_policy->work_lock);
+	}
+
+	sugov_task = kthread_create(cpufreq_schedutil_task, NULL,
+				    "cfschedutil");
+	if (IS_ERR(sugov_task))
+		return PTR_ERR(sugov_task);
+
+	sched_setscheduler_nocheck(sugov_task, SCHED_FIFO, &param);
+	get_task_struct(sugov_task);
+
+	/* NB: wake up so the thread does not look hung to the freezer */
+	wake_up_process(sugov_task);
+
+	return cpufreq_register_governor(&cpufreq_gov_schedutil);
+}
+
+#ifdef CONFIG_CPU_FREQ_DEFAULT_GOV_SCHEDUTIL
+fs_initcall(cpufreq_schedutil_init);
+#else
+module_init(cpufreq_schedutil_init);
+#endif
+
+static void __exit cpufreq_schedutil_exit(void)
+{
+	cpufreq_unregister_governor(&cpufreq_gov_schedutil);
+	kthread_stop(sugov_task);
+	put_task_struct(sugov_task);
+}
+
+module_exit(cpufreq_schedutil_exit);
+
+MODULE_DESCRIPTION("'cpufreq_schedutil' - A cpufreq governor driven by "
+	"scheduler load tracking");
+MODULE_LICENSE("GPL");
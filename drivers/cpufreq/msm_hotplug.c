@@ -16,6 +16,7 @@
 #include <linux/kernel.h>
 #include <linux/cpu.h>
 #include <linux/init.h>
+#include <linux/msm_hotplug.h>
 #include <linux/workqueue.h>
 #include <linux/sched.h>
 #include <linux/platform_device.h>
@@ -74,6 +75,12 @@ static struct cpu_hotplug {
 
 static struct workqueue_struct *hotplug_wq;
 static struct delayed_work hotplug_work;
+static bool hotplug_running;
+
+bool msm_hotplug_running(void)
+{
+	return ACCESS_ONCE(hotplug_running);
+}
 
 //static u64 last_boost_time;
 static unsigned int default_update_rates[] = { DEFAULT_UPDATE_RATE };
@@ -907,6 +914,7 @@ static int msm_hotplug_probe(struct platform_device *pdev)
 
 	queue_delayed_work_on(0, hotplug_wq, &hotplug_work,
 			      START_DELAY);
+	hotplug_running = true;
 
 	return ret;
 err_dev:
@@ -923,6 +931,7 @@ static struct platform_device msm_hotplug_device = {
 
 static int msm_hotplug_remove(struct platform_device *pdev)
 {
+	hotplug_running = false;
 	destroy_workqueue(hotplug_wq);
 	input_unregister_handler(&hotplug_input_handler);
 	kfree(stats.load_hist);
@@ -24,6 +24,7 @@
 #include <linux/seq_file.h>
 #include <linux/uaccess.h>
 #include <linux/slab.h>
+#include <linux/interrupt.h>
 
 #define BUCKETS 12
 #define INTERVALS 8
@@ -131,6 +132,18 @@ enum {MENU_HRTIMER_STOP, MENU_HRTIMER_REPEAT};
  * The iowait factor may look low, but realize that this is also already
  * represented in the system load average.
  *
+ * Per interrupt predictor
+ * -----------------------
+ * With CONFIG_IRQ_TIMINGS the interrupt core keeps inter-arrival statistics
+ * of every interrupt handled on a cpu (see kernel/irq/timings.c).  Regular
+ * sources such as a display vsync or audio DMA wake the cpu at times the
+ * next timer event and the correction factor cannot anticipate, so when
+ * one of them is expected before the predicted duration ends, the expected
+ * interrupt becomes the prediction.  Like the repeating pattern detector,
+ * a short prediction arms the menu hrtimer so that a mispredicted shallow
+ * sleep is reevaluated.  It can be switched off at runtime with the
+ * irq_predict module parameter.
+ *
  */
 
 struct menu_device {
@@ -220,6 +233,37 @@ static inline int performance_multiplier(void)
 
 static DEFINE_PER_CPU(struct menu_device, menu_devices);
 
+#ifdef CONFIG_IRQ_TIMINGS
+static bool irq_predict = true;
+module_param(irq_predict, bool, 0644);
+MODULE_PARM_DESC(irq_predict, "predict wakeups from interrupt statistics");
+
+/*
+ * Return the time until the next regular interrupt of this cpu in us if
+ * it is expected before @predicted_us, or 0.
+ */
+static u64 menu_irq_predict(u64 predicted_us)
+{
+	u64 now, next, irq_us;
+
+	if (!irq_predict)
+		return 0;
+
+	now = local_clock();
+	next = irq_timings_next_event(now);
+	if (next == ULLONG_MAX)
+		return 0;
+
+	irq_us = div_u64(next - now, NSEC_PER_USEC);
+	return irq_us < predicted_us ? irq_us : 0;
+}
+#else
+static inline u64 menu_irq_predict(u64 predicted_us)
+{
+	return 0;
+}
+#endif
+
 static void menu_update(struct cpuidle_driver *drv, struct cpuidle_device *dev);
 
 /* This implements DIV_ROUND_CLOSEST but avoids 64 bit division */
@@ -331,6 +375,7 @@ static int menu_select(struct cpuidle_driver *drv, struct cpuidle_device *dev)
 	int multiplier;
 	struct timespec t;
 	int repeat = 0, low_predicted = 0;
+	u64 irq_us;
 	int cpu = smp_processor_id();
 	struct hrtimer *hrtmr = &per_cpu(menu_hrtimer, cpu);
 #ifdef CONFIG_PM_DEBUG
@@ -390,6 +435,10 @@ static int menu_select(struct cpuidle_driver *drv, struct cpuidle_device *dev)
 
 	repeat = get_typical_interval(data);
 
+	irq_us = menu_irq_predict(data->predicted_us);
+	if (irq_us)
+		data->predicted_us = irq_us;
+
 	/*
 	 * We want to default to C1 (hlt), not to busy polling
 	 * unless the timer is happening really really soon.
@@ -435,7 +484,7 @@ static int menu_select(struct cpuidle_driver *drv, struct cpuidle_device *dev)
 		 */
 		timer_us = 2 * (data->predicted_us + MAX_DEVIATION);
 
-		if (repeat && (4 * timer_us < data->expected_us)) {
+		if ((repeat || irq_us) && (4 * timer_us < data->expected_us)) {
 			RCU_NONIDLE(hrtimer_start(hrtmr,
 				ns_to_ktime(1000 * timer_us),
 				HRTIMER_MODE_REL_PINNED));
@@ -706,6 +755,9 @@ static int __init init_menu(void)
 				NULL, NULL, &idle_hist_ops);
 	if (!d3)
 		pr_warn("idle_hist: Failed to create debugfs for idle_hist\n");
+#endif
+#ifdef CONFIG_IRQ_TIMINGS
+	irq_timings_enable();
 #endif
 	return cpuidle_register_governor(&menu_governor);
 }
@@ -716,6 +768,9 @@ static int __init init_menu(void)
 static void __exit exit_menu(void)
 {
 	cpuidle_unregister_governor(&menu_governor);
+#ifdef CONFIG_IRQ_TIMINGS
+	irq_timings_disable();
+#endif
 }
 
 MODULE_LICENSE("GPL");
@@ -2029,11 +2029,13 @@ static int hsi_debug_show(struct seq_file *m, void *p)
 			ktime_to_us(ws->start_prevent_time));
 	seq_printf(m, "   prevent_sleep_time: %lld us\n",
 			ktime_to_us(ws->prevent_sleep_time));
-	seq_printf(m, "   event_count       : %ld\n", ws->event_count);
+	seq_printf(m, "   event_count       : %ld\n",
+			atomic_long_read(&ws->event_count));
 	seq_printf(m, "   active_count      : %ld\n", ws->active_count);
 	seq_printf(m, "   relax_count       : %ld\n", ws->relax_count);
 	seq_printf(m, "   expire_count      : %ld\n", ws->expire_count);
-	seq_printf(m, "   wakeup_count      : %ld\n", ws->wakeup_count);
+	seq_printf(m, "   wakeup_count      : %ld\n",
+			atomic_long_read(&ws->wakeup_count));
 	seq_printf(m, "   active            : %d\n",  ws->active);
 	seq_printf(m, "   autosleep_enabled : %d\n",  ws->autosleep_enabled);
 #endif
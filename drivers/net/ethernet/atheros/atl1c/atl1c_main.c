@@ -63,7 +63,8 @@ static void atl1c_down(struct atl1c_adapter *adapter);
 static int atl1c_reset_mac(struct atl1c_hw *hw);
 static void atl1c_reset_dma_ring(struct atl1c_adapter *adapter);
 static int atl1c_configure(struct atl1c_adapter *adapter);
-static int atl1c_alloc_rx_buffer(struct atl1c_adapter *adapter);
+static int atl1c_alloc_rx_buffer(struct atl1c_adapter *adapter,
+				 bool napi_mode);
 
 static const u16 atl1c_pay_load_size[] = {
 	128, 256, 512, 1024, 2048, 4096,
@@ -1448,7 +1449,7 @@ static int atl1c_configure(struct atl1c_adapter *adapter)
 	atl1c_set_multi(netdev);
 	atl1c_restore_vlan(adapter);
 
-	num = atl1c_alloc_rx_buffer(adapter);
+	num = atl1c_alloc_rx_buffer(adapter, false);
 	if (unlikely(num == 0))
 		return -ENOMEM;
 
@@ -1648,14 +1649,36 @@ static inline void atl1c_rx_checksum(struct atl1c_adapter *adapter,
 	skb_checksum_none_assert(skb);
 }
 
-static struct sk_buff *atl1c_alloc_skb(struct atl1c_adapter *adapter)
+/*
+ * Refills from the NAPI poll carve their buffers out of the per cpu
+ * napi_alloc_frag() cache, the one done at configure time uses a page of
+ * the adapter's own.
+ */
+static struct sk_buff *atl1c_alloc_skb(struct atl1c_adapter *adapter,
+				       bool napi_mode)
 {
 	struct sk_buff *skb;
 	struct page *page;
+	void *data;
 
-	if (adapter->rx_frag_size > PAGE_SIZE)
+	if (adapter->rx_frag_size > PAGE_SIZE) {
+		if (napi_mode)
+			return __napi_alloc_skb(&adapter->napi,
+						adapter->rx_buffer_len,
+						GFP_ATOMIC);
 		return netdev_alloc_skb(adapter->netdev,
 					adapter->rx_buffer_len);
+	}
+
+	if (napi_mode) {
+		data = napi_alloc_frag(adapter->rx_frag_size);
+		if (unlikely(!data))
+			return NULL;
+		skb = build_skb(data, adapter->rx_frag_size);
+		if (unlikely(!skb))
+			put_page(virt_to_head_page(data));
+		return skb;
+	}
 
 	page = adapter->rx_page;
 	if (!page) {
@@ -1677,7 +1700,8 @@ static struct sk_buff *atl1c_alloc_skb(struct atl1c_adapter *adapter)
 	return skb;
 }
 
-static int atl1c_alloc_rx_buffer(struct atl1c_adapter *adapter)
+static int atl1c_alloc_rx_buffer(struct atl1c_adapter *adapter,
+				 bool napi_mode)
 {
 	struct atl1c_rfd_ring *rfd_ring = &adapter->rfd_ring;
 	struct pci_dev *pdev = adapter->pdev;
@@ -1698,7 +1722,7 @@ static int atl1c_alloc_rx_buffer(struct atl1c_adapter *adapter)
 	while (next_info->flags & ATL1C_BUFFER_FREE) {
 		rfd_desc = ATL1C_RFD_DESC(rfd_ring, rfd_next_to_use);
 
-		skb = atl1c_alloc_skb(adapter);
+		skb = atl1c_alloc_skb(adapter, napi_mode);
 		if (unlikely(!skb)) {
 			if (netif_msg_rx_err(adapter))
 				dev_warn(&pdev->dev, "alloc rx buffer failed\n");
@@ -1855,7 +1879,7 @@ rrs_checked:
 		count++;
 	}
 	if (count)
-		atl1c_alloc_rx_buffer(adapter);
+		atl1c_alloc_rx_buffer(adapter, true);
 }
 
 /**
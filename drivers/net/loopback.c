@@ -77,7 +77,7 @@ static netdev_tx_t loopback_xmit(struct sk_buff *skb,
 
 	skb_orphan(skb);
 
-	/* Before queueing this packet to netif_rx(),
+	/* Before queueing this packet to a GRO cell,
 	 * make sure dst is refcounted.
 	 */
 	skb_dst_force(skb);
@@ -88,7 +88,8 @@ static netdev_tx_t loopback_xmit(struct sk_buff *skb,
 	lb_stats = this_cpu_ptr(dev->lstats);
 
 	len = skb->len;
-	if (likely(netif_rx(skb) == NET_RX_SUCCESS)) {
+	if (likely(netif_gro_cells_receive(netdev_priv(dev), skb) ==
+		   NET_RX_SUCCESS)) {
 		u64_stats_update_begin(&lb_stats->syncp);
 		lb_stats->bytes += len;
 		lb_stats->packets++;
@@ -141,11 +142,17 @@ static int loopback_dev_init(struct net_device *dev)
 	if (!dev->lstats)
 		return -ENOMEM;
 
+	if (netif_gro_cells_init(netdev_priv(dev), dev)) {
+		free_percpu(dev->lstats);
+		return -ENOMEM;
+	}
+
 	return 0;
 }
 
 static void loopback_dev_free(struct net_device *dev)
 {
+	netif_gro_cells_destroy(netdev_priv(dev));
 	free_percpu(dev->lstats);
 	free_netdev(dev);
 }
@@ -193,7 +200,8 @@ static __net_init int loopback_net_init(struct net *net)
 	int err;
 
 	err = -ENOMEM;
-	dev = alloc_netdev(0, "lo", loopback_setup);
+	dev = alloc_netdev(sizeof(struct netif_gro_cells), "lo",
+			   loopback_setup);
 	if (!dev)
 		goto out;
 
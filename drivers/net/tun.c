@@ -187,6 +187,8 @@ struct tun_struct {
 	struct list_head disabled;
 	void *security;
 	u32 flow_count;
+	struct netif_gro_cells gro_cells;
+	unsigned int rx_batched;
 };
 
 static inline u32 tun_hashfn(u32 rxhash)
@@ -1227,7 +1229,8 @@ static ssize_t tun_get_user(struct tun_struct *tun, struct tun_file *tfile,
 	skb_probe_transport_header(skb, 0);
 
 	rxhash = skb_get_rxhash(skb);
-	netif_rx_ni(skb);
+	netif_gro_cells_receive_ni(&tun->gro_cells, skb,
+				   ACCESS_ONCE(tun->rx_batched));
 
 	tun->dev->stats.rx_packets++;
 	tun->dev->stats.rx_bytes += len;
@@ -1414,6 +1417,7 @@ static void tun_free_netdev(struct net_device *dev)
 	struct tun_struct *tun = netdev_priv(dev);
 
 	BUG_ON(!(list_empty(&tun->disabled)));
+	netif_gro_cells_destroy(&tun->gro_cells);
 	tun_flow_uninit(tun);
 	security_tun_dev_free_security(tun->security);
 	free_netdev(dev);
@@ -1685,6 +1689,10 @@ static int tun_set_iff(struct net *net, struct file *file, struct ifreq *ifr)
 		if (err < 0)
 			goto err_free_dev;
 
+		err = netif_gro_cells_init(&tun->gro_cells, dev);
+		if (err < 0)
+			goto err_free_flow;
+
 		dev->hw_features = NETIF_F_SG | NETIF_F_FRAGLIST |
 			TUN_USER_FEATURES;
 		dev->features = dev->hw_features;
@@ -1693,7 +1701,7 @@ static int tun_set_iff(struct net *net, struct file *file, struct ifreq *ifr)
 		INIT_LIST_HEAD(&tun->disabled);
 		err = tun_attach(tun, file);
 		if (err < 0)
-			goto err_free_flow;
+			goto err_free_cells;
 
 		err = register_netdevice(tun->dev);
 		if (err < 0)
@@ -1743,6 +1751,8 @@ static int tun_set_iff(struct net *net, struct file *file, struct ifreq *ifr)
 
 err_detach:
 	tun_detach_all(dev);
+err_free_cells:
+	netif_gro_cells_destroy(&tun->gro_cells);
 err_free_flow:
 	tun_flow_uninit(tun);
 	security_tun_dev_free_security(tun->security);
@@ -2283,12 +2293,40 @@ static void tun_set_msglevel(struct net_device *dev, u32 value)
 #endif
 }
 
+/*
+ * rx-frames: packets written to the device that may queue up before they
+ * are handed to the stack, for GRO to coalesce them.  0 (the default)
+ * hands every packet up before write() returns.
+ */
+static int tun_get_coalesce(struct net_device *dev,
+			    struct ethtool_coalesce *ec)
+{
+	struct tun_struct *tun = netdev_priv(dev);
+
+	ec->rx_max_coalesced_frames = tun->rx_batched;
+	return 0;
+}
+
+static int tun_set_coalesce(struct net_device *dev,
+			    struct ethtool_coalesce *ec)
+{
+	struct tun_struct *tun = netdev_priv(dev);
+
+	if (ec->rx_max_coalesced_frames > NAPI_POLL_WEIGHT)
+		return -EINVAL;
+
+	tun->rx_batched = ec->rx_max_coalesced_frames;
+	return 0;
+}
+
 static const struct ethtool_ops tun_ethtool_ops = {
 	.get_settings	= tun_get_settings,
 	.get_drvinfo	= tun_get_drvinfo,
 	.get_msglevel	= tun_get_msglevel,
 	.set_msglevel	= tun_set_msglevel,
 	.get_link	= ethtool_op_get_link,
+	.get_coalesce	= tun_get_coalesce,
+	.set_coalesce	= tun_set_coalesce,
 };
 
 
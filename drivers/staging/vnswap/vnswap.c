@@ -25,6 +25,9 @@
 #include <linux/atomic.h>
 #include <linux/types.h>
 #include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/highmem.h>
+#include <linux/lz4.h>
 
 #include "vnswap.h"
 
@@ -46,6 +49,8 @@ int *vnswap_table;
 
 /* Backing Storage bitmap information */
 unsigned long *backing_storage_bitmap;
+/* Number of records stored in each Backing Storage block */
+u8 *backing_storage_refcnt;
 unsigned int backing_storage_bitmap_last_allocated_index = -1;
 
 /* Backing Storage bmap and bdev information */
@@ -53,8 +58,6 @@ sector_t *backing_storage_bmap;
 struct block_device *backing_storage_bdev;
 struct file *backing_storage_file;
 
-static DEFINE_SPINLOCK(vnswap_original_bio_lock);
-
 void vnswap_init_disksize(u64 disksize)
 {
 	int i;
@@ -206,11 +209,17 @@ int vnswap_init_backing_storage(void)
 		backing_storage_bitmap[i] = 0;
 	backing_storage_bitmap_last_allocated_index = -1;
 
+	backing_storage_refcnt = vzalloc(vnswap_device->bs_size);
+	if (backing_storage_refcnt == NULL) {
+		ret = -ENOMEM;
+		goto free_bitmap;
+	}
+
 	backing_storage_bmap = vmalloc(vnswap_device->bs_size *
 							sizeof(sector_t));
 	if (backing_storage_bmap == NULL) {
 		ret = -ENOMEM;
-		goto free_bitmap;
+		goto free_refcnt;
 	}
 
 	for (probe_block = 0; probe_block < last_block; probe_block++) {
@@ -295,6 +304,9 @@ int vnswap_init_backing_storage(void)
 free_bmap:
 	vfree(backing_storage_bmap);
 
+free_refcnt:
+	vfree(backing_storage_refcnt);
+
 free_bitmap:
 	vfree(backing_storage_bitmap);
 
@@ -350,39 +362,241 @@ int vnswap_find_free_area_in_backing_storage(int *nand_offset)
 	return i;
 }
 
+/* Take a reference on backing storage block nand_offset for a record */
+static void vnswap_get_block(int nand_offset)
+{
+	if (!backing_storage_refcnt[nand_offset]++) {
+		set_bit(nand_offset, backing_storage_bitmap);
+		atomic_inc(&vnswap_device->stats.
+			vnswap_used_slot_num);
+	}
+}
+
+/* Drop a record reference, freeing the block with its last record */
+static void vnswap_put_block(int nand_offset)
+{
+	if (--backing_storage_refcnt[nand_offset])
+		return;
+
+	atomic_dec(&vnswap_device->stats.
+		vnswap_used_slot_num);
+	clear_bit(nand_offset, backing_storage_bitmap);
+
+	/*
+	 * When Backing Storage is full, set Backing Storage is not full
+	 * and resume the search right at the freed block.
+	 */
+	if (backing_storage_bitmap_last_allocated_index ==
+		vnswap_device->bs_size)
+		backing_storage_bitmap_last_allocated_index = nand_offset - 1;
+}
+
+/* Allocate a backing storage block holding one record */
+static int vnswap_alloc_block(int *nand_offset)
+{
+	int ret;
+
+	ret = vnswap_find_free_area_in_backing_storage(nand_offset);
+	if (ret < 0)
+		return ret;
+	vnswap_get_block(*nand_offset);
+	return 0;
+}
+
+static struct vnswap_cache_page *vnswap_cache_lookup(struct vnswap *vnswap,
+	int nand_offset)
+{
+	struct vnswap_cache_page *cp;
+	int i;
+
+	for (i = 0; i < VNSWAP_CACHE_PAGES; i++) {
+		cp = &vnswap->cache[i];
+		if (cp->state != VNSWAP_CACHE_EMPTY &&
+			cp->nand_offset == nand_offset)
+			return cp;
+	}
+	return NULL;
+}
+
+/* Reuse the next cache page that is not being read from, clock-wise */
+static struct vnswap_cache_page *vnswap_cache_claim(struct vnswap *vnswap,
+	int nand_offset)
+{
+	struct vnswap_cache_page *cp;
+	int i;
+
+	for (i = 0; i < VNSWAP_CACHE_PAGES; i++) {
+		cp = &vnswap->cache[vnswap->cache_hand];
+		vnswap->cache_hand = (vnswap->cache_hand + 1) %
+			VNSWAP_CACHE_PAGES;
+		if (cp->state != VNSWAP_CACHE_READING && !cp->users) {
+			cp->nand_offset = nand_offset;
+			cp->state = VNSWAP_CACHE_READING;
+			return cp;
+		}
+	}
+	return NULL;
+}
+
+static struct vnswap_cache_page *vnswap_cache_alloc_transient(
+	int nand_offset)
+{
+	struct vnswap_cache_page *cp;
+
+	cp = kzalloc(sizeof(*cp), GFP_NOIO);
+	if (!cp)
+		return NULL;
+	cp->page = alloc_page(GFP_NOIO);
+	if (!cp->page) {
+		kfree(cp);
+		return NULL;
+	}
+	cp->nand_offset = nand_offset;
+	cp->state = VNSWAP_CACHE_READING;
+	cp->transient = 1;
+	bio_list_init(&cp->waiters);
+	return cp;
+}
+
+/*
+ * Drop the cached copy of a block whose contents are being replaced.
+ * A read still in flight is marked invalid and dropped on completion.
+ */
+static void vnswap_cache_invalidate(struct vnswap *vnswap, int nand_offset)
+{
+	struct vnswap_cache_page *cp;
+	unsigned long flags;
+
+	spin_lock_irqsave(&vnswap->cache_lock, flags);
+	cp = vnswap_cache_lookup(vnswap, nand_offset);
+	if (cp) {
+		cp->nand_offset = -1;
+		if (cp->state == VNSWAP_CACHE_UPTODATE)
+			cp->state = VNSWAP_CACHE_EMPTY;
+	}
+	spin_unlock_irqrestore(&vnswap->cache_lock, flags);
+}
+
+/* Copy or decompress the record of original_bio out of its cached block */
+static int vnswap_cache_copy(struct vnswap_cache_page *cp,
+	struct bio *original_bio)
+{
+	struct page *page = original_bio->bi_io_vec[0].bv_page;
+	u32 index = original_bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+	unsigned char *user_mem, *cache_mem, *record;
+	size_t src_len, dst_len = PAGE_SIZE;
+	int slot, nr_sect, ret = 0;
+
+	/* stable: the swap cache page of index is locked under read */
+	slot = ACCESS_ONCE(vnswap_table[index]);
+	if (slot == -1 ||
+		VNSWAP_SLOT_NAND_OFFSET(slot) != ACCESS_ONCE(cp->nand_offset))
+		return -EIO;
+	nr_sect = VNSWAP_SLOT_NR_SECT(slot);
+
+	cache_mem = kmap_atomic(cp->page);
+	user_mem = kmap_atomic(page);
+	if (nr_sect == SECTORS_PER_PAGE) {
+		memcpy(user_mem, cache_mem, PAGE_SIZE);
+	} else {
+		record = cache_mem + (VNSWAP_SLOT_START(slot) << SECTOR_SHIFT);
+		src_len = *(u16 *)record;
+		if (src_len > (nr_sect << SECTOR_SHIFT) - sizeof(u16))
+			ret = -EIO;
+		else
+			ret = lz4_decompress_unknownoutputsize(
+				record + sizeof(u16), src_len,
+				user_mem, &dst_len);
+		if (!ret && dst_len != PAGE_SIZE)
+			ret = -EIO;
+	}
+	kunmap_atomic(user_mem);
+	kunmap_atomic(cache_mem);
+	flush_dcache_page(page);
+
+	if (ret)
+		pr_err("%s %d: decompress failed. (index, slot, ret) = " \
+				"(%d, 0x%08x, %d)\n",
+				__func__, __LINE__, index, slot, ret);
+	return ret ? -EIO : 0;
+}
+
+static void vnswap_complete_bios(struct bio_list *bios, int err)
+{
+	struct bio *original_bio;
+
+	while ((original_bio = bio_list_pop(bios))) {
+		if (err) {
+			bio_io_error(original_bio);
+			continue;
+		}
+		set_bit(BIO_UPTODATE, &original_bio->bi_flags);
+		bio_endio(original_bio, 0);
+	}
+}
+
+/*
+ * A read of a cached block finished: serve the bios waiting for it.
+ * The waiters are taken off under cache_lock but copied or decompressed
+ * without it.  The page stays VNSWAP_CACHE_READING meanwhile, so it is
+ * not reused, and bios that come in late are queued and served in the
+ * next round.
+ */
+static void vnswap_cache_end(struct vnswap *vnswap,
+	struct vnswap_cache_page *cp, int err)
+{
+	struct bio_list waiters, done, failed;
+	struct bio *original_bio;
+	unsigned long flags;
+
+	for (;;) {
+		bio_list_init(&waiters);
+		spin_lock_irqsave(&vnswap->cache_lock, flags);
+		if (bio_list_empty(&cp->waiters)) {
+			if (err || cp->nand_offset == -1)
+				cp->state = VNSWAP_CACHE_EMPTY;
+			else
+				cp->state = VNSWAP_CACHE_UPTODATE;
+			spin_unlock_irqrestore(&vnswap->cache_lock, flags);
+			break;
+		}
+		bio_list_merge(&waiters, &cp->waiters);
+		bio_list_init(&cp->waiters);
+		spin_unlock_irqrestore(&vnswap->cache_lock, flags);
+
+		bio_list_init(&done);
+		bio_list_init(&failed);
+		while ((original_bio = bio_list_pop(&waiters))) {
+			if (err || vnswap_cache_copy(cp, original_bio))
+				bio_list_add(&failed, original_bio);
+			else
+				bio_list_add(&done, original_bio);
+		}
+		vnswap_complete_bios(&done, 0);
+		vnswap_complete_bios(&failed, -EIO);
+	}
+
+	if (cp->transient) {
+		__free_page(cp->page);
+		kfree(cp);
+	}
+}
+
 /* refer req_bio_endio() */
-void vnswap_bio_end_read(struct bio *bio, int err)
+static void vnswap_bio_end_read(struct bio *bio, int err)
 {
+	struct vnswap_batch *batch = bio->bi_private;
 	const int uptodate = test_bit(BIO_UPTODATE, &bio->bi_flags);
-	struct bio *original_bio = (struct bio *) bio->bi_private;
-	unsigned long flags;
+	int i;
 
-	dprintk("%s %d: (uptodate,error,bi_size) = (%d, %d, %d)\n",
-			__func__, __LINE__, uptodate, err, bio->bi_size);
+	dprintk("%s %d: (uptodate,error,bi_size,bi_vcnt) = (%d, %d, %d, %d)\n",
+			__func__, __LINE__, uptodate, err, bio->bi_size,
+			bio->bi_vcnt);
 
 	if (!uptodate || err) {
 		atomic_inc(&vnswap_device->stats.vnswap_bio_end_fail_r1_num);
-		pr_err("%s %d: (error, bio->bi_size, original_bio->bi_size," \
-				"bio->bi_vcnt, original_bio->bi_vcnt, " \
-				"bio->bi_idx," \
-				"original_bio->bi_idx, " \
-				"vnswap_bio_end_fail_r1_num ~" \
-				"vnswap_bio_end_fail_r3_num) =" \
-				"(%d, %d, %d, %d, %d, %d, %d, %d, %d, %d)\n",
-				__func__, __LINE__, err, bio->bi_size,
-				original_bio->bi_size,
-				bio->bi_vcnt, original_bio->bi_vcnt,
-				bio->bi_idx,
-				original_bio->bi_idx,
-				vnswap_device->stats.
-					vnswap_bio_end_fail_r1_num.counter,
-				vnswap_device->stats.
-					vnswap_bio_end_fail_r2_num.counter,
-				vnswap_device->stats.
-					vnswap_bio_end_fail_r3_num.counter);
-		bio_io_error(original_bio);
-		goto out_bio_put;
-	} else {
+		err = err ? err : -EIO;
+	} else if (bio->bi_size) {
 		/*
 		* There are bytes yet to be transferred.
 		* blk_end_request() -> blk_end_bidi_request() ->
@@ -390,250 +604,335 @@ void vnswap_bio_end_read(struct bio *bio, int err)
 		* blk_update_request() -> req_bio_endio() ->
 		* bio->bi_size -= nbytes;
 		*/
-		spin_lock_irqsave(&vnswap_original_bio_lock, flags);
-		original_bio->bi_size -= (PAGE_SIZE-bio->bi_size);
-
-		if (bio->bi_size == PAGE_SIZE) {
+		if (bio->bi_size == bio->bi_vcnt * PAGE_SIZE)
 			atomic_inc(&vnswap_device->stats.
 				vnswap_bio_end_fail_r2_num);
-			pr_err("%s %d: (error, bio->bi_size, " \
-					"original_bio->bi_size," \
-					"bio->bi_vcnt," \
-					"original_bio->bi_vcnt, bio->bi_idx, " \
-					"original_bio->bi_idx," \
-					"vnswap_bio_end_fail_r1_num ~ " \
-					"vnswap_bio_end_fail_r3_num) = " \
-					"(%d, %d, %d, %d, %d, %d, %d, %d, %d, %d)\n",
-					__func__, __LINE__, err, bio->bi_size,
-					original_bio->bi_size,
-					bio->bi_vcnt, original_bio->bi_vcnt,
-					bio->bi_idx,
-					original_bio->bi_idx,
-					vnswap_device->stats.
-						vnswap_bio_end_fail_r1_num.
-						counter,
-					vnswap_device->stats.
-						vnswap_bio_end_fail_r2_num.
-						counter,
-					vnswap_device->stats.
-						vnswap_bio_end_fail_r3_num.
-						counter);
-			spin_unlock_irqrestore(&vnswap_original_bio_lock,
-				flags);
-			goto out_bio_put;
-		}
-
-		if (bio->bi_size || original_bio->bi_size) {
+		else
 			atomic_inc(&vnswap_device->stats.
 				vnswap_bio_end_fail_r3_num);
-			pr_err("%s %d: (error, bio->bi_size, " \
-					"original_bio->bi_size," \
-					"bio->bi_vcnt," \
-					"original_bio->bi_vcnt, bio->bi_idx, " \
-					"original_bio->bi_idx," \
-					"vnswap_bio_end_fail_r1_num ~ " \
-					"vnswap_bio_end_fail_r3_num) = " \
-					"(%d, %d, %d, %d, %d, %d, %d, %d, %d, %d)\n",
-					__func__, __LINE__, err, bio->bi_size,
-					original_bio->bi_size,
-					bio->bi_vcnt, original_bio->bi_vcnt,
-					bio->bi_idx, original_bio->bi_idx,
-					vnswap_device->stats.
-						vnswap_bio_end_fail_r1_num.
-						counter,
-					vnswap_device->stats.
-						vnswap_bio_end_fail_r2_num.
-						counter,
-					vnswap_device->stats.
-						vnswap_bio_end_fail_r3_num.
-						counter);
-			spin_unlock_irqrestore(&vnswap_original_bio_lock,
-				flags);
-			goto out_bio_put;
-		}
-
-		set_bit(BIO_UPTODATE, &original_bio->bi_flags);
-		spin_unlock_irqrestore(&vnswap_original_bio_lock, flags);
-		bio_endio(original_bio, 0);
+		err = -EIO;
 	}
 
-out_bio_put:
+	if (err)
+		pr_err("%s %d: (error, bio->bi_size, bio->bi_vcnt, " \
+				"vnswap_bio_end_fail_r1_num ~ " \
+				"vnswap_bio_end_fail_r3_num) = " \
+				"(%d, %d, %d, %d, %d, %d)\n",
+				__func__, __LINE__, err, bio->bi_size,
+				bio->bi_vcnt,
+				vnswap_device->stats.
+					vnswap_bio_end_fail_r1_num.counter,
+				vnswap_device->stats.
+					vnswap_bio_end_fail_r2_num.counter,
+				vnswap_device->stats.
+					vnswap_bio_end_fail_r3_num.counter);
+
+	for (i = 0; i < bio->bi_vcnt; i++)
+		vnswap_cache_end(vnswap_device, batch->cache[i], err);
+
+	kfree(batch);
 	bio_put(bio);
 }
 
 /* refer req_bio_endio() */
-void vnswap_bio_end_write(struct bio *bio, int err)
+static void vnswap_bio_end_write(struct bio *bio, int err)
 {
-	struct bio *original_bio = (struct bio *) bio->bi_private;
-	unsigned long flags;
+	struct vnswap_batch *batch = bio->bi_private;
+	int i;
 
-	dprintk("%s %d: (error, bi_size) = (%d, %d)\n",
-			__func__, __LINE__, err, bio->bi_size);
+	dprintk("%s %d: (error, bi_size, bi_vcnt) = (%d, %d, %d)\n",
+			__func__, __LINE__, err, bio->bi_size, bio->bi_vcnt);
 
 	if (err) {
 		atomic_inc(&vnswap_device->stats.vnswap_bio_end_fail_w1_num);
-		pr_err("%s %d: (error, bio->bi_size, original_bio->bi_size, " \
-				"bio->bi_vcnt," \
-				"original_bio->bi_vcnt, bio->bi_idx, " \
-				"original_bio->bi_idx," \
+	} else if (bio->bi_size) {
+		/* There are bytes yet to be transferred. */
+		if (bio->bi_size == bio->bi_vcnt * PAGE_SIZE)
+			atomic_inc(&vnswap_device->stats.
+				vnswap_bio_end_fail_w2_num);
+		else
+			atomic_inc(&vnswap_device->stats.
+				vnswap_bio_end_fail_w3_num);
+		err = -EIO;
+	}
+
+	if (err)
+		pr_err("%s %d: (error, bio->bi_size, bio->bi_vcnt, " \
 				"vnswap_bio_end_fail_w1_num ~ " \
 				"vnswap_bio_end_fail_w3_num) = " \
-				"(%d, %d, %d, %d, %d, %d, %d, %d, %d, %d)\n",
+				"(%d, %d, %d, %d, %d, %d)\n",
 				__func__, __LINE__, err, bio->bi_size,
-				original_bio->bi_size,
-				bio->bi_vcnt, original_bio->bi_vcnt,
-				bio->bi_idx,
-				original_bio->bi_idx,
+				bio->bi_vcnt,
 				vnswap_device->stats.
 					vnswap_bio_end_fail_w1_num.counter,
 				vnswap_device->stats.
 					vnswap_bio_end_fail_w2_num.counter,
 				vnswap_device->stats.
 					vnswap_bio_end_fail_w3_num.counter);
-		bio_io_error(original_bio);
-		goto out_bio_put;
+
+	/*
+	 * Readahead may have cached these blocks before they were
+	 * rewritten; drop them before any record in them can be read.
+	 */
+	for (i = 0; i < bio->bi_vcnt; i++) {
+		vnswap_cache_invalidate(vnswap_device, batch->nand_offset[i]);
+		if (test_bit(i, &batch->own_pages))
+			__free_page(bio->bi_io_vec[i].bv_page);
+	}
+
+	vnswap_complete_bios(&batch->orig_bios, err);
+
+	kfree(batch);
+	bio_put(bio);
+}
+
+/* Submit the pending batch bio; called with batch_lock held */
+static void vnswap_batch_submit(struct vnswap *vnswap, int rw)
+{
+	struct vnswap_batch **batchp;
+	struct vnswap_batch *batch;
+	struct bio *bio;
+
+	batchp = rw ? &vnswap->write_batch : &vnswap->read_batch;
+	batch = *batchp;
+	if (!batch)
+		return;
+	*batchp = NULL;
+
+	bio = batch->bio;
+	bio->bi_private = batch;
+	if (rw) {
+		bio->bi_end_io = vnswap_bio_end_write;
+		atomic_inc(&vnswap->stats.vnswap_write_bios);
+		atomic_add(bio->bi_vcnt, &vnswap->stats.
+			vnswap_write_bio_pages);
 	} else {
-		/*
-		* There are bytes yet to be transferred.
-		* blk_end_request() -> blk_end_bidi_request() ->
-		* blk_update_bidi_request() ->
-		* blk_update_request() -> req_bio_endio() ->
-		* bio->bi_size -= nbytes;
-		*/
-		spin_lock_irqsave(&vnswap_original_bio_lock, flags);
-		original_bio->bi_size -= (PAGE_SIZE-bio->bi_size);
+		bio->bi_end_io = vnswap_bio_end_read;
+		atomic_inc(&vnswap->stats.vnswap_read_bios);
+		atomic_add(bio->bi_vcnt, &vnswap->stats.
+			vnswap_read_bio_pages);
+	}
 
-		if (bio->bi_size == PAGE_SIZE) {
-			atomic_inc(&vnswap_device->stats.
-				vnswap_bio_end_fail_w2_num);
-			pr_err("%s %d: (error, bio->bi_size, " \
-					"original_bio->bi_size, " \
-					"bio->bi_vcnt," \
-					"original_bio->bi_vcnt, bio->bi_idx, " \
-					"original_bio->bi_idx," \
-					"vnswap_bio_end_fail_w1_num ~ " \
-					"vnswap_bio_end_fail_w3_num) = " \
-					"(%d, %d, %d, %d, %d, %d, %d, %d, %d, %d)\n",
-					__func__, __LINE__, err, bio->bi_size,
-					original_bio->bi_size,
-					bio->bi_vcnt, original_bio->bi_vcnt,
-					bio->bi_idx,
-					original_bio->bi_idx,
-					vnswap_device->stats.
-						vnswap_bio_end_fail_w1_num.
-						counter,
-					vnswap_device->stats.
-						vnswap_bio_end_fail_w2_num.
-						counter,
-					vnswap_device->stats.
-						vnswap_bio_end_fail_w3_num.
-						counter);
-			spin_unlock_irqrestore(&vnswap_original_bio_lock,
-				flags);
-			goto out_bio_put;
-		}
+	dprintk("%s %d: (rw, bi_sector, bi_vcnt) = (%d, %llu, %d)\n",
+			__func__, __LINE__, rw,
+			(unsigned long long)bio->bi_sector, bio->bi_vcnt);
 
-		if (bio->bi_size || original_bio->bi_size) {
-			atomic_inc(&vnswap_device->stats.
-				vnswap_bio_end_fail_w3_num);
-			pr_err("%s %d: (error, bio->bi_size, " \
-					"original_bio->bi_size, " \
-					"bio->bi_vcnt," \
-					"original_bio->bi_vcnt, bio->bi_idx, " \
-					"original_bio->bi_idx," \
-					"vnswap_bio_end_fail_w1_num ~ " \
-					"vnswap_bio_end_fail_w3_num) = " \
-					"(%d, %d, %d, %d, %d, %d, %d, %d, %d, %d)\n",
-					__func__, __LINE__, err, bio->bi_size,
-					original_bio->bi_size,
-					bio->bi_vcnt, original_bio->bi_vcnt,
-					bio->bi_idx,
-					original_bio->bi_idx,
-					vnswap_device->stats.
-						vnswap_bio_end_fail_w1_num.
-						counter,
-					vnswap_device->stats.
-						vnswap_bio_end_fail_w2_num.
-						counter,
-					vnswap_device->stats.
-						vnswap_bio_end_fail_w3_num.
-						counter);
-			spin_unlock_irqrestore(&vnswap_original_bio_lock,
-				flags);
-			goto out_bio_put;
+	submit_bio(rw, bio);
+}
+
+static struct vnswap_batch *vnswap_batch_alloc(sector_t sector)
+{
+	struct vnswap_batch *batch;
+
+	batch = kzalloc(sizeof(*batch), GFP_NOIO);
+	if (!batch)
+		return NULL;
+
+	batch->bio = bio_alloc(GFP_NOIO, VNSWAP_MAX_BATCH_PAGES);
+	if (!batch->bio) {
+		kfree(batch);
+		return NULL;
+	}
+	batch->bio->bi_sector = sector;
+	batch->bio->bi_bdev = backing_storage_bdev;
+	bio_list_init(&batch->orig_bios);
+	return batch;
+}
+
+/*
+ * Insert entry into VNSWAP_IO sub system
+ *
+ * Add backing storage block nand_offset to the pending read or write
+ * bio.  Blocks are gathered into one bio as long as they are contiguous
+ * on the backing device; the bio is submitted when the next block does
+ * not follow it, when it is full, or on unplug.  Called with batch_lock
+ * held.
+ */
+static int vnswap_submit_bio(struct vnswap *vnswap, int rw, int nand_offset,
+	struct page *page, struct bio_list *orig_bios,
+	struct vnswap_cache_page *cp, int own_page)
+{
+	struct vnswap_batch **batchp;
+	struct vnswap_batch *batch;
+	sector_t sector;
+	int i;
+
+	batchp = rw ? &vnswap->write_batch : &vnswap->read_batch;
+	batch = *batchp;
+	sector = backing_storage_bmap[nand_offset] << (PAGE_SHIFT - 9);
+
+	if (batch && (batch->next_sector != sector ||
+		bio_add_page(batch->bio, page, PAGE_SIZE, 0) != PAGE_SIZE)) {
+		vnswap_batch_submit(vnswap, rw);
+		batch = NULL;
+	}
+
+	if (!batch) {
+		batch = vnswap_batch_alloc(sector);
+		if (!batch) {
+			atomic_inc(&vnswap->stats.vnswap_bio_no_mem_num);
+			return -ENOMEM;
+		}
+		if (bio_add_page(batch->bio, page, PAGE_SIZE, 0) !=
+			PAGE_SIZE) {
+			bio_put(batch->bio);
+			kfree(batch);
+			return -EIO;
 		}
+		*batchp = batch;
+	}
 
-		set_bit(BIO_UPTODATE, &original_bio->bi_flags);
-		spin_unlock_irqrestore(&vnswap_original_bio_lock,
-			flags);
-		bio_endio(original_bio, 0);
+	i = batch->bio->bi_vcnt - 1;
+	batch->nand_offset[i] = nand_offset;
+	batch->cache[i] = cp;
+	if (own_page)
+		__set_bit(i, &batch->own_pages);
+	if (orig_bios) {
+		bio_list_merge(&batch->orig_bios, orig_bios);
+		bio_list_init(orig_bios);
 	}
+	batch->next_sector = sector + SECTORS_PER_PAGE;
 
-out_bio_put:
-	bio_put(bio);
+	dprintk("%s %d: (rw, nand_offset, bi_vcnt) = (%d, %d, %d)\n",
+			__func__, __LINE__, rw, nand_offset,
+			batch->bio->bi_vcnt);
+
+	if (batch->bio->bi_vcnt == VNSWAP_MAX_BATCH_PAGES)
+		vnswap_batch_submit(vnswap, rw);
+
+	return 0;
 }
 
-/* Insert entry into VNSWAP_IO sub system */
-int vnswap_submit_bio(int rw, int nand_offset,
-	struct page *page, struct bio *original_bio)
+/*
+ * Unmap the records of a pack which could not be written; called with
+ * vnswap_table_lock held.  Records overwritten meanwhile are left alone.
+ */
+static void vnswap_pack_unmap(struct vnswap_pack *pack)
 {
-	struct bio *bio;
-	int ret = 0;
+	int i;
 
-	if (!rw) {
-		VM_BUG_ON(!PageLocked(page));
-		VM_BUG_ON(PageUptodate(page));
+	for (i = 0; i < pack->nr_records; i++) {
+		if (vnswap_table[pack->index[i]] != pack->slot[i])
+			continue;
+		vnswap_table[pack->index[i]] = -1;
+		vnswap_put_block(pack->nand_offset);
+		atomic_dec(&vnswap_device->stats.vnswap_stored_pages);
 	}
+}
 
-	bio = bio_alloc(GFP_NOIO, 1);
+/* Queue the packed block for writing; called with batch_lock held */
+static void vnswap_pack_close(struct vnswap *vnswap)
+{
+	struct vnswap_pack *pack = &vnswap->pack;
+	int live, err = 0;
 
-	if (!bio) {
-		atomic_inc(&vnswap_device->stats.vnswap_bio_no_mem_num);
-		ret = -ENOMEM;
-		goto out;
+	if (!pack->page)
+		return;
+
+	/* only the pack's own reference left: every record was dropped */
+	spin_lock(&vnswap_table_lock);
+	live = backing_storage_refcnt[pack->nand_offset] > 1;
+	spin_unlock(&vnswap_table_lock);
+
+	if (live)
+		err = vnswap_submit_bio(vnswap, WRITE, pack->nand_offset,
+				pack->page, &pack->orig_bios, NULL, 1);
+	if (!live || err) {
+		vnswap_complete_bios(&pack->orig_bios, err);
+		__free_page(pack->page);
 	}
 
-	bio->bi_sector = (backing_storage_bmap[nand_offset] <<
-					(PAGE_SHIFT - 9));
-	bio->bi_bdev = backing_storage_bdev;
-	bio->bi_io_vec[0].bv_page = page;
-	bio->bi_io_vec[0].bv_len = PAGE_SIZE;
-	bio->bi_io_vec[0].bv_offset = 0;
-	bio->bi_vcnt = 1;
-	bio->bi_idx = 0;
-	bio->bi_size = PAGE_SIZE;
-	bio->bi_private = (void *) original_bio;
-	if (rw)
-		bio->bi_end_io = vnswap_bio_end_write;
+	spin_lock(&vnswap_table_lock);
+	if (err)
+		vnswap_pack_unmap(pack);
+	vnswap_put_block(pack->nand_offset);
+	spin_unlock(&vnswap_table_lock);
+
+	pack->page = NULL;
+}
+
+/* Submit everything gathered so far */
+static void vnswap_flush(struct vnswap *vnswap)
+{
+	mutex_lock(&vnswap->batch_lock);
+	vnswap_pack_close(vnswap);
+	vnswap_batch_submit(vnswap, WRITE);
+	vnswap_batch_submit(vnswap, READ);
+	mutex_unlock(&vnswap->batch_lock);
+}
+
+static void vnswap_flush_work(struct work_struct *work)
+{
+	vnswap_flush(container_of(work, struct vnswap, flush_work));
+}
+
+static void vnswap_unplug(struct blk_plug_cb *cb, bool from_schedule)
+{
+	struct vnswap *vnswap = cb->data;
+
+	/* Submitting bios may sleep, so not from within schedule() */
+	if (from_schedule)
+		kblockd_schedule_work(vnswap->queue, &vnswap->flush_work);
 	else
-		bio->bi_end_io = vnswap_bio_end_read;
+		vnswap_flush(vnswap);
+	kfree(cb);
+}
 
-	dprintk("%s %d: (rw, nand_offset) = (%d,%d)\n",
-			__func__, __LINE__, rw, nand_offset);
+/*
+ * Keep gathering blocks while the caller holds a plug, swap-out from
+ * reclaim and swap-in readahead do, and flush them right away if not.
+ */
+static void vnswap_plug(struct vnswap *vnswap)
+{
+	if (!blk_check_plugged(vnswap_unplug, vnswap,
+			sizeof(struct blk_plug_cb)))
+		vnswap_flush(vnswap);
+}
 
-	submit_bio(rw, bio);
+/*
+ * Read ahead the blocks following nand_offset which are in use and
+ * contiguous on the backing device, into the same bio.  Called with
+ * batch_lock held.
+ */
+static void vnswap_readahead(struct vnswap *vnswap, int nand_offset)
+{
+	struct vnswap_cache_page *cp;
+	unsigned long flags;
+	int i, ra_offset;
+
+	for (i = 1; i <= vnswap->readahead; i++) {
+		ra_offset = nand_offset + i;
+		if (ra_offset >= vnswap->bs_size ||
+			!test_bit(ra_offset, backing_storage_bitmap) ||
+			backing_storage_bmap[ra_offset] !=
+			backing_storage_bmap[nand_offset] + i)
+			break;
 
-	if (rw) {
-		atomic_inc(&vnswap_device->stats.
-			vnswap_stored_pages);
-		atomic_inc(&vnswap_device->stats.
-			vnswap_write_pages);
-	} else {
-		atomic_inc(&vnswap_device->stats.
-			vnswap_read_pages);
-	}
-	/* TODO: check bio->bi_flags */
+		spin_lock_irqsave(&vnswap->cache_lock, flags);
+		cp = NULL;
+		if (!vnswap_cache_lookup(vnswap, ra_offset))
+			cp = vnswap_cache_claim(vnswap, ra_offset);
+		spin_unlock_irqrestore(&vnswap->cache_lock, flags);
+		if (!cp)
+			break;
 
-out:
-	return ret;
+		if (vnswap_submit_bio(vnswap, READ, ra_offset, cp->page,
+				NULL, cp, 0)) {
+			vnswap_cache_end(vnswap, cp, -EIO);
+			break;
+		}
+		atomic_inc(&vnswap->stats.vnswap_readahead_pages);
+	}
 }
 
 int vnswap_bvec_read(struct vnswap *vnswap, struct bio_vec *bvec,
 	u32 index, struct bio *bio)
 {
+	struct vnswap_cache_page *cp;
 	struct page *page;
 	unsigned char *user_mem, *swap_header_page_mem;
-	int nand_offset = 0, ret = 0;
+	unsigned long flags;
+	int slot, nand_offset = 0, ret = 0;
 
 	page = bvec->bv_page;
 
@@ -649,12 +948,12 @@ int vnswap_bvec_read(struct vnswap *vnswap, struct bio_vec *bvec,
 	}
 
 	spin_lock(&vnswap_table_lock);
-	nand_offset = vnswap_table[index];
-	if (nand_offset == -1) {
+	slot = vnswap_table[index];
+	if (slot == -1) {
 		pr_err("%s %d: vnswap_table is not mapped. " \
 				"(index, nand_offset)" \
 				"= (%d, %d)\n", __func__, __LINE__,
-				index, nand_offset);
+				index, slot);
 		ret = -EIO;
 		atomic_inc(&vnswap_device->stats.
 			vnswap_not_mapped_read_pages);
@@ -662,14 +961,161 @@ int vnswap_bvec_read(struct vnswap *vnswap, struct bio_vec *bvec,
 		goto out;
 	}
 	spin_unlock(&vnswap_table_lock);
+	nand_offset = VNSWAP_SLOT_NAND_OFFSET(slot);
 
 	dprintk("%s %d: (index, nand_offset) = (%d, %d)\n",
 			__func__, __LINE__, index, nand_offset);
 
-	/* Read nand_offset position backing storage into page */
-	ret = vnswap_submit_bio(0, nand_offset, page, bio);
+	atomic_inc(&vnswap_device->stats.vnswap_read_pages);
+
+	spin_lock_irqsave(&vnswap->cache_lock, flags);
+	cp = vnswap_cache_lookup(vnswap, nand_offset);
+	if (cp && cp->state == VNSWAP_CACHE_UPTODATE) {
+		/* copy without the lock, the page is not reused meanwhile */
+		cp->users++;
+		spin_unlock_irqrestore(&vnswap->cache_lock, flags);
+		ret = vnswap_cache_copy(cp, bio);
+		spin_lock_irqsave(&vnswap->cache_lock, flags);
+		cp->users--;
+		spin_unlock_irqrestore(&vnswap->cache_lock, flags);
+		if (!ret) {
+			atomic_inc(&vnswap_device->stats.
+				vnswap_cache_hit_pages);
+			set_bit(BIO_UPTODATE, &bio->bi_flags);
+			bio_endio(bio, 0);
+		}
+		goto out;
+	}
+	if (cp) {
+		/* already being read, by readahead or another record */
+		bio_list_add(&cp->waiters, bio);
+		spin_unlock_irqrestore(&vnswap->cache_lock, flags);
+		goto out;
+	}
+	cp = vnswap_cache_claim(vnswap, nand_offset);
+	if (cp)
+		bio_list_add(&cp->waiters, bio);
+	spin_unlock_irqrestore(&vnswap->cache_lock, flags);
+
+	if (!cp) {
+		/* every cache page is being read, use a private one */
+		cp = vnswap_cache_alloc_transient(nand_offset);
+		if (!cp) {
+			atomic_inc(&vnswap_device->stats.
+				vnswap_bio_no_mem_num);
+			ret = -ENOMEM;
+			goto out;
+		}
+		bio_list_add(&cp->waiters, bio);
+	}
+
+	/* Read nand_offset position backing storage into the cache page */
+	mutex_lock(&vnswap->batch_lock);
+	if (vnswap_submit_bio(vnswap, READ, nand_offset, cp->page,
+			NULL, cp, 0))
+		vnswap_cache_end(vnswap, cp, -EIO);
+	else
+		vnswap_readahead(vnswap, nand_offset);
+	mutex_unlock(&vnswap->batch_lock);
+
+out:
+	return ret;
+}
+
+/*
+ * Compress page into compress_buf behind its u16 length.  Returns the
+ * record size in sectors, or SECTORS_PER_PAGE if the page does not
+ * compress well enough to share a block.  Called with vnswap->lock
+ * held for write, which serializes use of the buffers.
+ */
+static int vnswap_compress_page(struct vnswap *vnswap, struct page *page)
+{
+	unsigned char *user_mem;
+	size_t clen;
+	int ret;
+
+	user_mem = kmap_atomic(page);
+	ret = lz4_compress(user_mem, PAGE_SIZE,
+			vnswap->compress_buf + sizeof(u16), &clen,
+			vnswap->compress_workmem);
+	kunmap_atomic(user_mem);
+
+	if (ret || clen + sizeof(u16) > PAGE_SIZE - SECTOR_SIZE)
+		return SECTORS_PER_PAGE;
+
+	*(u16 *)vnswap->compress_buf = clen;
+	return DIV_ROUND_UP(clen + sizeof(u16), SECTOR_SIZE);
+}
+
+/* Append the compressed page in compress_buf to the packed block */
+static int vnswap_pack_write(struct vnswap *vnswap, u32 index,
+	int nr_sect, struct bio *bio)
+{
+	struct vnswap_pack *pack = &vnswap->pack;
+	unsigned char *pack_mem;
+	int nand_offset, ret = 0;
+
+	mutex_lock(&vnswap->batch_lock);
+
+	if (pack->page && pack->next_sect + nr_sect > SECTORS_PER_PAGE)
+		vnswap_pack_close(vnswap);
+
+	if (!pack->page) {
+		pack->page = alloc_page(GFP_NOIO);
+		if (!pack->page) {
+			atomic_inc(&vnswap_device->stats.
+				vnswap_bio_no_mem_num);
+			ret = -ENOMEM;
+			goto out;
+		}
+
+		spin_lock(&vnswap_table_lock);
+		ret = vnswap_alloc_block(&nand_offset);
+		if (ret < 0) {
+			spin_unlock(&vnswap_table_lock);
+			__free_page(pack->page);
+			pack->page = NULL;
+			goto out;
+		}
+		/* the pack's own reference */
+		vnswap_get_block(nand_offset);
+		spin_unlock(&vnswap_table_lock);
+
+		pack->nand_offset = nand_offset;
+		pack->next_sect = 0;
+		pack->nr_records = 0;
+		bio_list_init(&pack->orig_bios);
+		vnswap_cache_invalidate(vnswap, nand_offset);
+	}
+
+	spin_lock(&vnswap_table_lock);
+	if (pack->nr_records)
+		vnswap_get_block(pack->nand_offset);
+	vnswap_table[index] = VNSWAP_SLOT(pack->nand_offset,
+			pack->next_sect, nr_sect);
+	pack->index[pack->nr_records] = index;
+	pack->slot[pack->nr_records++] = vnswap_table[index];
+	spin_unlock(&vnswap_table_lock);
+
+	dprintk("%s %d: (index, nand_offset, start, nr_sect) = " \
+			"(%d, %d, %d, %d)\n",
+			__func__, __LINE__, index, pack->nand_offset,
+			pack->next_sect, nr_sect);
+
+	pack_mem = kmap_atomic(pack->page);
+	memcpy(pack_mem + (pack->next_sect << SECTOR_SHIFT),
+		vnswap->compress_buf, *(u16 *)vnswap->compress_buf +
+		sizeof(u16));
+	kunmap_atomic(pack_mem);
+
+	pack->next_sect += nr_sect;
+	bio_list_add(&pack->orig_bios, bio);
+	atomic_inc(&vnswap_device->stats.vnswap_compressed_pages);
+	atomic_inc(&vnswap_device->stats.vnswap_stored_pages);
+	atomic_inc(&vnswap_device->stats.vnswap_write_pages);
 
 out:
+	mutex_unlock(&vnswap->batch_lock);
 	return ret;
 }
 
@@ -677,8 +1123,9 @@ int vnswap_bvec_write(struct vnswap *vnswap, struct bio_vec *bvec,
 	u32 index, struct bio *bio)
 {
 	struct page *page;
+	struct bio_list orig_bios;
 	unsigned char *user_mem, *swap_header_page_mem;
-	int nand_offset = 0, ret;
+	int slot, nr_sect, nand_offset = 0, ret;
 
 	page = bvec->bv_page;
 
@@ -693,43 +1140,57 @@ int vnswap_bvec_write(struct vnswap *vnswap, struct bio_vec *bvec,
 	}
 
 	spin_lock(&vnswap_table_lock);
-	nand_offset = vnswap_table[index];
+	slot = vnswap_table[index];
 
 	/* duplicate write - remove existing mapping */
-	if (nand_offset != -1) {
+	if (slot != -1) {
 		atomic_inc(&vnswap_device->stats.
 			vnswap_double_mapped_slot_num);
-		clear_bit(nand_offset, backing_storage_bitmap);
 		vnswap_table[index] = -1;
-		atomic_dec(&vnswap_device->stats.
-			vnswap_used_slot_num);
+		vnswap_put_block(VNSWAP_SLOT_NAND_OFFSET(slot));
 		atomic_dec(&vnswap_device->stats.
 			vnswap_stored_pages);
 	}
+	spin_unlock(&vnswap_table_lock);
+
+	if (vnswap->compress) {
+		nr_sect = vnswap_compress_page(vnswap, page);
+		if (nr_sect < SECTORS_PER_PAGE)
+			return vnswap_pack_write(vnswap, index, nr_sect, bio);
+	}
 
-	ret = vnswap_find_free_area_in_backing_storage(&nand_offset);
+	spin_lock(&vnswap_table_lock);
+	ret = vnswap_alloc_block(&nand_offset);
 	if (ret < 0) {
 		spin_unlock(&vnswap_table_lock);
 		return ret;
 	}
-	set_bit(nand_offset, backing_storage_bitmap);
-	vnswap_table[index] = nand_offset;
-	atomic_inc(&vnswap_device->stats.
-		vnswap_used_slot_num);
+	vnswap_table[index] = VNSWAP_SLOT(nand_offset, 0, SECTORS_PER_PAGE);
 	spin_unlock(&vnswap_table_lock);
 
 	dprintk("%s %d: (index, nand_offset) = (%d, %d)\n",
 			__func__, __LINE__, index, nand_offset);
-	ret = vnswap_submit_bio(1, nand_offset, page, bio);
+
+	vnswap_cache_invalidate(vnswap, nand_offset);
+
+	bio_list_init(&orig_bios);
+	bio_list_add(&orig_bios, bio);
+	mutex_lock(&vnswap->batch_lock);
+	ret = vnswap_submit_bio(vnswap, WRITE, nand_offset, page,
+			&orig_bios, NULL, 0);
+	mutex_unlock(&vnswap->batch_lock);
 
 	if (ret) {
 		spin_lock(&vnswap_table_lock);
-		clear_bit(nand_offset, backing_storage_bitmap);
 		vnswap_table[index] = -1;
+		vnswap_put_block(nand_offset);
 		spin_unlock(&vnswap_table_lock);
+		return ret;
 	}
 
-	return ret;
+	atomic_inc(&vnswap_device->stats.vnswap_stored_pages);
+	atomic_inc(&vnswap_device->stats.vnswap_write_pages);
+	return 0;
 }
 
 int vnswap_bvec_rw(struct vnswap *vnswap, struct bio_vec *bvec,
@@ -757,7 +1218,7 @@ int vnswap_bvec_rw(struct vnswap *vnswap, struct bio_vec *bvec,
 void __vnswap_make_request(struct vnswap *vnswap,
 	struct bio *bio, int rw)
 {
-	int i, offset, ret;
+	int offset, ret;
 	u32 index, is_swap_header_page;
 	struct bio_vec *bvec;
 
@@ -800,43 +1261,43 @@ void __vnswap_make_request(struct vnswap *vnswap,
 		goto out_error;
 	}
 
-	bio_for_each_segment(bvec, bio, i) {
-		if (bvec->bv_len != PAGE_SIZE || bvec->bv_offset != 0) {
-			atomic_inc(&vnswap_device->stats.
-				vnswap_bio_invalid_num);
-			pr_err("%s %d: bvec is misaligned. " \
-					"(bv_len, bv_offset," \
-					"vnswap_bio_invalid_num) = (%d, %d, %d)\n",
-					__func__, __LINE__,
-					bvec->bv_len, bvec->bv_offset,
-					vnswap_device->stats.
-						vnswap_bio_invalid_num.counter);
-			goto out_error;
-		}
-
-		dprintk("%s %d: (rw, index, bvec->bv_len) = " \
-				"(%d, %d, %d)\n",
-				__func__, __LINE__, rw, index, bvec->bv_len);
+	bvec = bio_iovec(bio);
+	if (bvec->bv_len != PAGE_SIZE || bvec->bv_offset != 0) {
+		atomic_inc(&vnswap_device->stats.
+			vnswap_bio_invalid_num);
+		pr_err("%s %d: bvec is misaligned. " \
+				"(bv_len, bv_offset," \
+				"vnswap_bio_invalid_num) = (%d, %d, %d)\n",
+				__func__, __LINE__,
+				bvec->bv_len, bvec->bv_offset,
+				vnswap_device->stats.
+					vnswap_bio_invalid_num.counter);
+		goto out_error;
+	}
 
-		ret = vnswap_bvec_rw(vnswap, bvec, index, bio, rw);
-		if (ret < 0) {
-			if (ret != -ENOSPC)
-				pr_err("%s %d: vnswap_bvec_rw failed." \
-						"(ret) = (%d)\n",
-						__func__, __LINE__, ret);
-			else
-				dprintk("%s %d: vnswap_bvec_rw failed. " \
-				"(ret) = (%d)\n",
-						__func__, __LINE__, ret);
-			goto out_error;
-		}
+	dprintk("%s %d: (rw, index, bvec->bv_len) = " \
+			"(%d, %d, %d)\n",
+			__func__, __LINE__, rw, index, bvec->bv_len);
 
-		index++;
+	/* bio may be completed, and gone, once vnswap_bvec_rw succeeds */
+	ret = vnswap_bvec_rw(vnswap, bvec, index, bio, rw);
+	if (ret < 0) {
+		if (ret != -ENOSPC)
+			pr_err("%s %d: vnswap_bvec_rw failed." \
+					"(ret) = (%d)\n",
+					__func__, __LINE__, ret);
+		else
+			dprintk("%s %d: vnswap_bvec_rw failed. " \
+			"(ret) = (%d)\n",
+					__func__, __LINE__, ret);
+		goto out_error;
 	}
 
 	if (is_swap_header_page) {
 		set_bit(BIO_UPTODATE, &bio->bi_flags);
 		bio_endio(bio, 0);
+	} else {
+		vnswap_plug(vnswap);
 	}
 
 	return;
@@ -908,15 +1369,15 @@ error:
 void vnswap_slot_free_notify(struct block_device *bdev, unsigned long index)
 {
 	struct vnswap *vnswap;
-	int nand_offset = 0;
+	int slot;
 
 	vnswap = bdev->bd_disk->private_data;
 
 	spin_lock(&vnswap_table_lock);
-	nand_offset = vnswap_table[index];
+	slot = vnswap_table[index];
 
 	/* This index is not mapped to vnswap and is mapped to zswap */
-	if (nand_offset == -1) {
+	if (slot == -1) {
 		atomic_inc(&vnswap_device->stats.
 			vnswap_not_mapped_slot_free_num);
 		spin_unlock(&vnswap_table_lock);
@@ -927,16 +1388,8 @@ void vnswap_slot_free_notify(struct block_device *bdev, unsigned long index)
 		vnswap_mapped_slot_free_num);
 	atomic_dec(&vnswap_device->stats.
 		vnswap_stored_pages);
-	atomic_dec(&vnswap_device->stats.
-		vnswap_used_slot_num);
-	clear_bit(nand_offset, backing_storage_bitmap);
 	vnswap_table[index] = -1;
-
-	/* When Backing Storage is full, set Backing Storage is not full */
-	if (backing_storage_bitmap_last_allocated_index ==
-		vnswap_device->bs_size) {
-		backing_storage_bitmap_last_allocated_index = nand_offset;
-	}
+	vnswap_put_block(VNSWAP_SLOT_NAND_OFFSET(slot));
 	spin_unlock(&vnswap_table_lock);
 
 	/*
@@ -961,18 +1414,68 @@ const struct block_device_operations vnswap_devops = {
 	.owner = THIS_MODULE
 };
 
+static void vnswap_free_buffers(struct vnswap *vnswap)
+{
+	int i;
+
+	for (i = 0; i < VNSWAP_CACHE_PAGES; i++)
+		if (vnswap->cache[i].page)
+			__free_page(vnswap->cache[i].page);
+	kfree(vnswap->compress_buf);
+	kfree(vnswap->compress_workmem);
+}
+
+static int vnswap_alloc_buffers(struct vnswap *vnswap)
+{
+	struct vnswap_cache_page *cp;
+	int i;
+
+	vnswap->compress_workmem = kmalloc(LZ4_MEM_COMPRESS, GFP_KERNEL);
+	vnswap->compress_buf = kmalloc(sizeof(u16) +
+			lz4_compressbound(PAGE_SIZE), GFP_KERNEL);
+	if (!vnswap->compress_workmem || !vnswap->compress_buf)
+		goto error;
+
+	for (i = 0; i < VNSWAP_CACHE_PAGES; i++) {
+		cp = &vnswap->cache[i];
+		cp->nand_offset = -1;
+		cp->state = VNSWAP_CACHE_EMPTY;
+		cp->users = 0;
+		bio_list_init(&cp->waiters);
+		cp->page = alloc_page(GFP_KERNEL);
+		if (!cp->page)
+			goto error;
+	}
+	return 0;
+
+error:
+	vnswap_free_buffers(vnswap);
+	return -ENOMEM;
+}
+
 static int create_device(struct vnswap *vnswap)
 {
 	int ret = 0;
 
 	init_rwsem(&vnswap->lock);
+	mutex_init(&vnswap->batch_lock);
+	spin_lock_init(&vnswap->cache_lock);
+	INIT_WORK(&vnswap->flush_work, vnswap_flush_work);
+	vnswap->readahead = VNSWAP_DEFAULT_READAHEAD;
+
+	ret = vnswap_alloc_buffers(vnswap);
+	if (ret) {
+		pr_err("%s %d: Error allocating buffers for device\n",
+				__func__, __LINE__);
+		goto out;
+	}
 
 	vnswap->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!vnswap->queue) {
 		pr_err("%s %d: Error allocating disk queue for device\n",
 				__func__, __LINE__);
 		ret = -ENOMEM;
-		goto out;
+		goto out_free_buffers;
 	}
 
 	blk_queue_make_request(vnswap->queue, vnswap_make_request);
@@ -1051,6 +1554,9 @@ out_put_disk:
 out_free_queue:
 	blk_cleanup_queue(vnswap->queue);
 
+out_free_buffers:
+	vnswap_free_buffers(vnswap);
+
 	return ret;
 }
 
@@ -1067,6 +1573,9 @@ void destroy_device(struct vnswap *vnswap)
 
 	if (vnswap->queue)
 		blk_cleanup_queue(vnswap->queue);
+
+	cancel_work_sync(&vnswap->flush_work);
+	vnswap_free_buffers(vnswap);
 }
 
 int __init vnswap_init(void)
@@ -1084,6 +1593,7 @@ int __init vnswap_init(void)
 	/* Initialize global variables */
 	vnswap_table = NULL;
 	backing_storage_bitmap = NULL;
+	backing_storage_refcnt = NULL;
 	backing_storage_bmap = NULL;
 	backing_storage_bdev = NULL;
 	backing_storage_file = NULL;
@@ -1133,6 +1643,8 @@ void __exit vnswap_exit(void)
 		vfree(backing_storage_bmap);
 	if (backing_storage_bitmap)
 		vfree(backing_storage_bitmap);
+	if (backing_storage_refcnt)
+		vfree(backing_storage_refcnt);
 	if (vnswap_table)
 		vfree(vnswap_table);
 
@@ -16,6 +16,8 @@
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
 #include <linux/blkdev.h>
+#include <linux/bio.h>
+#include <linux/workqueue.h>
 
 #define VNSWAP_DEBUG    0
 
@@ -53,6 +55,31 @@
 
 #define MAX_BACKING_STORAGE_FILENAME_LEN	127
 
+/*
+ * vnswap_table entry
+ *  - bit 6 ~ : backing storage block (nand_offset)
+ *  - bit 3 ~ 5 : first sector of the record in the block
+ *  - bit 0 ~ 2 : number of sectors of the record - 1
+ * A record of SECTORS_PER_PAGE sectors holds an uncompressed page.
+ * Smaller records hold an lz4 compressed page behind its u16 length,
+ * so that several compressed pages share one backing storage block.
+ */
+#define VNSWAP_SLOT_SHIFT	6
+#define VNSWAP_SLOT(nand_offset, start, nr_sect) \
+	(((nand_offset) << VNSWAP_SLOT_SHIFT) | ((start) << 3) | \
+	((nr_sect) - 1))
+#define VNSWAP_SLOT_NAND_OFFSET(slot)	((slot) >> VNSWAP_SLOT_SHIFT)
+#define VNSWAP_SLOT_START(slot)		(((slot) >> 3) & 0x7)
+#define VNSWAP_SLOT_NR_SECT(slot)	(((slot) & 0x7) + 1)
+
+/* Max pages (backing storage blocks) in one bio to backing storage */
+#define VNSWAP_MAX_BATCH_PAGES	32
+
+/* Backing storage blocks cached for reads and readahead */
+#define VNSWAP_CACHE_PAGES	32
+#define VNSWAP_DEFAULT_READAHEAD	4
+#define VNSWAP_MAX_READAHEAD	16
+
 struct vnswap_stats {
 	u64 vnswap_is_init;	/* vnswap_init success or fail */
 	u64 vnswap_total_slot_num;	/* total  slot number */
@@ -87,10 +114,69 @@ struct vnswap_stats {
 		/* total not-mapped-slot free number */
 	atomic_t vnswap_backing_storage_full_num;
 		/* total write_fail_because_of_backing_storage_full number */
+	atomic_t vnswap_write_bios;
+		/* total write bios submitted to backing storage */
+	atomic_t vnswap_write_bio_pages;
+		/* total pages in write bios submitted to backing storage */
+	atomic_t vnswap_read_bios;
+		/* total read bios submitted to backing storage */
+	atomic_t vnswap_read_bio_pages;
+		/* total pages in read bios submitted to backing storage */
+	atomic_t vnswap_compressed_pages;
+		/* total pages written compressed */
+	atomic_t vnswap_readahead_pages;
+		/* total backing storage blocks read ahead */
+	atomic_t vnswap_cache_hit_pages;
+		/* total read pages served from the block cache */
 	int vnswap_backing_storage_open_fail;
 		/* backing storage file open fail */
 };
 
+enum vnswap_cache_state {
+	VNSWAP_CACHE_EMPTY,
+	VNSWAP_CACHE_READING,
+	VNSWAP_CACHE_UPTODATE,
+};
+
+/* Backing storage block read from NAND, shared by reads of its records */
+struct vnswap_cache_page {
+	int nand_offset;	/* -1: invalidated */
+	enum vnswap_cache_state state;
+	int transient;	/* allocated for one read, not in the cache */
+	int users;	/* hits copying out of page without cache_lock */
+	struct page *page;
+	struct bio_list waiters;
+		/* original bios to complete when the block is read */
+};
+
+/* Pending bio over contiguous backing storage blocks */
+struct vnswap_batch {
+	struct bio *bio;
+	sector_t next_sector;	/* sector the next block must start at */
+	int nand_offset[VNSWAP_MAX_BATCH_PAGES];
+	struct vnswap_cache_page *cache[VNSWAP_MAX_BATCH_PAGES];
+		/* read: cache page filled by each bvec */
+	unsigned long own_pages;
+		/* write: bvecs holding packed blocks to free on completion */
+	struct bio_list orig_bios;
+		/* write: original bios to complete with this bio */
+};
+
+/*
+ * Backing storage block being filled with compressed pages.  The pack
+ * holds a reference on its block of its own until it is written, so
+ * that overwriting or discarding its records cannot free the block.
+ */
+struct vnswap_pack {
+	struct page *page;
+	int nand_offset;
+	int next_sect;
+	struct bio_list orig_bios;
+	int nr_records;
+	u32 index[SECTORS_PER_PAGE];	/* records in the pack, */
+	int slot[SECTORS_PER_PAGE];	/* and their table entries */
+};
+
 struct vnswap {
 	struct rw_semaphore lock;
 		/* protect buffers against concurrent read and writes */
@@ -104,6 +190,22 @@ struct vnswap {
 		* VNSWAP_INIT_BACKING_STORAGE_SUCCESS ,
 		* others: vnswap init fail*/
 	struct vnswap_stats stats;
+	int compress;	/* store pages lz4 compressed */
+	int readahead;	/* backing storage blocks to read ahead */
+
+	struct mutex batch_lock;
+		/* protect write_batch, read_batch and pack */
+	struct vnswap_batch *write_batch;
+	struct vnswap_batch *read_batch;
+	struct vnswap_pack pack;
+	struct work_struct flush_work;
+	void *compress_workmem;
+	unsigned char *compress_buf;
+
+	spinlock_t cache_lock;
+		/* protect cache, taken from bio completion */
+	struct vnswap_cache_page cache[VNSWAP_CACHE_PAGES];
+	int cache_hand;
 };
 
 extern void vnswap_init_disksize(u64 disksize);
@@ -119,6 +119,75 @@ static ssize_t vnswap_swap_info_show(struct device *dev,
 	);
 }
 
+static ssize_t compress_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%d\n", vnswap_device->compress);
+}
+
+static ssize_t compress_store(struct device *dev,
+	struct device_attribute *attr, const char *buf, size_t len)
+{
+	int ret;
+	u64 val;
+
+	ret = kstrtoull(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	/* records of both kinds can be mixed, so switch at any time */
+	down_write(&vnswap_device->lock);
+	vnswap_device->compress = !!val;
+	up_write(&vnswap_device->lock);
+	return len;
+}
+
+static ssize_t readahead_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%d\n", vnswap_device->readahead);
+}
+
+static ssize_t readahead_store(struct device *dev,
+	struct device_attribute *attr, const char *buf, size_t len)
+{
+	int ret;
+	u64 val;
+
+	ret = kstrtoull(buf, 10, &val);
+	if (ret)
+		return ret;
+	if (val > VNSWAP_MAX_READAHEAD)
+		return -EINVAL;
+
+	vnswap_device->readahead = val;
+	return len;
+}
+
+static ssize_t vnswap_bio_stats_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
+{
+	struct vnswap_stats *stats = &vnswap_device->stats;
+	int write_bios = atomic_read(&stats->vnswap_write_bios);
+	int write_pages = atomic_read(&stats->vnswap_write_bio_pages);
+	int read_bios = atomic_read(&stats->vnswap_read_bios);
+	int read_pages = atomic_read(&stats->vnswap_read_bio_pages);
+
+	return sprintf(buf, "(write_bios, write_bio_pages, " \
+			"avg_write_bio_kb) = (%d, %d, %d)\n" \
+			"(read_bios, read_bio_pages, " \
+			"avg_read_bio_kb) = (%d, %d, %d)\n" \
+			"(compressed_pages, readahead_pages, " \
+			"cache_hit_pages) = (%d, %d, %d)\n",
+		write_bios, write_pages,
+		write_bios ? write_pages * (int)(PAGE_SIZE >> 10) / write_bios : 0,
+		read_bios, read_pages,
+		read_bios ? read_pages * (int)(PAGE_SIZE >> 10) / read_bios : 0,
+		atomic_read(&stats->vnswap_compressed_pages),
+		atomic_read(&stats->vnswap_readahead_pages),
+		atomic_read(&stats->vnswap_cache_hit_pages));
+}
+
 static DEVICE_ATTR(disksize, S_IRUGO | S_IWUSR, disksize_show,
 	disksize_store);
 static DEVICE_ATTR(swap_filename, S_IRUGO | S_IWUSR, swap_filename_show,
@@ -129,6 +198,12 @@ static DEVICE_ATTR(vnswap_init, S_IRUGO | S_IWUSR,
 	vnswap_init_show, NULL);
 static DEVICE_ATTR(vnswap_swap_info, S_IRUGO | S_IWUSR,
 	vnswap_swap_info_show, NULL);
+static DEVICE_ATTR(compress, S_IRUGO | S_IWUSR,
+	compress_show, compress_store);
+static DEVICE_ATTR(readahead, S_IRUGO | S_IWUSR,
+	readahead_show, readahead_store);
+static DEVICE_ATTR(vnswap_bio_stats, S_IRUGO,
+	vnswap_bio_stats_show, NULL);
 
 static struct attribute *vnswap_disk_attrs[] = {
 	&dev_attr_disksize.attr,
@@ -136,6 +211,9 @@ static struct attribute *vnswap_disk_attrs[] = {
 	&dev_attr_init_backing_storage.attr,
 	&dev_attr_vnswap_init.attr,
 	&dev_attr_vnswap_swap_info.attr,
+	&dev_attr_compress.attr,
+	&dev_attr_readahead.attr,
+	&dev_attr_vnswap_bio_stats.attr,
 	NULL,
 };
 
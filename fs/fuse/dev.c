@@ -93,6 +93,8 @@ struct fuse_req *fuse_request_alloc_nofs(unsigned npages)
 
 void fuse_request_free(struct fuse_req *req)
 {
+	if (req->passthrough_filp)
+		fput(req->passthrough_filp);
 	if (req->pages != req->inline_pages) {
 		kfree(req->pages);
 		kfree(req->page_descs);
@@ -300,28 +302,121 @@ static unsigned len_args(unsigned numargs, struct fuse_arg *args)
 	return nbytes;
 }
 
+/*
+ * Each CPU hands out the ids congruent to its number modulo nr_cpu_ids,
+ * starting above zero, which is special.
+ */
 static u64 fuse_get_unique(struct fuse_conn *fc)
 {
-	fc->reqctr++;
-	/* zero is special */
-	if (fc->reqctr == 0)
-		fc->reqctr = 1;
+	struct fuse_iqueue *iq = per_cpu_ptr(fc->iqs, raw_smp_processor_id());
+	u64 unique;
+
+	spin_lock(&iq->lock);
+	iq->reqctr += nr_cpu_ids;
+	unique = iq->reqctr;
+	spin_unlock(&iq->lock);
+
+	return unique;
+}
 
-	return fc->reqctr;
+/* The CPU after @cpu in the possible map, wrapping around */
+static int fuse_next_cpu(int cpu)
+{
+	cpu = cpumask_next(cpu, cpu_possible_mask);
+	if (cpu >= nr_cpu_ids)
+		cpu = cpumask_first(cpu_possible_mask);
+	return cpu;
 }
 
-static void queue_request(struct fuse_conn *fc, struct fuse_req *req)
+/*
+ * Wake up a reader for something queued on @cpu: one sleeping on that
+ * CPU if there is one, else one on the next CPU that has any.
+ */
+static void fuse_wake_up_reader(struct fuse_conn *fc, int cpu)
 {
+	struct fuse_iqueue *iq;
+	int i = cpu;
+
+	/* Pairs with the barrier in prepare_to_wait() */
+	smp_mb();
+	do {
+		iq = per_cpu_ptr(fc->iqs, i);
+		if (waitqueue_active(&iq->waitq)) {
+			wake_up(&iq->waitq);
+			break;
+		}
+		i = fuse_next_cpu(i);
+	} while (i != cpu);
+
+	kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+}
+
+void fuse_dev_wake_up_all(struct fuse_conn *fc)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		wake_up_all(&per_cpu_ptr(fc->iqs, cpu)->waitq);
+}
+
+/*
+ * Queue a request on the input queue of the current CPU.
+ *
+ * Returns false if the connection has been aborted.  fuse_abort_conn()
+ * clears fc->connected before it empties the queues, each under its lock,
+ * so a request is either refused here or ended by the abort.  Callers
+ * holding fc->lock have checked fc->connected already.
+ */
+static bool queue_request(struct fuse_conn *fc, struct fuse_req *req)
+{
+	int cpu = raw_smp_processor_id();
+	struct fuse_iqueue *iq = per_cpu_ptr(fc->iqs, cpu);
+
 	req->in.h.len = sizeof(struct fuse_in_header) +
 		len_args(req->in.numargs, (struct fuse_arg *) req->in.args);
-	list_add_tail(&req->list, &fc->pending);
-	req->state = FUSE_REQ_PENDING;
 	if (!req->waiting) {
 		req->waiting = 1;
 		atomic_inc(&fc->num_waiting);
 	}
-	wake_up(&fc->waitq);
-	kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+
+	spin_lock(&iq->lock);
+	if (!fc->connected) {
+		spin_unlock(&iq->lock);
+		return false;
+	}
+	req->iq_cpu = cpu;
+	req->state = FUSE_REQ_PENDING;
+	list_add_tail(&req->list, &iq->pending);
+	iq->num_pending++;
+	spin_unlock(&iq->lock);
+
+	fuse_wake_up_reader(fc, cpu);
+	return true;
+}
+
+/* Take @req off its input queue, called with iq->lock */
+static void __unqueue_request(struct fuse_iqueue *iq, struct fuse_req *req)
+{
+	list_del_init(&req->list);
+	iq->num_pending--;
+}
+
+/*
+ * Take @req off its input queue if no reader has taken it yet.  Returns
+ * true if it was still pending.
+ */
+static bool unqueue_request(struct fuse_conn *fc, struct fuse_req *req)
+{
+	struct fuse_iqueue *iq = per_cpu_ptr(fc->iqs, req->iq_cpu);
+	bool pending;
+
+	spin_lock(&iq->lock);
+	pending = req->state == FUSE_REQ_PENDING;
+	if (pending)
+		__unqueue_request(iq, req);
+	spin_unlock(&iq->lock);
+
+	return pending;
 }
 
 void fuse_queue_forget(struct fuse_conn *fc, struct fuse_forget_link *forget,
@@ -334,8 +429,7 @@ void fuse_queue_forget(struct fuse_conn *fc, struct fuse_forget_link *forget,
 	if (fc->connected) {
 		fc->forget_list_tail->next = forget;
 		fc->forget_list_tail = forget;
-		wake_up(&fc->waitq);
-		kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+		fuse_wake_up_reader(fc, raw_smp_processor_id());
 	} else {
 		kfree(forget);
 	}
@@ -352,7 +446,9 @@ static void flush_bg_queue(struct fuse_conn *fc)
 		list_del(&req->list);
 		fc->active_background++;
 		req->in.h.unique = fuse_get_unique(fc);
-		queue_request(fc, req);
+		/* being aborted: the abort ends the processing list next */
+		if (!queue_request(fc, req))
+			list_add_tail(&req->list, &fc->processing);
 	}
 }
 
@@ -416,8 +512,7 @@ __acquires(fc->lock)
 static void queue_interrupt(struct fuse_conn *fc, struct fuse_req *req)
 {
 	list_add_tail(&req->intr_entry, &fc->interrupts);
-	wake_up(&fc->waitq);
-	kill_fasync(&fc->fasync, SIGIO, POLL_IN);
+	fuse_wake_up_reader(fc, raw_smp_processor_id());
 }
 
 static void request_wait_answer(struct fuse_conn *fc, struct fuse_req *req)
@@ -452,8 +547,8 @@ __acquires(fc->lock)
 			return;
 
 		/* Request is not yet in userspace, bail out */
-		if (req->state == FUSE_REQ_PENDING) {
-			list_del(&req->list);
+		if (req->state == FUSE_REQ_PENDING &&
+		    unqueue_request(fc, req)) {
 			__fuse_put_request(req);
 			req->out.h.error = -EINTR;
 			return;
@@ -488,23 +583,30 @@ __acquires(fc->lock)
 	}
 }
 
+/*
+ * The request is queued without fc->lock, which is only taken to wait
+ * for the answer.
+ */
 static void __fuse_request_send(struct fuse_conn *fc, struct fuse_req *req)
 {
 	BUG_ON(req->background);
-	spin_lock(&fc->lock);
-	if (!fc->connected)
-		req->out.h.error = -ENOTCONN;
-	else if (fc->conn_error)
+	if (fc->conn_error) {
 		req->out.h.error = -ECONNREFUSED;
-	else {
-		req->in.h.unique = fuse_get_unique(fc);
-		queue_request(fc, req);
-		/* acquire extra reference, since request is still needed
-		   after request_end() */
-		__fuse_get_request(req);
+		return;
+	}
 
-		request_wait_answer(fc, req);
+	req->in.h.unique = fuse_get_unique(fc);
+	/* acquire extra reference, since request is still needed
+	   after request_end() */
+	__fuse_get_request(req);
+	if (!queue_request(fc, req)) {
+		__fuse_put_request(req);
+		req->out.h.error = -ENOTCONN;
+		return;
 	}
+
+	spin_lock(&fc->lock);
+	request_wait_answer(fc, req);
 	spin_unlock(&fc->lock);
 }
 
@@ -557,12 +659,8 @@ static int fuse_request_send_notify_reply(struct fuse_conn *fc,
 
 	req->isreply = 0;
 	req->in.h.unique = unique;
-	spin_lock(&fc->lock);
-	if (fc->connected) {
-		queue_request(fc, req);
+	if (queue_request(fc, req))
 		err = 0;
-	}
-	spin_unlock(&fc->lock);
 
 	return err;
 }
@@ -1012,31 +1110,58 @@ static int forget_pending(struct fuse_conn *fc)
 	return fc->forget_list_head.next != NULL;
 }
 
-static int request_pending(struct fuse_conn *fc)
+/*
+ * The input queue a reader on @cpu should take a request from: its own
+ * if anything is pending there, else the next one that has something.
+ * Lockless, to be confirmed under the queue lock.
+ */
+static struct fuse_iqueue *pending_iqueue(struct fuse_conn *fc, int cpu)
 {
-	return !list_empty(&fc->pending) || !list_empty(&fc->interrupts) ||
-		forget_pending(fc);
+	struct fuse_iqueue *iq;
+	int i = cpu;
+
+	do {
+		iq = per_cpu_ptr(fc->iqs, i);
+		if (ACCESS_ONCE(iq->num_pending))
+			return iq;
+		i = fuse_next_cpu(i);
+	} while (i != cpu);
+
+	return NULL;
 }
 
-/* Wait until a request is available on the pending list */
-static void request_wait(struct fuse_conn *fc)
-__releases(fc->lock)
-__acquires(fc->lock)
+/* Lockless check, to be confirmed under the respective locks */
+static int request_pending(struct fuse_conn *fc, int cpu)
 {
-	DECLARE_WAITQUEUE(wait, current);
+	return !list_empty(&fc->interrupts) || forget_pending(fc) ||
+		pending_iqueue(fc, cpu);
+}
 
-	add_wait_queue_exclusive(&fc->waitq, &wait);
-	while (fc->connected && !request_pending(fc)) {
-		set_current_state(TASK_INTERRUPTIBLE);
-		if (signal_pending(current))
-			break;
+/*
+ * Take the first request of the local input queue, or of another CPU's
+ * queue if the local one is empty, and mark it as being read.
+ *
+ * Returns NULL if no request is pending any more.
+ */
+static struct fuse_req *dequeue_pending(struct fuse_conn *fc)
+{
+	struct fuse_iqueue *iq;
+	struct fuse_req *req;
 
-		spin_unlock(&fc->lock);
-		schedule();
-		spin_lock(&fc->lock);
+	while ((iq = pending_iqueue(fc, raw_smp_processor_id()))) {
+		spin_lock(&iq->lock);
+		if (!list_empty(&iq->pending)) {
+			req = list_entry(iq->pending.next, struct fuse_req,
+					 list);
+			__unqueue_request(iq, req);
+			req->state = FUSE_REQ_READING;
+			spin_unlock(&iq->lock);
+			return req;
+		}
+		spin_unlock(&iq->lock);
 	}
-	set_current_state(TASK_RUNNING);
-	remove_wait_queue(&fc->waitq, &wait);
+
+	return NULL;
 }
 
 /*
@@ -1207,39 +1332,55 @@ static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
 	struct fuse_req *req;
 	struct fuse_in *in;
 	unsigned reqsize;
+	int cpu;
 
  restart:
-	spin_lock(&fc->lock);
+	cpu = raw_smp_processor_id();
 	err = -EAGAIN;
 	if ((file->f_flags & O_NONBLOCK) && fc->connected &&
-	    !request_pending(fc))
-		goto err_unlock;
+	    !request_pending(fc, cpu))
+		return err;
 
-	request_wait(fc);
-	err = -ENODEV;
+	/* Readers wait exclusively: each queued request wakes up one */
+	err = wait_event_interruptible_exclusive(
+				per_cpu_ptr(fc->iqs, cpu)->waitq,
+				!fc->connected || request_pending(fc, cpu));
+	if (err)
+		return -ERESTARTSYS;
 	if (!fc->connected)
-		goto err_unlock;
-	err = -ERESTARTSYS;
-	if (!request_pending(fc))
-		goto err_unlock;
+		return -ENODEV;
 
-	if (!list_empty(&fc->interrupts)) {
-		req = list_entry(fc->interrupts.next, struct fuse_req,
-				 intr_entry);
-		return fuse_read_interrupt(fc, cs, nbytes, req);
-	}
+	if (!list_empty(&fc->interrupts) || forget_pending(fc)) {
+		spin_lock(&fc->lock);
+		if (!list_empty(&fc->interrupts)) {
+			req = list_entry(fc->interrupts.next, struct fuse_req,
+					 intr_entry);
+			return fuse_read_interrupt(fc, cs, nbytes, req);
+		}
 
-	if (forget_pending(fc)) {
-		if (list_empty(&fc->pending) || fc->forget_batch-- > 0)
-			return fuse_read_forget(fc, cs, nbytes);
+		if (forget_pending(fc)) {
+			if (!pending_iqueue(fc, cpu) ||
+			    fc->forget_batch-- > 0)
+				return fuse_read_forget(fc, cs, nbytes);
 
-		if (fc->forget_batch <= -8)
-			fc->forget_batch = 16;
+			if (fc->forget_batch <= -8)
+				fc->forget_batch = 16;
+		}
+		spin_unlock(&fc->lock);
 	}
 
-	req = list_entry(fc->pending.next, struct fuse_req, list);
-	req->state = FUSE_REQ_READING;
-	list_move(&req->list, &fc->io);
+	req = dequeue_pending(fc);
+	if (!req)
+		goto restart;
+
+	spin_lock(&fc->lock);
+	if (!fc->connected) {
+		/* missed by end_queued_requests() while off any list */
+		req->out.h.error = -ECONNABORTED;
+		request_end(fc, req);
+		return -ENODEV;
+	}
+	list_add(&req->list, &fc->io);
 
 	in = &req->in;
 	reqsize = in->h.len;
@@ -1280,10 +1421,6 @@ static ssize_t fuse_dev_do_read(struct fuse_conn *fc, struct file *file,
 		spin_unlock(&fc->lock);
 	}
 	return reqsize;
-
- err_unlock:
-	spin_unlock(&fc->lock);
-	return err;
 }
 
 static ssize_t fuse_dev_read(struct kiocb *iocb, const struct iovec *iov,
@@ -1883,6 +2020,8 @@ static ssize_t fuse_dev_do_write(struct fuse_conn *fc,
 	spin_unlock(&fc->lock);
 
 	err = copy_out_args(cs, &req->out, nbytes);
+	if (!err)
+		fuse_setup_passthrough(fc, req);
 	fuse_copy_finish(cs);
 
 	spin_lock(&fc->lock);
@@ -1998,15 +2137,17 @@ static unsigned fuse_dev_poll(struct file *file, poll_table *wait)
 {
 	unsigned mask = POLLOUT | POLLWRNORM;
 	struct fuse_conn *fc = fuse_get_conn(file);
+	int cpu;
 	if (!fc)
 		return POLLERR;
 
-	poll_wait(file, &fc->waitq, wait);
+	cpu = raw_smp_processor_id();
+	poll_wait(file, &per_cpu_ptr(fc->iqs, cpu)->waitq, wait);
 
 	spin_lock(&fc->lock);
 	if (!fc->connected)
 		mask = POLLERR;
-	else if (request_pending(fc))
+	else if (request_pending(fc, cpu))
 		mask |= POLLIN | POLLRDNORM;
 	spin_unlock(&fc->lock);
 
@@ -2072,9 +2213,29 @@ static void end_queued_requests(struct fuse_conn *fc)
 __releases(fc->lock)
 __acquires(fc->lock)
 {
+	struct fuse_iqueue *iq;
+	struct fuse_req *req;
+	int cpu;
+
 	fc->max_background = UINT_MAX;
 	flush_bg_queue(fc);
-	end_requests(fc, &fc->pending);
+	for_each_possible_cpu(cpu) {
+		iq = per_cpu_ptr(fc->iqs, cpu);
+		for (;;) {
+			spin_lock(&iq->lock);
+			if (list_empty(&iq->pending)) {
+				spin_unlock(&iq->lock);
+				break;
+			}
+			req = list_entry(iq->pending.next, struct fuse_req,
+					 list);
+			__unqueue_request(iq, req);
+			spin_unlock(&iq->lock);
+			req->out.h.error = -ECONNABORTED;
+			request_end(fc, req);
+			spin_lock(&fc->lock);
+		}
+	}
 	end_requests(fc, &fc->processing);
 	while (forget_pending(fc))
 		kfree(dequeue_forget(fc, 1, NULL));
@@ -2124,7 +2285,7 @@ void fuse_abort_conn(struct fuse_conn *fc)
 		end_io_requests(fc);
 		end_queued_requests(fc);
 		end_polls(fc);
-		wake_up_all(&fc->waitq);
+		fuse_dev_wake_up_all(fc);
 		wake_up_all(&fc->blocked_waitq);
 		kill_fasync(&fc->fasync, SIGIO, POLL_IN);
 	}
@@ -23,6 +23,8 @@
 #include <linux/poll.h>
 #include <linux/workqueue.h>
 
+#define FUSE_SUPER_MAGIC 0x65735546
+
 /** Max number of pages that can be used in a single read request */
 #define FUSE_MAX_PAGES_PER_REQ 32
 
@@ -117,10 +119,37 @@ enum {
 	FUSE_I_ADVISE_RDPLUS,
 	/** An operation changing file size is in progress  */
 	FUSE_I_SIZE_UNSTABLE,
+	/** i_mtime has been updated locally; a flush to userspace needed */
+	FUSE_I_MTIME_DIRTY,
 };
 
 struct fuse_conn;
 
+/**
+ * Per-CPU input queue
+ *
+ * Requests are queued on the CPU they were submitted from, under the
+ * lock of that CPU's queue only, and wake up a daemon thread sleeping on
+ * that CPU.  Readers take requests from their local queue first and
+ * steal from other CPUs only when it is empty.
+ */
+struct fuse_iqueue {
+	/** Protects the fields below and the state of queued requests */
+	spinlock_t lock;
+
+	/** Number of requests on the pending list */
+	unsigned num_pending;
+
+	/** Last unique id handed out on this CPU */
+	u64 reqctr;
+
+	/** Requests submitted on this CPU, not yet read by userspace */
+	struct list_head pending;
+
+	/** Readers and pollers that went to sleep on this CPU */
+	wait_queue_head_t waitq;
+} ____cacheline_aligned_in_smp;
+
 /** FUSE specific file data */
 struct fuse_file {
 	/** Fuse connection for this file */
@@ -153,6 +182,9 @@ struct fuse_file {
 	/** Wait queue head for poll */
 	wait_queue_head_t poll_wait;
 
+	/** Lower file serving read/write/mmap (FOPEN_PASSTHROUGH) */
+	struct file *passthrough_filp;
+
 	/** Has flock been performed on this file? */
 	bool flock:1;
 };
@@ -291,6 +323,9 @@ struct fuse_req {
 	/** State of the request */
 	enum fuse_req_state state;
 
+	/** Input queue, while pending */
+	int iq_cpu;
+
 	/** The request input */
 	struct fuse_in in;
 
@@ -359,6 +394,9 @@ struct fuse_req {
 
 	/** Request is stolen from fuse_file->reserved_req */
 	struct file *stolen_file;
+
+	/** Lower file from an OPEN or CREATE reply, until claimed */
+	struct file *passthrough_filp;
 };
 
 /**
@@ -393,11 +431,8 @@ struct fuse_conn {
 	/** Maximum write size */
 	unsigned max_write;
 
-	/** Readers of the connection are waiting on this */
-	wait_queue_head_t waitq;
-
-	/** The list of pending requests */
-	struct list_head pending;
+	/** Per-CPU lists of pending requests and their readers */
+	struct fuse_iqueue __percpu *iqs;
 
 	/** The list of requests being processed */
 	struct list_head processing;
@@ -451,9 +486,6 @@ struct fuse_conn {
 	/** waitq for reserved requests */
 	wait_queue_head_t reserved_req_waitq;
 
-	/** The next unique request id */
-	u64 reqctr;
-
 	/** Connection established, cleared on umount, connection
 	    abort and device release */
 	unsigned connected;
@@ -546,6 +578,12 @@ struct fuse_conn {
 	/** Does the filesystem support asynchronous direct-IO submission? */
 	unsigned async_dio:1;
 
+	/** Use writeback cache for buffered writes.  Only set in INIT */
+	unsigned writeback_cache:1;
+
+	/** Can FOPEN_PASSTHROUGH be used?  Only set in INIT */
+	unsigned passthrough:1;
+
 	/** The number of requests waiting for completion */
 	atomic_t num_waiting;
 
@@ -793,10 +831,15 @@ struct fuse_conn *fuse_conn_get(struct fuse_conn *fc);
 
 void fuse_conn_kill(struct fuse_conn *fc);
 
+/**
+ * Wake up all readers and pollers of the device
+ */
+void fuse_dev_wake_up_all(struct fuse_conn *fc);
+
 /**
  * Initialize fuse_conn
  */
-void fuse_conn_init(struct fuse_conn *fc);
+int fuse_conn_init(struct fuse_conn *fc);
 
 /**
  * Release reference to fuse_conn
@@ -871,4 +914,20 @@ void fuse_write_update_size(struct inode *inode, loff_t pos);
 int fuse_do_setattr(struct inode *inode, struct iattr *attr,
 		    struct file *file);
 
+/**
+ * Send the locally maintained mtime to userspace (writeback cache mode)
+ */
+int fuse_flush_mtime(struct file *file, bool nofail);
+
+/* passthrough.c */
+void fuse_setup_passthrough(struct fuse_conn *fc, struct fuse_req *req);
+void fuse_passthrough_release(struct fuse_file *ff);
+bool fuse_passthrough_usable(struct file *file, bool write);
+ssize_t fuse_passthrough_aio_read(struct kiocb *iocb, const struct iovec *iov,
+				  unsigned long nr_segs, loff_t pos);
+ssize_t fuse_passthrough_aio_write(struct kiocb *iocb,
+				   const struct iovec *iov,
+				   unsigned long nr_segs, loff_t pos);
+int fuse_passthrough_mmap(struct file *file, struct vm_area_struct *vma);
+
 #endif /* _FS_FUSE_I_H */
@@ -0,0 +1,235 @@
+/*
+  FUSE: Filesystem in Userspace
+
+  Passthrough of read, write and mmap to a lower file supplied by the
+  filesystem daemon on open.
+
+  This program can be distributed under the terms of the GNU GPL.
+  See the file COPYING.
+*/
+
+#include "fuse_i.h"
+
+#include <linux/aio.h>
+#include <linux/capability.h>
+#include <linux/cred.h>
+#include <linux/file.h>
+#include <linux/fs_stack.h>
+#include <linux/fsnotify.h>
+#include <linux/mm.h>
+#include <linux/pagemap.h>
+#include <linux/uio.h>
+
+/*
+ * Pick up the lower file from an OPEN or CREATE reply
+ *
+ * Called while copying the reply from the daemon, so the descriptor in
+ * passthrough_fd is looked up in the daemon's file table.  The lower
+ * file is parked in req->passthrough_filp until the opener claims it;
+ * FOPEN_PASSTHROUGH is cleared from the reply if it cannot be used, so
+ * that the opener falls back to normal FUSE requests.
+ *
+ * Opens of the fuse file then access the lower file with the credentials
+ * it was opened with, so only a daemon with CAP_SYS_ADMIN may hand one
+ * out.
+ */
+void fuse_setup_passthrough(struct fuse_conn *fc, struct fuse_req *req)
+{
+	struct fuse_open_out *open_out;
+	struct file *passthrough_filp;
+	struct inode *passthrough_inode;
+	struct fuse_arg *arg;
+
+	if (!fc->passthrough || req->out.h.error)
+		return;
+
+	if (req->in.h.opcode != FUSE_OPEN && req->in.h.opcode != FUSE_CREATE)
+		return;
+
+	arg = &req->out.args[req->out.numargs - 1];
+	if (arg->size != sizeof(*open_out))
+		return;
+
+	open_out = arg->value;
+	if (!(open_out->open_flags & FOPEN_PASSTHROUGH))
+		return;
+
+	open_out->open_flags &= ~FOPEN_PASSTHROUGH;
+	if (open_out->open_flags & FOPEN_DIRECT_IO)
+		return;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return;
+
+	passthrough_filp = fget(open_out->passthrough_fd);
+	if (!passthrough_filp)
+		return;
+
+	/*
+	 * Only regular files on a filesystem that is not itself stacked:
+	 * that rules out fuse, and anything that may lead back to fuse.
+	 */
+	passthrough_inode = file_inode(passthrough_filp);
+	if (!S_ISREG(passthrough_inode->i_mode) ||
+	    passthrough_inode->i_sb->s_stack_depth) {
+		fput(passthrough_filp);
+		return;
+	}
+
+	req->passthrough_filp = passthrough_filp;
+	open_out->open_flags |= FOPEN_PASSTHROUGH;
+}
+
+void fuse_passthrough_release(struct fuse_file *ff)
+{
+	if (ff->passthrough_filp) {
+		fput(ff->passthrough_filp);
+		ff->passthrough_filp = NULL;
+	}
+}
+
+/*
+ * Can reads (or writes) on this file be served by the lower file?
+ *
+ * Flags that change write semantics must also be set on the lower
+ * file, otherwise the write goes through the normal FUSE path.
+ */
+bool fuse_passthrough_usable(struct file *file, bool write)
+{
+	struct fuse_file *ff = file->private_data;
+	struct file *lower = ff->passthrough_filp;
+
+	if (!lower)
+		return false;
+
+	if (!write)
+		return (lower->f_mode & FMODE_READ) && lower->f_op->aio_read;
+
+	if (!(lower->f_mode & FMODE_WRITE) || !lower->f_op->aio_write)
+		return false;
+
+	return !(file->f_flags & (O_APPEND | O_DSYNC) & ~lower->f_flags);
+}
+
+/*
+ * Read or write the lower file the way vfs_readv()/vfs_writev() would,
+ * with the credentials the daemon opened it with: the lower file gets its
+ * own security and mandatory lock checks, freeze protection and fsnotify
+ * events.
+ */
+static ssize_t fuse_passthrough_rw(int type, struct kiocb *iocb,
+				   const struct iovec *iov,
+				   unsigned long nr_segs, loff_t pos)
+{
+	struct file *file = iocb->ki_filp;
+	struct fuse_file *ff = file->private_data;
+	struct file *lower = ff->passthrough_filp;
+	const struct cred *old_cred;
+	ssize_t ret;
+
+	BUG_ON(!is_sync_kiocb(iocb));
+
+	old_cred = override_creds(lower->f_cred);
+
+	ret = rw_verify_area(type, lower, &pos, iov_length(iov, nr_segs));
+	if (ret < 0)
+		goto out;
+
+	iocb->ki_filp = lower;
+	if (type == READ) {
+		ret = lower->f_op->aio_read(iocb, iov, nr_segs, pos);
+	} else {
+		file_start_write(lower);
+		ret = lower->f_op->aio_write(iocb, iov, nr_segs, pos);
+		file_end_write(lower);
+	}
+	iocb->ki_filp = file;
+
+	if ((ret + (type == READ)) > 0) {
+		if (type == READ)
+			fsnotify_access(lower);
+		else
+			fsnotify_modify(lower);
+	}
+ out:
+	revert_creds(old_cred);
+	return ret;
+}
+
+ssize_t fuse_passthrough_aio_read(struct kiocb *iocb, const struct iovec *iov,
+				  unsigned long nr_segs, loff_t pos)
+{
+	struct file *file = iocb->ki_filp;
+	struct fuse_file *ff = file->private_data;
+	ssize_t ret;
+
+	ret = fuse_passthrough_rw(READ, iocb, iov, nr_segs, pos);
+	if (ret >= 0)
+		fsstack_copy_attr_atime(file_inode(file),
+					file_inode(ff->passthrough_filp));
+
+	return ret;
+}
+
+ssize_t fuse_passthrough_aio_write(struct kiocb *iocb,
+				   const struct iovec *iov,
+				   unsigned long nr_segs, loff_t pos)
+{
+	struct file *file = iocb->ki_filp;
+	struct inode *inode = file_inode(file);
+	struct fuse_conn *fc = get_fuse_conn(inode);
+	struct fuse_inode *fi = get_fuse_inode(inode);
+	struct fuse_file *ff = file->private_data;
+	struct file *lower = ff->passthrough_filp;
+	ssize_t ret;
+
+	ret = fuse_passthrough_rw(WRITE, iocb, iov, nr_segs, pos);
+	if (ret > 0) {
+		struct inode *lower_inode = file_inode(lower);
+
+		spin_lock(&fc->lock);
+		fi->attr_version = ++fc->attr_version;
+		fsstack_copy_inode_size(inode, lower_inode);
+		spin_unlock(&fc->lock);
+		fsstack_copy_attr_times(inode, lower_inode);
+
+		/* Drop data cached by other, non-passthrough opens */
+		if (inode->i_mapping->nrpages) {
+			loff_t end = iocb->ki_pos - 1;
+
+			invalidate_inode_pages2_range(inode->i_mapping,
+					(end - ret + 1) >> PAGE_CACHE_SHIFT,
+					end >> PAGE_CACHE_SHIFT);
+		}
+	}
+
+	return ret;
+}
+
+/*
+ * Map the lower file directly; the vma then holds a reference to the
+ * lower file instead of the fuse file, the same way ashmem hands out
+ * its shmem file.
+ */
+int fuse_passthrough_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct fuse_file *ff = file->private_data;
+	struct file *lower = ff->passthrough_filp;
+	int ret;
+
+	if (!lower->f_op->mmap)
+		return -ENODEV;
+
+	vma->vm_file = get_file(lower);
+	ret = lower->f_op->mmap(lower, vma);
+	if (ret) {
+		/* mmap_region() drops the reference to the fuse file */
+		vma->vm_file = file;
+		fput(lower);
+		return ret;
+	}
+	file_accessed(file);
+	fput(file);
+
+	return 0;
+}
@@ -34,6 +34,7 @@ struct request;
 struct sg_io_hdr;
 struct bsg_job;
 struct blkcg_gq;
+struct blk_latency_hist;
 
 #define BLKDEV_MIN_RQ	4
 #define BLKDEV_MAX_RQ	128	/* Default maximum */
@@ -149,6 +150,10 @@ struct request {
 	struct request_list *rl;		/* rl this rq is alloced from */
 	unsigned long long start_time_ns;
 	unsigned long long io_start_time_ns;    /* when passed to hardware */
+#endif
+#ifdef CONFIG_BLK_DEV_LATENCY_HIST
+	u64 lat_start_ns;		/* allocation time, for latency_hist */
+	unsigned int lat_bytes;		/* size when passed to hardware */
 #endif
 	/* Number of scatter-gather DMA addr+len pairs after
 	 * physical address coalescing is performed.
@@ -443,6 +448,9 @@ struct request_queue {
 #ifdef CONFIG_BLK_DEV_THROTTLING
 	/* Throttle data */
 	struct throtl_data *td;
+#endif
+#ifdef CONFIG_BLK_DEV_LATENCY_HIST
+	struct blk_latency_hist __percpu *latency_hist;
 #endif
 	struct rcu_head		rcu_head;
 };
@@ -43,6 +43,12 @@ SUBSYS(devices)
 
 /* */
 
+#if IS_SUBSYS_ENABLED(CONFIG_CGROUP_TIMER_SLACK)
+SUBSYS(timer_slack)
+#endif
+
+/* */
+
 #if IS_SUBSYS_ENABLED(CONFIG_CGROUP_FREEZER)
 SUBSYS(freezer)
 #endif
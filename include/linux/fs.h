@@ -1233,6 +1233,12 @@ struct sb_writers {
 #endif
 };
 
+/*
+ * Maximum number of layers of fs stack.  Needs to be limited to
+ * prevent kernel stack overflow
+ */
+#define FILESYSTEM_MAX_STACK_DEPTH 2
+
 struct super_block {
 	struct list_head	s_list;		/* Keep this first */
 	dev_t			s_dev;		/* search index; _not_ kdev_t */
@@ -1247,6 +1253,8 @@ struct super_block {
 	unsigned long		s_flags;
 	unsigned long		s_magic;
 	struct dentry		*s_root;
+	/* How deep in a filesystem stack this sb is, 0 if not stacked */
+	int			s_stack_depth;
 	struct rw_semaphore	s_umount;
 	int			s_count;
 	atomic_t		s_active;
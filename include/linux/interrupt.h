@@ -235,6 +235,12 @@ static inline void resume_device_irqs(void) { };
 static inline int check_wakeup_irqs(void) { return 0; }
 #endif
 
+#ifdef CONFIG_IRQ_TIMINGS
+extern void irq_timings_enable(void);
+extern void irq_timings_disable(void);
+extern u64 irq_timings_next_event(u64 now);
+#endif
+
 #if defined(CONFIG_SMP) && defined(CONFIG_GENERIC_HARDIRQS)
 
 extern cpumask_var_t irq_default_affinity;
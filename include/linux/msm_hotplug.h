@@ -0,0 +1,19 @@
+#ifndef _LINUX_MSM_HOTPLUG_H
+#define _LINUX_MSM_HOTPLUG_H
+
+#include <linux/types.h>
+
+/*
+ * Whether the MSM hotplug driver is managing the cpus, for other hotplug
+ * drivers to stay out of its way.
+ */
+#ifdef CONFIG_MSM_HOTPLUG
+extern bool msm_hotplug_running(void);
+#else
+static inline bool msm_hotplug_running(void)
+{
+	return false;
+}
+#endif
+
+#endif /* _LINUX_MSM_HOTPLUG_H */
@@ -88,6 +88,10 @@ struct socket_wq {
 	/* Note: wait MUST be first field of socket_wq */
 	wait_queue_head_t	wait;
 	struct fasync_struct	*fasync_list;
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	/* NAPI context the socket last received from, set from softirq */
+	unsigned int		napi_id;
+#endif
 	struct rcu_head		rcu;
 } ____cacheline_aligned_in_smp;
 
@@ -115,6 +119,9 @@ struct socket {
 	struct file		*file;
 	struct sock		*sk;
 	const struct proto_ops	*ops;
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	unsigned int		busy_poll;	/* usecs, SO_BUSY_POLL */
+#endif
 };
 
 struct vm_area_struct;
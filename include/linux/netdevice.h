@@ -324,12 +324,17 @@ struct napi_struct {
 	struct sk_buff		*gro_list;
 	struct sk_buff		*skb;
 	struct list_head	dev_list;
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	struct hlist_node	napi_hash_node;
+	unsigned int		napi_id;
+#endif
 };
 
 enum {
 	NAPI_STATE_SCHED,	/* Poll is scheduled */
 	NAPI_STATE_DISABLE,	/* Disable pending */
 	NAPI_STATE_NPSVC,	/* Netpoll - don't dequeue from poll_list */
+	NAPI_STATE_HASHED,	/* In NAPI hash, see napi_by_id() */
 };
 
 enum gro_result {
@@ -511,6 +516,42 @@ enum netdev_queue_state_t {
  * netif_xmit*stopped functions, they should only be using netif_tx_*.
  */
 
+/*
+ * Per cpu staging of packets sent to a root qdisc, see qdisc_stage_run().
+ * Senders queue packets on their cpu's list without the qdisc root lock
+ * and the holder of the root lock moves them into the qdisc in batches.
+ */
+struct qdisc_stage {
+	struct Qdisc		*qdisc;
+	int			(*enqueue)(struct sk_buff *skb, struct Qdisc *sch);
+	unsigned long		state;
+	unsigned int		batch;	/* staged packets per cpu before waiting */
+	struct sk_buff_head __percpu *cpu;
+	struct rcu_head		rcu;
+};
+
+enum qdisc_stage_state_t {
+	QDISC_STAGE_MISSED,	/* packets staged while the root lock was held */
+};
+
+#define QDISC_STAGE_BATCH	64
+
+extern struct qdisc_stage *qdisc_stage_create(struct Qdisc *sch,
+			int (*enqueue)(struct sk_buff *skb, struct Qdisc *sch),
+			unsigned int batch);
+extern void qdisc_stage_attach(struct qdisc_stage *stage);
+extern void qdisc_stage_destroy(struct qdisc_stage *stage);
+extern void qdisc_stage_drain(struct qdisc_stage *stage);
+extern void qdisc_stage_purge(struct qdisc_stage *stage);
+extern void qdisc_stage_run(struct Qdisc *q, struct qdisc_stage *stage);
+
+/* Drain from the dequeue path the packets senders left to the lock holder */
+static inline void qdisc_stage_poll(struct qdisc_stage *stage)
+{
+	if (stage && test_bit(QDISC_STAGE_MISSED, &stage->state))
+		qdisc_stage_drain(stage);
+}
+
 struct netdev_queue {
 /*
  * read mostly part
@@ -518,6 +559,7 @@ struct netdev_queue {
 	struct net_device	*dev;
 	struct Qdisc		*qdisc;
 	struct Qdisc		*qdisc_sleeping;
+	struct qdisc_stage __rcu *qdisc_stage;
 #ifdef CONFIG_SYSFS
 	struct kobject		kobj;
 #endif
@@ -1500,6 +1542,35 @@ void netif_napi_add(struct net_device *dev, struct napi_struct *napi,
  */
 void netif_napi_del(struct napi_struct *napi);
 
+/**
+ *  napi_hash_del - make a napi context unreachable by its id
+ *  @napi: napi context
+ *
+ *  netif_napi_del() does it and then waits for busy pollers that may still
+ *  see @napi.  Code deleting many contexts at once can unhash them all
+ *  first and wait only once, with synchronize_net().  Returns true if
+ *  @napi was hashed.
+ */
+bool napi_hash_del(struct napi_struct *napi);
+
+/*
+ * Per cpu NAPI contexts of a device that is not interrupt driven, see
+ * netif_gro_cells_receive()
+ */
+struct netif_gro_cell {
+	struct sk_buff_head	queue;		/* posted packets */
+	struct sk_buff_head	process;	/* taken by the poll */
+	struct napi_struct	napi;
+} ____cacheline_aligned_in_smp;
+
+struct netif_gro_cells {
+	struct netif_gro_cell __percpu	*cells;
+};
+
+extern int netif_gro_cells_init(struct netif_gro_cells *gcells,
+				struct net_device *dev);
+extern void netif_gro_cells_destroy(struct netif_gro_cells *gcells);
+
 struct napi_gro_cb {
 	/* Virtual address of skb_shinfo(skb)->frags[0].page + offset. */
 	void *frag0;
@@ -2201,6 +2272,11 @@ extern void dev_kfree_skb_any(struct sk_buff *skb);
 
 extern int		netif_rx(struct sk_buff *skb);
 extern int		netif_rx_ni(struct sk_buff *skb);
+extern int		netif_gro_cells_receive(struct netif_gro_cells *gcells,
+						struct sk_buff *skb);
+extern int		netif_gro_cells_receive_ni(struct netif_gro_cells *gcells,
+						   struct sk_buff *skb,
+						   unsigned int batch);
 extern int		netif_receive_skb(struct sk_buff *skb);
 extern gro_result_t	napi_gro_receive(struct napi_struct *napi,
 					 struct sk_buff *skb);
@@ -2241,6 +2317,8 @@ extern int		dev_hard_start_xmit(struct sk_buff *skb,
 					    struct netdev_queue *txq);
 extern int		dev_forward_skb(struct net_device *dev,
 					struct sk_buff *skb);
+extern int		__dev_forward_skb(struct net_device *dev,
+					  struct sk_buff *skb);
 
 extern int		netdev_budget;
 
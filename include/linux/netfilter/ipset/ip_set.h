@@ -124,6 +124,10 @@ struct ip_set_type_variant {
 	/* Return true if "b" set is the same as "a"
 	 * according to the create set parameters */
 	bool (*same_set)(const struct ip_set *a, const struct ip_set *b);
+
+	/* Kernelspace test is safe against concurrent add/del/resize
+	 * under rcu_read_lock_bh() alone, the set lock is not taken */
+	bool rcu_test;
 };
 
 /* The core set type structure */
@@ -160,6 +164,9 @@ struct ip_set_type {
 /* register and unregister set type */
 extern int ip_set_type_register(struct ip_set_type *set_type);
 extern void ip_set_type_unregister(struct ip_set_type *set_type);
+extern struct ip_set_type *ip_set_type_get(const char *name, u8 family,
+					   u8 revision);
+extern void ip_set_type_put(struct ip_set_type *set_type);
 
 /* A generic IP set */
 struct ip_set {
@@ -530,6 +530,13 @@ struct dev_pm_info {
 	struct wakeup_source	*wakeup;
 	bool			wakeup_path:1;
 	bool			syscore:1;
+	struct list_head	suppliers;	/* Owned by the PM core */
+	struct list_head	consumers;	/* Ditto */
+	unsigned int		dep_visit;	/* Ditto */
+	u32			resume_wait_us;
+	u32			resume_noirq_us;
+	u32			resume_early_us;
+	u32			resume_us;
 #else
 	unsigned int		should_wakeup:1;
 #endif
@@ -652,6 +659,10 @@ extern void __suspend_report_result(const char *function, void *fn, int ret);
 	} while (0)
 
 extern int device_pm_wait_for_dev(struct device *sub, struct device *dev);
+extern int device_pm_add_supplier(struct device *consumer,
+				  struct device *supplier);
+extern void device_pm_remove_supplier(struct device *consumer,
+				      struct device *supplier);
 extern void dpm_for_each_dev(void *data, void (*fn)(struct device *, void *));
 
 extern int pm_generic_prepare(struct device *dev);
@@ -692,6 +703,15 @@ static inline int device_pm_wait_for_dev(struct device *a, struct device *b)
 	return 0;
 }
 
+static inline int device_pm_add_supplier(struct device *consumer,
+					 struct device *supplier)
+{
+	return 0;
+}
+
+static inline void device_pm_remove_supplier(struct device *consumer,
+					     struct device *supplier) {}
+
 static inline void dpm_for_each_dev(void *data, void (*fn)(struct device *, void *))
 {
 }
@@ -26,6 +26,7 @@
 # error "please don't include this file directly"
 #endif
 
+#include <linux/atomic.h>
 #include <linux/types.h>
 
 /**
@@ -35,11 +36,12 @@
  * @max_time: Maximum time this wakeup source has been continuously active.
  * @last_time: Monotonic clock when the wakeup source's was touched last time.
  * @prevent_sleep_time: Total time this source has been preventing autosleep.
- * @event_count: Number of signaled wakeup events.
+ * @event_count: Number of signaled wakeup events, updated without @lock.
  * @active_count: Number of times the wakeup sorce was activated.
  * @relax_count: Number of times the wakeup sorce was deactivated.
  * @expire_count: Number of times the wakeup source's timeout has expired.
- * @wakeup_count: Number of times the wakeup source might abort suspend.
+ * @wakeup_count: Number of times the wakeup source might abort suspend,
+ *	updated without @lock.
  * @active: Status of the wakeup source.
  * @has_timeout: The wakeup source has been activated with a timeout.
  */
@@ -54,12 +56,12 @@ struct wakeup_source {
 	ktime_t last_time;
 	ktime_t start_prevent_time;
 	ktime_t prevent_sleep_time;
-	unsigned long		event_count;
+	atomic_long_t		event_count;
 	unsigned long		active_count;
 	unsigned long		relax_count;
 	unsigned long		expire_count;
-	unsigned long		wakeup_count;
-	bool			active:1;
+	atomic_long_t		wakeup_count;
+	bool			active;
 	bool			autosleep_enabled:1;
 };
 
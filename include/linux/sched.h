@@ -103,6 +103,12 @@ extern unsigned long nr_iowait(void);
 extern unsigned long nr_iowait_cpu(int cpu);
 extern unsigned long this_cpu_load(void);
 
+#ifdef CONFIG_CPU_CONCURRENCY
+/* cpu_concurrency() of a cpu running one task all the time */
+#define CPU_CONCURRENCY_SHIFT	10
+extern unsigned long cpu_concurrency(int cpu);
+#endif
+
 
 extern void calc_global_load(unsigned long ticks);
 extern void update_cpu_load_nohz(void);
@@ -785,6 +791,28 @@ enum cpu_idle_type {
 
 #ifdef CONFIG_WORKLOAD_CONSOLIDATION
 #define SD_ASYM_CONCURRENCY	0x4000	/* Higher concurrency in front to save power */
+
+#define WC_MAX_CAP_STATES	8
+
+/*
+ * Energy cost of a cpu, used by workload consolidation to choose the
+ * cpus to pack on: the compute capacity (SCHED_POWER_SCALE for the
+ * fastest cpu of the system) and busy power in mW of each performance
+ * state in ascending order, the power of the cpu idling while its
+ * cluster is up, and the power of keeping that cluster up at all.
+ */
+struct wc_cpu_energy {
+	unsigned int nr_cap_states;
+	struct {
+		unsigned long cap;
+		unsigned int power;
+	} cap_states[WC_MAX_CAP_STATES];
+	unsigned int idle_power;
+	unsigned int cluster_power;
+};
+
+extern int workload_consolidation_set_energy(int cpu,
+					const struct wc_cpu_energy *energy);
 #else
 #define SD_ASYM_CONCURRENCY 0
 #endif
@@ -1107,6 +1135,10 @@ struct task_struct {
 #if defined(CONFIG_SCHEDSTATS) || defined(CONFIG_TASK_DELAY_ACCT)
 	struct sched_info sched_info;
 #endif
+#ifdef CONFIG_SCHED_LATENCY_HIST
+	u64 schedlat_wakeup;	/* rq clock at the last wakeup */
+	u64 schedlat_queued;	/* rq clock since the task waits to run */
+#endif
 
 	struct list_head tasks;
 #ifdef CONFIG_SMP
@@ -1389,6 +1421,7 @@ struct task_struct {
 	/*
 	 * time slack values; these are used to round up poll() and
 	 * select() etc timeout values. These are in nanoseconds.
+	 * See also task_get_effective_timer_slack().
 	 */
 	unsigned long timer_slack_ns;
 	unsigned long default_timer_slack_ns;
@@ -2263,6 +2296,20 @@ static inline void unlock_task_sighand(struct task_struct *tsk,
 	spin_unlock_irqrestore(&tsk->sighand->siglock, *flags);
 }
 
+/*
+ * The timer slack to use for @tsk: its own, raised to the minimum of its
+ * timer_slack cgroup, if any.
+ */
+#ifdef CONFIG_CGROUP_TIMER_SLACK
+extern unsigned long task_get_effective_timer_slack(struct task_struct *tsk);
+#else
+static inline unsigned long
+task_get_effective_timer_slack(struct task_struct *tsk)
+{
+	return tsk->timer_slack_ns;
+}
+#endif
+
 #ifdef CONFIG_CGROUPS
 static inline void threadgroup_change_begin(struct task_struct *tsk)
 {
@@ -2662,4 +2709,22 @@ static inline unsigned long rlimit_max(unsigned int limit)
 	return task_rlimit_max(current, limit);
 }
 
+#ifdef CONFIG_CPU_FREQ
+/*
+ * Callback run by the scheduler when the load tracking of a cpu is
+ * updated, with the runqueue lock held and interrupts off.  util is the
+ * recent runnable fraction of the cpu, scaled to max.
+ */
+struct update_util_data {
+	void (*func)(struct update_util_data *data, u64 time,
+		     unsigned long util, unsigned long max);
+};
+
+extern void cpufreq_add_update_util_hook(int cpu,
+		struct update_util_data *data,
+		void (*func)(struct update_util_data *data, u64 time,
+			     unsigned long util, unsigned long max));
+extern void cpufreq_remove_update_util_hook(int cpu);
+#endif /* CONFIG_CPU_FREQ */
+
 #endif
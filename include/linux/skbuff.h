@@ -107,6 +107,7 @@
  */
 
 struct net_device;
+struct napi_struct;
 struct scatterlist;
 struct pipe_inode_info;
 
@@ -382,6 +383,7 @@ typedef unsigned char *sk_buff_data_t;
  *	@wifi_acked_valid: wifi_acked was set
  *	@wifi_acked: whether frame was acked on wifi or not
  *	@no_fcs:  Request NIC to treat last 4 bytes as Ethernet FCS
+ *	@napi_id: id of the NAPI struct this skb came from
  *	@dma_cookie: a cookie to one of several possible DMA operations
  *		done by skb DMA functions
  *	@secmark: security marking
@@ -497,8 +499,11 @@ struct sk_buff {
 	/* 7/9 bit hole (depending on ndisc_nodetype presence) */
 	kmemcheck_bitfield_end(flags2);
 
-#ifdef CONFIG_NET_DMA
-	dma_cookie_t		dma_cookie;
+#if defined(CONFIG_NET_DMA) || defined(CONFIG_NET_RX_BUSY_POLL)
+	union {
+		unsigned int	napi_id;
+		dma_cookie_t	dma_cookie;
+	};
 #endif
 #ifdef CONFIG_NETWORK_SECMARK
 	__u32			secmark;
@@ -630,6 +635,7 @@ extern void kfree_skb(struct sk_buff *skb);
 extern void kfree_skb_list(struct sk_buff *segs);
 extern void skb_tx_error(struct sk_buff *skb);
 extern void consume_skb(struct sk_buff *skb);
+extern void napi_consume_skb(struct sk_buff *skb, int budget);
 extern void	       __kfree_skb(struct sk_buff *skb);
 extern struct kmem_cache *skbuff_head_cache;
 
@@ -1990,6 +1996,24 @@ static inline struct sk_buff *dev_alloc_skb(unsigned int length)
 	return netdev_alloc_skb(NULL, length);
 }
 
+extern void *napi_alloc_frag(unsigned int fragsz);
+extern struct sk_buff *__napi_alloc_skb(struct napi_struct *napi,
+					unsigned int length, gfp_t gfp_mask);
+
+/**
+ *	napi_alloc_skb - allocate an skbuff for rx in a NAPI poll
+ *	@napi: napi context the skb is received on
+ *	@length: length to allocate
+ *
+ *	Like netdev_alloc_skb(), with NET_IP_ALIGN headroom, but only for
+ *	callers with BHs off.
+ */
+static inline struct sk_buff *napi_alloc_skb(struct napi_struct *napi,
+					     unsigned int length)
+{
+	return __napi_alloc_skb(napi, length, GFP_ATOMIC);
+}
+
 
 static inline struct sk_buff *__netdev_alloc_skb_ip_align(struct net_device *dev,
 		unsigned int length, gfp_t gfp)
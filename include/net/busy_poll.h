@@ -0,0 +1,137 @@
+/*
+ * Busy polling of sockets
+ *
+ * A task about to sleep waiting for a socket to receive, with busy
+ * polling enabled on it (SO_BUSY_POLL, net.core.busy_read) can instead
+ * spin for a while on the NAPI context the socket last received from,
+ * saving the interrupt to wakeup latency when a reply is about to come.
+ *
+ * The NAPI context is found by the id that napi_gro_receive() stores in
+ * the skb and that sock_queue_rcv_skb() passes on to the socket.  While
+ * the context is idle the spinning task runs its poll routine itself.
+ *
+ * poll() and select() spin in the system call rather than per socket:
+ * sock_poll() returns POLL_BUSY_LOOP for a socket that can be busy
+ * polled, and once a pass over the fds found nothing ready the system
+ * call keeps passing POLL_BUSY_LOOP back in the key, for one NAPI poll
+ * per socket and pass, until net.core.busy_poll usecs have gone by.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ */
+
+#ifndef _LINUX_NET_BUSY_POLL_H
+#define _LINUX_NET_BUSY_POLL_H
+
+#include <linux/netdevice.h>
+#include <linux/net.h>
+#include <linux/sched.h>
+#include <net/sock.h>
+
+#ifdef CONFIG_NET_RX_BUSY_POLL
+
+extern unsigned int sysctl_net_busy_read __read_mostly;
+extern unsigned int sysctl_net_busy_poll __read_mostly;
+
+/* Packets a busy poller may process per call of a NAPI poll routine */
+#define BUSY_POLL_BUDGET	8
+
+extern bool sk_busy_loop(struct sock *sk, unsigned int usecs);
+
+static inline bool net_busy_loop_on(void)
+{
+	return sysctl_net_busy_poll;
+}
+
+/* One deadline for a whole poll() or select() call */
+static inline u64 busy_loop_end_time(void)
+{
+	return local_clock() + (u64)ACCESS_ONCE(sysctl_net_busy_poll) *
+			       NSEC_PER_USEC;
+}
+
+static inline bool busy_loop_timeout(u64 end_time)
+{
+	return local_clock() >= end_time;
+}
+
+/* Busy polling is on for the socket and it receives from a NAPI context */
+static inline bool sk_can_busy_loop(struct sock *sk)
+{
+	struct socket *sock = sk->sk_socket;
+
+	return sock && sock->busy_poll &&
+	       ACCESS_ONCE(rcu_dereference_protected(sock->wq, 1)->napi_id) &&
+	       !need_resched() && !signal_pending(current);
+}
+
+/* Before a blocking receive sleeps: spin for the SO_BUSY_POLL time */
+static inline bool sk_busy_read(struct sock *sk)
+{
+	return sk_can_busy_loop(sk) &&
+	       sk_busy_loop(sk, sk->sk_socket->busy_poll);
+}
+
+/* Called by the receive path of a NAPI context */
+static inline void skb_mark_napi_id(struct sk_buff *skb,
+				    struct napi_struct *napi)
+{
+	skb->napi_id = napi->napi_id;
+}
+
+/* Called when the skb is queued to the socket */
+static inline void sk_mark_napi_id(struct sock *sk, struct sk_buff *skb)
+{
+	struct socket_wq *wq;
+
+	rcu_read_lock();
+	wq = rcu_dereference(sk->sk_wq);
+	if (wq && wq->napi_id != skb->napi_id)
+		wq->napi_id = skb->napi_id;
+	rcu_read_unlock();
+}
+
+#else /* CONFIG_NET_RX_BUSY_POLL */
+
+static inline bool sk_busy_loop(struct sock *sk, unsigned int usecs)
+{
+	return false;
+}
+
+static inline bool net_busy_loop_on(void)
+{
+	return false;
+}
+
+static inline u64 busy_loop_end_time(void)
+{
+	return 0;
+}
+
+static inline bool busy_loop_timeout(u64 end_time)
+{
+	return true;
+}
+
+static inline bool sk_can_busy_loop(struct sock *sk)
+{
+	return false;
+}
+
+static inline bool sk_busy_read(struct sock *sk)
+{
+	return false;
+}
+
+static inline void skb_mark_napi_id(struct sk_buff *skb,
+				    struct napi_struct *napi)
+{
+}
+
+static inline void sk_mark_napi_id(struct sock *sk, struct sk_buff *skb)
+{
+}
+
+#endif /* CONFIG_NET_RX_BUSY_POLL */
+#endif /* _LINUX_NET_BUSY_POLL_H */
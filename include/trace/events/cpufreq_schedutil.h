@@ -0,0 +1,62 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM cpufreq_schedutil
+
+#if !defined(_TRACE_CPUFREQ_SCHEDUTIL_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _TRACE_CPUFREQ_SCHEDUTIL_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(cpufreq_schedutil_request,
+	TP_PROTO(unsigned int cpu, unsigned long util, unsigned long max,
+		 unsigned int cur, unsigned int next),
+	TP_ARGS(cpu, util, max, cur, next),
+
+	TP_STRUCT__entry(
+		__field(unsigned int,	cpu	)
+		__field(unsigned long,	util	)
+		__field(unsigned long,	max	)
+		__field(unsigned int,	cur	)
+		__field(unsigned int,	next	)
+	),
+
+	TP_fast_assign(
+		__entry->cpu = cpu;
+		__entry->util = util;
+		__entry->max = max;
+		__entry->cur = cur;
+		__entry->next = next;
+	),
+
+	TP_printk("cpu=%u util=%lu max=%lu cur=%u next=%u",
+		  __entry->cpu, __entry->util, __entry->max,
+		  __entry->cur, __entry->next)
+);
+
+TRACE_EVENT(cpufreq_schedutil_setspeed,
+	TP_PROTO(unsigned int cpu, unsigned int targfreq,
+		 unsigned int actualfreq, u64 delay_ns),
+	TP_ARGS(cpu, targfreq, actualfreq, delay_ns),
+
+	TP_STRUCT__entry(
+		__field(unsigned int,	cpu		)
+		__field(unsigned int,	targfreq	)
+		__field(unsigned int,	actualfreq	)
+		__field(u64,		delay_ns	)
+	),
+
+	TP_fast_assign(
+		__entry->cpu = cpu;
+		__entry->targfreq = targfreq;
+		__entry->actualfreq = actualfreq;
+		__entry->delay_ns = delay_ns;
+	),
+
+	TP_printk("cpu=%u targ=%u actual=%u delay_ns=%llu",
+		  __entry->cpu, __entry->targfreq, __entry->actualfreq,
+		  (unsigned long long)__entry->delay_ns)
+);
+
+#endif /* _TRACE_CPUFREQ_SCHEDUTIL_H */
+
+/* This part must be outside protection */
+#include <trace/define_trace.h>
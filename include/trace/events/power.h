@@ -99,6 +99,31 @@ DEFINE_EVENT(wakeup_source, wakeup_source_deactivate,
 	TP_ARGS(name, state)
 );
 
+TRACE_EVENT(early_suspend_handler,
+
+	TP_PROTO(void *handler, int level, bool resume, s64 duration_us),
+
+	TP_ARGS(handler, level, resume, duration_us),
+
+	TP_STRUCT__entry(
+		__field(	void *,		handler		)
+		__field(	int,		level		)
+		__field(	bool,		resume		)
+		__field(	s64,		duration_us	)
+	),
+
+	TP_fast_assign(
+		__entry->handler = handler;
+		__entry->level = level;
+		__entry->resume = resume;
+		__entry->duration_us = duration_us;
+	),
+
+	TP_printk("%pf level=%d %s duration_us=%lld", __entry->handler,
+		__entry->level, __entry->resume ? "resume" : "suspend",
+		(long long)__entry->duration_us)
+);
+
 /*
  * The clock events are used for clock enable/disable and for
  *  clock rate change
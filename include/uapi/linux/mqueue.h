@@ -30,6 +30,14 @@ struct mq_attr {
 	long	__reserved[4];	/* ignored for input, zeroed for output */
 };
 
+/*
+ * mq_flags for mq_open(O_CREAT): keep the messages in a ring of mq_maxmsg
+ * preallocated slots while they all have the same priority, so that one
+ * sender and one receiver do not contend on a lock. Reported back by
+ * mq_getattr(), ignored by mq_setattr().
+ */
+#define MQ_SPSC		0x40000000
+
 /*
  * SIGEV_THREAD implementation:
  * SIGEV_THREAD must be implemented in user space. If SIGEV_THREAD is passed
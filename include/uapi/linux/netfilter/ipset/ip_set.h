@@ -94,6 +94,8 @@ enum {
 	IPSET_ATTR_ELEMENTS,
 	IPSET_ATTR_REFERENCES,
 	IPSET_ATTR_MEMSIZE,
+	IPSET_ATTR_LOOKUPS,
+	IPSET_ATTR_HITS,
 
 	__IPSET_ATTR_CREATE_MAX,
 };
@@ -700,6 +700,7 @@ enum {
 	TCA_FQ_CODEL_ECN,
 	TCA_FQ_CODEL_FLOWS,
 	TCA_FQ_CODEL_QUANTUM,
+	TCA_FQ_CODEL_STAGE_BATCH,
 	__TCA_FQ_CODEL_MAX
 };
 
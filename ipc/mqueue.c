@@ -63,6 +63,43 @@ struct ext_wait_queue {		/* queue of sleeping tasks */
 	int state;		/* one of STATE_* values */
 };
 
+/* Slot of the ring of a MQ_SPSC queue */
+struct mqueue_slot {
+	unsigned int		m_ts;		/* message text size */
+	unsigned int		m_prio;		/* message priority */
+	char			m_text[];
+};
+
+/*
+ * Ring of a queue created with MQ_SPSC.
+ *
+ * While it is active, all messages of the queue are in the ring and the
+ * tree is empty. Senders only take send_mutex and write head, receivers
+ * only take recv_mutex and write tail: a sender and a receiver share no
+ * lock and no msg_msg is allocated. When a message of another priority
+ * than the queued ones is sent, the ring is moved into the tree (see
+ * mq_ring_to_tree()) and the queue works as usual until it is empty and
+ * has no waiters again (see mq_ring_resume()).
+ */
+struct mqueue_ring {
+	struct mutex		send_mutex ____cacheline_aligned_in_smp;
+	unsigned int		head;		/* messages sent */
+	unsigned int		head_slot;
+	unsigned int		last_prio;	/* of the last message sent */
+	unsigned long		bytes_in;
+
+	struct mutex		recv_mutex ____cacheline_aligned_in_smp;
+	unsigned int		tail;		/* messages received */
+	unsigned int		tail_slot;
+	unsigned long		bytes_out;
+
+	int			active ____cacheline_aligned_in_smp;
+	atomic_t		recv_waiters;	/* in mq_ring_wait() */
+	unsigned int		nslots;
+	size_t			slot_size;
+	char			*slots;
+};
+
 struct mqueue_inode_info {
 	spinlock_t lock;
 	struct inode vfs_inode;
@@ -83,6 +120,8 @@ struct mqueue_inode_info {
 	struct ext_wait_queue e_wait_q[2];
 
 	unsigned long qsize; /* size of queue in memory (sum of all msgs) */
+
+	struct mqueue_ring *ring;	/* MQ_SPSC queues only */
 };
 
 static const struct inode_operations mqueue_dir_inode_operations;
@@ -213,6 +252,79 @@ try_again:
 	return msg;
 }
 
+static inline struct mqueue_slot *ring_slot(struct mqueue_ring *ring,
+					    unsigned int i)
+{
+	return (struct mqueue_slot *)(ring->slots + i * ring->slot_size);
+}
+
+static inline unsigned int ring_count(struct mqueue_ring *ring)
+{
+	return ACCESS_ONCE(ring->head) - ACCESS_ONCE(ring->tail);
+}
+
+/* Messages in the queue: only one of the ring and the tree has any */
+static inline long mq_curmsgs(struct mqueue_inode_info *info)
+{
+	long curmsgs = info->attr.mq_curmsgs;
+
+	if (info->ring)
+		curmsgs += ring_count(info->ring);
+	return curmsgs;
+}
+
+static inline size_t mq_ring_slot_size(struct mq_attr *attr)
+{
+	return ALIGN(sizeof(struct mqueue_slot) + attr->mq_msgsize,
+		     sizeof(long));
+}
+
+/*
+ * What a ring costs on top of the tree budget, charged against
+ * RLIMIT_MSGQUEUE along with it.
+ */
+static unsigned long mq_ring_bytes(struct mq_attr *attr)
+{
+	return sizeof(struct mqueue_ring) +
+	       attr->mq_maxmsg * mq_ring_slot_size(attr);
+}
+
+static struct mqueue_ring *mq_ring_alloc(struct mq_attr *attr)
+{
+	struct mqueue_ring *ring;
+	unsigned long size;
+
+	ring = kzalloc(sizeof(*ring), GFP_KERNEL);
+	if (!ring)
+		return NULL;
+	ring->nslots = attr->mq_maxmsg;
+	ring->slot_size = mq_ring_slot_size(attr);
+	size = ring->nslots * ring->slot_size;
+	if (size > PAGE_SIZE)
+		ring->slots = vmalloc(size);
+	else
+		ring->slots = kmalloc(size, GFP_KERNEL);
+	if (!ring->slots) {
+		kfree(ring);
+		return NULL;
+	}
+	mutex_init(&ring->send_mutex);
+	mutex_init(&ring->recv_mutex);
+	ring->active = 1;
+	return ring;
+}
+
+static void mq_ring_free(struct mqueue_ring *ring)
+{
+	if (!ring)
+		return;
+	if (is_vmalloc_addr(ring->slots))
+		vfree(ring->slots);
+	else
+		kfree(ring->slots);
+	kfree(ring);
+}
+
 static struct inode *mqueue_get_inode(struct super_block *sb,
 		struct ipc_namespace *ipc_ns, umode_t mode,
 		struct mq_attr *attr)
@@ -233,7 +345,7 @@ static struct inode *mqueue_get_inode(struct super_block *sb,
 
 	if (S_ISREG(mode)) {
 		struct mqueue_inode_info *info;
-		unsigned long mq_bytes, mq_treesize;
+		unsigned long mq_bytes, mq_treesize, ring_bytes;
 
 		inode->i_fop = &mqueue_file_operations;
 		inode->i_size = FILENT_SIZE;
@@ -249,6 +361,7 @@ static struct inode *mqueue_get_inode(struct super_block *sb,
 		info->user = NULL;	/* set when all is ok */
 		info->msg_tree = RB_ROOT;
 		info->node_cache = NULL;
+		info->ring = NULL;
 		memset(&info->attr, 0, sizeof(info->attr));
 		info->attr.mq_maxmsg = min(ipc_ns->mq_msg_max,
 					   ipc_ns->mq_msg_default);
@@ -277,9 +390,14 @@ static struct inode *mqueue_get_inode(struct super_block *sb,
 
 		mq_bytes = mq_treesize + (info->attr.mq_maxmsg *
 					  info->attr.mq_msgsize);
+		ring_bytes = 0;
+		if (attr && (attr->mq_flags & MQ_SPSC))
+			ring_bytes = mq_ring_bytes(&info->attr);
+		mq_bytes += ring_bytes;
 
 		spin_lock(&mq_lock);
-		if (u->mq_bytes + mq_bytes < u->mq_bytes ||
+		if (mq_bytes < ring_bytes ||
+		    u->mq_bytes + mq_bytes < u->mq_bytes ||
 		    u->mq_bytes + mq_bytes > rlimit(RLIMIT_MSGQUEUE)) {
 			spin_unlock(&mq_lock);
 			/* mqueue_evict_inode() releases info->messages */
@@ -289,6 +407,17 @@ static struct inode *mqueue_get_inode(struct super_block *sb,
 		u->mq_bytes += mq_bytes;
 		spin_unlock(&mq_lock);
 
+		if (ring_bytes) {
+			info->ring = mq_ring_alloc(&info->attr);
+			if (!info->ring) {
+				/* info->user is not set, evict won't do it */
+				spin_lock(&mq_lock);
+				u->mq_bytes -= mq_bytes;
+				spin_unlock(&mq_lock);
+				goto out_inode;
+			}
+		}
+
 		/* all is ok */
 		info->user = get_uid(u);
 	} else if (S_ISDIR(mode)) {
@@ -399,6 +528,10 @@ static void mqueue_evict_inode(struct inode *inode)
 
 	mq_bytes = mq_treesize + (info->attr.mq_maxmsg *
 				  info->attr.mq_msgsize);
+	if (info->ring) {
+		mq_bytes += mq_ring_bytes(&info->attr);
+		mq_ring_free(info->ring);
+	}
 
 	user = info->user;
 	if (user) {
@@ -487,12 +620,17 @@ static ssize_t mqueue_read_file(struct file *filp, char __user *u_data,
 {
 	struct mqueue_inode_info *info = MQUEUE_I(file_inode(filp));
 	char buffer[FILENT_SIZE];
+	unsigned long qsize;
 	ssize_t ret;
 
 	spin_lock(&info->lock);
+	qsize = info->qsize;
+	if (info->ring)
+		qsize += ACCESS_ONCE(info->ring->bytes_in) -
+			 ACCESS_ONCE(info->ring->bytes_out);
 	snprintf(buffer, sizeof(buffer),
 			"QSIZE:%-10lu NOTIFY:%-5d SIGNO:%-5d NOTIFY_PID:%-6d\n",
-			info->qsize,
+			qsize,
 			info->notify_owner ? info->notify.sigev_notify : 0,
 			(info->notify_owner &&
 			 info->notify.sigev_notify == SIGEV_SIGNAL) ?
@@ -528,12 +666,15 @@ static unsigned int mqueue_poll_file(struct file *filp, struct poll_table_struct
 	int retval = 0;
 
 	poll_wait(filp, &info->wait_q, poll_tab);
+	/* the ring is changed without info->lock, see mq_ring_wake() */
+	if (info->ring)
+		smp_mb();
 
 	spin_lock(&info->lock);
-	if (info->attr.mq_curmsgs)
+	if (mq_curmsgs(info))
 		retval = POLLIN | POLLRDNORM;
 
-	if (info->attr.mq_curmsgs < info->attr.mq_maxmsg)
+	if (mq_curmsgs(info) < info->attr.mq_maxmsg)
 		retval |= POLLOUT | POLLWRNORM;
 	spin_unlock(&info->lock);
 
@@ -636,7 +777,7 @@ static void __do_notify(struct mqueue_inode_info *info)
 	 * empty to not empty. Here we are sure that no one is waiting
 	 * synchronously. */
 	if (info->notify_owner &&
-	    info->attr.mq_curmsgs == 1) {
+	    mq_curmsgs(info) == 1) {
 		struct siginfo sig_i;
 		switch (info->notify.sigev_notify) {
 		case SIGEV_NONE:
@@ -949,6 +1090,278 @@ static inline void pipelined_receive(struct mqueue_inode_info *info)
 	sender->state = STATE_READY;
 }
 
+/* Ring send and receive functions, see struct mqueue_ring.
+ *
+ * head is written by senders only, tail by receivers only. A sender
+ * fills the slot before it publishes head, a receiver is done with the
+ * slot before it publishes tail. Tasks waiting for the ring and pollers
+ * sleep on info->wait_q: the side that changed the ring checks for them
+ * after a memory barrier, which pairs with the one in prepare_to_wait()
+ * and in mqueue_poll_file().
+ */
+
+/* mq_ring_send() and mq_ring_receive(): the queue uses the tree */
+#define MQ_RING_OFF	1
+
+/*
+ * Called with info->lock held. Reactivates the ring of a queue that
+ * works with the tree, if the tree is empty and nobody waits for it.
+ * Returns true if the ring is active: the caller must then drop the lock
+ * and use the ring.
+ */
+static bool mq_ring_resume(struct mqueue_inode_info *info)
+{
+	struct mqueue_ring *ring = info->ring;
+
+	if (!ring)
+		return false;
+	if (!ring->active) {
+		if (info->attr.mq_curmsgs ||
+		    !list_empty(&info->e_wait_q[SEND].list) ||
+		    !list_empty(&info->e_wait_q[RECV].list))
+			return false;
+		ACCESS_ONCE(ring->active) = 1;
+	}
+	return true;
+}
+
+/*
+ * Called with ring->send_mutex held, when a message of another priority
+ * is sent: moves the messages of the ring into the tree, in order.
+ */
+static int mq_ring_to_tree(struct mqueue_inode_info *info)
+{
+	struct mqueue_ring *ring = info->ring;
+	struct msg_msg *msg, *tmp;
+	unsigned int i, slot;
+	LIST_HEAD(msgs);
+	int ret = 0;
+
+	mutex_lock(&ring->recv_mutex);
+	slot = ring->tail_slot;
+	for (i = ring->tail; i != ring->head; i++) {
+		struct mqueue_slot *s = ring_slot(ring, slot);
+
+		msg = load_msg_kernel(s->m_text, s->m_ts);
+		if (IS_ERR(msg)) {
+			ret = PTR_ERR(msg);
+			goto out_free;
+		}
+		msg->m_ts = s->m_ts;
+		msg->m_type = s->m_prio;
+		list_add_tail(&msg->m_list, &msgs);
+		if (++slot == ring->nslots)
+			slot = 0;
+	}
+
+	spin_lock(&info->lock);
+	list_for_each_entry_safe(msg, tmp, &msgs, m_list) {
+		list_del(&msg->m_list);
+		/* all have the same priority: at most one new leaf */
+		ret = msg_insert(msg, info);
+		if (ret) {
+			list_add(&msg->m_list, &msgs);
+			/* put back what was inserted, the ring is unchanged */
+			while (info->attr.mq_curmsgs)
+				free_msg(msg_get(info));
+			spin_unlock(&info->lock);
+			goto out_free;
+		}
+	}
+	ring->active = 0;
+	ring->tail = ring->head;
+	ring->tail_slot = ring->head_slot;
+	ring->bytes_out = ring->bytes_in;
+	spin_unlock(&info->lock);
+	mutex_unlock(&ring->recv_mutex);
+
+	/* tasks waiting for the ring must now use the tree */
+	wake_up(&info->wait_q);
+	return 0;
+
+out_free:
+	mutex_unlock(&ring->recv_mutex);
+	list_for_each_entry_safe(msg, tmp, &msgs, m_list)
+		free_msg(msg);
+	return ret;
+}
+
+/* Wake up the tasks that wait for the ring or poll, after a change */
+static void mq_ring_wake(struct mqueue_inode_info *info)
+{
+	smp_mb();
+	if (waitqueue_active(&info->wait_q))
+		wake_up(&info->wait_q);
+}
+
+static bool mq_ring_ready(struct mqueue_inode_info *info, int sr)
+{
+	struct mqueue_ring *ring = info->ring;
+
+	if (!ACCESS_ONCE(ring->active))
+		return true;
+	if (sr == SEND)
+		return ring_count(ring) < info->attr.mq_maxmsg;
+	return ring_count(ring) != 0;
+}
+
+/*
+ * Waits until the ring has room (SEND) or a message (RECV), or the queue
+ * switched to the tree.
+ */
+static int mq_ring_wait(struct mqueue_inode_info *info, int sr,
+			ktime_t *timeout)
+{
+	DEFINE_WAIT(wait);
+	int ret = 0;
+
+	/* a waiting receiver takes the place of notification */
+	if (sr == RECV)
+		atomic_inc(&info->ring->recv_waiters);
+	for (;;) {
+		prepare_to_wait(&info->wait_q, &wait, TASK_INTERRUPTIBLE);
+		if (mq_ring_ready(info, sr))
+			break;
+		if (signal_pending(current)) {
+			ret = -ERESTARTSYS;
+			break;
+		}
+		if (!schedule_hrtimeout_range_clock(timeout, 0,
+				HRTIMER_MODE_ABS, CLOCK_REALTIME)) {
+			ret = mq_ring_ready(info, sr) ? 0 : -ETIMEDOUT;
+			break;
+		}
+	}
+	finish_wait(&info->wait_q, &wait);
+	if (sr == RECV)
+		atomic_dec(&info->ring->recv_waiters);
+	return ret;
+}
+
+static int mq_ring_send(struct mqueue_inode_info *info, struct file *filp,
+			const char __user *u_msg_ptr, size_t msg_len,
+			unsigned int msg_prio, ktime_t *timeout)
+{
+	struct mqueue_ring *ring = info->ring;
+	struct mqueue_slot *slot;
+	unsigned int head, tail;
+	int ret;
+
+	for (;;) {
+		if (mutex_lock_interruptible(&ring->send_mutex))
+			return -ERESTARTSYS;
+		if (!ring->active) {
+			ret = MQ_RING_OFF;
+			goto out_unlock;
+		}
+		head = ring->head;
+		tail = ACCESS_ONCE(ring->tail);
+		if (head != tail && msg_prio != ring->last_prio) {
+			ret = mq_ring_to_tree(info);
+			if (!ret)
+				ret = MQ_RING_OFF;
+			goto out_unlock;
+		}
+		if (head - tail < info->attr.mq_maxmsg)
+			break;
+		mutex_unlock(&ring->send_mutex);
+
+		if (filp->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		ret = mq_ring_wait(info, SEND, timeout);
+		if (ret)
+			return ret;
+	}
+
+	/* the receiver is done with the slot, see mq_ring_receive() */
+	smp_mb();
+	slot = ring_slot(ring, ring->head_slot);
+	if (copy_from_user(slot->m_text, u_msg_ptr, msg_len)) {
+		ret = -EFAULT;
+		goto out_unlock;
+	}
+	slot->m_ts = msg_len;
+	slot->m_prio = msg_prio;
+	ring->last_prio = msg_prio;
+	ring->bytes_in += msg_len;
+	if (++ring->head_slot == ring->nslots)
+		ring->head_slot = 0;
+	/* the slot before head */
+	smp_wmb();
+	ACCESS_ONCE(ring->head) = head + 1;
+
+	/*
+	 * With send_mutex held, there is one message in the queue only if
+	 * it was empty before this one.  Like pipelined_send(), a receiver
+	 * waiting for it means no notification.  head before recv_waiters,
+	 * pairs with prepare_to_wait() in mq_ring_wait().
+	 */
+	smp_mb();
+	if (ACCESS_ONCE(info->notify_owner) &&
+	    !atomic_read(&ring->recv_waiters)) {
+		spin_lock(&info->lock);
+		__do_notify(info);
+		spin_unlock(&info->lock);
+	} else {
+		mq_ring_wake(info);
+	}
+	ret = 0;
+
+out_unlock:
+	mutex_unlock(&ring->send_mutex);
+	return ret;
+}
+
+static int mq_ring_receive(struct mqueue_inode_info *info, struct file *filp,
+			   char __user *u_msg_ptr,
+			   unsigned int __user *u_msg_prio, ktime_t *timeout,
+			   ssize_t *len)
+{
+	struct mqueue_ring *ring = info->ring;
+	struct mqueue_slot *slot;
+	unsigned int tail;
+	int ret;
+
+	for (;;) {
+		if (mutex_lock_interruptible(&ring->recv_mutex))
+			return -ERESTARTSYS;
+		if (!ring->active) {
+			mutex_unlock(&ring->recv_mutex);
+			return MQ_RING_OFF;
+		}
+		tail = ring->tail;
+		if (ACCESS_ONCE(ring->head) != tail)
+			break;
+		mutex_unlock(&ring->recv_mutex);
+
+		if (filp->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		ret = mq_ring_wait(info, RECV, timeout);
+		if (ret)
+			return ret;
+	}
+
+	/* head before the slot, see mq_ring_send() */
+	smp_rmb();
+	slot = ring_slot(ring, ring->tail_slot);
+	*len = slot->m_ts;
+	ret = 0;
+	/* like msg_get() and store_msg(), the message is gone on a fault */
+	if ((u_msg_prio && put_user(slot->m_prio, u_msg_prio)) ||
+	    copy_to_user(u_msg_ptr, slot->m_text, slot->m_ts))
+		ret = -EFAULT;
+	ring->bytes_out += slot->m_ts;
+	if (++ring->tail_slot == ring->nslots)
+		ring->tail_slot = 0;
+	/* done with the slot before it can be reused */
+	smp_mb();
+	ACCESS_ONCE(ring->tail) = tail + 1;
+	mutex_unlock(&ring->recv_mutex);
+
+	mq_ring_wake(info);
+	return ret;
+}
+
 SYSCALL_DEFINE5(mq_timedsend, mqd_t, mqdes, const char __user *, u_msg_ptr,
 		size_t, msg_len, unsigned int, msg_prio,
 		const struct timespec __user *, u_abs_timeout)
@@ -1000,6 +1413,15 @@ SYSCALL_DEFINE5(mq_timedsend, mqd_t, mqdes, const char __user *, u_msg_ptr,
 		goto out_fput;
 	}
 
+retry:
+	if (info->ring) {
+		ret = mq_ring_send(info, f.file, u_msg_ptr, msg_len, msg_prio,
+				   timeout);
+		if (ret != MQ_RING_OFF)
+			goto out_fput;
+		ret = 0;
+	}
+
 	/* First try to allocate memory, before doing anything with
 	 * existing queues. */
 	msg_ptr = load_msg(u_msg_ptr, msg_len);
@@ -1030,6 +1452,12 @@ SYSCALL_DEFINE5(mq_timedsend, mqd_t, mqdes, const char __user *, u_msg_ptr,
 		kfree(new_leaf);
 	}
 
+	if (mq_ring_resume(info)) {
+		spin_unlock(&info->lock);
+		free_msg(msg_ptr);
+		goto retry;
+	}
+
 	if (info->attr.mq_curmsgs == info->attr.mq_maxmsg) {
 		if (f.file->f_flags & O_NONBLOCK) {
 			ret = -EAGAIN;
@@ -1073,7 +1501,7 @@ SYSCALL_DEFINE5(mq_timedreceive, mqd_t, mqdes, char __user *, u_msg_ptr,
 		size_t, msg_len, unsigned int __user *, u_msg_prio,
 		const struct timespec __user *, u_abs_timeout)
 {
-	ssize_t ret;
+	ssize_t ret, len;
 	struct msg_msg *msg_ptr;
 	struct fd f;
 	struct inode *inode;
@@ -1117,6 +1545,17 @@ SYSCALL_DEFINE5(mq_timedreceive, mqd_t, mqdes, char __user *, u_msg_ptr,
 		goto out_fput;
 	}
 
+retry:
+	if (info->ring) {
+		ret = mq_ring_receive(info, f.file, u_msg_ptr, u_msg_prio,
+				      timeout, &len);
+		if (ret != MQ_RING_OFF) {
+			if (!ret)
+				ret = len;
+			goto out_fput;
+		}
+	}
+
 	/*
 	 * msg_insert really wants us to have a valid, spare node struct so
 	 * it doesn't have to kmalloc a GFP_ATOMIC allocation, but it will
@@ -1135,6 +1574,12 @@ SYSCALL_DEFINE5(mq_timedreceive, mqd_t, mqdes, char __user *, u_msg_ptr,
 	} else {
 		kfree(new_leaf);
 	}
+	new_leaf = NULL;
+
+	if (mq_ring_resume(info)) {
+		spin_unlock(&info->lock);
+		goto retry;
+	}
 
 	if (info->attr.mq_curmsgs == 0) {
 		if (f.file->f_flags & O_NONBLOCK) {
@@ -1322,7 +1767,7 @@ SYSCALL_DEFINE3(mq_getsetattr, mqd_t, mqdes,
 	if (u_mqstat != NULL) {
 		if (copy_from_user(&mqstat, u_mqstat, sizeof(struct mq_attr)))
 			return -EFAULT;
-		if (mqstat.mq_flags & (~O_NONBLOCK))
+		if (mqstat.mq_flags & (~(O_NONBLOCK | MQ_SPSC)))
 			return -EINVAL;
 	}
 
@@ -1343,6 +1788,9 @@ SYSCALL_DEFINE3(mq_getsetattr, mqd_t, mqdes,
 
 	omqstat = info->attr;
 	omqstat.mq_flags = f.file->f_flags & O_NONBLOCK;
+	omqstat.mq_curmsgs = mq_curmsgs(info);
+	if (info->ring)
+		omqstat.mq_flags |= MQ_SPSC;
 	if (u_mqstat) {
 		audit_mq_getsetattr(mqdes, &mqstat);
 		spin_lock(&f.file->f_lock);
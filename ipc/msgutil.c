@@ -113,6 +113,38 @@ out_err:
 	free_msg(msg);
 	return ERR_PTR(err);
 }
+
+/* load_msg() for a message that is already in kernel memory */
+struct msg_msg *load_msg_kernel(const void *src, int len)
+{
+	struct msg_msg *msg;
+	struct msg_msgseg *seg;
+	int err;
+	int alen;
+
+	msg = alloc_msg(len);
+	if (msg == NULL)
+		return ERR_PTR(-ENOMEM);
+
+	alen = min(len, DATALEN_MSG);
+	memcpy(msg + 1, src, alen);
+
+	for (seg = msg->next; seg != NULL; seg = seg->next) {
+		len -= alen;
+		src = (char *)src + alen;
+		alen = min(len, DATALEN_SEG);
+		memcpy(seg + 1, src, alen);
+	}
+
+	err = security_msg_msg_alloc(msg);
+	if (err) {
+		free_msg(msg);
+		return ERR_PTR(err);
+	}
+
+	return msg;
+}
+
 #ifdef CONFIG_CHECKPOINT_RESTORE
 struct msg_msg *copy_msg(struct msg_msg *src, struct msg_msg *dst)
 {
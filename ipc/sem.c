@@ -61,16 +61,18 @@
  * - A woken up task may not even touch the semaphore array anymore, it may
  *   have been destroyed already by a semctl(RMID).
  * - The synchronizations between wake-ups due to a timeout/signal and a
- *   wake-up due to a completed semaphore operation is achieved by using an
- *   intermediate state (IN_WAKEUP).
+ *   wake-up due to a completed semaphore operation is achieved by holding
+ *   a reference to the woken up task or, when many tasks are woken up at
+ *   once, by using an intermediate state (IN_WAKEUP).
  * - UNDO values are stored in an array (one per process and per
  *   semaphore array, lazily allocated). For backwards compatibility, multiple
  *   modes for the UNDO variables are supported (per process, per thread)
  *   (see copy_semundo, CLONE_SYSVSEM)
- * - There are two lists of the pending operations: a per-array list
- *   and per-semaphore list (stored in the array). This allows to achieve FIFO
- *   ordering without always scanning all pending operations.
- *   The worst-case behavior is nevertheless O(N^2) for N wakeups.
+ * - A pending operation is linked into the per-semaphore list of every
+ *   semaphore it operates on (see struct sem_wait). After a change only the
+ *   lists of the modified semaphores are scanned, thus the cost of a semop()
+ *   depends on the number of semaphores it affects and not on the size of
+ *   the array. A sequence number keeps the FIFO ordering across the lists.
  */
 
 #include <linux/slab.h>
@@ -95,16 +97,20 @@ struct sem {
 	int	semval;		/* current value */
 	int	sempid;		/* pid of last operation */
 	spinlock_t	lock;	/* spinlock for fine-grained semtimedop */
-	struct list_head pending_alter; /* pending single-sop operations */
-					/* that alter the semaphore */
-	struct list_head pending_const; /* pending single-sop operations */
-					/* that do not alter the semaphore*/
+	struct list_head pending_alter; /* pending operations that alter */
+					/* the array (struct sem_wait) */
+	struct list_head pending_const; /* pending operations that do not */
+					/* alter the array (struct sem_wait) */
+	struct list_head updated;	/* list of modified semaphores, */
+					/* see update_queue() */
+	struct list_head *next_alter;	/* first untried pending_alter */
+					/* entry in update_queue() */
 	time_t	sem_otime;	/* candidate for sem_otime */
 } ____cacheline_aligned_in_smp;
 
 /* One queue for each sleeping process in the system. */
 struct sem_queue {
-	struct list_head	list;	 /* queue of pending operations */
+	struct list_head	list;	 /* list of tasks to wake up */
 	struct task_struct	*sleeper; /* this process */
 	struct sem_undo		*undo;	 /* undo structure */
 	int			pid;	 /* process id of requesting process */
@@ -112,6 +118,24 @@ struct sem_queue {
 	struct sembuf		*sops;	 /* array of pending operations */
 	int			nsops;	 /* number of operations */
 	int			alter;	 /* does *sops alter the array? */
+	struct sem_wait		*waits;	 /* links into the semaphore lists */
+	int			nwaits;	 /* number of links */
+	unsigned int		seq;	 /* FIFO position in the array */
+};
+
+/* Link of a pending operation into the list of one of its semaphores */
+struct sem_wait {
+	struct list_head	list;	/* sem->pending_{alter,const} */
+	struct sem_queue	*q;	/* the pending operation */
+};
+
+/* Tasks to be woken up after all locks were dropped. */
+#define SEM_WAKE_BATCH	16
+
+struct sem_wake {
+	int			nr;
+	struct task_struct	*tasks[SEM_WAKE_BATCH]; /* referenced tasks */
+	struct list_head	slow;	/* queues in IN_WAKEUP state */
 };
 
 /* Each task has a list of undo requests. They are executed automatically
@@ -152,17 +176,19 @@ static int sysvipc_sem_proc_show(struct seq_file *s, void *it);
 
 #define SEMMSL_FAST	256 /* 512 bytes on stack */
 #define SEMOPM_FAST	64  /* ~ 372 bytes on stack */
+#define SEMWAIT_FAST	8   /* ~ 192 bytes on stack */
 
 /*
  * Locking:
  *	sem_undo.id_next,
  *	sem_array.complex_count,
- *	sem_array.pending{_alter,_cont},
  *	sem_array.sem_undo: global sem_lock() for read/write
  *	sem_undo.proc_next: only "current" is allowed to read/write that field.
  *	
- *	sem_array.sem_base[i].pending_{const,alter}:
+ *	sem_array.sem_base[i].pending_{const,alter},
+ *	sem_array.sem_base[i].{updated,next_alter}:
  *		global or semaphore sem_lock() for read/write
+ *	sem_array.queue_seq: atomic, see link_queue()
  */
 
 #define sc_semmsl	sem_ctls[0]
@@ -196,53 +222,6 @@ void __init sem_init (void)
 				IPC_SEM_IDS, sysvipc_sem_proc_show);
 }
 
-/**
- * unmerge_queues - unmerge queues, if possible.
- * @sma: semaphore array
- *
- * The function unmerges the wait queues if complex_count is 0.
- * It must be called prior to dropping the global semaphore array lock.
- */
-static void unmerge_queues(struct sem_array *sma)
-{
-	struct sem_queue *q, *tq;
-
-	/* complex operations still around? */
-	if (sma->complex_count)
-		return;
-	/*
-	 * We will switch back to simple mode.
-	 * Move all pending operation back into the per-semaphore
-	 * queues.
-	 */
-	list_for_each_entry_safe(q, tq, &sma->pending_alter, list) {
-		struct sem *curr;
-		curr = &sma->sem_base[q->sops[0].sem_num];
-
-		list_add_tail(&q->list, &curr->pending_alter);
-	}
-	INIT_LIST_HEAD(&sma->pending_alter);
-}
-
-/**
- * merge_queues - Merge single semop queues into global queue
- * @sma: semaphore array
- *
- * This function merges all per-semaphore queues into the global queue.
- * It is necessary to achieve FIFO ordering for the pending single-sop
- * operations when a multi-semop operation must sleep.
- * Only the alter operations must be moved, the const operations can stay.
- */
-static void merge_queues(struct sem_array *sma)
-{
-	int i;
-	for (i = 0; i < sma->sem_nsems; i++) {
-		struct sem *sem = sma->sem_base + i;
-
-		list_splice_init(&sem->pending_alter, &sma->pending_alter);
-	}
-}
-
 static void sem_rcu_free(struct rcu_head *head)
 {
 	struct ipc_rcu *p = container_of(head, struct ipc_rcu, rcu);
@@ -364,7 +343,6 @@ static inline int sem_lock(struct sem_array *sma, struct sembuf *sops,
 static inline void sem_unlock(struct sem_array *sma, int locknum)
 {
 	if (locknum == -1) {
-		unmerge_queues(sma);
 		ipc_unlock_object(&sma->sem_perm);
 	} else {
 		struct sem *sem = sma->sem_base + locknum;
@@ -464,6 +442,13 @@ static inline void sem_rmid(struct ipc_namespace *ns, struct sem_array *s)
  *   will oops, because the task structure is already invalid.
  *   (yes, this happened on s390 with sysv msg).
  *
+ * The first SEM_WAKE_BATCH tasks of a wakeup pass avoid the two stages:
+ * the waker takes a reference to the task_struct, sets queue.status to the
+ * final value while still holding the lock and calls wake_up_process after
+ * dropping it. The woken up task does not have to wait for the waker, and
+ * the reference keeps wake_up_process safe even if the task has returned
+ * from semtimedop in between. A wakeup that arrives late is spurious, which
+ * every sleeper must cope with anyway.
  */
 #define IN_WAKEUP	1
 
@@ -520,12 +505,12 @@ static int newary(struct ipc_namespace *ns, struct ipc_params *params)
 	for (i = 0; i < nsems; i++) {
 		INIT_LIST_HEAD(&sma->sem_base[i].pending_alter);
 		INIT_LIST_HEAD(&sma->sem_base[i].pending_const);
+		INIT_LIST_HEAD(&sma->sem_base[i].updated);
 		spin_lock_init(&sma->sem_base[i].lock);
 	}
 
 	sma->complex_count = 0;
-	INIT_LIST_HEAD(&sma->pending_alter);
-	INIT_LIST_HEAD(&sma->pending_const);
+	atomic_set(&sma->queue_seq, 0);
 	INIT_LIST_HEAD(&sma->list_id);
 	sma->sem_nsems = nsems;
 	sma->sem_ctime = get_seconds();
@@ -657,16 +642,33 @@ undo:
 	return result;
 }
 
-/** wake_up_sem_queue_prepare(q, error): Prepare wake-up
+static void sem_wake_init(struct sem_wake *pt)
+{
+	pt->nr = 0;
+	INIT_LIST_HEAD(&pt->slow);
+}
+
+/** wake_up_sem_queue_prepare(pt, q, error): Prepare wake-up
+ * @pt: tasks to be woken up
  * @q: queue entry that must be signaled
  * @error: Error value for the signal
  *
  * Prepare the wake-up of the queue entry q.
  */
-static void wake_up_sem_queue_prepare(struct list_head *pt,
+static void wake_up_sem_queue_prepare(struct sem_wake *pt,
 				struct sem_queue *q, int error)
 {
-	if (list_empty(pt)) {
+	if (pt->nr < SEM_WAKE_BATCH) {
+		struct task_struct *sleeper = q->sleeper;
+
+		get_task_struct(sleeper);
+		pt->tasks[pt->nr++] = sleeper;
+		/* q can disappear immediately after writing q->status. */
+		smp_wmb();
+		q->status = error;
+		return;
+	}
+	if (list_empty(&pt->slow)) {
 		/*
 		 * Hold preempt off so that we don't get preempted and have the
 		 * wakee busy-wait until we're scheduled back on.
@@ -676,25 +678,31 @@ static void wake_up_sem_queue_prepare(struct list_head *pt,
 	q->status = IN_WAKEUP;
 	q->pid = error;
 
-	list_add_tail(&q->list, pt);
+	list_add_tail(&q->list, &pt->slow);
 }
 
 /**
  * wake_up_sem_queue_do(pt) - do the actual wake-up
- * @pt: list of tasks to be woken up
+ * @pt: tasks to be woken up
  *
  * Do the actual wake-up.
  * The function is called without any locks held, thus the semaphore array
  * could be destroyed already and the tasks can disappear as soon as the
  * status is set to the actual return code.
  */
-static void wake_up_sem_queue_do(struct list_head *pt)
+static void wake_up_sem_queue_do(struct sem_wake *pt)
 {
 	struct sem_queue *q, *t;
 	int did_something;
+	int i;
+
+	for (i = 0; i < pt->nr; i++) {
+		wake_up_process(pt->tasks[i]);
+		put_task_struct(pt->tasks[i]);
+	}
 
-	did_something = !list_empty(pt);
-	list_for_each_entry_safe(q, t, pt, list) {
+	did_something = !list_empty(&pt->slow);
+	list_for_each_entry_safe(q, t, &pt->slow, list) {
 		wake_up_process(q->sleeper);
 		/* q can disappear immediately after writing q->status. */
 		smp_wmb();
@@ -704,86 +712,108 @@ static void wake_up_sem_queue_do(struct list_head *pt)
 		preempt_enable();
 }
 
+/**
+ * link_queue(sma, q) - add a sleeping operation to the pending lists
+ * @sma: semaphore array
+ * @q: the operation, q->waits must have room for q->nsops entries
+ *
+ * q is linked once into the list of every semaphore it operates on:
+ * pending_alter if it alters the array, pending_const otherwise.
+ * Simple operations are queued under the per-semaphore lock, so the
+ * sequence number that orders the lists is taken atomically.
+ */
+static void link_queue(struct sem_array *sma, struct sem_queue *q)
+{
+	int i, j;
+
+	q->seq = atomic_inc_return(&sma->queue_seq);
+	q->nwaits = 0;
+	for (i = 0; i < q->nsops; i++) {
+		int num = q->sops[i].sem_num;
+		struct sem *curr = sma->sem_base + num;
+		struct sem_wait *w;
+
+		for (j = 0; j < i; j++) {
+			if (q->sops[j].sem_num == num)
+				break;
+		}
+		if (j < i)
+			continue;
+
+		w = &q->waits[q->nwaits++];
+		w->q = q;
+		if (q->alter)
+			list_add_tail(&w->list, &curr->pending_alter);
+		else
+			list_add_tail(&w->list, &curr->pending_const);
+	}
+	if (q->nsops > 1)
+		sma->complex_count++;
+}
+
 static void unlink_queue(struct sem_array *sma, struct sem_queue *q)
 {
-	list_del(&q->list);
+	int i;
+
+	for (i = 0; i < q->nwaits; i++)
+		list_del(&q->waits[i].list);
 	if (q->nsops > 1)
 		sma->complex_count--;
 }
 
-/** check_restart(sma, q)
+/* Was a queued before b? */
+static inline int sem_queue_before(struct sem_queue *a, struct sem_queue *b)
+{
+	return (int)(a->seq - b->seq) < 0;
+}
+
+/**
+ * sem_updated(sma, semnum, updated) - note a modified semaphore
  * @sma: semaphore array
- * @q: the operation that just completed
+ * @semnum: semaphore that was modified
+ * @updated: list of the modified semaphores
  *
- * update_queue is O(N^2) when it restarts scanning the whole queue of
- * waiting operations. Therefore this function checks if the restart is
- * really necessary. It is called after a previously waiting operation
- * modified the array.
- * Note that wait-for-zero operations are handled without restart.
+ * Collects the semaphores whose pending operations update_queue() must
+ * look at. Each semaphore is added only once.
  */
-static int check_restart(struct sem_array *sma, struct sem_queue *q)
+static void sem_updated(struct sem_array *sma, int semnum,
+			struct list_head *updated)
 {
-	/* pending complex alter operations are too difficult to analyse */
-	if (!list_empty(&sma->pending_alter))
-		return 1;
+	struct sem *curr = sma->sem_base + semnum;
 
-	/* we were a sleeping complex operation. Too difficult */
-	if (q->nsops > 1)
-		return 1;
-
-	/* It is impossible that someone waits for the new value:
-	 * - complex operations always restart.
-	 * - wait-for-zero are handled seperately.
-	 * - q is a previously sleeping simple operation that
-	 *   altered the array. It must be a decrement, because
-	 *   simple increments never sleep.
-	 * - If there are older (higher priority) decrements
-	 *   in the queue, then they have observed the original
-	 *   semval value and couldn't proceed. The operation
-	 *   decremented to value - thus they won't proceed either.
-	 */
-	return 0;
+	if (list_empty(&curr->updated))
+		list_add_tail(&curr->updated, updated);
 }
 
 /**
- * wake_const_ops(sma, semnum, pt) - Wake up non-alter tasks
+ * wake_const_ops(sma, curr, pt) - Wake up non-alter tasks
  * @sma: semaphore array.
- * @semnum: semaphore that was modified.
- * @pt: list head for the tasks that must be woken up.
+ * @curr: semaphore that was set to 0.
+ * @pt: the tasks that must be woken up.
  *
  * wake_const_ops must be called after a semaphore in a semaphore array
- * was set to 0. If complex const operations are pending, wake_const_ops must
- * be called with semnum = -1, as well as with the number of each modified
- * semaphore.
- * The tasks that must be woken up are added to @pt. The return code
- * is stored in q->pid.
+ * was set to 0. Complex const operations are found on the lists of all
+ * their semaphores, thus no other list must be scanned.
+ * The tasks that must be woken up are added to @pt.
  * The function returns 1 if at least one operation was completed successfully.
  */
-static int wake_const_ops(struct sem_array *sma, int semnum,
-				struct list_head *pt)
+static int wake_const_ops(struct sem_array *sma, struct sem *curr,
+				struct sem_wake *pt)
 {
-	struct sem_queue *q;
-	struct list_head *walk;
-	struct list_head *pending_list;
+	struct sem_wait *w, *tw;
 	int semop_completed = 0;
 
-	if (semnum == -1)
-		pending_list = &sma->pending_const;
-	else
-		pending_list = &sma->sem_base[semnum].pending_const;
-
-	walk = pending_list->next;
-	while (walk != pending_list) {
+	list_for_each_entry_safe(w, tw, &curr->pending_const, list) {
+		struct sem_queue *q = w->q;
 		int error;
 
-		q = container_of(walk, struct sem_queue, list);
-		walk = walk->next;
-
 		error = perform_atomic_semop(sma, q->sops, q->nsops,
 						 q->undo, q->pid);
 
 		if (error <= 0) {
-			/* operation completed, remove from queue & wakeup */
+			/* operation completed, remove from queue & wakeup.
+			 * q has no other entry in this list, tw stays valid.
+			 */
 
 			unlink_queue(sma, q);
 
@@ -796,124 +826,102 @@ static int wake_const_ops(struct sem_array *sma, int semnum,
 }
 
 /**
- * do_smart_wakeup_zero(sma, sops, nsops, pt) - wakeup all wait for zero tasks
- * @sma: semaphore array
- * @sops: operations that were performed
- * @nsops: number of operations
- * @pt: list head of the tasks that must be woken up.
- *
- * do_smart_wakeup_zero() checks all required queue for wait-for-zero
- * operations, based on the actual changes that were performed on the
- * semaphore array.
- * The function returns 1 if at least one operation was completed successfully.
- */
-static int do_smart_wakeup_zero(struct sem_array *sma, struct sembuf *sops,
-					int nsops, struct list_head *pt)
-{
-	int i;
-	int semop_completed = 0;
-	int got_zero = 0;
-
-	/* first: the per-semaphore queues, if known */
-	if (sops) {
-		for (i = 0; i < nsops; i++) {
-			int num = sops[i].sem_num;
-
-			if (sma->sem_base[num].semval == 0) {
-				got_zero = 1;
-				semop_completed |= wake_const_ops(sma, num, pt);
-			}
-		}
-	} else {
-		/*
-		 * No sops means modified semaphores not known.
-		 * Assume all were changed.
-		 */
-		for (i = 0; i < sma->sem_nsems; i++) {
-			if (sma->sem_base[i].semval == 0) {
-				got_zero = 1;
-				semop_completed |= wake_const_ops(sma, i, pt);
-			}
-		}
-	}
-	/*
-	 * If one of the modified semaphores got 0,
-	 * then check the global queue, too.
-	 */
-	if (got_zero)
-		semop_completed |= wake_const_ops(sma, -1, pt);
-
-	return semop_completed;
-}
-
-
-/**
- * update_queue(sma, semnum): Look for tasks that can be completed.
+ * update_queue(sma, updated, pt): Look for tasks that can be completed.
  * @sma: semaphore array.
- * @semnum: semaphore that was modified.
- * @pt: list head for the tasks that must be woken up.
+ * @updated: the semaphores that were modified, see sem_updated().
+ * @pt: the tasks that must be woken up.
  *
- * update_queue must be called after a semaphore in a semaphore array
- * was modified. If multiple semaphores were modified, update_queue must
- * be called with semnum = -1, as well as with the number of each modified
- * semaphore.
- * The tasks that must be woken up are added to @pt. The return code
- * is stored in q->pid.
+ * update_queue must be called after semaphores in a semaphore array were
+ * modified. A sleeping operation can only proceed if one of its semaphores
+ * changed, thus only the lists of the semaphores on @updated are scanned.
+ * The operations are tried in FIFO order across these lists: the oldest
+ * untried entry of all the lists comes first. Semaphores modified by the
+ * completed operations are added to @updated, which is empty on return.
+ * The tasks that must be woken up are added to @pt.
  * The function internally checks if const operations can now succeed.
  *
  * The function return 1 if at least one semop was completed successfully.
  */
-static int update_queue(struct sem_array *sma, int semnum, struct list_head *pt)
+static int update_queue(struct sem_array *sma, struct list_head *updated,
+			struct sem_wake *pt)
 {
-	struct sem_queue *q;
-	struct list_head *walk;
-	struct list_head *pending_list;
+	struct sem *curr, *tmp, *best_sem = NULL;
+	struct sem_queue *q, *best;
 	int semop_completed = 0;
+	int error, restart, i;
 
-	if (semnum == -1)
-		pending_list = &sma->pending_alter;
-	else
-		pending_list = &sma->sem_base[semnum].pending_alter;
+	list_for_each_entry(curr, updated, updated) {
+		if (curr->semval == 0)
+			semop_completed |= wake_const_ops(sma, curr, pt);
+		curr->next_alter = curr->pending_alter.next;
+	}
 
 again:
-	walk = pending_list->next;
-	while (walk != pending_list) {
-		int error, restart;
-
-		q = container_of(walk, struct sem_queue, list);
-		walk = walk->next;
-
-		/* If we are scanning the single sop, per-semaphore list of
-		 * one semaphore and that semaphore is 0, then it is not
-		 * necessary to scan further: simple increments
-		 * that affect only one entry succeed immediately and cannot
-		 * be in the  per semaphore pending queue, and decrements
-		 * cannot be successful if the value is already 0.
+	best = NULL;
+	list_for_each_entry(curr, updated, updated) {
+		/* Without complex operations, only simple decrements
+		 * sleep in pending_alter and none of them can be
+		 * successful if the value is already 0.
 		 */
-		if (semnum != -1 && sma->sem_base[semnum].semval == 0)
-			break;
+		if (!sma->complex_count && curr->semval == 0)
+			continue;
+		if (curr->next_alter == &curr->pending_alter)
+			continue;
 
-		error = perform_atomic_semop(sma, q->sops, q->nsops,
-					 q->undo, q->pid);
+		q = list_entry(curr->next_alter, struct sem_wait, list)->q;
+		if (!best || sem_queue_before(q, best)) {
+			best = q;
+			best_sem = curr;
+		}
+	}
+	if (!best)
+		goto out;
 
-		/* Does q->sleeper still need to sleep? */
-		if (error > 0)
-			continue;
+	best_sem->next_alter = best_sem->next_alter->next;
 
-		unlink_queue(sma, q);
+	error = perform_atomic_semop(sma, best->sops, best->nsops,
+				 best->undo, best->pid);
 
-		if (error) {
-			restart = 0;
-		} else {
-			semop_completed = 1;
-			do_smart_wakeup_zero(sma, q->sops, q->nsops, pt);
-			restart = check_restart(sma, q);
+	/* Does best->sleeper still need to sleep? */
+	if (error > 0)
+		goto again;
+
+	unlink_queue(sma, best);
+
+	if (error == 0) {
+		semop_completed = 1;
+		for (i = 0; i < best->nsops; i++) {
+			int num = best->sops[i].sem_num;
+
+			if (!best->sops[i].sem_op)
+				continue;
+			sem_updated(sma, num, updated);
+			if (sma->sem_base[num].semval == 0)
+				wake_const_ops(sma, sma->sem_base + num, pt);
 		}
+	}
+
+	/*
+	 * A simple operation was a decrement, because simple increments
+	 * never sleep. Older decrements on the same semaphore have
+	 * observed the previous value and couldn't proceed, thus they
+	 * won't proceed now either and the scan can go on. Complex
+	 * operations are too difficult to analyse, and the entries
+	 * of best in other lists may have been the next ones to try.
+	 */
+	restart = best->nsops > 1 || sma->complex_count;
+
+	wake_up_sem_queue_prepare(pt, best, error);
 
-		wake_up_sem_queue_prepare(pt, q, error);
-		if (restart)
-			goto again;
+	if (restart) {
+		list_for_each_entry(curr, updated, updated)
+			curr->next_alter = curr->pending_alter.next;
 	}
+	goto again;
+
+out:
+	list_for_each_entry_safe(curr, tmp, updated, updated)
+		list_del_init(&curr->updated);
 	return semop_completed;
 }
 
@@ -936,55 +944,24 @@ static void set_semotime(struct sem_array *sma, struct sembuf *sops)
 }
 
 /**
- * do_smart_update(sma, sops, nsops, otime, pt) - optimized update_queue
+ * do_smart_update(sma, sops, updated, otime, pt) - optimized update_queue
  * @sma: semaphore array
- * @sops: operations that were performed
- * @nsops: number of operations
+ * @sops: operations that were performed, may be NULL
+ * @updated: the semaphores that were modified, see sem_updated()
  * @otime: force setting otime
- * @pt: list head of the tasks that must be woken up.
+ * @pt: the tasks that must be woken up.
  *
- * do_smart_update() does the required calls to update_queue and wakeup_zero,
- * based on the actual changes that were performed on the semaphore array.
+ * do_smart_update() completes the pending operations that can proceed
+ * after the semaphores on @updated were modified.
  * Note that the function does not do the actual wake-up: the caller is
  * responsible for calling wake_up_sem_queue_do(@pt).
  * It is safe to perform this call after dropping all locks.
  */
-static void do_smart_update(struct sem_array *sma, struct sembuf *sops, int nsops,
-			int otime, struct list_head *pt)
+static void do_smart_update(struct sem_array *sma, struct sembuf *sops,
+			struct list_head *updated, int otime,
+			struct sem_wake *pt)
 {
-	int i;
-
-	otime |= do_smart_wakeup_zero(sma, sops, nsops, pt);
-
-	if (!list_empty(&sma->pending_alter)) {
-		/* semaphore array uses the global queue - just process it. */
-		otime |= update_queue(sma, -1, pt);
-	} else {
-		if (!sops) {
-			/*
-			 * No sops, thus the modified semaphores are not
-			 * known. Check all.
-			 */
-			for (i = 0; i < sma->sem_nsems; i++)
-				otime |= update_queue(sma, i, pt);
-		} else {
-			/*
-			 * Check the semaphores that were increased:
-			 * - No complex ops, thus all sleeping ops are
-			 *   decrease.
-			 * - if we decreased the value, then any sleeping
-			 *   semaphore ops wont be able to run: If the
-			 *   previous value was too small, then the new
-			 *   value will be too small, too.
-			 */
-			for (i = 0; i < nsops; i++) {
-				if (sops[i].sem_op > 0) {
-					otime |= update_queue(sma,
-							sops[i].sem_num, pt);
-				}
-			}
-		}
-	}
+	otime |= update_queue(sma, updated, pt);
 	if (otime)
 		set_semotime(sma, sops);
 }
@@ -1001,19 +978,12 @@ static void do_smart_update(struct sem_array *sma, struct sembuf *sops, int nsop
 static int count_semncnt (struct sem_array * sma, ushort semnum)
 {
 	int semncnt;
-	struct sem_queue * q;
+	struct sem_wait * w;
 
 	semncnt = 0;
-	list_for_each_entry(q, &sma->sem_base[semnum].pending_alter, list) {
-		struct sembuf * sops = q->sops;
-		BUG_ON(sops->sem_num != semnum);
-		if ((sops->sem_op < 0) && !(sops->sem_flg & IPC_NOWAIT))
-			semncnt++;
-	}
-
-	list_for_each_entry(q, &sma->pending_alter, list) {
-		struct sembuf * sops = q->sops;
-		int nsops = q->nsops;
+	list_for_each_entry(w, &sma->sem_base[semnum].pending_alter, list) {
+		struct sembuf * sops = w->q->sops;
+		int nsops = w->q->nsops;
 		int i;
 		for (i = 0; i < nsops; i++)
 			if (sops[i].sem_num == semnum
@@ -1027,19 +997,12 @@ static int count_semncnt (struct sem_array * sma, ushort semnum)
 static int count_semzcnt (struct sem_array * sma, ushort semnum)
 {
 	int semzcnt;
-	struct sem_queue * q;
+	struct sem_wait * w;
 
 	semzcnt = 0;
-	list_for_each_entry(q, &sma->sem_base[semnum].pending_const, list) {
-		struct sembuf * sops = q->sops;
-		BUG_ON(sops->sem_num != semnum);
-		if ((sops->sem_op == 0) && !(sops->sem_flg & IPC_NOWAIT))
-			semzcnt++;
-	}
-
-	list_for_each_entry(q, &sma->pending_const, list) {
-		struct sembuf * sops = q->sops;
-		int nsops = q->nsops;
+	list_for_each_entry(w, &sma->sem_base[semnum].pending_const, list) {
+		struct sembuf * sops = w->q->sops;
+		int nsops = w->q->nsops;
 		int i;
 		for (i = 0; i < nsops; i++)
 			if (sops[i].sem_num == semnum
@@ -1057,9 +1020,9 @@ static int count_semzcnt (struct sem_array * sma, ushort semnum)
 static void freeary(struct ipc_namespace *ns, struct kern_ipc_perm *ipcp)
 {
 	struct sem_undo *un, *tu;
-	struct sem_queue *q, *tq;
+	struct sem_queue *q;
 	struct sem_array *sma = container_of(ipcp, struct sem_array, sem_perm);
-	struct list_head tasks;
+	struct sem_wake tasks;
 	int i;
 
 	/* Free the existing undo structures for this semaphore set.  */
@@ -1074,23 +1037,20 @@ static void freeary(struct ipc_namespace *ns, struct kern_ipc_perm *ipcp)
 	}
 
 	/* Wake up all pending processes and let them fail with EIDRM. */
-	INIT_LIST_HEAD(&tasks);
-	list_for_each_entry_safe(q, tq, &sma->pending_const, list) {
-		unlink_queue(sma, q);
-		wake_up_sem_queue_prepare(&tasks, q, -EIDRM);
-	}
-
-	list_for_each_entry_safe(q, tq, &sma->pending_alter, list) {
-		unlink_queue(sma, q);
-		wake_up_sem_queue_prepare(&tasks, q, -EIDRM);
-	}
+	sem_wake_init(&tasks);
 	for (i = 0; i < sma->sem_nsems; i++) {
 		struct sem *sem = sma->sem_base + i;
-		list_for_each_entry_safe(q, tq, &sem->pending_const, list) {
+
+		/* unlink_queue() removes all entries of q, in any list */
+		while (!list_empty(&sem->pending_const)) {
+			q = list_first_entry(&sem->pending_const,
+					     struct sem_wait, list)->q;
 			unlink_queue(sma, q);
 			wake_up_sem_queue_prepare(&tasks, q, -EIDRM);
 		}
-		list_for_each_entry_safe(q, tq, &sem->pending_alter, list) {
+		while (!list_empty(&sem->pending_alter)) {
+			q = list_first_entry(&sem->pending_alter,
+					     struct sem_wait, list)->q;
 			unlink_queue(sma, q);
 			wake_up_sem_queue_prepare(&tasks, q, -EIDRM);
 		}
@@ -1241,7 +1201,8 @@ static int semctl_setval(struct ipc_namespace *ns, int semid, int semnum,
 	struct sem_array *sma;
 	struct sem* curr;
 	int err;
-	struct list_head tasks;
+	struct sem_wake tasks;
+	LIST_HEAD(updated);
 	int val;
 #if defined(CONFIG_64BIT) && defined(__BIG_ENDIAN)
 	/* big-endian 64bit */
@@ -1254,7 +1215,7 @@ static int semctl_setval(struct ipc_namespace *ns, int semid, int semnum,
 	if (val > SEMVMX || val < 0)
 		return -ERANGE;
 
-	INIT_LIST_HEAD(&tasks);
+	sem_wake_init(&tasks);
 
 	rcu_read_lock();
 	sma = sem_obtain_object_check(ns, semid);
@@ -1292,7 +1253,8 @@ static int semctl_setval(struct ipc_namespace *ns, int semid, int semnum,
 	curr->sempid = task_tgid_vnr(current);
 	sma->sem_ctime = get_seconds();
 	/* maybe some queued-up processes were waiting for this */
-	do_smart_update(sma, NULL, 0, 0, &tasks);
+	sem_updated(sma, semnum, &updated);
+	do_smart_update(sma, NULL, &updated, 0, &tasks);
 	sem_unlock(sma, -1);
 	rcu_read_unlock();
 	wake_up_sem_queue_do(&tasks);
@@ -1307,9 +1269,9 @@ static int semctl_main(struct ipc_namespace *ns, int semid, int semnum,
 	int err, nsems;
 	ushort fast_sem_io[SEMMSL_FAST];
 	ushort* sem_io = fast_sem_io;
-	struct list_head tasks;
+	struct sem_wake tasks;
 
-	INIT_LIST_HEAD(&tasks);
+	sem_wake_init(&tasks);
 
 	rcu_read_lock();
 	sma = sem_obtain_object_check(ns, semid);
@@ -1373,6 +1335,7 @@ static int semctl_main(struct ipc_namespace *ns, int semid, int semnum,
 	{
 		int i;
 		struct sem_undo *un;
+		LIST_HEAD(updated);
 
 		if (!ipc_rcu_getref(sma)) {
 			rcu_read_unlock();
@@ -1410,8 +1373,10 @@ static int semctl_main(struct ipc_namespace *ns, int semid, int semnum,
 			goto out_free;
 		}
 
-		for (i = 0; i < nsems; i++)
+		for (i = 0; i < nsems; i++) {
 			sma->sem_base[i].semval = sem_io[i];
+			sem_updated(sma, i, &updated);
+		}
 
 		ipc_assert_locked_object(&sma->sem_perm);
 		list_for_each_entry(un, &sma->list_id, list_id) {
@@ -1420,7 +1385,7 @@ static int semctl_main(struct ipc_namespace *ns, int semid, int semnum,
 		}
 		sma->sem_ctime = get_seconds();
 		/* maybe some queued-up processes were waiting for this */
-		do_smart_update(sma, NULL, 0, 0, &tasks);
+		do_smart_update(sma, NULL, &updated, 0, &tasks);
 		err = 0;
 		goto out_unlock;
 	}
@@ -1758,12 +1723,14 @@ SYSCALL_DEFINE4(semtimedop, int, semid, struct sembuf __user *, tsops,
 	struct sem_array *sma;
 	struct sembuf fast_sops[SEMOPM_FAST];
 	struct sembuf* sops = fast_sops, *sop;
+	struct sem_wait fast_waits[SEMWAIT_FAST];
+	struct sem_wait *waits = fast_waits;
 	struct sem_undo *un;
 	int undos = 0, alter = 0, max, locknum;
 	struct sem_queue queue;
 	unsigned long jiffies_left = 0;
 	struct ipc_namespace *ns;
-	struct list_head tasks;
+	struct sem_wake tasks;
 
 	ns = current->nsproxy->ipc_ns;
 
@@ -1776,6 +1743,13 @@ SYSCALL_DEFINE4(semtimedop, int, semid, struct sembuf __user *, tsops,
 		if(sops==NULL)
 			return -ENOMEM;
 	}
+	if (nsops > SEMWAIT_FAST) {
+		waits = kmalloc(sizeof(*waits)*nsops, GFP_KERNEL);
+		if (waits == NULL) {
+			error = -ENOMEM;
+			goto out_free;
+		}
+	}
 	if (copy_from_user (sops, tsops, nsops * sizeof(*tsops))) {
 		error=-EFAULT;
 		goto out_free;
@@ -1803,7 +1777,7 @@ SYSCALL_DEFINE4(semtimedop, int, semid, struct sembuf __user *, tsops,
 			alter = 1;
 	}
 
-	INIT_LIST_HEAD(&tasks);
+	sem_wake_init(&tasks);
 
 	if (undos) {
 		/* On success, find_alloc_undo takes the rcu_read_lock */
@@ -1854,9 +1828,16 @@ SYSCALL_DEFINE4(semtimedop, int, semid, struct sembuf __user *, tsops,
 		/* If the operation was successful, then do
 		 * the required updates.
 		 */
-		if (alter)
-			do_smart_update(sma, sops, nsops, 1, &tasks);
-		else
+		if (alter) {
+			LIST_HEAD(updated);
+
+			for (sop = sops; sop < sops + nsops; sop++) {
+				if (sop->sem_op != 0)
+					sem_updated(sma, sop->sem_num,
+						    &updated);
+			}
+			do_smart_update(sma, sops, &updated, 1, &tasks);
+		} else
 			set_semotime(sma, sops);
 	}
 	if (error <= 0)
@@ -1871,34 +1852,8 @@ SYSCALL_DEFINE4(semtimedop, int, semid, struct sembuf __user *, tsops,
 	queue.undo = un;
 	queue.pid = task_tgid_vnr(current);
 	queue.alter = alter;
-
-	if (nsops == 1) {
-		struct sem *curr;
-		curr = &sma->sem_base[sops->sem_num];
-
-		if (alter) {
-			if (sma->complex_count) {
-				list_add_tail(&queue.list,
-						&sma->pending_alter);
-			} else {
-
-				list_add_tail(&queue.list,
-						&curr->pending_alter);
-			}
-		} else {
-			list_add_tail(&queue.list, &curr->pending_const);
-		}
-	} else {
-		if (!sma->complex_count)
-			merge_queues(sma);
-
-		if (alter)
-			list_add_tail(&queue.list, &sma->pending_alter);
-		else
-			list_add_tail(&queue.list, &sma->pending_const);
-
-		sma->complex_count++;
-	}
+	queue.waits = waits;
+	link_queue(sma, &queue);
 
 	queue.status = -EINTR;
 	queue.sleeper = current;
@@ -1976,6 +1931,8 @@ out_rcu_wakeup:
 out_free:
 	if(sops != fast_sops)
 		kfree(sops);
+	if (waits != fast_waits)
+		kfree(waits);
 	return error;
 }
 
@@ -2033,7 +1990,8 @@ void exit_sem(struct task_struct *tsk)
 	for (;;) {
 		struct sem_array *sma;
 		struct sem_undo *un;
-		struct list_head tasks;
+		struct sem_wake tasks;
+		LIST_HEAD(updated);
 		int semid, i;
 
 		rcu_read_lock();
@@ -2098,11 +2056,12 @@ void exit_sem(struct task_struct *tsk)
 				if (semaphore->semval > SEMVMX)
 					semaphore->semval = SEMVMX;
 				semaphore->sempid = task_tgid_vnr(current);
+				sem_updated(sma, i, &updated);
 			}
 		}
 		/* maybe some queued-up processes were waiting for this */
-		INIT_LIST_HEAD(&tasks);
-		do_smart_update(sma, NULL, 0, 1, &tasks);
+		sem_wake_init(&tasks);
+		do_smart_update(sma, NULL, &updated, 1, &tasks);
 		sem_unlock(sma, -1);
 		rcu_read_unlock();
 		wake_up_sem_queue_do(&tasks);
@@ -0,0 +1,103 @@
+/*
+ * cgroup_timer_slack.c - control group timer slack subsystem
+ *
+ * Sets a minimum timer slack for the tasks of a group, so that e.g. all
+ * background applications get their hrtimer based sleeps (nanosleep,
+ * poll, select, futex waits) batched with other wakeups instead of each
+ * breaking up an idle period at its exact expiry.
+ *
+ * timer_slack.slack_ns is inherited from the parent when a group is
+ * created, 0 means no minimum.  The task's own timer_slack_ns, as set by
+ * prctl(PR_SET_TIMERSLACK) and inherited on fork, is left alone: the
+ * group value only applies while the task is in the group, through
+ * task_get_effective_timer_slack().
+ */
+
+#include <linux/cgroup.h>
+#include <linux/err.h>
+#include <linux/export.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+
+struct timer_slack_cgroup {
+	struct cgroup_subsys_state css;
+	unsigned long slack_ns;
+};
+
+static inline struct timer_slack_cgroup *cgroup_ts(struct cgroup *cgrp)
+{
+	return container_of(cgroup_subsys_state(cgrp, timer_slack_subsys_id),
+			    struct timer_slack_cgroup, css);
+}
+
+static inline struct timer_slack_cgroup *task_ts(struct task_struct *p)
+{
+	return container_of(task_subsys_state(p, timer_slack_subsys_id),
+			    struct timer_slack_cgroup, css);
+}
+
+unsigned long task_get_effective_timer_slack(struct task_struct *p)
+{
+	unsigned long slack;
+
+	rcu_read_lock();
+	slack = ACCESS_ONCE(task_ts(p)->slack_ns);
+	rcu_read_unlock();
+
+	return max(p->timer_slack_ns, slack);
+}
+EXPORT_SYMBOL_GPL(task_get_effective_timer_slack);
+
+static struct cgroup_subsys_state *timer_slack_css_alloc(struct cgroup *cgrp)
+{
+	struct timer_slack_cgroup *tsc;
+
+	tsc = kzalloc(sizeof(*tsc), GFP_KERNEL);
+	if (!tsc)
+		return ERR_PTR(-ENOMEM);
+	return &tsc->css;
+}
+
+static int timer_slack_css_online(struct cgroup *cgrp)
+{
+	if (cgrp->parent)
+		cgroup_ts(cgrp)->slack_ns = cgroup_ts(cgrp->parent)->slack_ns;
+	return 0;
+}
+
+static void timer_slack_css_free(struct cgroup *cgrp)
+{
+	kfree(cgroup_ts(cgrp));
+}
+
+static u64 timer_slack_read(struct cgroup *cgrp, struct cftype *cft)
+{
+	return cgroup_ts(cgrp)->slack_ns;
+}
+
+static int timer_slack_write(struct cgroup *cgrp, struct cftype *cft, u64 val)
+{
+	if (val > ULONG_MAX)
+		return -EINVAL;
+
+	ACCESS_ONCE(cgroup_ts(cgrp)->slack_ns) = val;
+	return 0;
+}
+
+static struct cftype timer_slack_files[] = {
+	{
+		.name = "slack_ns",
+		.read_u64 = timer_slack_read,
+		.write_u64 = timer_slack_write,
+	},
+	{ }	/* terminate */
+};
+
+struct cgroup_subsys timer_slack_subsys = {
+	.name		= "timer_slack",
+	.css_alloc	= timer_slack_css_alloc,
+	.css_online	= timer_slack_css_online,
+	.css_free	= timer_slack_css_free,
+	.subsys_id	= timer_slack_subsys_id,
+	.base_cftypes	= timer_slack_files,
+};
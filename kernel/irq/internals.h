@@ -6,6 +6,7 @@
  * of this file for your non core code.
  */
 #include <linux/irqdesc.h>
+#include <linux/static_key.h>
 
 #define istate core_internal_state__do_not_mess_with_it
 
@@ -173,3 +174,16 @@ static inline bool irqd_has_set(struct irq_data *d, unsigned int mask)
 {
 	return d->state_use_accessors & mask;
 }
+
+#ifdef CONFIG_IRQ_TIMINGS
+extern struct static_key irq_timing_enabled;
+extern void __irq_timings_record(unsigned int irq);
+
+static inline void irq_timings_record(unsigned int irq)
+{
+	if (static_key_false(&irq_timing_enabled))
+		__irq_timings_record(irq);
+}
+#else
+static inline void irq_timings_record(unsigned int irq) { }
+#endif
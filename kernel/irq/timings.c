@@ -0,0 +1,174 @@
+/*
+ * linux/kernel/irq/timings.c
+ *
+ * This file contains the per-cpu interrupt inter-arrival statistics used
+ * to predict the next interrupt of an idle cpu.
+ *
+ * Many wakeups of an idle cpu come from interrupts that fire at a steady
+ * rate, e.g. display vsync, modem or audio DMA, and which the next timer
+ * event knows nothing about.  For every interrupt handled on a cpu an
+ * exponentially weighted average and variance of the interval since its
+ * previous occurrence is kept, and a source whose intervals vary by less
+ * than a quarter of their average is considered regular.  The earliest
+ * projected occurrence of the regular sources of a cpu is its predicted
+ * next interrupt.
+ */
+
+#include <linux/irq.h>
+#include <linux/interrupt.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+
+#include "internals.h"
+
+/*
+ * Interrupts tracked per cpu.  The slots are 4-way set associative by irq
+ * number, so that a few colliding sources keep their history; a new
+ * source replaces the least recently seen one of its set.
+ */
+#define IRQT_SLOTS		32
+#define IRQT_WAYS		4
+#define IRQT_SETS		(IRQT_SLOTS / IRQT_WAYS)
+/* A new interval weighs 1/8 in the averages */
+#define IRQT_EWMA_SHIFT		3
+/* Intervals needed before a source can be considered regular */
+#define IRQT_MIN_SAMPLES	8
+/* Longer gaps restart the statistics of a source, in us */
+#define IRQT_MAX_INTERVAL	(1 << 20)
+/* Number of missed periods after which a source is assumed stopped */
+#define IRQT_MAX_MISSED		4
+
+struct irqt_stat {
+	unsigned int irq;
+	unsigned int count;	/* intervals seen, up to IRQT_MIN_SAMPLES */
+	u64 last;		/* local_clock() of the last occurrence, or 0 */
+	s64 avg;		/* average interval, us */
+	s64 var;		/* variance of the interval, us^2 */
+};
+
+struct irqt_cpu {
+	struct irqt_stat slot[IRQT_SLOTS];
+};
+
+static DEFINE_PER_CPU(struct irqt_cpu, irqt_cpus);
+
+struct static_key irq_timing_enabled = STATIC_KEY_INIT_FALSE;
+
+/* Find the slot of @irq in its set, or NULL and the slot to replace */
+static struct irqt_stat *irqt_lookup(struct irqt_cpu *c, unsigned int irq,
+				     struct irqt_stat **victim)
+{
+	struct irqt_stat *set = &c->slot[(irq % IRQT_SETS) * IRQT_WAYS];
+	int i;
+
+	*victim = set;
+	for (i = 0; i < IRQT_WAYS; i++) {
+		if (set[i].last && set[i].irq == irq)
+			return &set[i];
+		if (set[i].last < (*victim)->last)
+			*victim = &set[i];
+	}
+	return NULL;
+}
+
+/*
+ * Called from handle_irq_event_percpu() with interrupts disabled, on the
+ * cpu handling @irq.
+ */
+void __irq_timings_record(unsigned int irq)
+{
+	struct irqt_stat *s, *victim;
+	u64 now = local_clock();
+	s64 interval, diff;
+
+	s = irqt_lookup(this_cpu_ptr(&irqt_cpus), irq, &victim);
+	if (!s) {
+		s = victim;
+		s->irq = irq;
+		s->count = 0;
+		s->last = now;
+		return;
+	}
+
+	interval = div_u64(now - s->last, NSEC_PER_USEC);
+	s->last = now;
+	if (interval > IRQT_MAX_INTERVAL) {
+		s->count = 0;
+		return;
+	}
+
+	if (!s->count) {
+		s->avg = interval;
+		s->var = 0;
+	} else {
+		diff = interval - s->avg;
+		s->avg += diff >> IRQT_EWMA_SHIFT;
+		s->var += (diff * diff - s->var) >> IRQT_EWMA_SHIFT;
+	}
+	if (s->count < IRQT_MIN_SAMPLES)
+		s->count++;
+}
+
+/**
+ * irq_timings_next_event - predict the next interrupt of this cpu
+ * @now: current local_clock() time
+ *
+ * Must be called with interrupts disabled.  Returns the local_clock() time
+ * at which the earliest regular interrupt source of this cpu is expected
+ * to fire next, or ULLONG_MAX if there is none.
+ */
+u64 irq_timings_next_event(u64 now)
+{
+	struct irqt_cpu *c = this_cpu_ptr(&irqt_cpus);
+	u64 next = ULLONG_MAX;
+	int i;
+
+	if (!static_key_false(&irq_timing_enabled))
+		return next;
+
+	for (i = 0; i < IRQT_SLOTS; i++) {
+		struct irqt_stat *s = &c->slot[i];
+		u64 period, t, missed;
+
+		if (s->count < IRQT_MIN_SAMPLES || s->avg <= 0)
+			continue;
+		/* stddev above avg / 4 */
+		if (s->var * 16 > s->avg * s->avg)
+			continue;
+
+		period = s->avg * NSEC_PER_USEC;
+		t = s->last + period;
+		if (t <= now) {
+			/* project over occurrences that went elsewhere */
+			missed = div64_u64(now - s->last, period);
+			if (missed >= IRQT_MAX_MISSED)
+				continue;
+			t = s->last + (missed + 1) * period;
+		}
+		if (t < next)
+			next = t;
+	}
+
+	return next;
+}
+EXPORT_SYMBOL_GPL(irq_timings_next_event);
+
+/**
+ * irq_timings_enable - start recording interrupt timings
+ *
+ * Calls nest; recording stops when every caller has called
+ * irq_timings_disable().
+ */
+void irq_timings_enable(void)
+{
+	static_key_slow_inc(&irq_timing_enabled);
+}
+EXPORT_SYMBOL_GPL(irq_timings_enable);
+
+void irq_timings_disable(void)
+{
+	static_key_slow_dec(&irq_timing_enabled);
+}
+EXPORT_SYMBOL_GPL(irq_timings_disable);
@@ -14,22 +14,45 @@
  */
 
 #include <linux/earlysuspend.h>
+#include <linux/completion.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
 #include <linux/rtc.h>
+#include <linux/slab.h>
 #include <linux/writeback.h>
 #include <linux/pm_wakeup.h>
 #include <linux/workqueue.h>
+#include <trace/events/power.h>
 
 #include "power.h"
 
 enum {
 	DEBUG_USER_STATE = 1U << 0,
 	DEBUG_SUSPEND = 1U << 2,
+	DEBUG_TIMING = 1U << 3,
 };
 static int debug_mask = DEBUG_USER_STATE;
 module_param_named(debug_mask, debug_mask, int, S_IRUGO | S_IWUSR | S_IWGRP);
 
+/*
+ * Handlers of the same level are independent of each other, so they are
+ * run in parallel and a level takes as long as its slowest handler.  A
+ * handler still running after handler_timeout_ms is reported and the next
+ * level is started without it; it is waited for before the early suspend
+ * or late resume completes.  0 means wait for each level indefinitely.
+ */
+static bool parallel = true;
+module_param(parallel, bool, S_IRUGO | S_IWUSR | S_IWGRP);
+static unsigned int handler_timeout_ms = 1000;
+module_param(handler_timeout_ms, uint, S_IRUGO | S_IWUSR | S_IWGRP);
+
+struct early_suspend_call {
+	struct work_struct work;
+	struct completion done;
+	struct early_suspend *handler;
+	bool resume;
+};
+
 static DEFINE_MUTEX(early_suspend_lock);
 static DEFINE_MUTEX(suspend_lock);
 static LIST_HEAD(early_suspend_handlers);
@@ -38,6 +61,7 @@ static void late_resume(struct work_struct *work);
 static void try_to_suspend(struct work_struct *work);
 static struct workqueue_struct *early_suspend_wq;
 static struct workqueue_struct *suspend_wq;
+static struct workqueue_struct *handler_wq;
 static DECLARE_WORK(early_suspend_work, early_suspend);
 static DECLARE_WORK(late_resume_work, late_resume);
 static DECLARE_WORK(suspend_work, try_to_suspend);
@@ -123,9 +147,115 @@ void unregister_early_suspend(struct early_suspend *handler)
 }
 EXPORT_SYMBOL(unregister_early_suspend);
 
-static void early_suspend(struct work_struct *work)
+static void call_handler(struct early_suspend *handler, bool resume)
+{
+	void (*fn)(struct early_suspend *h);
+	ktime_t start;
+	s64 usecs;
+
+	fn = resume ? handler->resume : handler->suspend;
+	start = ktime_get();
+	fn(handler);
+	usecs = ktime_us_delta(ktime_get(), start);
+
+	trace_early_suspend_handler(fn, handler->level, resume, usecs);
+	if (debug_mask & DEBUG_TIMING)
+		pr_info("%s: %pf took %lld usecs\n",
+			resume ? "late_resume" : "early_suspend", fn, usecs);
+}
+
+static void call_handler_work(struct work_struct *work)
+{
+	struct early_suspend_call *call =
+		container_of(work, struct early_suspend_call, work);
+
+	call_handler(call->handler, call->resume);
+	complete(&call->done);
+}
+
+static void wait_handler(struct early_suspend_call *call,
+			 unsigned long deadline)
+{
+	long left;
+
+	if (!handler_timeout_ms) {
+		wait_for_completion(&call->done);
+		return;
+	}
+
+	left = time_before(jiffies, deadline) ? deadline - jiffies : 0;
+	if (!wait_for_completion_timeout(&call->done, left))
+		pr_warn("%s: %pf at level %d still running after %u ms\n",
+			call->resume ? "late_resume" : "early_suspend",
+			call->resume ? call->handler->resume :
+				       call->handler->suspend,
+			call->handler->level, handler_timeout_ms);
+}
+
+/*
+ * Call the suspend, or the resume, handlers one level at a time.  Called
+ * with early_suspend_lock held, which keeps the handlers registered until
+ * all of them have returned.
+ */
+static void call_handlers(bool resume)
 {
+	struct early_suspend_call *calls;
 	struct early_suspend *pos;
+	unsigned long deadline;
+	int nr = 0, first, i;
+
+	list_for_each_entry(pos, &early_suspend_handlers, link)
+		nr++;
+
+	calls = parallel && nr ? kcalloc(nr, sizeof(*calls), GFP_KERNEL) : NULL;
+	if (!calls) {
+		if (resume) {
+			list_for_each_entry_reverse(pos, &early_suspend_handlers,
+						    link)
+				if (pos->resume != NULL)
+					call_handler(pos, true);
+		} else {
+			list_for_each_entry(pos, &early_suspend_handlers, link)
+				if (pos->suspend != NULL)
+					call_handler(pos, false);
+		}
+		return;
+	}
+
+	nr = 0;
+	if (resume) {
+		list_for_each_entry_reverse(pos, &early_suspend_handlers, link)
+			if (pos->resume != NULL)
+				calls[nr++].handler = pos;
+	} else {
+		list_for_each_entry(pos, &early_suspend_handlers, link)
+			if (pos->suspend != NULL)
+				calls[nr++].handler = pos;
+	}
+
+	for (first = 0; first < nr; first = i) {
+		int level = calls[first].handler->level;
+
+		for (i = first; i < nr && calls[i].handler->level == level; i++) {
+			INIT_WORK(&calls[i].work, call_handler_work);
+			init_completion(&calls[i].done);
+			calls[i].resume = resume;
+			queue_work(handler_wq, &calls[i].work);
+		}
+
+		deadline = jiffies + msecs_to_jiffies(handler_timeout_ms);
+		for (i = first; i < nr && calls[i].handler->level == level; i++)
+			wait_handler(&calls[i], deadline);
+	}
+
+	/* handlers that timed out above */
+	for (i = 0; i < nr; i++)
+		wait_for_completion(&calls[i].done);
+	kfree(calls);
+}
+
+static void early_suspend(struct work_struct *work)
+{
 	unsigned long irqflags;
 	int abort = 0;
 
@@ -146,10 +276,7 @@ static void early_suspend(struct work_struct *work)
 
 	if (debug_mask & DEBUG_SUSPEND)
 		pr_info("early_suspend: call handlers\n");
-	list_for_each_entry(pos, &early_suspend_handlers, link) {
-		if (pos->suspend != NULL)
-			pos->suspend(pos);
-	}
+	call_handlers(false);
 	mutex_unlock(&early_suspend_lock);
 
 	if (debug_mask & DEBUG_SUSPEND)
@@ -166,7 +293,6 @@ abort:
 
 static void late_resume(struct work_struct *work)
 {
-	struct early_suspend *pos;
 	unsigned long irqflags;
 	int abort = 0;
 
@@ -185,9 +311,7 @@ static void late_resume(struct work_struct *work)
 	}
 	if (debug_mask & DEBUG_SUSPEND)
 		pr_info("late_resume: call handlers\n");
-	list_for_each_entry_reverse(pos, &early_suspend_handlers, link)
-		if (pos->resume != NULL)
-			pos->resume(pos);
+	call_handlers(true);
 	if (debug_mask & DEBUG_SUSPEND)
 		pr_info("late_resume: done\n");
 abort:
@@ -255,8 +379,18 @@ int __init early_suspend_init(void)
 		goto es_wq_err;
 	}
 
+	handler_wq = alloc_workqueue("early_suspend_handlers",
+				     WQ_UNBOUND | WQ_HIGHPRI, 0);
+
+	if (!handler_wq) {
+		ret = -ENOMEM;
+		goto s_wq_err;
+	}
+
 	goto out;
 
+s_wq_err:
+	destroy_workqueue(suspend_wq);
 es_wq_err:
 	destroy_workqueue(early_suspend_wq);
 ws_err:
@@ -10,25 +10,38 @@
  */
 
 #include <linux/ctype.h>
+#include <linux/dcache.h>
 #include <linux/device.h>
 #include <linux/err.h>
+#include <linux/hash.h>
 #include <linux/hrtimer.h>
 #include <linux/list.h>
 #include <linux/rbtree.h>
+#include <linux/rculist.h>
 #include <linux/slab.h>
 
+/*
+ * Wakelocks are kept in a name ordered tree for pm_show_wakelocks() and in
+ * a hash table for lookups.  Both are modified under wakelocks_lock only,
+ * but the hash table is RCU protected, so that locking and unlocking an
+ * existing wakelock, which is what user space does most of the time, does
+ * not need the mutex.
+ */
 static DEFINE_MUTEX(wakelocks_lock);
 
+#define WL_HASH_BITS	6
+
 struct wakelock {
 	char			*name;
+	unsigned int		hash;
+	bool			dead;	/* being garbage collected */
 	struct rb_node		node;
+	struct hlist_node	hnode;
 	struct wakeup_source	ws;
-#ifdef CONFIG_PM_WAKELOCKS_GC
-	struct list_head	lru;
-#endif
 };
 
 static struct rb_root wakelocks_tree = RB_ROOT;
+static struct hlist_head wakelocks_hash[1 << WL_HASH_BITS];
 
 ssize_t pm_show_wakelocks(char *buf, bool show_active)
 {
@@ -80,59 +93,84 @@ static inline void decrement_wakelocks_number(void) {}
 #define WL_GC_COUNT_MAX	100
 #define WL_GC_TIME_SEC	300
 
-static LIST_HEAD(wakelocks_lru_list);
-static unsigned int wakelocks_gc_count;
-
-static inline void wakelocks_lru_add(struct wakelock *wl)
-{
-	list_add(&wl->lru, &wakelocks_lru_list);
-}
-
-static inline void wakelocks_lru_most_recent(struct wakelock *wl)
-{
-	list_move(&wl->lru, &wakelocks_lru_list);
-}
+static atomic_t wakelocks_gc_count = ATOMIC_INIT(0);
 
+/*
+ * Called with wakelocks_lock held.  Lock-free lookups may still activate a
+ * wakelock after it has been found idle here; they see ->dead set under
+ * the wakeup source's lock and back off to the locked path, which no
+ * longer finds the wakelock.
+ */
 static void wakelocks_gc(void)
 {
-	struct wakelock *wl, *aux;
+	struct rb_node *node, *next;
+	struct wakelock *wl;
 	ktime_t now;
 
-	if (++wakelocks_gc_count <= WL_GC_COUNT_MAX)
+	if (atomic_read(&wakelocks_gc_count) <= WL_GC_COUNT_MAX)
 		return;
+	atomic_set(&wakelocks_gc_count, 0);
 
 	now = ktime_get();
-	list_for_each_entry_safe_reverse(wl, aux, &wakelocks_lru_list, lru) {
+	for (node = rb_first(&wakelocks_tree); node; node = next) {
 		u64 idle_time_ns;
-		bool active;
+
+		next = rb_next(node);
+		wl = rb_entry(node, struct wakelock, node);
 
 		spin_lock_irq(&wl->ws.lock);
 		idle_time_ns = ktime_to_ns(ktime_sub(now, wl->ws.last_time));
-		active = wl->ws.active;
+		if (!wl->ws.active &&
+		    idle_time_ns >= (u64)WL_GC_TIME_SEC * NSEC_PER_SEC)
+			wl->dead = true;
 		spin_unlock_irq(&wl->ws.lock);
 
-		if (idle_time_ns < ((u64)WL_GC_TIME_SEC * NSEC_PER_SEC))
-			break;
+		if (!wl->dead)
+			continue;
 
-		if (!active) {
-			wakeup_source_remove(&wl->ws);
-			rb_erase(&wl->node, &wakelocks_tree);
-			list_del(&wl->lru);
-			kfree(wl->name);
-			kfree(wl);
-			decrement_wakelocks_number();
-		}
+		hlist_del_rcu(&wl->hnode);
+		rb_erase(&wl->node, &wakelocks_tree);
+		/* waits for the lock-free lookups */
+		wakeup_source_remove(&wl->ws);
+		wakeup_source_drop(&wl->ws);
+		kfree(wl->name);
+		kfree(wl);
+		decrement_wakelocks_number();
+	}
+}
+
+static inline void wakelocks_gc_tick(void)
+{
+	if (atomic_inc_return(&wakelocks_gc_count) > WL_GC_COUNT_MAX) {
+		mutex_lock(&wakelocks_lock);
+		wakelocks_gc();
+		mutex_unlock(&wakelocks_lock);
 	}
-	wakelocks_gc_count = 0;
 }
 #else /* !CONFIG_PM_WAKELOCKS_GC */
-static inline void wakelocks_lru_add(struct wakelock *wl) {}
-static inline void wakelocks_lru_most_recent(struct wakelock *wl) {}
-static inline void wakelocks_gc(void) {}
+static inline void wakelocks_gc_tick(void) {}
 #endif /* !CONFIG_PM_WAKELOCKS_GC */
 
-static struct wakelock *wakelock_lookup_add(const char *name, size_t len,
-					    bool add_if_not_found)
+static inline struct hlist_head *wakelock_bucket(unsigned int hash)
+{
+	return &wakelocks_hash[hash_32(hash, WL_HASH_BITS)];
+}
+
+/* Called under rcu_read_lock() or with wakelocks_lock held */
+static struct wakelock *wakelock_find(const char *name, size_t len,
+				      unsigned int hash)
+{
+	struct wakelock *wl;
+
+	hlist_for_each_entry_rcu(wl, wakelock_bucket(hash), hnode)
+		if (wl->hash == hash && !strncmp(name, wl->name, len) &&
+		    !wl->name[len])
+			return wl;
+	return NULL;
+}
+
+static struct wakelock *wakelock_add(const char *name, size_t len,
+				     unsigned int hash)
 {
 	struct rb_node **node = &wakelocks_tree.rb_node;
 	struct rb_node *parent = *node;
@@ -144,24 +182,17 @@ static struct wakelock *wakelock_lookup_add(const char *name, size_t len,
 		parent = *node;
 		wl = rb_entry(*node, struct wakelock, node);
 		diff = strncmp(name, wl->name, len);
-		if (diff == 0) {
-			if (wl->name[len])
-				diff = -1;
-			else
-				return wl;
-		}
+		if (diff == 0)
+			diff = -1;
 		if (diff < 0)
 			node = &(*node)->rb_left;
 		else
 			node = &(*node)->rb_right;
 	}
-	if (!add_if_not_found)
-		return ERR_PTR(-EINVAL);
 
 	if (wakelocks_limit_exceeded())
 		return ERR_PTR(-ENOSPC);
 
-	/* Not found, we have to add a new one. */
 	wl = kzalloc(sizeof(*wl), GFP_KERNEL);
 	if (!wl)
 		return ERR_PTR(-ENOMEM);
@@ -171,44 +202,18 @@ static struct wakelock *wakelock_lookup_add(const char *name, size_t len,
 		kfree(wl);
 		return ERR_PTR(-ENOMEM);
 	}
+	wl->hash = hash;
 	wl->ws.name = wl->name;
 	wakeup_source_add(&wl->ws);
 	rb_link_node(&wl->node, parent, node);
 	rb_insert_color(&wl->node, &wakelocks_tree);
-	wakelocks_lru_add(wl);
+	hlist_add_head_rcu(&wl->hnode, wakelock_bucket(hash));
 	increment_wakelocks_number();
 	return wl;
 }
 
-int pm_wake_lock(const char *buf)
+static void wakelock_activate(struct wakelock *wl, u64 timeout_ns)
 {
-	const char *str = buf;
-	struct wakelock *wl;
-	u64 timeout_ns = 0;
-	size_t len;
-	int ret = 0;
-
-	while (*str && !isspace(*str))
-		str++;
-
-	len = str - buf;
-	if (!len)
-		return -EINVAL;
-
-	if (*str && *str != '\n') {
-		/* Find out if there's a valid timeout string appended. */
-		ret = kstrtou64(skip_spaces(str), 10, &timeout_ns);
-		if (ret)
-			return -EINVAL;
-	}
-
-	mutex_lock(&wakelocks_lock);
-
-	wl = wakelock_lookup_add(buf, len, true);
-	if (IS_ERR(wl)) {
-		ret = PTR_ERR(wl);
-		goto out;
-	}
 	if (timeout_ns) {
 		u64 timeout_ms = timeout_ns + NSEC_PER_MSEC - 1;
 
@@ -217,43 +222,139 @@ int pm_wake_lock(const char *buf)
 	} else {
 		__pm_stay_awake(&wl->ws);
 	}
+}
 
-	wakelocks_lru_most_recent(wl);
+/*
+ * Activate the wakelock named by @len characters at @name, creating it if
+ * needed.
+ */
+static int wake_lock_one(const char *name, size_t len, u64 timeout_ns)
+{
+	unsigned int hash = full_name_hash(name, len);
+	struct wakelock *wl;
+	int ret = 0;
+
+	rcu_read_lock();
+	wl = wakelock_find(name, len, hash);
+	if (wl) {
+		wakelock_activate(wl, timeout_ns);
+		if (!ACCESS_ONCE(wl->dead)) {
+			rcu_read_unlock();
+			return 0;
+		}
+		/* lost against the garbage collector */
+		__pm_relax(&wl->ws);
+	}
+	rcu_read_unlock();
+
+	mutex_lock(&wakelocks_lock);
+
+	wl = wakelock_find(name, len, hash);
+	if (!wl)
+		wl = wakelock_add(name, len, hash);
+	if (IS_ERR(wl))
+		ret = PTR_ERR(wl);
+	else
+		wakelock_activate(wl, timeout_ns);
 
- out:
 	mutex_unlock(&wakelocks_lock);
 	return ret;
 }
 
-int pm_wake_unlock(const char *buf)
+static int wake_unlock_one(const char *name, size_t len)
 {
+	unsigned int hash = full_name_hash(name, len);
 	struct wakelock *wl;
+	int ret = -EINVAL;
+
+	rcu_read_lock();
+	wl = wakelock_find(name, len, hash);
+	if (wl && !ACCESS_ONCE(wl->dead)) {
+		__pm_relax(&wl->ws);
+		ret = 0;
+	}
+	rcu_read_unlock();
+
+	if (!ret)
+		wakelocks_gc_tick();
+	return ret;
+}
+
+/*
+ * Both wake_lock and wake_unlock take one wakelock per line, so that user
+ * space can lock or unlock several of them with a single write.  The lines
+ * are handled in order and the first error ends the write.
+ */
+static const char *next_line(const char *buf, const char **end)
+{
+	const char *eol = buf + strcspn(buf, "\n");
+
+	*end = eol;
+	return *eol ? eol + 1 : eol;
+}
+
+/* Parse the optional timeout between @str and @end */
+static int parse_timeout(const char *str, const char *end, u64 *timeout_ns)
+{
+	char num[24];
 	size_t len;
-	int ret = 0;
 
-	len = strlen(buf);
-	if (!len)
+	*timeout_ns = 0;
+	str = skip_spaces(str);
+	if (str >= end)
+		return 0;
+
+	len = end - str;
+	if (len >= sizeof(num))
 		return -EINVAL;
+	memcpy(num, str, len);
+	num[len] = '\0';
+	return kstrtou64(strim(num), 10, timeout_ns) ? -EINVAL : 0;
+}
 
-	if (buf[len-1] == '\n')
-		len--;
+int pm_wake_lock(const char *buf)
+{
+	const char *line, *next, *end, *str;
+	u64 timeout_ns;
+	int ret;
 
-	if (!len)
+	if (!*buf)
 		return -EINVAL;
 
-	mutex_lock(&wakelocks_lock);
+	for (line = buf; *line; line = next) {
+		next = next_line(line, &end);
 
-	wl = wakelock_lookup_add(buf, len, false);
-	if (IS_ERR(wl)) {
-		ret = PTR_ERR(wl);
-		goto out;
+		str = line;
+		while (str < end && !isspace(*str))
+			str++;
+		if (str == line)
+			return -EINVAL;
+
+		ret = parse_timeout(str, end, &timeout_ns);
+		if (!ret)
+			ret = wake_lock_one(line, str - line, timeout_ns);
+		if (ret)
+			return ret;
 	}
-	__pm_relax(&wl->ws);
+	return 0;
+}
 
-	wakelocks_lru_most_recent(wl);
-	wakelocks_gc();
+int pm_wake_unlock(const char *buf)
+{
+	const char *line, *next, *end;
+	int ret;
 
- out:
-	mutex_unlock(&wakelocks_lock);
-	return ret;
+	if (!*buf)
+		return -EINVAL;
+
+	for (line = buf; *line; line = next) {
+		next = next_line(line, &end);
+		if (end == line)
+			return -EINVAL;
+
+		ret = wake_unlock_one(line, end - line);
+		if (ret)
+			return ret;
+	}
+	return 0;
 }
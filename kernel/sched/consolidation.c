@@ -14,6 +14,12 @@
  * and finally run the workload on non-shielded CPUs if they are
  * predicted capable after the consolidation.
  *
+ * When the platform or userspace provides an energy cost table for
+ * the CPUs, the number of non-shielded groups is instead the one with
+ * the lowest estimated power for the predicted concurrency, so that
+ * cluster and frequency costs are weighed against each other rather
+ * than always packing on as few CPUs as possible.
+ *
  * Copyright (C) 2013 Intel, Inc.,
  *
  * Author: Rudramuni, Vishwesh M <vishwesh.m.rudramuni@intel.com>
@@ -23,6 +29,10 @@
 
 #ifdef CONFIG_CPU_CONCURRENCY
 
+#include <linux/cpu.h>
+#include <linux/device.h>
+#include <linux/slab.h>
+
 #include "sched.h"
 
 /*
@@ -180,6 +190,12 @@ static const unsigned long *cc_decayed_sum = cc_decayed_sum_1;
 static unsigned long cc_decayed_sum_len =
 	sizeof(cc_decayed_sum_1) / sizeof(cc_decayed_sum_1[0]) - 1;
 
+/*
+ * the sum a cpu converges to with one task running all the time,
+ * which depends on the decay rate
+ */
+static unsigned long cc_task_sum = 1UL << CPU_CONCURRENCY_SHIFT;
+
 /*
  * sysctl handler to update decay rate
  */
@@ -221,6 +237,7 @@ int concurrency_decay_rate_handler(struct ctl_table *table, int write,
 	}
 
 	cc_decay_max_pds *= sysctl_concurrency_decay_rate;
+	ACCESS_ONCE(cc_task_sum) = cc_decayed_sum[cc_decayed_sum_len] + 1;
 
 	return 0;
 }
@@ -400,6 +417,32 @@ void update_cpu_concurrency(struct rq *rq)
 	__update_concurrency(rq, now, cc);
 }
 
+/**
+ * cpu_concurrency - average number of runnable tasks of a cpu
+ * @cpu: the cpu
+ *
+ * Returns the concurrency of @cpu over its completed sum periods, decayed
+ * up to now, scaled by 1 << CPU_CONCURRENCY_SHIFT whatever the decay rate.
+ * Takes the runqueue lock of @cpu, so that the sum of an idle cpu whose
+ * tick is stopped is brought up to date as well.
+ */
+unsigned long cpu_concurrency(int cpu)
+{
+	struct rq *rq = cpu_rq(cpu);
+	unsigned long flags;
+	u64 sum;
+
+	raw_spin_lock_irqsave(&rq->lock, flags);
+	update_rq_clock(rq);
+	update_cpu_concurrency(rq);
+	sum = rq->concurrency.sum;
+	raw_spin_unlock_irqrestore(&rq->lock, flags);
+
+	return div64_u64(sum << CPU_CONCURRENCY_SHIFT,
+			 ACCESS_ONCE(cc_task_sum));
+}
+EXPORT_SYMBOL_GPL(cpu_concurrency);
+
 #endif
 
 #ifdef CONFIG_WORKLOAD_CONSOLIDATION
@@ -527,58 +570,347 @@ __can_consolidate_cc(u64 src_cc, int src_nr, u64 dst_cc, int dst_nr)
 }
 
 /*
- * find the group for asymmetric concurrency
- * problem to address: traverse sd from top to down
+ * Energy aware consolidation
+ *
+ * Each CPU may have an energy cost table (struct wc_cpu_energy).  The
+ * concurrency of a domain is turned into a demand in capacity units,
+ * and for every candidate number of leading groups the demand is spread
+ * over their CPUs by capacity.  Each CPU then runs at the lowest
+ * capacity state that fits its share, busy for share / cap of the time
+ * and idle for the rest; each group used adds its cluster cost, unless
+ * the groups share a package anyway.  Groups that are shielded are
+ * assumed to sleep at no cost.
  */
-struct sched_group *
-workload_consolidation_find_group(struct sched_domain *sd,
-	struct task_struct *p, int this_cpu)
+static DEFINE_PER_CPU(struct wc_cpu_energy *, wc_energy);
+static DEFINE_MUTEX(wc_energy_mutex);
+
+static inline unsigned long wc_energy_max_cap(const struct wc_cpu_energy *e)
 {
-	int half, sg_weight, ns_half = 0;
-	struct sched_group *sg;
+	return e->cap_states[e->nr_cap_states - 1].cap;
+}
+
+/* power in mW of a cpu with @demand capacity units to serve */
+static unsigned long
+wc_cpu_power(const struct wc_cpu_energy *e, unsigned long demand)
+{
+	unsigned long cap;
+	unsigned int i, power;
+
+	for (i = 0; i < e->nr_cap_states - 1; i++)
+		if (e->cap_states[i].cap >= demand)
+			break;
+
+	cap = e->cap_states[i].cap;
+	power = e->cap_states[i].power;
+	if (demand >= cap)
+		return power;
+
+	return div_u64((u64)power * demand +
+		       (u64)e->idle_power * (cap - demand), cap);
+}
+
+/*
+ * demand of @sd in capacity units, scaled by cc_weight(1); false if a
+ * cpu in it has no energy table, in which case the energy model is not
+ * used for this domain
+ */
+static bool wc_domain_demand(struct sched_domain *sd, u64 *demand)
+{
+	struct wc_cpu_energy *e;
+	int i;
+
+	*demand = 0;
+	for_each_cpu(i, sched_domain_span(sd)) {
+		e = rcu_dereference_sched(per_cpu(wc_energy, i));
+		if (!e)
+			return false;
+
+		*demand += cpu_rq(i)->concurrency.sum_now *
+			wc_energy_max_cap(e);
+	}
+
+	return true;
+}
+
+/*
+ * estimated power in mW of serving @demand on the first @nr groups of
+ * @sd, or ULONG_MAX if they are not capable of it (or a table went
+ * away under us)
+ */
+static unsigned long
+wc_groups_power(struct sched_domain *sd, int nr, u64 demand)
+{
+	struct sched_group *sg = sd->first_group;
+	struct wc_cpu_energy *e;
+	unsigned long power = 0;
+	u64 cap = 0, share;
+	int i, j;
+
+	for (i = 0; i < nr; i++, sg = sg->next) {
+		for_each_cpu(j, sched_group_cpus(sg)) {
+			e = rcu_dereference_sched(per_cpu(wc_energy, j));
+			if (!e)
+				return ULONG_MAX;
+			cap += wc_energy_max_cap(e);
+		}
+	}
+
+	/* same headroom as the concurrency threshold of the domain */
+	if (demand * 100 > cap * cc_weight(1) * sd->asym_concurrency)
+		return ULONG_MAX;
+
+	sg = sd->first_group;
+	for (i = 0; i < nr; i++, sg = sg->next) {
+		e = rcu_dereference_sched(per_cpu(wc_energy,
+						  group_first_cpu(sg)));
+		if (!e)
+			return ULONG_MAX;
+		if (!(sd->flags & SD_SHARE_PKG_RESOURCES))
+			power += e->cluster_power;
+
+		for_each_cpu(j, sched_group_cpus(sg)) {
+			e = rcu_dereference_sched(per_cpu(wc_energy, j));
+			if (!e)
+				return ULONG_MAX;
+			share = div64_u64(demand * wc_energy_max_cap(e),
+					  cap);
+			share = cc_scale_down(share);
+			power += wc_cpu_power(e, min_t(u64, share,
+						wc_energy_max_cap(e)));
+		}
+	}
+
+	return power;
+}
+
+/*
+ * workload_consolidation_set_energy - set or clear the energy table of @cpu
+ *
+ * May sleep.  The table is copied.
+ */
+int workload_consolidation_set_energy(int cpu,
+				      const struct wc_cpu_energy *energy)
+{
+	struct wc_cpu_energy *new = NULL, *old;
+	unsigned int i;
+
+	if (cpu < 0 || cpu >= nr_cpu_ids || !cpu_possible(cpu))
+		return -EINVAL;
+
+	if (energy) {
+		if (!energy->nr_cap_states ||
+		    energy->nr_cap_states > WC_MAX_CAP_STATES)
+			return -EINVAL;
+
+		for (i = 0; i < energy->nr_cap_states; i++) {
+			if (!energy->cap_states[i].cap)
+				return -EINVAL;
+			if (i && energy->cap_states[i].cap <=
+				 energy->cap_states[i - 1].cap)
+				return -EINVAL;
+		}
+
+		new = kmemdup(energy, sizeof(*new), GFP_KERNEL);
+		if (!new)
+			return -ENOMEM;
+	}
+
+	mutex_lock(&wc_energy_mutex);
+	old = rcu_dereference_protected(per_cpu(wc_energy, cpu),
+					lockdep_is_held(&wc_energy_mutex));
+	rcu_assign_pointer(per_cpu(wc_energy, cpu), new);
+	mutex_unlock(&wc_energy_mutex);
+
+	/* readers run with preemption disabled */
+	if (old) {
+		synchronize_sched();
+		kfree(old);
+	}
+
+	return 0;
+}
+
+/*
+ * /sys/devices/system/cpu/sched_energy shows one line per cpu that has
+ * an energy table:
+ *
+ *	<cpu> <idle mW> <cluster mW> <cap>:<mW> [<cap>:<mW> ...]
+ *
+ * Writing lines of the same format replaces the table of those cpus,
+ * and writing just "<cpu>" removes it.
+ */
+static ssize_t show_sched_energy(struct device *dev,
+				 struct device_attribute *attr, char *buf)
+{
+	struct wc_cpu_energy *e;
+	ssize_t len = 0;
+	unsigned int i;
+	int cpu;
+
+	mutex_lock(&wc_energy_mutex);
+	for_each_possible_cpu(cpu) {
+		e = rcu_dereference_protected(per_cpu(wc_energy, cpu),
+					lockdep_is_held(&wc_energy_mutex));
+		if (!e)
+			continue;
+
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%d %u %u",
+				 cpu, e->idle_power, e->cluster_power);
+		for (i = 0; i < e->nr_cap_states; i++)
+			len += scnprintf(buf + len, PAGE_SIZE - len, " %lu:%u",
+					 e->cap_states[i].cap,
+					 e->cap_states[i].power);
+		len += scnprintf(buf + len, PAGE_SIZE - len, "\n");
+	}
+	mutex_unlock(&wc_energy_mutex);
+
+	return len;
+}
+
+static int parse_sched_energy(char *line)
+{
+	struct wc_cpu_energy e;
+	int cpu, n, ret;
+
+	memset(&e, 0, sizeof(e));
+
+	ret = sscanf(line, "%d %u %u%n", &cpu, &e.idle_power,
+		     &e.cluster_power, &n);
+	if (ret == 1)
+		return workload_consolidation_set_energy(cpu, NULL);
+	if (ret != 3)
+		return -EINVAL;
+
+	for (line += n; *skip_spaces(line); line += n) {
+		if (e.nr_cap_states == WC_MAX_CAP_STATES)
+			return -EINVAL;
+		if (sscanf(line, " %lu:%u%n",
+			   &e.cap_states[e.nr_cap_states].cap,
+			   &e.cap_states[e.nr_cap_states].power, &n) != 2)
+			return -EINVAL;
+		e.nr_cap_states++;
+	}
+
+	return workload_consolidation_set_energy(cpu, &e);
+}
+
+static ssize_t store_sched_energy(struct device *dev,
+				  struct device_attribute *attr,
+				  const char *buf, size_t count)
+{
+	char *str, *pos, *line;
+	int ret = 0;
+
+	str = kstrndup(buf, count, GFP_KERNEL);
+	if (!str)
+		return -ENOMEM;
+
+	pos = str;
+	while ((line = strsep(&pos, "\n")) != NULL) {
+		if (!*skip_spaces(line))
+			continue;
+
+		ret = parse_sched_energy(line);
+		if (ret)
+			break;
+	}
+
+	kfree(str);
+	return ret ? ret : count;
+}
+
+static DEVICE_ATTR(sched_energy, 0644, show_sched_energy, store_sched_energy);
+
+static int __init wc_energy_sysfs_init(void)
+{
+	return device_create_file(cpu_subsys.dev_root, &dev_attr_sched_energy);
+}
+late_initcall(wc_energy_sysfs_init);
+
+/*
+ * the number of leading groups of @sd the workload should be
+ * consolidated to, 0 if it should stay spread over all of them
+ *
+ * as of now, we have the following assumption
+ * 1) every sched_group has the same weight
+ * 2) without energy tables, every CPU has the same computing power
+ */
+static int __nonshielded_groups(struct sched_domain *sd)
+{
+	int half, sg_weight, ret = 0;
+	unsigned long power, best;
 	u64 sd_cc;
 
 	half = DIV_ROUND_CLOSEST(sd->total_groups, 2);
+
+	if (wc_domain_demand(sd, &sd_cc)) {
+		best = wc_groups_power(sd, sd->total_groups, sd_cc);
+
+		while (half) {
+			power = wc_groups_power(sd, half, sd_cc);
+			if (power == ULONG_MAX)
+				break;
+
+			if (power < best) {
+				best = power;
+				ret = half;
+			}
+			half /= 2;
+		}
+
+		return ret;
+	}
+
 	sg_weight = sd->groups->group_weight;
 
 	sd_cc = sched_domain_cc(sd);
 	sd_cc *= 100;
 
 	while (half) {
-		int allowed = 0, i;
 		int cpus = sg_weight * half;
 		u64 threshold = __calc_cc_thr(cpus,
 			sd->asym_concurrency);
 
-		/*
-		 * we did not consider the added cc by this
-		 * wakeup (mostly from fork/exec)
-		 */
 		if (!__can_consolidate_cc(sd_cc, sd->span_weight,
 			threshold, cpus))
-			break;
-
-		sg = sd->first_group;
-		for (i = 0; i < half; ++i) {
-			/* if it has no cpus allowed */
-			if (!cpumask_intersects(sched_group_cpus(sg),
-					tsk_cpus_allowed(p)))
-				continue;
-
-			allowed = 1;
-			sg = sg->next;
-		}
-
-		if (!allowed)
-			break;
+			return ret;
 
-		ns_half = half;
+		ret = half;
 		half /= 2;
 	}
 
+	return ret;
+}
+
+/*
+ * find the group for asymmetric concurrency
+ * problem to address: traverse sd from top to down
+ */
+struct sched_group *
+workload_consolidation_find_group(struct sched_domain *sd,
+	struct task_struct *p, int this_cpu)
+{
+	struct sched_group *sg;
+	int ns_half, i;
+
+	/*
+	 * we did not consider the added cc by this
+	 * wakeup (mostly from fork/exec)
+	 */
+	ns_half = __nonshielded_groups(sd);
 	if (!ns_half)
 		return NULL;
 
+	/* if none of the groups has cpus allowed */
+	sg = sd->first_group;
+	for (i = 0; i < ns_half; ++i, sg = sg->next)
+		if (cpumask_intersects(sched_group_cpus(sg),
+				tsk_cpus_allowed(p)))
+			break;
+
+	if (i == ns_half)
+		return NULL;
+
 	if (ns_half == 1)
 		return sd->first_group;
 
@@ -624,35 +956,20 @@ int workload_consolidation_cpu_shielded(int cpu)
 	sd = top_flag_domain(cpu, SD_ASYM_CONCURRENCY);
 
 	while (sd) {
-		int half, sg_weight, this_sg_nr;
-		u64 sd_cc;
+		int ns_half;
 
 		if (!(sd->flags & SD_ASYM_CONCURRENCY)) {
 			sd = sd->child;
 			continue;
 		}
 
-		half = DIV_ROUND_CLOSEST(sd->total_groups, 2);
-		sg_weight = sd->groups->group_weight;
-		this_sg_nr = sd->group_number;
-
-		sd_cc = sched_domain_cc(sd);
-		sd_cc *= 100;
-
-		while (half) {
-			int cpus = sg_weight * half;
-			u64 threshold = __calc_cc_thr(cpus,
-				sd->asym_concurrency);
-
-			if (!__can_consolidate_cc(sd_cc, sd->span_weight,
-				threshold, cpus))
-				return 0;
-
-			if (this_sg_nr >= half)
-				return 1;
+		ns_half = __nonshielded_groups(sd);
+		if (ns_half && sd->group_number >= ns_half)
+			return 1;
 
-			half /= 2;
-		}
+		/* only look into the group if it is the one packed on */
+		if (ns_half != 1)
+			return 0;
 
 		sd = sd->child;
 	}
@@ -660,38 +977,6 @@ int workload_consolidation_cpu_shielded(int cpu)
 	return 0;
 }
 
-/*
- * as of now, we have the following assumption
- * 1) every sched_group has the same weight
- * 2) every CPU has the same computing power
- */
-static inline int __nonshielded_groups(struct sched_domain *sd)
-{
-	int half, sg_weight, ret = 0;
-	u64 sd_cc;
-
-	half = DIV_ROUND_CLOSEST(sd->total_groups, 2);
-	sg_weight = sd->groups->group_weight;
-
-	sd_cc = sched_domain_cc(sd);
-	sd_cc *= 100;
-
-	while (half) {
-		int cpus = sg_weight * half;
-		u64 threshold = __calc_cc_thr(cpus,
-			sd->asym_concurrency);
-
-		if (!__can_consolidate_cc(sd_cc, sd->span_weight,
-			threshold, cpus))
-			return ret;
-
-		ret = half;
-		half /= 2;
-	}
-
-	return ret;
-}
-
 static DEFINE_PER_CPU(struct cpumask, nonshielded_cpumask);
 
 /*
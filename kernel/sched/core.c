@@ -766,6 +766,7 @@ static void enqueue_task(struct rq *rq, struct task_struct *p, int flags)
 {
 	update_rq_clock(rq);
 	sched_info_queued(p);
+	schedlat_enqueue(rq, p, flags);
 	p->sched_class->enqueue_task(rq, p, flags);
 	update_cpu_concurrency(rq);
 }
@@ -1850,6 +1851,7 @@ prepare_task_switch(struct rq *rq, struct task_struct *prev,
 {
 	trace_sched_switch(prev, next);
 	sched_info_switch(prev, next);
+	schedlat_switch(rq, prev, next);
 	perf_event_task_sched_out(prev, next);
 	fire_sched_out_preempt_notifiers(prev, next);
 	prepare_lock_switch(rq, next);
@@ -7769,6 +7771,9 @@ static void cpu_cgroup_css_offline(struct cgroup *cgrp)
 {
 	struct task_group *tg = cgroup_tg(cgrp);
 
+#ifdef CONFIG_SCHED_LATENCY_HIST
+	sched_latency_hist_set_group(tg, false);
+#endif
 	sched_offline_group(tg);
 }
 
@@ -8102,6 +8107,21 @@ static u64 cpu_rt_period_read_uint(struct cgroup *cgrp, struct cftype *cft)
 }
 #endif /* CONFIG_RT_GROUP_SCHED */
 
+#ifdef CONFIG_SCHED_LATENCY_HIST
+static u64 cpu_latency_hist_read_u64(struct cgroup *cgrp, struct cftype *cft)
+{
+	return cgroup_tg(cgrp)->latency_hist;
+}
+
+static int cpu_latency_hist_write_u64(struct cgroup *cgrp, struct cftype *cft,
+				      u64 val)
+{
+	if (val > 1)
+		return -EINVAL;
+	return sched_latency_hist_set_group(cgroup_tg(cgrp), val);
+}
+#endif /* CONFIG_SCHED_LATENCY_HIST */
+
 static struct cftype cpu_files[] = {
 #ifdef CONFIG_FAIR_GROUP_SCHED
 	{
@@ -8137,6 +8157,13 @@ static struct cftype cpu_files[] = {
 		.read_u64 = cpu_rt_period_read_uint,
 		.write_u64 = cpu_rt_period_write_uint,
 	},
+#endif
+#ifdef CONFIG_SCHED_LATENCY_HIST
+	{
+		.name = "latency_hist",
+		.read_u64 = cpu_latency_hist_read_u64,
+		.write_u64 = cpu_latency_hist_write_u64,
+	},
 #endif
 	{ }	/* terminate */
 };
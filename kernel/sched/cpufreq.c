@@ -0,0 +1,54 @@
+/*
+ * Scheduler code and data structures related to cpufreq.
+ *
+ * A cpufreq governor may register a callback per cpu that the fair
+ * class runs whenever it refreshes the runnable average of that cpu's
+ * runqueue, i.e. at enqueue, dequeue, tick and idle transitions.  This
+ * lets the governor pick frequencies from the scheduler's own view of
+ * the load instead of sampling idle time from a timer.
+ */
+
+#include <linux/module.h>
+
+#include "sched.h"
+
+DEFINE_PER_CPU(struct update_util_data *, cpufreq_update_util_data);
+
+/**
+ * cpufreq_add_update_util_hook - Populate the CPU's update_util_data pointer.
+ * @cpu: The CPU to set the pointer for.
+ * @data: New pointer value.
+ * @func: Callback function to set for the CPU.
+ *
+ * The callback runs with the runqueue lock of @cpu held and interrupts
+ * disabled, so it must not sleep and should be short.  The caller must
+ * make sure @data stays valid until cpufreq_remove_update_util_hook()
+ * has been called and a synchronize_sched() has completed.
+ */
+void cpufreq_add_update_util_hook(int cpu, struct update_util_data *data,
+			void (*func)(struct update_util_data *data, u64 time,
+				     unsigned long util, unsigned long max))
+{
+	if (WARN_ON(!data || !func))
+		return;
+
+	if (WARN_ON(per_cpu(cpufreq_update_util_data, cpu)))
+		return;
+
+	data->func = func;
+	rcu_assign_pointer(per_cpu(cpufreq_update_util_data, cpu), data);
+}
+EXPORT_SYMBOL_GPL(cpufreq_add_update_util_hook);
+
+/**
+ * cpufreq_remove_update_util_hook - Clear the CPU's update_util_data pointer.
+ * @cpu: The CPU to clear the pointer for.
+ *
+ * Callers must use synchronize_sched() before freeing or reusing the
+ * data the pointer pointed to.
+ */
+void cpufreq_remove_update_util_hook(int cpu)
+{
+	rcu_assign_pointer(per_cpu(cpufreq_update_util_data, cpu), NULL);
+}
+EXPORT_SYMBOL_GPL(cpufreq_remove_update_util_hook);
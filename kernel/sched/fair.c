@@ -1499,6 +1499,7 @@ static inline void update_rq_runnable_avg(struct rq *rq, int runnable)
 {
 	__update_entity_runnable_avg(rq->clock_task, &rq->avg, runnable);
 	__update_tg_runnable_avg(&rq->avg, &rq->cfs);
+	cpufreq_update_util(rq);
 }
 
 /* Add the load generated by se into cfs_rq's child load-average */
@@ -0,0 +1,250 @@
+/*
+ * Scheduling latency histograms.
+ *
+ * Two per-cpu log2 histograms are kept: the wakeup latency, from the
+ * moment a task is enqueued by a wakeup until it gets the cpu, and the
+ * runqueue wait, from the moment a task becomes runnable or is preempted
+ * until it runs again.  Both are accounted on the cpu the task ends up
+ * running on, in rq clock nanoseconds.
+ *
+ * Recording is off by default and the scheduler hooks sit behind a static
+ * key.  It is controlled through /proc/schedlat, which also shows the
+ * histograms.  If any cpu cgroup has cpu.latency_hist set, only tasks of
+ * such groups are recorded.
+ */
+
+#include <linux/proc_fs.h>
+#include <linux/seq_file.h>
+#include <linux/static_key.h>
+#include <linux/uaccess.h>
+
+#include "sched.h"
+
+/*
+ * bump this up when changing the output format of /proc/schedlat
+ */
+#define SCHEDLAT_VERSION	1
+
+/*
+ * Bucket 0 holds latencies below 2^SCHEDLAT_MIN_SHIFT ns, bucket i those
+ * below 2^(SCHEDLAT_MIN_SHIFT + i) ns, and the last one everything above.
+ */
+#define SCHEDLAT_MIN_SHIFT	10
+#define SCHEDLAT_NR_BUCKETS	26
+
+enum {
+	SCHEDLAT_WAKEUP,
+	SCHEDLAT_RQWAIT,
+	SCHEDLAT_NR_TYPES,
+};
+
+static const char * const schedlat_names[SCHEDLAT_NR_TYPES] = {
+	[SCHEDLAT_WAKEUP] = "wakeup",
+	[SCHEDLAT_RQWAIT] = "rqwait",
+};
+
+struct schedlat_hist {
+	unsigned long buckets[SCHEDLAT_NR_TYPES][SCHEDLAT_NR_BUCKETS];
+};
+
+static DEFINE_PER_CPU(struct schedlat_hist, schedlat_hist);
+
+struct static_key sched_latency_key = STATIC_KEY_INIT_FALSE;
+
+/* serializes enabling and the cgroup filter */
+static DEFINE_MUTEX(schedlat_mutex);
+static bool schedlat_enabled;
+
+/*
+ * Timestamps taken before recording was last enabled are stale; tasks
+ * keep them across a disabled period since nothing clears them then.
+ */
+static u64 schedlat_epoch;
+
+/* number of task groups with latency_hist set */
+static int schedlat_nr_groups;
+
+static inline bool schedlat_stamp_valid(u64 stamp)
+{
+	return stamp >= ACCESS_ONCE(schedlat_epoch);
+}
+
+static inline void schedlat_record(int type, u64 now, u64 stamp)
+{
+	s64 delta = now - stamp;
+	int idx = 0;
+
+	/* the stamp may come from another cpu's rq clock */
+	if (delta > 0)
+		idx = fls64((u64)delta >> SCHEDLAT_MIN_SHIFT);
+	if (idx >= SCHEDLAT_NR_BUCKETS)
+		idx = SCHEDLAT_NR_BUCKETS - 1;
+
+	__this_cpu_inc(schedlat_hist.buckets[type][idx]);
+}
+
+static inline bool schedlat_wanted(struct task_struct *p)
+{
+#ifdef CONFIG_CGROUP_SCHED
+	if (ACCESS_ONCE(schedlat_nr_groups))
+		return task_group(p)->latency_hist;
+#endif
+	return true;
+}
+
+void __schedlat_enqueue(struct rq *rq, struct task_struct *p, int flags)
+{
+	if (!schedlat_stamp_valid(p->schedlat_queued))
+		p->schedlat_queued = rq->clock;
+	if (flags & ENQUEUE_WAKEUP)
+		p->schedlat_wakeup = rq->clock;
+}
+
+void __schedlat_switch(struct rq *rq, struct task_struct *prev,
+		       struct task_struct *next)
+{
+	u64 now = rq->clock;
+
+	/* a preempted task starts waiting again */
+	if (prev->on_rq && prev != rq->idle)
+		prev->schedlat_queued = now;
+
+	if (next == rq->idle)
+		return;
+
+	if (schedlat_wanted(next)) {
+		if (schedlat_stamp_valid(next->schedlat_wakeup))
+			schedlat_record(SCHEDLAT_WAKEUP, now,
+					next->schedlat_wakeup);
+		if (schedlat_stamp_valid(next->schedlat_queued))
+			schedlat_record(SCHEDLAT_RQWAIT, now,
+					next->schedlat_queued);
+	}
+	next->schedlat_wakeup = 0;
+	next->schedlat_queued = 0;
+}
+
+#ifdef CONFIG_CGROUP_SCHED
+/*
+ * Add @tg to or remove it from the set of groups whose tasks are recorded.
+ * While that set is empty, all tasks are.
+ */
+int sched_latency_hist_set_group(struct task_group *tg, bool on)
+{
+	mutex_lock(&schedlat_mutex);
+	if (tg->latency_hist != on) {
+		tg->latency_hist = on;
+		schedlat_nr_groups += on ? 1 : -1;
+	}
+	mutex_unlock(&schedlat_mutex);
+
+	return 0;
+}
+#endif
+
+static void schedlat_set_enabled(bool on)
+{
+	mutex_lock(&schedlat_mutex);
+	if (on && !schedlat_enabled) {
+		ACCESS_ONCE(schedlat_epoch) = local_clock();
+		smp_wmb();
+		static_key_slow_inc(&sched_latency_key);
+	} else if (!on && schedlat_enabled) {
+		static_key_slow_dec(&sched_latency_key);
+	}
+	schedlat_enabled = on;
+	mutex_unlock(&schedlat_mutex);
+}
+
+static void schedlat_reset(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(&per_cpu(schedlat_hist, cpu), 0,
+		       sizeof(struct schedlat_hist));
+}
+
+static int schedlat_show(struct seq_file *m, void *v)
+{
+	unsigned long sum[SCHEDLAT_NR_BUCKETS];
+	int cpu, type, i;
+
+	seq_printf(m, "version %d\n", SCHEDLAT_VERSION);
+	seq_printf(m, "enabled %d\n", schedlat_enabled);
+	seq_printf(m, "cgroups %d\n", ACCESS_ONCE(schedlat_nr_groups));
+
+	/* upper bound of each bucket, in ns */
+	seq_puts(m, "le_ns");
+	for (i = 0; i < SCHEDLAT_NR_BUCKETS - 1; i++)
+		seq_printf(m, " %llu", 1ULL << (SCHEDLAT_MIN_SHIFT + i));
+	seq_puts(m, " inf\n");
+
+	for (type = 0; type < SCHEDLAT_NR_TYPES; type++) {
+		memset(sum, 0, sizeof(sum));
+		for_each_online_cpu(cpu) {
+			struct schedlat_hist *h = &per_cpu(schedlat_hist, cpu);
+
+			seq_printf(m, "%s cpu%d", schedlat_names[type], cpu);
+			for (i = 0; i < SCHEDLAT_NR_BUCKETS; i++) {
+				seq_printf(m, " %lu", h->buckets[type][i]);
+				sum[i] += h->buckets[type][i];
+			}
+			seq_putc(m, '\n');
+		}
+		seq_printf(m, "%s all", schedlat_names[type]);
+		for (i = 0; i < SCHEDLAT_NR_BUCKETS; i++)
+			seq_printf(m, " %lu", sum[i]);
+		seq_putc(m, '\n');
+	}
+
+	return 0;
+}
+
+/*
+ * Writing "1" starts recording, "0" stops it and "reset" clears the
+ * histograms.
+ */
+static ssize_t schedlat_write(struct file *file, const char __user *ubuf,
+			      size_t cnt, loff_t *ppos)
+{
+	char buf[16], *cmd;
+	size_t len = min(cnt, sizeof(buf) - 1);
+
+	if (copy_from_user(buf, ubuf, len))
+		return -EFAULT;
+	buf[len] = '\0';
+	cmd = strim(buf);
+
+	if (!strcmp(cmd, "1"))
+		schedlat_set_enabled(true);
+	else if (!strcmp(cmd, "0"))
+		schedlat_set_enabled(false);
+	else if (!strcmp(cmd, "reset"))
+		schedlat_reset();
+	else
+		return -EINVAL;
+
+	*ppos += cnt;
+	return cnt;
+}
+
+static int schedlat_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, schedlat_show, NULL);
+}
+
+static const struct file_operations proc_schedlat_operations = {
+	.open    = schedlat_open,
+	.read    = seq_read,
+	.write   = schedlat_write,
+	.llseek  = seq_lseek,
+	.release = single_release,
+};
+
+static int __init proc_schedlat_init(void)
+{
+	proc_create("schedlat", 0644, NULL, &proc_schedlat_operations);
+	return 0;
+}
+module_init(proc_schedlat_init);
@@ -164,6 +164,11 @@ struct task_group {
 #endif
 
 	struct cfs_bandwidth cfs_bandwidth;
+
+#ifdef CONFIG_SCHED_LATENCY_HIST
+	/* record latencies of this group's tasks in /proc/schedlat */
+	bool latency_hist;
+#endif
 };
 
 #ifdef CONFIG_FAIR_GROUP_SCHED
@@ -1094,6 +1099,31 @@ static inline void init_cpu_concurrency(struct rq *rq) {}
 static inline void update_cpu_concurrency(struct rq *rq) {}
 #endif
 
+#ifdef CONFIG_CPU_FREQ
+DECLARE_PER_CPU(struct update_util_data *, cpufreq_update_util_data);
+
+/*
+ * Pass the freshly updated runnable average of rq to the cpufreq
+ * governor, if it asked for it.  Called with the rq lock held.
+ */
+static inline void cpufreq_update_util(struct rq *rq)
+{
+	struct update_util_data *data;
+	unsigned long util;
+
+	data = rcu_dereference_sched(per_cpu(cpufreq_update_util_data,
+					     cpu_of(rq)));
+	if (!data)
+		return;
+
+	util = div_u64((u64)rq->avg.runnable_avg_sum << SCHED_POWER_SHIFT,
+		       rq->avg.runnable_avg_period + 1);
+	data->func(data, rq->clock, util, SCHED_POWER_SCALE);
+}
+#else
+static inline void cpufreq_update_util(struct rq *rq) {}
+#endif
+
 extern struct rt_bandwidth def_rt_bandwidth;
 extern void init_rt_bandwidth(struct rt_bandwidth *rt_b, u64 period, u64 runtime);
 
@@ -155,6 +155,39 @@ sched_info_switch(struct task_struct *prev, struct task_struct *next)
 #define sched_info_switch(t, next)		do { } while (0)
 #endif /* CONFIG_SCHEDSTATS || CONFIG_TASK_DELAY_ACCT */
 
+#ifdef CONFIG_SCHED_LATENCY_HIST
+extern struct static_key sched_latency_key;
+
+extern void __schedlat_enqueue(struct rq *rq, struct task_struct *p, int flags);
+extern void __schedlat_switch(struct rq *rq, struct task_struct *prev,
+			      struct task_struct *next);
+extern int sched_latency_hist_set_group(struct task_group *tg, bool on);
+
+/*
+ * Called when a task is put on a runqueue, after the rq clock was updated.
+ */
+static inline void
+schedlat_enqueue(struct rq *rq, struct task_struct *p, int flags)
+{
+	if (static_key_false(&sched_latency_key))
+		__schedlat_enqueue(rq, p, flags);
+}
+
+/*
+ * Called when @next was picked to replace @prev on @rq, with rq->lock held.
+ */
+static inline void
+schedlat_switch(struct rq *rq, struct task_struct *prev,
+		struct task_struct *next)
+{
+	if (static_key_false(&sched_latency_key))
+		__schedlat_switch(rq, prev, next);
+}
+#else
+#define schedlat_enqueue(rq, p, flags)		do { } while (0)
+#define schedlat_switch(rq, prev, next)		do { } while (0)
+#endif /* CONFIG_SCHED_LATENCY_HIST */
+
 /*
  * The following are functions that support scheduler-internal time accounting.
  * These functions are generally called at the timer tick.  None of this depends
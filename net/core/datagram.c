@@ -55,6 +55,7 @@
 #include <net/checksum.h>
 #include <net/sock.h>
 #include <net/tcp_states.h>
+#include <net/busy_poll.h>
 #include <trace/events/skb.h>
 
 /*
@@ -212,6 +213,9 @@ struct sk_buff *__skb_recv_datagram(struct sock *sk, unsigned int flags,
 		if (!timeo)
 			goto no_packet;
 
+		/* wait_for_more_packets() returns at once if it worked */
+		sk_busy_read(sk);
+
 	} while (!wait_for_more_packets(sk, err, &timeo, last));
 
 	return NULL;
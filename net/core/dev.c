@@ -129,6 +129,8 @@
 #include <linux/inetdevice.h>
 #include <linux/cpu_rmap.h>
 #include <linux/static_key.h>
+#include <linux/hashtable.h>
+#include <net/busy_poll.h>
 
 #include "net-sysfs.h"
 
@@ -1628,24 +1630,16 @@ static inline bool is_skb_forwardable(struct net_device *dev,
 }
 
 /**
- * dev_forward_skb - loopback an skb to another netif
+ * __dev_forward_skb - prepare an skb to be loopbacked to another netif
  *
  * @dev: destination network device
  * @skb: buffer to forward
  *
- * return values:
- *	NET_RX_SUCCESS	(no congestion)
- *	NET_RX_DROP     (packet was dropped, but freed)
- *
- * dev_forward_skb can be used for injecting an skb from the
- * start_xmit function of one device into the receive queue
- * of another device.
- *
- * The receiving device may be in another namespace, so
- * we have to clear all information in the skb that could
- * impact namespace isolation.
+ * Does what dev_forward_skb() does short of posting the skb, for drivers
+ * that post it themselves.  Returns NET_RX_SUCCESS, or NET_RX_DROP if the
+ * skb was dropped and freed.
  */
-int dev_forward_skb(struct net_device *dev, struct sk_buff *skb)
+int __dev_forward_skb(struct net_device *dev, struct sk_buff *skb)
 {
 	if (skb_shinfo(skb)->tx_flags & SKBTX_DEV_ZEROCOPY) {
 		if (skb_copy_ubufs(skb, GFP_ATOMIC)) {
@@ -1672,7 +1666,31 @@ int dev_forward_skb(struct net_device *dev, struct sk_buff *skb)
 	secpath_reset(skb);
 	nf_reset(skb);
 	nf_reset_trace(skb);
-	return netif_rx(skb);
+	return NET_RX_SUCCESS;
+}
+EXPORT_SYMBOL_GPL(__dev_forward_skb);
+
+/**
+ * dev_forward_skb - loopback an skb to another netif
+ *
+ * @dev: destination network device
+ * @skb: buffer to forward
+ *
+ * return values:
+ *	NET_RX_SUCCESS	(no congestion)
+ *	NET_RX_DROP     (packet was dropped, but freed)
+ *
+ * dev_forward_skb can be used for injecting an skb from the
+ * start_xmit function of one device into the receive queue
+ * of another device.
+ *
+ * The receiving device may be in another namespace, so
+ * we have to clear all information in the skb that could
+ * impact namespace isolation.
+ */
+int dev_forward_skb(struct net_device *dev, struct sk_buff *skb)
+{
+	return __dev_forward_skb(dev, skb) ?: netif_rx(skb);
 }
 EXPORT_SYMBOL_GPL(dev_forward_skb);
 
@@ -2651,16 +2669,62 @@ static void qdisc_pkt_len_init(struct sk_buff *skb)
 	}
 }
 
+/*
+ * Transmit through a root qdisc staging packets per cpu: the packet is
+ * queued on this cpu's stage without the root lock and whoever holds
+ * the lock moves it into the qdisc. A sender that cannot take the lock
+ * leaves its packet to the holder and returns, one that has a full batch
+ * staged waits for the lock, which pushes back on it. Packets dropped by
+ * the qdisc are not reported to the sender.
+ */
+static int __dev_xmit_skb_staged(struct sk_buff *skb, struct Qdisc *q,
+				 struct qdisc_stage *stage)
+{
+	struct sk_buff_head *list = this_cpu_ptr(stage->cpu);
+	spinlock_t *root_lock = qdisc_lock(q);
+	unsigned int qlen;
+
+	skb_dst_force(skb);
+	spin_lock(&list->lock);
+	__skb_queue_tail(list, skb);
+	qlen = skb_queue_len(list);
+	spin_unlock(&list->lock);
+
+	if (unlikely(qlen >= ACCESS_ONCE(stage->batch))) {
+		spin_lock(root_lock);
+	} else if (!spin_trylock(root_lock)) {
+		set_bit(QDISC_STAGE_MISSED, &stage->state);
+		smp_mb__after_clear_bit();
+		if (!spin_trylock(root_lock)) {
+			/*
+			 * The holder drains the stage if it is a sender or
+			 * runs the qdisc. Otherwise, have the qdisc run later.
+			 */
+			if (!qdisc_is_running(q))
+				__netif_schedule(q);
+			return NET_XMIT_SUCCESS;
+		}
+	}
+	qdisc_stage_run(q, stage);
+	return NET_XMIT_SUCCESS;
+}
+
 static inline int __dev_xmit_skb(struct sk_buff *skb, struct Qdisc *q,
 				 struct net_device *dev,
 				 struct netdev_queue *txq)
 {
 	spinlock_t *root_lock = qdisc_lock(q);
+	struct qdisc_stage *stage;
 	bool contended;
 	int rc;
 
 	qdisc_pkt_len_init(skb);
 	qdisc_calculate_pkt_len(skb, q);
+
+	stage = rcu_dereference_bh(txq->qdisc_stage);
+	if (stage && stage->qdisc == q)
+		return __dev_xmit_skb_staged(skb, q, stage);
+
 	/*
 	 * Heuristic to force contended enqueues to serialize on a
 	 * separate lock before trying to get qdisc main lock.
@@ -3211,6 +3275,193 @@ int netif_rx_ni(struct sk_buff *skb)
 }
 EXPORT_SYMBOL(netif_rx_ni);
 
+/*
+ * GRO cells
+ *
+ * netif_rx() hands packets up one at a time from the backlog, without
+ * GRO.  Devices that receive from the transmit path of another device or
+ * from user space rather than from an interrupt (veth, loopback, tun) can
+ * instead queue on a per cpu GRO cell, whose NAPI poll takes everything
+ * queued at once and feeds it to GRO, so that a TCP flow going through
+ * them is coalesced like one received by a NAPI driver.  With GRO turned
+ * off on the device, packets take the netif_rx() path.
+ */
+static int netif_gro_cell_poll(struct napi_struct *napi, int budget)
+{
+	struct netif_gro_cell *cell = container_of(napi, struct netif_gro_cell,
+						   napi);
+	struct sk_buff *skb;
+	int work = 0;
+
+	while (work < budget) {
+		skb = __skb_dequeue(&cell->process);
+		if (!skb) {
+			spin_lock_irq(&cell->queue.lock);
+			skb_queue_splice_tail_init(&cell->queue,
+						   &cell->process);
+			spin_unlock_irq(&cell->queue.lock);
+
+			skb = __skb_dequeue(&cell->process);
+			if (!skb)
+				break;
+		}
+
+		napi_gro_receive(napi, skb);
+		work++;
+	}
+
+	if (work < budget) {
+		napi_complete(napi);
+		/* Pairs with the test_and_set_bit() of a producer that saw
+		 * us still scheduled.
+		 */
+		smp_mb();
+		if (!skb_queue_empty(&cell->queue))
+			napi_schedule(napi);
+	}
+	return work;
+}
+
+/**
+ *	netif_gro_cells_init - set up the GRO cells of a device
+ *	@gcells: cells to set up
+ *	@dev: device receiving through them
+ */
+int netif_gro_cells_init(struct netif_gro_cells *gcells,
+			 struct net_device *dev)
+{
+	int cpu;
+
+	gcells->cells = alloc_percpu(struct netif_gro_cell);
+	if (!gcells->cells)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct netif_gro_cell *cell = per_cpu_ptr(gcells->cells, cpu);
+
+		skb_queue_head_init(&cell->queue);
+		__skb_queue_head_init(&cell->process);
+		netif_napi_add(dev, &cell->napi, netif_gro_cell_poll,
+			       NAPI_POLL_WEIGHT);
+		napi_enable(&cell->napi);
+	}
+	return 0;
+}
+EXPORT_SYMBOL(netif_gro_cells_init);
+
+/**
+ *	netif_gro_cells_destroy - free the GRO cells of a device
+ *	@gcells: cells to free
+ *
+ *	Must be called once the device can no longer receive, before it is
+ *	freed.  Packets still queued are dropped.
+ */
+void netif_gro_cells_destroy(struct netif_gro_cells *gcells)
+{
+	bool hashed = false;
+	int cpu;
+
+	if (!gcells->cells)
+		return;
+
+	/* one grace period for all cells rather than one each */
+	for_each_possible_cpu(cpu)
+		hashed |= napi_hash_del(&per_cpu_ptr(gcells->cells, cpu)->napi);
+	if (hashed)
+		synchronize_net();
+
+	for_each_possible_cpu(cpu) {
+		struct netif_gro_cell *cell = per_cpu_ptr(gcells->cells, cpu);
+
+		napi_disable(&cell->napi);
+		netif_napi_del(&cell->napi);
+		skb_queue_purge(&cell->queue);
+		__skb_queue_purge(&cell->process);
+	}
+	free_percpu(gcells->cells);
+	gcells->cells = NULL;
+}
+EXPORT_SYMBOL(netif_gro_cells_destroy);
+
+/**
+ *	netif_gro_cells_receive	-	post buffer to a GRO cell
+ *	@gcells: cells of the receiving device
+ *	@skb: buffer to post
+ *
+ *	Like netif_rx(), but the packet is queued on the cell of the current
+ *	cpu, to go through GRO.  May be called from any context.
+ *
+ *	return values:
+ *	NET_RX_SUCCESS	(no congestion)
+ *	NET_RX_DROP     (packet was dropped)
+ */
+int netif_gro_cells_receive(struct netif_gro_cells *gcells,
+			    struct sk_buff *skb)
+{
+	struct netif_gro_cell *cell;
+	unsigned long flags;
+
+	if (!gcells->cells || !(skb->dev->features & NETIF_F_GRO))
+		return netif_rx(skb);
+
+	net_timestamp_check(netdev_tstamp_prequeue, skb);
+
+	trace_netif_rx(skb);
+
+	local_irq_save(flags);
+	cell = this_cpu_ptr(gcells->cells);
+
+	spin_lock(&cell->queue.lock);
+	if (unlikely(skb_queue_len(&cell->queue) > netdev_max_backlog)) {
+		spin_unlock(&cell->queue.lock);
+		local_irq_restore(flags);
+
+		atomic_long_inc(&skb->dev->rx_dropped);
+		kfree_skb(skb);
+		return NET_RX_DROP;
+	}
+	__skb_queue_tail(&cell->queue, skb);
+	spin_unlock(&cell->queue.lock);
+
+	if (napi_schedule_prep(&cell->napi))
+		____napi_schedule(&__get_cpu_var(softnet_data), &cell->napi);
+	local_irq_restore(flags);
+
+	return NET_RX_SUCCESS;
+}
+EXPORT_SYMBOL(netif_gro_cells_receive);
+
+/**
+ *	netif_gro_cells_receive_ni - netif_gro_cells_receive() from process context
+ *	@gcells: cells of the receiving device
+ *	@skb: buffer to post
+ *	@batch: packets to let queue up before processing them
+ *
+ *	Like netif_rx_ni(), the cell is run before returning, but only once
+ *	@batch packets are queued on it.  Until then they are left to
+ *	ksoftirqd, so that GRO gets to coalesce the packets of a writer that
+ *	posts bursts, at the cost of some latency.
+ */
+int netif_gro_cells_receive_ni(struct netif_gro_cells *gcells,
+			       struct sk_buff *skb, unsigned int batch)
+{
+	bool defer = batch > 1 && gcells->cells &&
+		     (skb->dev->features & NETIF_F_GRO);
+	int err;
+
+	preempt_disable();
+	err = netif_gro_cells_receive(gcells, skb);
+	if (defer &&
+	    skb_queue_len(&this_cpu_ptr(gcells->cells)->queue) < batch)
+		raise_softirq(NET_RX_SOFTIRQ);
+	else if (local_softirq_pending())
+		do_softirq();
+	preempt_enable();
+
+	return err;
+}
+EXPORT_SYMBOL(netif_gro_cells_receive_ni);
+
 static void net_tx_action(struct softirq_action *h)
 {
 	struct softnet_data *sd = &__get_cpu_var(softnet_data);
@@ -3250,9 +3501,17 @@ static void net_tx_action(struct softirq_action *h)
 
 			root_lock = qdisc_lock(q);
 			if (spin_trylock(root_lock)) {
+				struct qdisc_stage *stage;
+
 				smp_mb__before_clear_bit();
 				clear_bit(__QDISC_STATE_SCHED,
 					  &q->state);
+				stage = rcu_dereference_bh(
+						q->dev_queue->qdisc_stage);
+				if (stage && stage->qdisc == q) {
+					qdisc_stage_run(q, stage);
+					continue;
+				}
 				qdisc_run(q);
 				spin_unlock(root_lock);
 			} else {
@@ -3847,7 +4106,7 @@ static gro_result_t napi_skb_finish(gro_result_t ret, struct sk_buff *skb)
 
 	case GRO_MERGED_FREE:
 		if (NAPI_GRO_CB(skb)->free == NAPI_GRO_FREE_STOLEN_HEAD)
-			kmem_cache_free(skbuff_head_cache, skb);
+			kfree_skb_partial(skb, true);
 		else
 			__kfree_skb(skb);
 		break;
@@ -3879,6 +4138,7 @@ static void skb_gro_reset_offset(struct sk_buff *skb)
 
 gro_result_t napi_gro_receive(struct napi_struct *napi, struct sk_buff *skb)
 {
+	skb_mark_napi_id(skb, napi);
 	skb_gro_reset_offset(skb);
 
 	return napi_skb_finish(dev_gro_receive(napi, skb), skb);
@@ -3979,6 +4239,7 @@ gro_result_t napi_gro_frags(struct napi_struct *napi)
 	if (!skb)
 		return GRO_DROP;
 
+	skb_mark_napi_id(skb, napi);
 	return napi_frags_finish(napi, skb, dev_gro_receive(napi, skb));
 }
 EXPORT_SYMBOL(napi_gro_frags);
@@ -4113,6 +4374,132 @@ void napi_complete(struct napi_struct *n)
 }
 EXPORT_SYMBOL(napi_complete);
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+/* NAPI contexts by id, for busy polling sockets */
+static DEFINE_SPINLOCK(napi_hash_lock);
+static unsigned int napi_gen_id;
+static DEFINE_HASHTABLE(napi_hash, 8);
+
+/* Must be called under rcu_read_lock() or napi_hash_lock */
+static struct napi_struct *napi_by_id(unsigned int napi_id)
+{
+	struct napi_struct *napi;
+
+	hash_for_each_possible_rcu(napi_hash, napi, napi_hash_node, napi_id)
+		if (napi->napi_id == napi_id)
+			return napi;
+
+	return NULL;
+}
+
+static void napi_hash_add(struct napi_struct *napi)
+{
+	spin_lock(&napi_hash_lock);
+
+	/* 0 is no id, and the ids of long lived contexts may be reached
+	 * again after a wrap around
+	 */
+	do {
+		if (unlikely(!++napi_gen_id))
+			napi_gen_id = 1;
+	} while (napi_by_id(napi_gen_id));
+
+	napi->napi_id = napi_gen_id;
+	hash_add_rcu(napi_hash, &napi->napi_hash_node, napi->napi_id);
+	set_bit(NAPI_STATE_HASHED, &napi->state);
+
+	spin_unlock(&napi_hash_lock);
+}
+
+bool napi_hash_del(struct napi_struct *napi)
+{
+	bool hashed = false;
+
+	spin_lock(&napi_hash_lock);
+	if (test_and_clear_bit(NAPI_STATE_HASHED, &napi->state)) {
+		hash_del_rcu(&napi->napi_hash_node);
+		hashed = true;
+	}
+	spin_unlock(&napi_hash_lock);
+
+	return hashed;
+}
+
+/*
+ * Poll @napi once with a small budget, as net_rx_action() would, unless
+ * it is scheduled or being polled already.  Called with BHs off.  The
+ * driver's napi_complete() takes it off the local list; if it still has
+ * work when the budget runs out it is handed to the NET_RX softirq.
+ */
+static void busy_poll_napi(struct napi_struct *napi)
+{
+	LIST_HEAD(busy_list);
+	void *have;
+
+	if (!napi_schedule_prep(napi))
+		return;
+
+	have = netpoll_poll_lock(napi);
+	list_add(&napi->poll_list, &busy_list);
+	napi->poll(napi, BUSY_POLL_BUDGET);
+	if (!list_empty(&busy_list)) {
+		list_del(&napi->poll_list);
+		__napi_schedule(napi);
+	}
+	netpoll_poll_unlock(have);
+}
+
+/**
+ *	sk_busy_loop - busy poll for a socket to receive
+ *	@sk: socket, see sk_can_busy_loop()
+ *	@usecs: time to spin at most, 0 for a single pass
+ *
+ *	Polls the NAPI context @sk last received from until @sk has
+ *	something to receive, the time is up or the task has to give up the
+ *	cpu.  Softirqs raised meanwhile run when BHs are enabled again after
+ *	each poll.  Returns true if @sk has something to receive.
+ */
+bool sk_busy_loop(struct sock *sk, unsigned int usecs)
+{
+	struct socket_wq *wq = rcu_dereference_protected(sk->sk_socket->wq, 1);
+	u64 end = local_clock() + (u64)usecs * NSEC_PER_USEC;
+	struct napi_struct *napi;
+
+	rcu_read_lock();
+
+	/* Nothing is coming from a context that is gone or down */
+	napi = napi_by_id(ACCESS_ONCE(wq->napi_id));
+	if (!napi || !netif_running(napi->dev))
+		goto out;
+
+	for (;;) {
+		local_bh_disable();
+		busy_poll_napi(napi);
+		local_bh_enable();
+
+		if (!skb_queue_empty(&sk->sk_receive_queue) ||
+		    need_resched() || signal_pending(current) ||
+		    local_clock() >= end)
+			break;
+		cpu_relax();
+	}
+out:
+	rcu_read_unlock();
+	return !skb_queue_empty(&sk->sk_receive_queue);
+}
+EXPORT_SYMBOL(sk_busy_loop);
+#else
+static inline void napi_hash_add(struct napi_struct *napi)
+{
+}
+
+bool napi_hash_del(struct napi_struct *napi)
+{
+	return false;
+}
+#endif /* CONFIG_NET_RX_BUSY_POLL */
+EXPORT_SYMBOL_GPL(napi_hash_del);
+
 void netif_napi_add(struct net_device *dev, struct napi_struct *napi,
 		    int (*poll)(struct napi_struct *, int), int weight)
 {
@@ -4132,6 +4519,7 @@ void netif_napi_add(struct net_device *dev, struct napi_struct *napi,
 	napi->poll_owner = -1;
 #endif
 	set_bit(NAPI_STATE_SCHED, &napi->state);
+	napi_hash_add(napi);
 }
 EXPORT_SYMBOL(netif_napi_add);
 
@@ -4139,6 +4527,10 @@ void netif_napi_del(struct napi_struct *napi)
 {
 	struct sk_buff *skb, *next;
 
+	/* busy pollers may still be looking at it */
+	if (napi_hash_del(napi))
+		synchronize_net();
+
 	list_del_init(&napi->dev_list);
 	napi_free_frags(napi);
 
@@ -5741,6 +6133,7 @@ EXPORT_SYMBOL(alloc_netdev_mqs);
 void free_netdev(struct net_device *dev)
 {
 	struct napi_struct *p, *n;
+	bool hashed = false;
 
 	release_net(dev_net(dev));
 
@@ -5754,6 +6147,10 @@ void free_netdev(struct net_device *dev)
 	/* Flush device addresses */
 	dev_addr_flush(dev);
 
+	list_for_each_entry(p, &dev->napi_list, dev_list)
+		hashed |= napi_hash_del(p);
+	if (hashed)
+		synchronize_net();
 	list_for_each_entry_safe(p, n, &dev->napi_list, dev_list)
 		netif_napi_del(p);
 
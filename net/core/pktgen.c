@@ -199,6 +199,10 @@
 #define F_QUEUE_MAP_CPU (1<<14)	/* queue map mirrors smp_processor_id() */
 #define F_NODE          (1<<15)	/* Node memory alloc*/
 
+/* Xmit modes */
+#define M_START_XMIT		0	/* Default normal TX */
+#define M_NETIF_RECEIVE		1	/* Inject packets into stack */
+
 /* Thread control flag bits */
 #define T_STOP        (1<<0)	/* Stop run */
 #define T_RUN         (1<<1)	/* Start run */
@@ -382,6 +386,7 @@ struct pktgen_dev {
 	u16 queue_map_max;
 	__u32 skb_priority;	/* skb priority field */
 	int node;               /* Memory node */
+	int xmit_mode;		/* M_START_XMIT or M_NETIF_RECEIVE */
 
 #ifdef CONFIG_XFRM
 	__u8	ipsmode;		/* IPSEC mode (config) */
@@ -539,6 +544,10 @@ static int pktgen_if_show(struct seq_file *seq, void *v)
 	seq_printf(seq, "     flows: %u flowlen: %u\n", pkt_dev->cflows,
 		   pkt_dev->lflow);
 
+	seq_printf(seq, "     xmit_mode: %s\n",
+		   pkt_dev->xmit_mode == M_NETIF_RECEIVE ?
+		   "netif_receive" : "start_xmit");
+
 	seq_printf(seq,
 		   "     queue_map_min: %u  queue_map_max: %u\n",
 		   pkt_dev->queue_map_min,
@@ -1064,7 +1073,8 @@ static ssize_t pktgen_if_write(struct file *file,
 		if (len < 0)
 			return len;
 		if ((value > 0) &&
-		    (!(pkt_dev->odev->priv_flags & IFF_TX_SKB_SHARING)))
+		    ((pkt_dev->xmit_mode == M_NETIF_RECEIVE) ||
+		     !(pkt_dev->odev->priv_flags & IFF_TX_SKB_SHARING)))
 			return -ENOTSUPP;
 		i += len;
 		pkt_dev->clone_skb = value;
@@ -1072,6 +1082,35 @@ static ssize_t pktgen_if_write(struct file *file,
 		sprintf(pg_result, "OK: clone_skb=%d", pkt_dev->clone_skb);
 		return count;
 	}
+	if (!strcmp(name, "xmit_mode")) {
+		char f[32];
+
+		memset(f, 0, 32);
+		len = strn_len(&user_buffer[i], sizeof(f) - 1);
+		if (len < 0)
+			return len;
+
+		if (copy_from_user(f, &user_buffer[i], len))
+			return -EFAULT;
+		i += len;
+
+		if (strcmp(f, "start_xmit") == 0) {
+			pkt_dev->xmit_mode = M_START_XMIT;
+		} else if (strcmp(f, "netif_receive") == 0) {
+			/* clone_skb set earlier, not supported in this mode */
+			if (pkt_dev->clone_skb > 0)
+				return -ENOTSUPP;
+
+			pkt_dev->xmit_mode = M_NETIF_RECEIVE;
+		} else {
+			sprintf(pg_result,
+				"xmit_mode -:%s:- unknown\nAvailable modes: %s",
+				f, "start_xmit, netif_receive\n");
+			return count;
+		}
+		sprintf(pg_result, "OK: xmit_mode=%s", f);
+		return count;
+	}
 	if (!strcmp(name, "count")) {
 		len = num_arg(&user_buffer[i], 10, &value);
 		if (len < 0)
@@ -3183,6 +3222,10 @@ static void pktgen_wait_for_skb(struct pktgen_dev *pkt_dev)
 {
 	ktime_t idle_start = ktime_get();
 
+	/* packets injected into the stack are not kept */
+	if (!pkt_dev->skb)
+		return;
+
 	while (atomic_read(&(pkt_dev->skb->users)) != 1) {
 		if (signal_pending(current))
 			break;
@@ -3195,6 +3238,41 @@ static void pktgen_wait_for_skb(struct pktgen_dev *pkt_dev)
 	pkt_dev->idle_acc += ktime_to_ns(ktime_sub(ktime_get(), idle_start));
 }
 
+/*
+ * Hand a new packet to the stack as if odev had received it, to measure
+ * the receive path: allocation, protocol demux and free of the skb.
+ * Every packet is allocated by fill_packet(), so clone_skb is not used.
+ */
+static void pktgen_receive(struct pktgen_dev *pkt_dev)
+{
+	struct sk_buff *skb;
+
+	if (pkt_dev->delay)
+		spin(pkt_dev, pkt_dev->next_tx);
+
+	/* as a NAPI poll would: the skb is allocated and freed with BHs off */
+	local_bh_disable();
+	skb = fill_packet(pkt_dev->odev, pkt_dev);
+	if (unlikely(!skb)) {
+		local_bh_enable();
+		pr_err("ERROR: couldn't allocate skb in fill_packet\n");
+		schedule();
+		return;
+	}
+	pkt_dev->last_pkt_size = skb->len;
+	pkt_dev->allocated_skbs++;
+
+	skb->protocol = eth_type_trans(skb, skb->dev);
+	if (netif_receive_skb(skb) == NET_RX_DROP)
+		pkt_dev->errors++;
+	local_bh_enable();
+
+	pkt_dev->last_ok = 1;
+	pkt_dev->sofar++;
+	pkt_dev->seq_num++;
+	pkt_dev->tx_bytes += pkt_dev->last_pkt_size;
+}
+
 static void pktgen_xmit(struct pktgen_dev *pkt_dev)
 {
 	struct net_device *odev = pkt_dev->odev;
@@ -3218,6 +3296,11 @@ static void pktgen_xmit(struct pktgen_dev *pkt_dev)
 		return;
 	}
 
+	if (pkt_dev->xmit_mode == M_NETIF_RECEIVE) {
+		pktgen_receive(pkt_dev);
+		goto out;
+	}
+
 	/* If no skb or clone count exhausted then get new one */
 	if (!pkt_dev->skb || (pkt_dev->last_ok &&
 			      ++pkt_dev->clone_count >= pkt_dev->clone_skb)) {
@@ -3279,7 +3362,7 @@ static void pktgen_xmit(struct pktgen_dev *pkt_dev)
 	}
 unlock:
 	__netif_tx_unlock_bh(txq);
-
+out:
 	/* If pkt_dev->count is zero, then run forever */
 	if ((pkt_dev->count != 0) && (pkt_dev->sofar >= pkt_dev->count)) {
 		pktgen_wait_for_skb(pkt_dev);
@@ -60,6 +60,7 @@
 #include <linux/scatterlist.h>
 #include <linux/errqueue.h>
 #include <linux/prefetch.h>
+#include <linux/cpu.h>
 
 #include <net/protocol.h>
 #include <net/dst.h>
@@ -74,6 +75,70 @@
 struct kmem_cache *skbuff_head_cache __read_mostly;
 static struct kmem_cache *skbuff_fclone_cache __read_mostly;
 
+/*
+ * Per cpu cache of sk_buff heads.
+ *
+ * On the receive path an skb is mostly allocated in a NAPI poll and freed
+ * in softirq context on the same cpu: once forwarded, dropped, merged by
+ * GRO or consumed as a pure ACK.  Heads freed with BHs off are stacked
+ * per cpu for the next allocation with BHs off, so that these pairs do
+ * not go through the slab and reuse a cache hot object.  When the stack
+ * overflows, its older half goes back to the slab at once.
+ */
+#define SKB_HEAD_CACHE_SIZE	64
+
+struct skb_head_cache {
+	unsigned int	count;
+	void		*heads[SKB_HEAD_CACHE_SIZE];
+};
+static DEFINE_PER_CPU(struct skb_head_cache, skb_head_cache);
+
+/* BHs off, and not in a hardirq that may have interrupted them */
+static inline bool skb_head_cache_usable(void)
+{
+	return in_softirq() && !in_irq() && !in_nmi();
+}
+
+static struct sk_buff *skb_head_alloc(gfp_t gfp_mask, int node)
+{
+	if (skb_head_cache_usable()) {
+		struct skb_head_cache *hc = &__get_cpu_var(skb_head_cache);
+
+		if (hc->count)
+			return hc->heads[--hc->count];
+	}
+	return kmem_cache_alloc_node(skbuff_head_cache,
+				     gfp_mask & ~__GFP_DMA, node);
+}
+
+static void skb_head_free(struct sk_buff *skb)
+{
+	struct skb_head_cache *hc;
+	unsigned int i, half;
+
+	if (!skb_head_cache_usable()) {
+		kmem_cache_free(skbuff_head_cache, skb);
+		return;
+	}
+
+	hc = &__get_cpu_var(skb_head_cache);
+	if (unlikely(hc->count == SKB_HEAD_CACHE_SIZE)) {
+		half = SKB_HEAD_CACHE_SIZE / 2;
+		for (i = 0; i < half; i++)
+			kmem_cache_free(skbuff_head_cache, hc->heads[i]);
+		memmove(hc->heads, hc->heads + half,
+			(hc->count - half) * sizeof(hc->heads[0]));
+		hc->count -= half;
+	}
+	hc->heads[hc->count++] = skb;
+}
+
+static void skb_head_cache_drain(struct skb_head_cache *hc)
+{
+	while (hc->count)
+		kmem_cache_free(skbuff_head_cache, hc->heads[--hc->count]);
+}
+
 static void sock_pipe_buf_release(struct pipe_inode_info *pipe,
 				  struct pipe_buffer *buf)
 {
@@ -184,8 +249,7 @@ struct sk_buff *__alloc_skb_head(gfp_t gfp_mask, int node)
 	struct sk_buff *skb;
 
 	/* Get the HEAD */
-	skb = kmem_cache_alloc_node(skbuff_head_cache,
-				    gfp_mask & ~__GFP_DMA, node);
+	skb = skb_head_alloc(gfp_mask, node);
 	if (!skb)
 		goto out;
 
@@ -239,7 +303,10 @@ struct sk_buff *__alloc_skb(unsigned int size, gfp_t gfp_mask,
 		gfp_mask |= __GFP_MEMALLOC;
 
 	/* Get the HEAD */
-	skb = kmem_cache_alloc_node(cache, gfp_mask & ~__GFP_DMA, node);
+	if (flags & SKB_ALLOC_FCLONE)
+		skb = kmem_cache_alloc_node(cache, gfp_mask & ~__GFP_DMA, node);
+	else
+		skb = skb_head_alloc(gfp_mask, node);
 	if (!skb)
 		goto out;
 	prefetchw(skb);
@@ -301,7 +368,10 @@ struct sk_buff *__alloc_skb(unsigned int size, gfp_t gfp_mask,
 out:
 	return skb;
 nodata:
-	kmem_cache_free(cache, skb);
+	if (flags & SKB_ALLOC_FCLONE)
+		kmem_cache_free(cache, skb);
+	else
+		skb_head_free(skb);
 	skb = NULL;
 	goto out;
 }
@@ -330,7 +400,7 @@ struct sk_buff *build_skb(void *data, unsigned int frag_size)
 	struct sk_buff *skb;
 	unsigned int size = frag_size ? : ksize(data);
 
-	skb = kmem_cache_alloc(skbuff_head_cache, GFP_ATOMIC);
+	skb = skb_head_alloc(GFP_ATOMIC, NUMA_NO_NODE);
 	if (!skb)
 		return NULL;
 
@@ -367,16 +437,15 @@ struct netdev_alloc_cache {
 	unsigned int		pagecnt_bias;
 };
 static DEFINE_PER_CPU(struct netdev_alloc_cache, netdev_alloc_cache);
+/* Only used with BHs off, so it does not need interrupts disabled */
+static DEFINE_PER_CPU(struct netdev_alloc_cache, napi_alloc_cache);
 
-static void *__netdev_alloc_frag(unsigned int fragsz, gfp_t gfp_mask)
+static void *__alloc_page_frag(struct netdev_alloc_cache *nc,
+			       unsigned int fragsz, gfp_t gfp_mask)
 {
-	struct netdev_alloc_cache *nc;
 	void *data = NULL;
 	int order;
-	unsigned long flags;
 
-	local_irq_save(flags);
-	nc = &__get_cpu_var(netdev_alloc_cache);
 	if (unlikely(!nc->frag.page)) {
 refill:
 		for (order = NETDEV_FRAG_PAGE_MAX_ORDER; ;) {
@@ -409,6 +478,17 @@ recycle:
 	nc->frag.offset += fragsz;
 	nc->pagecnt_bias--;
 end:
+	return data;
+}
+
+static void *__netdev_alloc_frag(unsigned int fragsz, gfp_t gfp_mask)
+{
+	unsigned long flags;
+	void *data;
+
+	local_irq_save(flags);
+	data = __alloc_page_frag(&__get_cpu_var(netdev_alloc_cache), fragsz,
+				 gfp_mask);
 	local_irq_restore(flags);
 	return data;
 }
@@ -426,6 +506,20 @@ void *netdev_alloc_frag(unsigned int fragsz)
 }
 EXPORT_SYMBOL(netdev_alloc_frag);
 
+/**
+ * napi_alloc_frag - allocate a page fragment from BH context
+ * @fragsz: fragment size
+ *
+ * Like netdev_alloc_frag(), for NAPI polls and other callers with BHs
+ * off, from a cache that does not need interrupts disabled.
+ */
+void *napi_alloc_frag(unsigned int fragsz)
+{
+	return __alloc_page_frag(&__get_cpu_var(napi_alloc_cache), fragsz,
+				 GFP_ATOMIC | __GFP_COLD);
+}
+EXPORT_SYMBOL(napi_alloc_frag);
+
 /**
  *	__netdev_alloc_skb - allocate an skbuff for rx on a specific device
  *	@dev: network device to receive on
@@ -471,6 +565,53 @@ struct sk_buff *__netdev_alloc_skb(struct net_device *dev,
 }
 EXPORT_SYMBOL(__netdev_alloc_skb);
 
+/**
+ *	__napi_alloc_skb - allocate an skbuff for rx in a NAPI poll
+ *	@napi: napi context the skb is received on
+ *	@length: length to allocate
+ *	@gfp_mask: get_free_pages mask, passed to alloc_skb
+ *
+ *	Like __netdev_alloc_skb(), but only for callers with BHs off: small
+ *	buffers are carved from the napi_alloc_frag() cache and the sk_buff
+ *	is taken from the per cpu head cache.  The buffer has NET_SKB_PAD
+ *	and NET_IP_ALIGN of headroom built in.
+ *
+ *	%NULL is returned if there is no free memory.
+ */
+struct sk_buff *__napi_alloc_skb(struct napi_struct *napi,
+				 unsigned int length, gfp_t gfp_mask)
+{
+	struct sk_buff *skb = NULL;
+	unsigned int fragsz;
+
+	length += NET_SKB_PAD + NET_IP_ALIGN;
+	fragsz = SKB_DATA_ALIGN(length) +
+		 SKB_DATA_ALIGN(sizeof(struct skb_shared_info));
+
+	if (fragsz <= PAGE_SIZE && !(gfp_mask & (__GFP_WAIT | GFP_DMA))) {
+		void *data;
+
+		if (sk_memalloc_socks())
+			gfp_mask |= __GFP_MEMALLOC;
+
+		data = __alloc_page_frag(&__get_cpu_var(napi_alloc_cache),
+					 fragsz, gfp_mask);
+		if (likely(data)) {
+			skb = build_skb(data, fragsz);
+			if (unlikely(!skb))
+				put_page(virt_to_head_page(data));
+		}
+	} else {
+		skb = __alloc_skb(length, gfp_mask, SKB_ALLOC_RX, NUMA_NO_NODE);
+	}
+	if (likely(skb)) {
+		skb_reserve(skb, NET_SKB_PAD + NET_IP_ALIGN);
+		skb->dev = napi->dev;
+	}
+	return skb;
+}
+EXPORT_SYMBOL(__napi_alloc_skb);
+
 void skb_add_rx_frag(struct sk_buff *skb, int i, struct page *page, int off,
 		     int size, unsigned int truesize)
 {
@@ -549,7 +690,7 @@ static void kfree_skbmem(struct sk_buff *skb)
 
 	switch (skb->fclone) {
 	case SKB_FCLONE_UNAVAILABLE:
-		kmem_cache_free(skbuff_head_cache, skb);
+		skb_head_free(skb);
 		break;
 
 	case SKB_FCLONE_ORIG:
@@ -697,6 +838,45 @@ void consume_skb(struct sk_buff *skb)
 }
 EXPORT_SYMBOL(consume_skb);
 
+/**
+ *	napi_consume_skb - free an skbuff from a NAPI poll
+ *	@skb: buffer to free
+ *	@budget: budget the poll was called with
+ *
+ *	For transmit completions done in a NAPI poll.  The skb state and data
+ *	are released right away, the head is stacked on the per cpu cache for
+ *	the skbs the same poll allocates, and the cache returns heads to the
+ *	slab half a stack at a time.  netpoll calls the poll with a zero
+ *	budget, possibly with interrupts disabled, in which case the skb is
+ *	freed as dev_kfree_skb_any() would.
+ */
+void napi_consume_skb(struct sk_buff *skb, int budget)
+{
+	if (unlikely(!skb))
+		return;
+
+	if (unlikely(!budget)) {
+		dev_kfree_skb_any(skb);
+		return;
+	}
+
+	if (likely(atomic_read(&skb->users) == 1))
+		smp_rmb();
+	else if (likely(!atomic_dec_and_test(&skb->users)))
+		return;
+	trace_consume_skb(skb);
+
+	/* fclones share their slab object, leave them to kfree_skbmem() */
+	if (skb->fclone != SKB_FCLONE_UNAVAILABLE) {
+		__kfree_skb(skb);
+		return;
+	}
+
+	skb_release_all(skb);
+	skb_head_free(skb);
+}
+EXPORT_SYMBOL(napi_consume_skb);
+
 static void __copy_skb_header(struct sk_buff *new, const struct sk_buff *old)
 {
 	new->tstamp		= old->tstamp;
@@ -744,6 +924,10 @@ static void __copy_skb_header(struct sk_buff *new, const struct sk_buff *old)
 	new->vlan_tci		= old->vlan_tci;
 
 	skb_copy_secmark(new, old);
+
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	new->napi_id		= old->napi_id;
+#endif
 }
 
 /*
@@ -904,7 +1088,7 @@ struct sk_buff *skb_clone(struct sk_buff *skb, gfp_t gfp_mask)
 		if (skb_pfmemalloc(skb))
 			gfp_mask |= __GFP_MEMALLOC;
 
-		n = kmem_cache_alloc(skbuff_head_cache, gfp_mask);
+		n = skb_head_alloc(gfp_mask, NUMA_NO_NODE);
 		if (!n)
 			return NULL;
 
@@ -3099,6 +3283,33 @@ done:
 }
 EXPORT_SYMBOL_GPL(skb_gro_receive);
 
+/*
+ * The caches of a cpu that went offline are only touched again once it is
+ * back, hand their heads and the napi frag page back now.
+ */
+static int skb_cpu_callback(struct notifier_block *nfb,
+			    unsigned long action, void *hcpu)
+{
+	unsigned int cpu = (unsigned long)hcpu;
+	struct netdev_alloc_cache *nc;
+
+	if (action != CPU_DEAD && action != CPU_DEAD_FROZEN)
+		return NOTIFY_OK;
+
+	skb_head_cache_drain(&per_cpu(skb_head_cache, cpu));
+
+	nc = &per_cpu(napi_alloc_cache, cpu);
+	if (nc->frag.page) {
+		if (nc->pagecnt_bias) {
+			atomic_sub(nc->pagecnt_bias - 1,
+				   &nc->frag.page->_count);
+			put_page(nc->frag.page);
+		}
+		nc->frag.page = NULL;
+	}
+	return NOTIFY_OK;
+}
+
 void __init skb_init(void)
 {
 	skbuff_head_cache = kmem_cache_create("skbuff_head_cache",
@@ -3112,6 +3323,7 @@ void __init skb_init(void)
 						0,
 						SLAB_HWCACHE_ALIGN|SLAB_PANIC,
 						NULL);
+	hotcpu_notifier(skb_cpu_callback, 0);
 }
 
 /**
@@ -3436,7 +3648,7 @@ void kfree_skb_partial(struct sk_buff *skb, bool head_stolen)
 {
 	if (head_stolen) {
 		skb_release_head_state(skb);
-		kmem_cache_free(skbuff_head_cache, skb);
+		skb_head_free(skb);
 	} else {
 		__kfree_skb(skb);
 	}
@@ -130,6 +130,7 @@
 #include <linux/ipsec.h>
 #include <net/cls_cgroup.h>
 #include <net/netprio_cgroup.h>
+#include <net/busy_poll.h>
 
 #include <linux/filter.h>
 
@@ -273,6 +274,12 @@ __u32 sysctl_rmem_default __read_mostly = SK_RMEM_MAX;
 int sysctl_optmem_max __read_mostly = sizeof(unsigned long)*(2*UIO_MAXIOV+512);
 EXPORT_SYMBOL(sysctl_optmem_max);
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+/* Busy polling in usecs: SO_BUSY_POLL default, and for poll() and select() */
+unsigned int sysctl_net_busy_read __read_mostly;
+unsigned int sysctl_net_busy_poll __read_mostly;
+#endif
+
 struct static_key memalloc_socks = STATIC_KEY_INIT_FALSE;
 EXPORT_SYMBOL_GPL(memalloc_socks);
 
@@ -419,6 +426,8 @@ int sock_queue_rcv_skb(struct sock *sk, struct sk_buff *skb)
 	 */
 	skb_dst_force(skb);
 
+	sk_mark_napi_id(sk, skb);
+
 	spin_lock_irqsave(&list->lock, flags);
 	skb->dropcount = atomic_read(&sk->sk_drops);
 	__skb_queue_tail(list, skb);
@@ -898,6 +907,18 @@ set_rcvbuf:
 		sock_valbool_flag(sk, SOCK_SELECT_ERR_QUEUE, valbool);
 		break;
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	case SO_BUSY_POLL:
+		/* allow unprivileged users to decrease the value */
+		if (val < 0)
+			ret = -EINVAL;
+		else if (val > sock->busy_poll && !capable(CAP_NET_ADMIN))
+			ret = -EPERM;
+		else
+			sock->busy_poll = val;
+		break;
+#endif
+
 	default:
 		ret = -ENOPROTOOPT;
 		break;
@@ -1155,6 +1176,12 @@ int sock_getsockopt(struct socket *sock, int level, int optname,
 		v.val = sock_flag(sk, SOCK_SELECT_ERR_QUEUE);
 		break;
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	case SO_BUSY_POLL:
+		v.val = sock->busy_poll;
+		break;
+#endif
+
 	default:
 		return -ENOPROTOOPT;
 	}
@@ -2243,6 +2270,9 @@ void sock_init_data(struct socket *sock, struct sock *sk)
 		sk->sk_type	=	sock->type;
 		sk->sk_wq	=	sock->wq;
 		sock->sk	=	sk;
+#ifdef CONFIG_NET_RX_BUSY_POLL
+		sock->busy_poll	=	sysctl_net_busy_read;
+#endif
 	} else
 		sk->sk_wq	=	NULL;
 
@@ -0,0 +1,365 @@
+/* Copyright (C) 2013 Jozsef Kadlecsik <kadlec@blackhole.kfki.hu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/* Lookup benchmark of the hash:net,port, hash:net,iface and
+ * hash:net,port,iface set types.
+ *
+ * A private set of every type is filled with the given numbers of host
+ * elements and the time a matching packet takes to be tested against it
+ * is measured on one CPU and then on all online CPUs at once. Packets are
+ * tested with the same locking as ip_set_test(). The results are printed
+ * when the module is loaded, the module itself does not stay loaded:
+ *
+ *	modprobe ip_set_bench sizes=16,256,4096,65536 lookups=1000000
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/cpu.h>
+#include <linux/slab.h>
+#include <linux/skbuff.h>
+#include <linux/ip.h>
+#include <linux/udp.h>
+#include <linux/ktime.h>
+#include <linux/netdevice.h>
+#include <net/net_namespace.h>
+#include <net/netlink.h>
+
+#include <linux/netfilter.h>
+#include <linux/netfilter/x_tables.h>
+#include <linux/netfilter/ipset/ip_set.h>
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Jozsef Kadlecsik <kadlec@blackhole.kfki.hu>");
+MODULE_DESCRIPTION("ipset lookup benchmark");
+
+static unsigned int sizes[8] = { 16, 256, 4096, 65536 };
+static unsigned int nr_sizes = 4;
+module_param_array(sizes, uint, &nr_sizes, 0);
+MODULE_PARM_DESC(sizes, "Numbers of elements in the sets");
+
+static unsigned int lookups = 1000000;
+module_param(lookups, uint, 0);
+MODULE_PARM_DESC(lookups, "Lookups per CPU and set size");
+
+static const char * const types[] = {
+	"hash:net,port",
+	"hash:net,iface",
+	"hash:net,port,iface",
+};
+
+#define BENCH_SADDR	0x0a000000	/* 10.0.0.0 */
+#define BENCH_DADDR	0xc0a80001	/* 192.168.0.1 */
+#define BENCH_PORT	5000
+
+struct bench_thread {
+	struct ip_set *set;
+	struct completion *start;
+	struct completion *done;
+	atomic_t *running;
+	unsigned int nelem;
+	u64 ns;
+	int ret;
+};
+
+/* A UDP packet from 10.0.0.0 received on the loopback device */
+static struct sk_buff *
+bench_skb(void)
+{
+	struct sk_buff *skb;
+	struct udphdr *uh;
+	struct iphdr *iph;
+
+	skb = alloc_skb(sizeof(*iph) + sizeof(*uh), GFP_KERNEL);
+	if (!skb)
+		return NULL;
+	skb_reset_network_header(skb);
+	iph = (struct iphdr *)skb_put(skb, sizeof(*iph));
+	memset(iph, 0, sizeof(*iph));
+	iph->version = 4;
+	iph->ihl = 5;
+	iph->ttl = 64;
+	iph->protocol = IPPROTO_UDP;
+	iph->tot_len = htons(sizeof(*iph) + sizeof(*uh));
+	iph->saddr = htonl(BENCH_SADDR);
+	iph->daddr = htonl(BENCH_DADDR);
+	skb_set_transport_header(skb, sizeof(*iph));
+	uh = (struct udphdr *)skb_put(skb, sizeof(*uh));
+	memset(uh, 0, sizeof(*uh));
+	uh->source = htons(BENCH_PORT);
+	uh->dest = htons(BENCH_PORT);
+	uh->len = htons(sizeof(*uh));
+	skb->protocol = htons(ETH_P_IP);
+	skb->dev = init_net.loopback_dev;
+
+	return skb;
+}
+
+static int
+bench_kadt(struct ip_set *set, struct sk_buff *skb, enum ipset_adt adt)
+{
+	struct xt_action_param par = {
+		.in = init_net.loopback_dev,
+		.family = NFPROTO_IPV4,
+	};
+	struct ip_set_adt_opt opt = {
+		.family = NFPROTO_IPV4,
+		.dim = set->type->dimension,
+		.flags = IPSET_DIM_ONE_SRC | IPSET_DIM_TWO_SRC |
+			 IPSET_DIM_THREE_SRC,
+		.ext.timeout = UINT_MAX,
+	};
+
+	return set->variant->kadt(set, skb, &par, adt, &opt);
+}
+
+/* Add the elements 10.0.0.0 - 10.0.0.(nelem - 1), resizing as needed */
+static int
+bench_fill(struct ip_set *set, unsigned int nelem)
+{
+	struct sk_buff *skb = bench_skb();
+	bool retried = false;
+	unsigned int i;
+	int ret = 0;
+
+	if (!skb)
+		return -ENOMEM;
+	for (i = 0; i < nelem && !ret; ) {
+		ip_hdr(skb)->saddr = htonl(BENCH_SADDR + i);
+		write_lock_bh(&set->lock);
+		ret = bench_kadt(set, skb, IPSET_ADD);
+		write_unlock_bh(&set->lock);
+		if (ret == -EAGAIN) {
+			ret = set->variant->resize(set, retried);
+			retried = true;
+			continue;
+		}
+		retried = false;
+		i++;
+	}
+	kfree_skb(skb);
+	return ret;
+}
+
+/* Test packets matching elements of the set, as ip_set_test() does */
+static int
+bench_lookup(struct ip_set *set, unsigned int nelem, u64 *ns)
+{
+	struct sk_buff *skb = bench_skb();
+	unsigned int i;
+	ktime_t start;
+	int ret = 0;
+
+	if (!skb)
+		return -ENOMEM;
+	start = ktime_get();
+	for (i = 0; i < lookups && ret >= 0; i++) {
+		ip_hdr(skb)->saddr = htonl(BENCH_SADDR + i % nelem);
+		if (set->variant->rcu_test) {
+			rcu_read_lock_bh();
+			ret = bench_kadt(set, skb, IPSET_TEST);
+			rcu_read_unlock_bh();
+		} else {
+			read_lock_bh(&set->lock);
+			ret = bench_kadt(set, skb, IPSET_TEST);
+			read_unlock_bh(&set->lock);
+		}
+		if (ret == 0)
+			ret = -ENOENT;
+	}
+	*ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	kfree_skb(skb);
+	return ret < 0 ? ret : 0;
+}
+
+static int
+bench_thread_fn(void *data)
+{
+	struct bench_thread *t = data;
+
+	wait_for_completion(t->start);
+	t->ret = bench_lookup(t->set, t->nelem, &t->ns);
+	if (atomic_dec_and_test(t->running))
+		complete(t->done);
+
+	/* Wait to be stopped */
+	set_current_state(TASK_INTERRUPTIBLE);
+	while (!kthread_should_stop()) {
+		schedule();
+		set_current_state(TASK_INTERRUPTIBLE);
+	}
+	__set_current_state(TASK_RUNNING);
+	return 0;
+}
+
+/* Run the lookups on every online cpu at once, report the average */
+static int
+bench_lookup_parallel(struct ip_set *set, unsigned int nelem, u64 *ns,
+		      unsigned int *ncpus)
+{
+	DECLARE_COMPLETION_ONSTACK(start);
+	DECLARE_COMPLETION_ONSTACK(done);
+	struct task_struct **tasks;
+	struct bench_thread *threads;
+	atomic_t running;
+	int cpu, ret = 0;
+	unsigned int n = 0;
+
+	tasks = kcalloc(nr_cpu_ids, sizeof(*tasks), GFP_KERNEL);
+	threads = kcalloc(nr_cpu_ids, sizeof(*threads), GFP_KERNEL);
+	if (!tasks || !threads) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	get_online_cpus();
+	atomic_set(&running, num_online_cpus());
+	for_each_online_cpu(cpu) {
+		threads[cpu].set = set;
+		threads[cpu].start = &start;
+		threads[cpu].done = &done;
+		threads[cpu].running = &running;
+		threads[cpu].nelem = nelem;
+		tasks[cpu] = kthread_create_on_node(bench_thread_fn,
+						    &threads[cpu],
+						    cpu_to_node(cpu),
+						    "ipset_bench/%d", cpu);
+		if (IS_ERR(tasks[cpu])) {
+			ret = PTR_ERR(tasks[cpu]);
+			tasks[cpu] = NULL;
+			break;
+		}
+		kthread_bind(tasks[cpu], cpu);
+		wake_up_process(tasks[cpu]);
+	}
+	complete_all(&start);
+	if (!ret)
+		wait_for_completion(&done);
+	*ns = 0;
+	for_each_online_cpu(cpu) {
+		if (!tasks[cpu])
+			continue;
+		kthread_stop(tasks[cpu]);
+		if (!ret && threads[cpu].ret)
+			ret = threads[cpu].ret;
+		*ns += threads[cpu].ns;
+		n++;
+	}
+	put_online_cpus();
+	*ncpus = n;
+	if (n)
+		do_div(*ns, n);
+out:
+	kfree(threads);
+	kfree(tasks);
+	return ret;
+}
+
+static struct ip_set *
+bench_create(struct ip_set_type *type, unsigned int nelem)
+{
+	struct nlattr *tb[IPSET_ATTR_CREATE_MAX + 1] = { NULL };
+	struct {
+		struct nlattr nla;
+		__be32 value;
+	} maxelem = {
+		.nla = {
+			.nla_len = nla_attr_size(sizeof(__be32)),
+			.nla_type = IPSET_ATTR_MAXELEM | NLA_F_NET_BYTEORDER,
+		},
+		.value = htonl(nelem),
+	};
+	struct ip_set *set;
+
+	set = kzalloc(sizeof(*set), GFP_KERNEL);
+	if (!set)
+		return NULL;
+	rwlock_init(&set->lock);
+	snprintf(set->name, IPSET_MAXNAMELEN, "bench_%u", nelem);
+	set->family = NFPROTO_IPV4;
+	set->revision = type->revision_max;
+	set->type = type;
+	set->ref = 1;
+
+	tb[IPSET_ATTR_MAXELEM] = &maxelem.nla;
+	if (type->create(set, tb, 0)) {
+		kfree(set);
+		return NULL;
+	}
+	return set;
+}
+
+static void
+bench_destroy(struct ip_set *set)
+{
+	set->variant->destroy(set);
+	kfree(set);
+}
+
+static void
+bench_type(const char *name)
+{
+	struct ip_set_type *type;
+	struct ip_set *set;
+	unsigned int i, ncpus;
+	u64 ns, pns;
+	int ret;
+
+	request_module("ip_set_%s", name);
+	type = ip_set_type_get(name, NFPROTO_IPV4, 0);
+	if (!type) {
+		pr_info("%s: set type is not available\n", name);
+		return;
+	}
+
+	for (i = 0; i < nr_sizes; i++) {
+		if (!sizes[i])
+			continue;
+		set = bench_create(type, sizes[i]);
+		if (!set) {
+			pr_info("%s: cannot create set\n", name);
+			break;
+		}
+		ret = bench_fill(set, sizes[i]);
+		if (!ret)
+			ret = bench_lookup(set, sizes[i], &ns);
+		if (!ret)
+			ret = bench_lookup_parallel(set, sizes[i], &pns,
+						    &ncpus);
+		if (!ret) {
+			do_div(ns, lookups);
+			do_div(pns, lookups);
+			pr_info("%-20s %6u elements: %llu ns/lookup, "
+				"%llu ns/lookup on %u cpus\n",
+				name, sizes[i], ns, pns, ncpus);
+		} else
+			pr_info("%s %u elements: failed: %d\n",
+				name, sizes[i], ret);
+		bench_destroy(set);
+	}
+
+	ip_set_type_put(type);
+}
+
+static int __init
+ip_set_bench_init(void)
+{
+	int i;
+
+	if (!lookups)
+		return -EINVAL;
+	for (i = 0; i < ARRAY_SIZE(types); i++)
+		bench_type(types[i]);
+
+	/* Sets were freed by RCU, nothing is left to unload */
+	rcu_barrier_bh();
+	return -EAGAIN;
+}
+
+module_init(ip_set_bench_init);
@@ -232,6 +232,31 @@ unlock:
 }
 EXPORT_SYMBOL_GPL(ip_set_type_unregister);
 
+/* Find a registered set type and reference it, for in-kernel users
+ * creating sets of their own. The type module is not loaded on demand.
+ */
+struct ip_set_type *
+ip_set_type_get(const char *name, u8 family, u8 revision)
+{
+	struct ip_set_type *type;
+
+	rcu_read_lock();
+	type = find_set_type(name, family, revision);
+	if (type && !try_module_get(type->me))
+		type = NULL;
+	rcu_read_unlock();
+
+	return type;
+}
+EXPORT_SYMBOL_GPL(ip_set_type_get);
+
+void
+ip_set_type_put(struct ip_set_type *type)
+{
+	module_put(type->me);
+}
+EXPORT_SYMBOL_GPL(ip_set_type_put);
+
 /* Utility functions */
 void *
 ip_set_alloc(size_t size)
@@ -400,9 +425,15 @@ ip_set_test(ip_set_id_t index, const struct sk_buff *skb,
 	    !(opt->family == set->family || set->family == NFPROTO_UNSPEC))
 		return 0;
 
-	read_lock_bh(&set->lock);
-	ret = set->variant->kadt(set, skb, par, IPSET_TEST, opt);
-	read_unlock_bh(&set->lock);
+	if (set->variant->rcu_test) {
+		rcu_read_lock_bh();
+		ret = set->variant->kadt(set, skb, par, IPSET_TEST, opt);
+		rcu_read_unlock_bh();
+	} else {
+		read_lock_bh(&set->lock);
+		ret = set->variant->kadt(set, skb, par, IPSET_TEST, opt);
+		read_unlock_bh(&set->lock);
+	}
 
 	if (ret == -EAGAIN) {
 		/* Type requests element to be completed */
@@ -902,6 +933,8 @@ ip_set_destroy(struct sock *ctnl, struct sk_buff *skb,
 			}
 		}
 		read_unlock_bh(&ip_set_ref_lock);
+		/* Lockless readers may still use a set swapped out */
+		synchronize_net();
 		for (i = 0; i < ip_set_max; i++) {
 			s = nfnl_set(i);
 			if (s != NULL)
@@ -918,6 +951,7 @@ ip_set_destroy(struct sock *ctnl, struct sk_buff *skb,
 		}
 		read_unlock_bh(&ip_set_ref_lock);
 
+		synchronize_net();
 		ip_set_destroy_set(i);
 	}
 	return 0;
@@ -1024,6 +1058,8 @@ out:
  * protected by the ip_set_ref_lock. The kernel interfaces
  * do not hold the mutex but the pointer settings are atomic
  * so the ip_set_list always contains valid pointers to the sets.
+ * A packet may still be looking at the set swapped out, therefore
+ * destroying a set waits for the packets in flight.
  */
 
 static int
@@ -0,0 +1,945 @@
+/* Copyright (C) 2011-2013 Jozsef Kadlecsik <kadlec@blackhole.kfki.hu>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/* Kernel module implementing an IP set type: the hash:net,port,iface type
+ *
+ * Unlike the array based hash types, elements are chained in the buckets
+ * and the set is tested by packets without taking the set lock: lookups
+ * run under rcu_read_lock_bh() only. Adding, deleting and expiring
+ * elements are serialized by the set lock as usual, unlink elements with
+ * the RCU list primitives and free them after a grace period.
+ *
+ * Resizing
+ *
+ * Every element has two list nodes and a table uses one of them, flipped
+ * by every resize. The resize links all elements into the new table with
+ * the spare node while readers keep walking the old one, publishes the
+ * new table and frees the old one after a grace period, so that no
+ * element is copied and no lookup can miss an element.
+ *
+ * Prefixes
+ *
+ * The different prefix lengths in the set are kept in an array, from the
+ * most specific to the least specific one, which is replaced as a whole
+ * whenever a prefix length appears or disappears. A packet is tested
+ * against every prefix length in that array.
+ */
+
+#include <linux/jhash.h>
+#include <linux/module.h>
+#include <linux/ip.h>
+#include <linux/skbuff.h>
+#include <linux/errno.h>
+#include <linux/random.h>
+#include <linux/rculist.h>
+#include <linux/percpu.h>
+#include <net/ip.h>
+#include <net/ipv6.h>
+#include <net/netlink.h>
+
+#include <linux/netfilter.h>
+#include <linux/netfilter/ipset/pfxlen.h>
+#include <linux/netfilter/ipset/ip_set.h>
+#include <linux/netfilter/ipset/ip_set_getport.h>
+#include <linux/netfilter/ipset/ip_set_hash.h>
+
+#define REVISION_MIN	0
+#define REVISION_MAX	0
+
+MODULE_LICENSE("GPL");
+MODULE_AUTHOR("Jozsef Kadlecsik <kadlec@blackhole.kfki.hu>");
+IP_SET_MODULE_DESC("hash:net,port,iface", REVISION_MIN, REVISION_MAX);
+MODULE_ALIAS("ip_set_hash:net,port,iface");
+
+/* Longest chain in a bucket before the hash table is resized */
+#define CHAIN_MAX		12
+
+#define HOST_MASK(set)		((set)->family == NFPROTO_IPV4 ? 32 : 128)
+
+/* The hashed and compared part of an element */
+struct hash_netportiface_key {
+	union nf_inet_addr ip;
+	char iface[IFNAMSIZ];
+	__be16 port;
+	u8 proto;
+	u8 cidr;
+	u8 physdev;
+	u8 padding[3];
+};
+
+struct hash_netportiface_elem {
+	struct hlist_node node[2];	/* indexed by the table version */
+	struct hash_netportiface_key key;
+	u8 nomatch;
+	unsigned long timeout;
+	struct ip_set_counter counter;
+	struct rcu_head rcu;
+};
+
+struct hash_netportiface_table {
+	u8 htable_bits;		/* size of hash table == 2^htable_bits */
+	u8 ver;			/* list node of the elements in this table */
+	struct hlist_head bucket[0];
+};
+
+/* Prefix lengths in the set, most specific first */
+struct hash_netportiface_nets {
+	struct rcu_head rcu;
+	u8 len;
+	u8 cidr[0];
+};
+
+/* Lookups by packets, counted per cpu so that they are not shared */
+struct hash_netportiface_stats {
+	u64 lookups;
+	u64 hits;
+};
+
+struct hash_netportiface {
+	struct hash_netportiface_table __rcu *table;
+	struct hash_netportiface_nets __rcu *nets;
+	struct hash_netportiface_stats __percpu *stats;
+	u32 maxelem;		/* max elements in the hash */
+	u32 elements;		/* current element (vs timeout) */
+	u32 initval;		/* random jhash init value */
+	u32 timeout;		/* timeout value, if enabled */
+	struct timer_list gc;	/* garbage collection when timeout enabled */
+	struct hash_netportiface_key next; /* temporary storage for uadd */
+	u32 nets_count[129];	/* number of elements per prefix length */
+};
+
+#define HKEY(key, initval, htable_bits)				\
+(jhash2((u32 *)(key), sizeof(struct hash_netportiface_key) / sizeof(u32), \
+	initval) & jhash_mask(htable_bits))
+
+static inline bool
+hash_netportiface_expired(const struct ip_set *set,
+			  struct hash_netportiface_elem *e)
+{
+	return SET_WITH_TIMEOUT(set) && ip_set_timeout_expired(&e->timeout);
+}
+
+static inline void
+hash_netportiface_netmask(const struct ip_set *set,
+			  struct hash_netportiface_key *k, u8 cidr)
+{
+	if (set->family == NFPROTO_IPV4)
+		k->ip.ip &= ip_set_netmask(cidr);
+	else
+		ip6_netmask(&k->ip, cidr);
+	k->cidr = cidr;
+}
+
+static void
+hash_netportiface_free_rcu(struct rcu_head *head)
+{
+	kfree(container_of(head, struct hash_netportiface_elem, rcu));
+}
+
+static void
+hash_netportiface_nets_free_rcu(struct rcu_head *head)
+{
+	kfree(container_of(head, struct hash_netportiface_nets, rcu));
+}
+
+/* Find a live element in the current table. Called with BHs disabled,
+ * either under the set lock or rcu_read_lock_bh() */
+static struct hash_netportiface_elem *
+hash_netportiface_find(const struct ip_set *set,
+		       const struct hash_netportiface_key *k)
+{
+	const struct hash_netportiface *h = set->data;
+	struct hash_netportiface_table *t = rcu_dereference_bh(h->table);
+	struct hash_netportiface_elem *e;
+	u32 key = HKEY(k, h->initval, t->htable_bits);
+
+	hlist_for_each_entry_rcu(e, &t->bucket[key], node[t->ver])
+		if (!memcmp(&e->key, k, sizeof(*k)) &&
+		    !hash_netportiface_expired(set, e))
+			return e;
+	return NULL;
+}
+
+/* Rebuild the array of prefix lengths from the counters, with the set
+ * lock held. On failure the old array stays in place. */
+static int
+hash_netportiface_nets_update(struct ip_set *set)
+{
+	struct hash_netportiface *h = set->data;
+	struct hash_netportiface_nets *nets, *old;
+	int cidr, len = 0;
+
+	for (cidr = HOST_MASK(set); cidr >= 0; cidr--)
+		if (h->nets_count[cidr])
+			len++;
+
+	nets = kmalloc(sizeof(*nets) + len, GFP_ATOMIC);
+	if (!nets)
+		return -ENOMEM;
+	nets->len = 0;
+	for (cidr = HOST_MASK(set); cidr >= 0; cidr--)
+		if (h->nets_count[cidr])
+			nets->cidr[nets->len++] = cidr;
+
+	old = rcu_dereference_protected(h->nets, 1);
+	rcu_assign_pointer(h->nets, nets);
+	if (old)
+		call_rcu_bh(&old->rcu, hash_netportiface_nets_free_rcu);
+	return 0;
+}
+
+static int
+hash_netportiface_add_cidr(struct ip_set *set, u8 cidr)
+{
+	struct hash_netportiface *h = set->data;
+	int ret;
+
+	if (h->nets_count[cidr]++)
+		return 0;
+	ret = hash_netportiface_nets_update(set);
+	if (ret)
+		h->nets_count[cidr]--;
+	return ret;
+}
+
+static void
+hash_netportiface_del_cidr(struct ip_set *set, u8 cidr)
+{
+	struct hash_netportiface *h = set->data;
+
+	/* A stale prefix length costs a lookup only, ignore errors */
+	if (!--h->nets_count[cidr])
+		hash_netportiface_nets_update(set);
+}
+
+static void
+hash_netportiface_unlink(struct ip_set *set, struct hash_netportiface_table *t,
+			 struct hash_netportiface_elem *e)
+{
+	struct hash_netportiface *h = set->data;
+
+	hlist_del_rcu(&e->node[t->ver]);
+	h->elements--;
+	hash_netportiface_del_cidr(set, e->key.cidr);
+	call_rcu_bh(&e->rcu, hash_netportiface_free_rcu);
+}
+
+/* Add an element to a hash and update the internal counters when succeeded,
+ * otherwise report the proper error code. */
+static int
+hash_netportiface_add(struct ip_set *set, void *value,
+		      const struct ip_set_ext *ext,
+		      struct ip_set_ext *mext, u32 flags)
+{
+	struct hash_netportiface *h = set->data;
+	struct hash_netportiface_table *t = rcu_dereference_bh(h->table);
+	const struct hash_netportiface_key *k = value;
+	struct hash_netportiface_elem *e;
+	struct hlist_head *head;
+	unsigned int chain = 0;
+
+	head = &t->bucket[HKEY(k, h->initval, t->htable_bits)];
+	hlist_for_each_entry(e, head, node[t->ver]) {
+		chain++;
+		if (memcmp(&e->key, k, sizeof(*k)))
+			continue;
+		if (!(flags & IPSET_FLAG_EXIST) &&
+		    !hash_netportiface_expired(set, e))
+			return -IPSET_ERR_EXIST;
+		/* Just the extensions could be overwritten */
+		goto set_ext;
+	}
+
+	if (h->elements >= h->maxelem) {
+		if (net_ratelimit())
+			pr_warning("Set %s is full, maxelem %u reached\n",
+				   set->name, h->maxelem);
+		return -IPSET_ERR_HASH_FULL;
+	}
+	if (chain >= CHAIN_MAX) {
+		/* Trigger rehashing */
+		h->next = *k;
+		return -EAGAIN;
+	}
+
+	e = kzalloc(sizeof(*e), GFP_ATOMIC);
+	if (!e)
+		return -ENOMEM;
+	if (hash_netportiface_add_cidr(set, k->cidr)) {
+		kfree(e);
+		return -ENOMEM;
+	}
+	e->key = *k;
+	e->nomatch = !!((flags >> 16) & IPSET_FLAG_NOMATCH);
+	if (SET_WITH_TIMEOUT(set))
+		ip_set_timeout_set(&e->timeout, ext->timeout);
+	if (SET_WITH_COUNTER(set))
+		ip_set_init_counter(&e->counter, ext);
+	hlist_add_head_rcu(&e->node[t->ver], head);
+	h->elements++;
+	return 0;
+
+set_ext:
+	e->nomatch = !!((flags >> 16) & IPSET_FLAG_NOMATCH);
+	if (SET_WITH_TIMEOUT(set))
+		ip_set_timeout_set(&e->timeout, ext->timeout);
+	if (SET_WITH_COUNTER(set))
+		ip_set_init_counter(&e->counter, ext);
+	return 0;
+}
+
+static int
+hash_netportiface_del(struct ip_set *set, void *value,
+		      const struct ip_set_ext *ext,
+		      struct ip_set_ext *mext, u32 flags)
+{
+	struct hash_netportiface *h = set->data;
+	struct hash_netportiface_elem *e;
+
+	e = hash_netportiface_find(set, value);
+	if (!e)
+		return -IPSET_ERR_EXIST;
+	hash_netportiface_unlink(set, rcu_dereference_bh(h->table), e);
+	return 0;
+}
+
+/* Test whether the element is added to the set: an address which is not
+ * a network is tested against all the prefix lengths in the set */
+static int
+hash_netportiface_test(struct ip_set *set, void *value,
+		       const struct ip_set_ext *ext,
+		       struct ip_set_ext *mext, u32 flags)
+{
+	struct hash_netportiface *h = set->data;
+	struct hash_netportiface_key *k = value;
+	const struct hash_netportiface_nets *nets;
+	struct hash_netportiface_elem *e = NULL;
+	union nf_inet_addr ip = k->ip;
+	u8 i;
+
+	this_cpu_inc(h->stats->lookups);
+	if (k->cidr != HOST_MASK(set)) {
+		e = hash_netportiface_find(set, k);
+	} else {
+		nets = rcu_dereference_bh(h->nets);
+		for (i = 0; nets && i < nets->len && !e; i++) {
+			k->ip = ip;
+			hash_netportiface_netmask(set, k, nets->cidr[i]);
+			e = hash_netportiface_find(set, k);
+		}
+	}
+	if (!e)
+		return 0;
+
+	this_cpu_inc(h->stats->hits);
+	if (SET_WITH_COUNTER(set))
+		ip_set_update_counter(&e->counter, ext, mext, flags);
+	return e->nomatch ? -ENOTEMPTY : 1;
+}
+
+/* Delete expired elements from the hashtable, with the set lock held */
+static void
+hash_netportiface_expire(struct ip_set *set)
+{
+	struct hash_netportiface *h = set->data;
+	struct hash_netportiface_table *t = rcu_dereference_bh(h->table);
+	struct hash_netportiface_elem *e;
+	struct hlist_node *n;
+	u32 i;
+
+	for (i = 0; i < jhash_size(t->htable_bits); i++)
+		hlist_for_each_entry_safe(e, n, &t->bucket[i], node[t->ver])
+			if (ip_set_timeout_expired(&e->timeout))
+				hash_netportiface_unlink(set, t, e);
+}
+
+static void
+hash_netportiface_gc(unsigned long ul_set)
+{
+	struct ip_set *set = (struct ip_set *) ul_set;
+	struct hash_netportiface *h = set->data;
+
+	write_lock_bh(&set->lock);
+	hash_netportiface_expire(set);
+	write_unlock_bh(&set->lock);
+
+	h->gc.expires = jiffies + IPSET_GC_PERIOD(h->timeout) * HZ;
+	add_timer(&h->gc);
+}
+
+/* Resize a hash: double the hash table and link the elements into it by
+ * their spare list node. Called by userspace commands only, which are
+ * serialized by the nfnl mutex, without the set lock held. */
+static int
+hash_netportiface_resize(struct ip_set *set, bool retried)
+{
+	struct hash_netportiface *h = set->data;
+	struct hash_netportiface_table *t, *orig;
+	struct hash_netportiface_elem *e;
+	u8 htable_bits;
+	u32 i, elements;
+
+	/* Try to cleanup once */
+	if (SET_WITH_TIMEOUT(set) && !retried) {
+		elements = h->elements;
+		write_lock_bh(&set->lock);
+		hash_netportiface_expire(set);
+		write_unlock_bh(&set->lock);
+		if (h->elements < elements)
+			return 0;
+	}
+
+	orig = rcu_dereference_protected(h->table, 1);
+	htable_bits = orig->htable_bits + 1;
+	if (htable_bits > 31) {
+		pr_warning("Cannot increase the hashsize of set %s further\n",
+			   set->name);
+		return -IPSET_ERR_HASH_FULL;
+	}
+	t = ip_set_alloc(sizeof(*t) +
+			 jhash_size(htable_bits) * sizeof(struct hlist_head));
+	if (!t)
+		return -ENOMEM;
+	t->htable_bits = htable_bits;
+	t->ver = !orig->ver;
+
+	write_lock_bh(&set->lock);
+	for (i = 0; i < jhash_size(orig->htable_bits); i++)
+		hlist_for_each_entry(e, &orig->bucket[i], node[orig->ver])
+			hlist_add_head_rcu(&e->node[t->ver],
+				&t->bucket[HKEY(&e->key, h->initval,
+						htable_bits)]);
+	rcu_assign_pointer(h->table, t);
+	write_unlock_bh(&set->lock);
+
+	/* Give time to other readers of the set */
+	synchronize_rcu_bh();
+
+	pr_debug("set %s resized from %u to %u\n", set->name,
+		 orig->htable_bits, t->htable_bits);
+	ip_set_free(orig);
+
+	return 0;
+}
+
+/* Flush a hash type of set: destroy all elements */
+static void
+hash_netportiface_flush(struct ip_set *set)
+{
+	struct hash_netportiface *h = set->data;
+	struct hash_netportiface_table *t = rcu_dereference_bh(h->table);
+	struct hash_netportiface_elem *e;
+	struct hlist_node *n;
+	u32 i;
+
+	for (i = 0; i < jhash_size(t->htable_bits); i++)
+		hlist_for_each_entry_safe(e, n, &t->bucket[i], node[t->ver])
+			hash_netportiface_unlink(set, t, e);
+}
+
+/* Destroy a hash type of set, without readers left */
+static void
+hash_netportiface_destroy(struct ip_set *set)
+{
+	struct hash_netportiface *h = set->data;
+	struct hash_netportiface_table *t;
+	struct hash_netportiface_elem *e;
+	struct hlist_node *n;
+	u32 i;
+
+	if (SET_WITH_TIMEOUT(set))
+		del_timer_sync(&h->gc);
+
+	t = rcu_dereference_protected(h->table, 1);
+	for (i = 0; i < jhash_size(t->htable_bits); i++)
+		hlist_for_each_entry_safe(e, n, &t->bucket[i], node[t->ver])
+			kfree(e);
+	ip_set_free(t);
+	kfree(rcu_dereference_protected(h->nets, 1));
+	free_percpu(h->stats);
+	kfree(h);
+
+	set->data = NULL;
+}
+
+static bool
+hash_netportiface_same_set(const struct ip_set *a, const struct ip_set *b)
+{
+	const struct hash_netportiface *x = a->data;
+	const struct hash_netportiface *y = b->data;
+
+	/* Resizing changes htable_bits, so we ignore it */
+	return x->maxelem == y->maxelem &&
+	       x->timeout == y->timeout &&
+	       a->extensions == b->extensions;
+}
+
+/* Reply a HEADER request: fill out the header part of the set */
+static int
+hash_netportiface_head(struct ip_set *set, struct sk_buff *skb)
+{
+	const struct hash_netportiface *h = set->data;
+	const struct hash_netportiface_table *t;
+	u64 lookups = 0, hits = 0;
+	struct nlattr *nested;
+	size_t memsize;
+	u32 hsize;
+	int cpu;
+
+	read_lock_bh(&set->lock);
+	t = rcu_dereference_bh(h->table);
+	hsize = jhash_size(t->htable_bits);
+	memsize = sizeof(*h) + sizeof(*t) +
+		  hsize * sizeof(struct hlist_head) +
+		  h->elements * sizeof(struct hash_netportiface_elem);
+	read_unlock_bh(&set->lock);
+
+	for_each_possible_cpu(cpu) {
+		const struct hash_netportiface_stats *stats =
+			per_cpu_ptr(h->stats, cpu);
+
+		lookups += stats->lookups;
+		hits += stats->hits;
+	}
+
+	nested = ipset_nest_start(skb, IPSET_ATTR_DATA);
+	if (!nested)
+		goto nla_put_failure;
+	if (nla_put_net32(skb, IPSET_ATTR_HASHSIZE, htonl(hsize)) ||
+	    nla_put_net32(skb, IPSET_ATTR_MAXELEM, htonl(h->maxelem)) ||
+	    nla_put_net32(skb, IPSET_ATTR_REFERENCES, htonl(set->ref - 1)) ||
+	    nla_put_net32(skb, IPSET_ATTR_MEMSIZE, htonl(memsize)) ||
+	    nla_put_net64(skb, IPSET_ATTR_LOOKUPS, cpu_to_be64(lookups)) ||
+	    nla_put_net64(skb, IPSET_ATTR_HITS, cpu_to_be64(hits)) ||
+	    ((set->extensions & IPSET_EXT_TIMEOUT) &&
+	     nla_put_net32(skb, IPSET_ATTR_TIMEOUT, htonl(h->timeout))) ||
+	    ((set->extensions & IPSET_EXT_COUNTER) &&
+	     nla_put_net32(skb, IPSET_ATTR_CADT_FLAGS,
+			   htonl(IPSET_FLAG_WITH_COUNTERS))))
+		goto nla_put_failure;
+	ipset_nest_end(skb, nested);
+
+	return 0;
+nla_put_failure:
+	return -EMSGSIZE;
+}
+
+static bool
+hash_netportiface_data_list(const struct ip_set *set, struct sk_buff *skb,
+			    struct hash_netportiface_elem *e)
+{
+	const struct hash_netportiface_key *k = &e->key;
+	u32 flags = (e->nomatch ? IPSET_FLAG_NOMATCH : 0) |
+		    (k->physdev ? IPSET_FLAG_PHYSDEV : 0);
+
+	if ((set->family == NFPROTO_IPV4 ?
+	     nla_put_ipaddr4(skb, IPSET_ATTR_IP, k->ip.ip) :
+	     nla_put_ipaddr6(skb, IPSET_ATTR_IP, &k->ip.in6)) ||
+	    nla_put_net16(skb, IPSET_ATTR_PORT, k->port) ||
+	    nla_put_u8(skb, IPSET_ATTR_CIDR, k->cidr) ||
+	    nla_put_u8(skb, IPSET_ATTR_PROTO, k->proto) ||
+	    nla_put_string(skb, IPSET_ATTR_IFACE, k->iface) ||
+	    (flags &&
+	     nla_put_net32(skb, IPSET_ATTR_CADT_FLAGS, htonl(flags))) ||
+	    (SET_WITH_TIMEOUT(set) &&
+	     nla_put_net32(skb, IPSET_ATTR_TIMEOUT,
+			   htonl(ip_set_timeout_get(&e->timeout)))) ||
+	    (SET_WITH_COUNTER(set) &&
+	     ip_set_put_counter(skb, &e->counter)))
+		return 1;
+	return 0;
+}
+
+/* Reply a LIST/SAVE request: dump the elements of the specified set,
+ * with the set lock held for reading */
+static int
+hash_netportiface_list(const struct ip_set *set,
+		       struct sk_buff *skb, struct netlink_callback *cb)
+{
+	const struct hash_netportiface *h = set->data;
+	const struct hash_netportiface_table *t = rcu_dereference_bh(h->table);
+	struct hash_netportiface_elem *e;
+	struct nlattr *atd, *nested;
+	u32 first = cb->args[2];
+	/* We assume that one hash bucket fills into one page */
+	void *incomplete;
+
+	atd = ipset_nest_start(skb, IPSET_ATTR_ADT);
+	if (!atd)
+		return -EMSGSIZE;
+	for (; cb->args[2] < jhash_size(t->htable_bits); cb->args[2]++) {
+		incomplete = skb_tail_pointer(skb);
+		hlist_for_each_entry(e, &t->bucket[cb->args[2]],
+				     node[t->ver]) {
+			if (hash_netportiface_expired(set, e))
+				continue;
+			nested = ipset_nest_start(skb, IPSET_ATTR_DATA);
+			if (!nested) {
+				if (cb->args[2] == first) {
+					nla_nest_cancel(skb, atd);
+					return -EMSGSIZE;
+				} else
+					goto nla_put_failure;
+			}
+			if (hash_netportiface_data_list(set, skb, e))
+				goto nla_put_failure;
+			ipset_nest_end(skb, nested);
+		}
+	}
+	ipset_nest_end(skb, atd);
+	/* Set listing finished */
+	cb->args[2] = 0;
+
+	return 0;
+
+nla_put_failure:
+	nlmsg_trim(skb, incomplete);
+	ipset_nest_end(skb, atd);
+	if (unlikely(first == cb->args[2])) {
+		pr_warning("Can't list set %s: one bucket does not fit into "
+			   "a message. Please report it!\n", set->name);
+		cb->args[2] = 0;
+		return -EMSGSIZE;
+	}
+	return 0;
+}
+
+static int
+hash_netportiface_kadt(struct ip_set *set, const struct sk_buff *skb,
+		       const struct xt_action_param *par,
+		       enum ipset_adt adt, struct ip_set_adt_opt *opt)
+{
+	struct hash_netportiface *h = set->data;
+	ipset_adtfn adtfn = set->variant->adt[adt];
+	const struct hash_netportiface_nets *nets;
+	struct hash_netportiface_key k = { .cidr = HOST_MASK(set) };
+	struct ip_set_ext ext = IP_SET_INIT_KEXT(skb, opt, h);
+	const char *iface;
+
+	if (set->family == NFPROTO_IPV4) {
+		if (!ip_set_get_ip4_port(skb, opt->flags & IPSET_DIM_TWO_SRC,
+					 &k.port, &k.proto))
+			return -EINVAL;
+		ip4addrptr(skb, opt->flags & IPSET_DIM_ONE_SRC, &k.ip.ip);
+	} else {
+		if (!ip_set_get_ip6_port(skb, opt->flags & IPSET_DIM_TWO_SRC,
+					 &k.port, &k.proto))
+			return -EINVAL;
+		ip6addrptr(skb, opt->flags & IPSET_DIM_ONE_SRC, &k.ip.in6);
+	}
+
+#define IFACE(dir)	(par->dir ? par->dir->name : NULL)
+#define PHYSDEV(dir)	(nf_bridge->dir ? nf_bridge->dir->name : NULL)
+#define SRCDIR		(opt->flags & IPSET_DIM_THREE_SRC)
+
+	if (opt->cmdflags & IPSET_FLAG_PHYSDEV) {
+#ifdef CONFIG_BRIDGE_NETFILTER
+		const struct nf_bridge_info *nf_bridge = skb->nf_bridge;
+
+		if (!nf_bridge)
+			return -EINVAL;
+		iface = SRCDIR ? PHYSDEV(physindev) : PHYSDEV(physoutdev);
+		k.physdev = 1;
+#else
+		iface = NULL;
+#endif
+	} else
+		iface = SRCDIR ? IFACE(in) : IFACE(out);
+
+	if (!iface)
+		return -EINVAL;
+	strncpy(k.iface, iface, IFNAMSIZ);
+
+	/* Elements are added and deleted with the most specific prefix */
+	if (adt != IPSET_TEST) {
+		nets = rcu_dereference_bh(h->nets);
+		if (nets && nets->len)
+			k.cidr = nets->cidr[0];
+		hash_netportiface_netmask(set, &k, k.cidr);
+	}
+
+	return adtfn(set, &k, &ext, &opt->ext, opt->cmdflags);
+}
+
+static int
+hash_netportiface_uadt(struct ip_set *set, struct nlattr *tb[],
+		       enum ipset_adt adt, u32 *lineno, u32 flags,
+		       bool retried)
+{
+	struct hash_netportiface *h = set->data;
+	ipset_adtfn adtfn = set->variant->adt[adt];
+	struct hash_netportiface_key k = { .cidr = HOST_MASK(set) };
+	struct ip_set_ext ext = IP_SET_INIT_UEXT(h);
+	u32 port, port_to, p = 0, ip = 0, ip_to, last;
+	bool with_ports = false;
+	u8 cidr;
+	int ret;
+
+	if (unlikely(!tb[IPSET_ATTR_IP] ||
+		     !tb[IPSET_ATTR_IFACE] ||
+		     !ip_set_attr_netorder(tb, IPSET_ATTR_PORT) ||
+		     !ip_set_optattr_netorder(tb, IPSET_ATTR_PORT_TO) ||
+		     !ip_set_optattr_netorder(tb, IPSET_ATTR_TIMEOUT) ||
+		     !ip_set_optattr_netorder(tb, IPSET_ATTR_CADT_FLAGS) ||
+		     !ip_set_optattr_netorder(tb, IPSET_ATTR_PACKETS) ||
+		     !ip_set_optattr_netorder(tb, IPSET_ATTR_BYTES)))
+		return -IPSET_ERR_PROTOCOL;
+	if (unlikely(tb[IPSET_ATTR_IP_TO] && set->family != NFPROTO_IPV4))
+		return -IPSET_ERR_HASH_RANGE_UNSUPPORTED;
+
+	if (tb[IPSET_ATTR_LINENO])
+		*lineno = nla_get_u32(tb[IPSET_ATTR_LINENO]);
+
+	if (set->family == NFPROTO_IPV4)
+		ret = ip_set_get_hostipaddr4(tb[IPSET_ATTR_IP], &ip);
+	else
+		ret = ip_set_get_ipaddr6(tb[IPSET_ATTR_IP], &k.ip);
+	if (ret || (ret = ip_set_get_extensions(set, tb, &ext)))
+		return ret;
+
+	if (tb[IPSET_ATTR_CIDR]) {
+		k.cidr = nla_get_u8(tb[IPSET_ATTR_CIDR]);
+		if (k.cidr > HOST_MASK(set))
+			return -IPSET_ERR_INVALID_CIDR;
+	}
+
+	k.port = nla_get_be16(tb[IPSET_ATTR_PORT]);
+	if (tb[IPSET_ATTR_PROTO]) {
+		k.proto = nla_get_u8(tb[IPSET_ATTR_PROTO]);
+		with_ports = ip_set_proto_with_ports(k.proto);
+
+		if (k.proto == 0)
+			return -IPSET_ERR_INVALID_PROTO;
+	} else
+		return -IPSET_ERR_MISSING_PROTO;
+
+	if (!(with_ports || k.proto == IPPROTO_ICMP ||
+	      k.proto == IPPROTO_ICMPV6))
+		k.port = 0;
+
+	with_ports = with_ports && tb[IPSET_ATTR_PORT_TO];
+
+	strncpy(k.iface, nla_data(tb[IPSET_ATTR_IFACE]), IFNAMSIZ);
+
+	if (tb[IPSET_ATTR_CADT_FLAGS]) {
+		u32 cadt_flags = ip_set_get_h32(tb[IPSET_ATTR_CADT_FLAGS]);
+		if (cadt_flags & IPSET_FLAG_PHYSDEV)
+			k.physdev = 1;
+		if (cadt_flags & IPSET_FLAG_NOMATCH)
+			flags |= (IPSET_FLAG_NOMATCH << 16);
+	}
+
+	if (adt == IPSET_TEST || !(with_ports || tb[IPSET_ATTR_IP_TO])) {
+		if (set->family == NFPROTO_IPV4)
+			k.ip.ip = htonl(ip);
+		hash_netportiface_netmask(set, &k, k.cidr);
+		ret = adtfn(set, &k, &ext, &ext, flags);
+		return ip_set_enomatch(ret, flags, adt) ? 1 :
+		       ip_set_eexist(ret, flags) ? 0 : ret;
+	}
+
+	port = port_to = ntohs(k.port);
+	if (with_ports) {
+		port_to = ip_set_get_h16(tb[IPSET_ATTR_PORT_TO]);
+		if (port_to < port)
+			swap(port, port_to);
+	}
+
+	if (set->family != NFPROTO_IPV4) {
+		hash_netportiface_netmask(set, &k, k.cidr);
+		if (retried)
+			port = ntohs(h->next.port);
+		for (; port <= port_to; port++) {
+			k.port = htons(port);
+			ret = adtfn(set, &k, &ext, &ext, flags);
+
+			if (ret && !ip_set_eexist(ret, flags))
+				return ret;
+			else
+				ret = 0;
+		}
+		return ret;
+	}
+
+	if (tb[IPSET_ATTR_IP_TO]) {
+		ret = ip_set_get_hostipaddr4(tb[IPSET_ATTR_IP_TO], &ip_to);
+		if (ret)
+			return ret;
+		if (ip_to < ip)
+			swap(ip, ip_to);
+		if (ip + UINT_MAX == ip_to)
+			return -IPSET_ERR_HASH_RANGE;
+	} else
+		ip_set_mask_from_to(ip, ip_to, k.cidr);
+
+	if (retried)
+		ip = ntohl(h->next.ip.ip);
+	while (!after(ip, ip_to)) {
+		k.ip.ip = htonl(ip);
+		last = ip_set_range_to_cidr(ip, ip_to, &cidr);
+		k.cidr = cidr;
+		p = retried && ip == ntohl(h->next.ip.ip) ? ntohs(h->next.port)
+							  : port;
+		for (; p <= port_to; p++) {
+			k.port = htons(p);
+			ret = adtfn(set, &k, &ext, &ext, flags);
+
+			if (ret && !ip_set_eexist(ret, flags))
+				return ret;
+			else
+				ret = 0;
+		}
+		ip = last + 1;
+	}
+	return ret;
+}
+
+static const struct ip_set_type_variant hash_netportiface_variant = {
+	.kadt	= hash_netportiface_kadt,
+	.uadt	= hash_netportiface_uadt,
+	.adt	= {
+		[IPSET_ADD] = hash_netportiface_add,
+		[IPSET_DEL] = hash_netportiface_del,
+		[IPSET_TEST] = hash_netportiface_test,
+	},
+	.destroy = hash_netportiface_destroy,
+	.flush	= hash_netportiface_flush,
+	.head	= hash_netportiface_head,
+	.list	= hash_netportiface_list,
+	.resize	= hash_netportiface_resize,
+	.same_set = hash_netportiface_same_set,
+	.rcu_test = true,
+};
+
+static int
+hash_netportiface_create(struct ip_set *set, struct nlattr *tb[], u32 flags)
+{
+	u32 hashsize = IPSET_DEFAULT_HASHSIZE, maxelem = IPSET_DEFAULT_MAXELEM;
+	struct hash_netportiface_table *t;
+	struct hash_netportiface *h;
+	u32 cadt_flags = 0;
+	u8 hbits;
+
+	if (!(set->family == NFPROTO_IPV4 || set->family == NFPROTO_IPV6))
+		return -IPSET_ERR_INVALID_FAMILY;
+
+	if (unlikely(!ip_set_optattr_netorder(tb, IPSET_ATTR_HASHSIZE) ||
+		     !ip_set_optattr_netorder(tb, IPSET_ATTR_MAXELEM) ||
+		     !ip_set_optattr_netorder(tb, IPSET_ATTR_TIMEOUT) ||
+		     !ip_set_optattr_netorder(tb, IPSET_ATTR_CADT_FLAGS)))
+		return -IPSET_ERR_PROTOCOL;
+
+	if (tb[IPSET_ATTR_HASHSIZE]) {
+		hashsize = ip_set_get_h32(tb[IPSET_ATTR_HASHSIZE]);
+		if (hashsize < IPSET_MIMINAL_HASHSIZE)
+			hashsize = IPSET_MIMINAL_HASHSIZE;
+	}
+	if (tb[IPSET_ATTR_MAXELEM])
+		maxelem = ip_set_get_h32(tb[IPSET_ATTR_MAXELEM]);
+
+	/* Round up to the first 2^n value */
+	hbits = fls(hashsize - 1);
+	if (hbits > 31)
+		return -ENOMEM;
+
+	h = kzalloc(sizeof(*h), GFP_KERNEL);
+	if (!h)
+		return -ENOMEM;
+	h->stats = alloc_percpu(struct hash_netportiface_stats);
+	t = ip_set_alloc(sizeof(*t) +
+			 jhash_size(hbits) * sizeof(struct hlist_head));
+	if (!h->stats || !t) {
+		if (t)
+			ip_set_free(t);
+		free_percpu(h->stats);
+		kfree(h);
+		return -ENOMEM;
+	}
+	t->htable_bits = hbits;
+	RCU_INIT_POINTER(h->table, t);
+
+	h->maxelem = maxelem;
+	get_random_bytes(&h->initval, sizeof(h->initval));
+	h->timeout = IPSET_NO_TIMEOUT;
+
+	set->data = h;
+	set->variant = &hash_netportiface_variant;
+
+	if (tb[IPSET_ATTR_CADT_FLAGS])
+		cadt_flags = ip_set_get_h32(tb[IPSET_ATTR_CADT_FLAGS]);
+	if (cadt_flags & IPSET_FLAG_WITH_COUNTERS)
+		set->extensions |= IPSET_EXT_COUNTER;
+	if (tb[IPSET_ATTR_TIMEOUT]) {
+		h->timeout = ip_set_timeout_uget(tb[IPSET_ATTR_TIMEOUT]);
+		set->extensions |= IPSET_EXT_TIMEOUT;
+
+		init_timer(&h->gc);
+		h->gc.data = (unsigned long) set;
+		h->gc.function = hash_netportiface_gc;
+		h->gc.expires = jiffies + IPSET_GC_PERIOD(h->timeout) * HZ;
+		add_timer(&h->gc);
+	}
+
+	pr_debug("create %s hashsize %u (%u) maxelem %u: %p(%p)\n",
+		 set->name, jhash_size(hbits), hbits, h->maxelem, h, t);
+
+	return 0;
+}
+
+static struct ip_set_type hash_netportiface_type __read_mostly = {
+	.name		= "hash:net,port,iface",
+	.protocol	= IPSET_PROTOCOL,
+	.features	= IPSET_TYPE_IP | IPSET_TYPE_PORT | IPSET_TYPE_IFACE |
+			  IPSET_TYPE_NOMATCH,
+	.dimension	= IPSET_DIM_THREE,
+	.family		= NFPROTO_UNSPEC,
+	.revision_min	= REVISION_MIN,
+	.revision_max	= REVISION_MAX,
+	.create		= hash_netportiface_create,
+	.create_policy	= {
+		[IPSET_ATTR_HASHSIZE]	= { .type = NLA_U32 },
+		[IPSET_ATTR_MAXELEM]	= { .type = NLA_U32 },
+		[IPSET_ATTR_PROBES]	= { .type = NLA_U8 },
+		[IPSET_ATTR_RESIZE]	= { .type = NLA_U8  },
+		[IPSET_ATTR_PROTO]	= { .type = NLA_U8 },
+		[IPSET_ATTR_TIMEOUT]	= { .type = NLA_U32 },
+		[IPSET_ATTR_CADT_FLAGS]	= { .type = NLA_U32 },
+	},
+	.adt_policy	= {
+		[IPSET_ATTR_IP]		= { .type = NLA_NESTED },
+		[IPSET_ATTR_IP_TO]	= { .type = NLA_NESTED },
+		[IPSET_ATTR_PORT]	= { .type = NLA_U16 },
+		[IPSET_ATTR_PORT_TO]	= { .type = NLA_U16 },
+		[IPSET_ATTR_PROTO]	= { .type = NLA_U8 },
+		[IPSET_ATTR_CIDR]	= { .type = NLA_U8 },
+		[IPSET_ATTR_IFACE]	= { .type = NLA_NUL_STRING,
+					    .len  = IFNAMSIZ - 1 },
+		[IPSET_ATTR_TIMEOUT]	= { .type = NLA_U32 },
+		[IPSET_ATTR_LINENO]	= { .type = NLA_U32 },
+		[IPSET_ATTR_CADT_FLAGS]	= { .type = NLA_U32 },
+		[IPSET_ATTR_BYTES]	= { .type = NLA_U64 },
+		[IPSET_ATTR_PACKETS]	= { .type = NLA_U64 },
+	},
+	.me		= THIS_MODULE,
+};
+
+static int __init
+hash_netportiface_init(void)
+{
+	return ip_set_type_register(&hash_netportiface_type);
+}
+
+static void __exit
+hash_netportiface_fini(void)
+{
+	ip_set_type_unregister(&hash_netportiface_type);
+	/* Wait for the elements freed by RCU */
+	rcu_barrier_bh();
+}
+
+module_init(hash_netportiface_init);
+module_exit(hash_netportiface_fini);
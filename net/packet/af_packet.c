@@ -309,6 +309,10 @@ static void __packet_set_status(struct packet_sock *po, void *frame, int status)
 		flush_dcache_page(pgv_to_page(&h.h2->tp_status));
 		break;
 	case TPACKET_V3:
+		/* only tx ring frames, the rx ring has block status */
+		h.h3->tp_status = status;
+		flush_dcache_page(pgv_to_page(&h.h3->tp_status));
+		break;
 	default:
 		WARN(1, "TPACKET version not supported.\n");
 		BUG();
@@ -332,6 +336,8 @@ static int __packet_get_status(struct packet_sock *po, void *frame)
 		flush_dcache_page(pgv_to_page(&h.h2->tp_status));
 		return h.h2->tp_status;
 	case TPACKET_V3:
+		flush_dcache_page(pgv_to_page(&h.h3->tp_status));
+		return h.h3->tp_status;
 	default:
 		WARN(1, "TPACKET version not supported.\n");
 		BUG();
@@ -380,6 +386,9 @@ static __u32 __packet_set_timestamp(struct packet_sock *po, void *frame,
 		h.h2->tp_nsec = ts.tv_nsec;
 		break;
 	case TPACKET_V3:
+		h.h3->tp_sec = ts.tv_sec;
+		h.h3->tp_nsec = ts.tv_nsec;
+		break;
 	default:
 		WARN(1, "TPACKET version not supported.\n");
 		BUG();
@@ -1158,6 +1167,56 @@ static unsigned int fanout_demux_cpu(struct packet_fanout *f,
 	return smp_processor_id() % num;
 }
 
+/*
+ * A flow goes to the socket of the cpu that received its first packet and
+ * stays there, even if later packets are received on other cpus, until it
+ * has been idle for PACKET_FANOUT_FLOW_IDLE.  Captures then scale with the
+ * cpus RPS or the senders spread the flows on, without reordering a flow
+ * across sockets.  Flows sharing a slot of the table share their socket.
+ *
+ * A slot holds an index into f->arr, which __fanout_unlink() compacts, so
+ * it also records f->flow_gen and is ignored once a member has left.
+ * Packets without a flow hash have no flow to keep together, they go by
+ * cpu alone.
+ */
+#define FLOW_IDX_MASK		0xff
+#define FLOW_VALID		0x100
+#define FLOW_GEN_SHIFT		9
+#define FLOW_GEN_MASK		0x7f
+#define FLOW_STAMP_SHIFT	16
+#define FLOW_STAMP_MASK		((1U << (32 - FLOW_STAMP_SHIFT)) - 1)
+
+static unsigned int fanout_demux_cpu_flow(struct packet_fanout *f,
+					  struct sk_buff *skb,
+					  unsigned int num)
+{
+	u32 hash = skb_get_rxhash(skb);
+	u32 *slot, flow, stamp, now, gen;
+	unsigned int idx;
+
+	if (!hash)
+		return smp_processor_id() % num;
+
+	slot = &f->flows[hash & (PACKET_FANOUT_FLOWS - 1)];
+	now = jiffies & FLOW_STAMP_MASK;
+	gen = ACCESS_ONCE(f->flow_gen) & FLOW_GEN_MASK;
+	flow = ACCESS_ONCE(*slot);
+	idx = flow & FLOW_IDX_MASK;
+	stamp = flow >> FLOW_STAMP_SHIFT;
+
+	if (!(flow & FLOW_VALID) || idx >= num ||
+	    ((flow >> FLOW_GEN_SHIFT) & FLOW_GEN_MASK) != gen ||
+	    ((now - stamp) & FLOW_STAMP_MASK) > PACKET_FANOUT_FLOW_IDLE)
+		idx = smp_processor_id() % num;
+	else if (stamp == now)
+		return idx;
+
+	/* racing updates of a slot only pick one of the cpus */
+	ACCESS_ONCE(*slot) = now << FLOW_STAMP_SHIFT |
+			     gen << FLOW_GEN_SHIFT | FLOW_VALID | idx;
+	return idx;
+}
+
 static unsigned int fanout_demux_rollover(struct packet_fanout *f,
 					  struct sk_buff *skb,
 					  unsigned int idx, unsigned int skip,
@@ -1215,6 +1274,9 @@ static int packet_rcv_fanout(struct sk_buff *skb, struct net_device *dev,
 	case PACKET_FANOUT_CPU:
 		idx = fanout_demux_cpu(f, skb, num);
 		break;
+	case PACKET_FANOUT_CPU_FLOW:
+		idx = fanout_demux_cpu_flow(f, skb, num);
+		break;
 	case PACKET_FANOUT_ROLLOVER:
 		idx = fanout_demux_rollover(f, skb, 0, (unsigned int) -1, num);
 		break;
@@ -1258,6 +1320,8 @@ static void __fanout_unlink(struct sock *sk, struct packet_sock *po)
 	BUG_ON(i >= f->num_members);
 	f->arr[i] = f->arr[f->num_members - 1];
 	f->num_members--;
+	/* the cpu flow table may point at the moved member */
+	f->flow_gen++;
 	spin_unlock(&f->lock);
 }
 
@@ -1284,6 +1348,7 @@ static int fanout_add(struct sock *sk, u16 id, u16 type_flags)
 	case PACKET_FANOUT_HASH:
 	case PACKET_FANOUT_LB:
 	case PACKET_FANOUT_CPU:
+	case PACKET_FANOUT_CPU_FLOW:
 		break;
 	default:
 		return -EINVAL;
@@ -1312,6 +1377,15 @@ static int fanout_add(struct sock *sk, u16 id, u16 type_flags)
 		match = kzalloc(sizeof(*match), GFP_KERNEL);
 		if (!match)
 			goto out;
+		if (type == PACKET_FANOUT_CPU_FLOW) {
+			match->flows = kcalloc(PACKET_FANOUT_FLOWS,
+					       sizeof(*match->flows),
+					       GFP_KERNEL);
+			if (!match->flows) {
+				kfree(match);
+				goto out;
+			}
+		}
 		write_pnet(&match->net, sock_net(sk));
 		match->id = id;
 		match->type = type;
@@ -1361,6 +1435,7 @@ static void fanout_release(struct sock *sk)
 	if (atomic_dec_and_test(&f->sk_ref)) {
 		list_del(&f->list);
 		dev_remove_pack(&f->prot_hook);
+		kfree(f->flows);
 		kfree(f);
 	}
 	mutex_unlock(&fanout_mutex);
@@ -1939,6 +2014,14 @@ static int tpacket_fill_skb(struct packet_sock *po, struct sk_buff *skb,
 	skb_shinfo(skb)->destructor_arg = ph.raw;
 
 	switch (po->tp_version) {
+	case TPACKET_V3:
+		/* frames are fixed size, tp_next_offset is for rx blocks */
+		if (unlikely(ph.h3->tp_next_offset)) {
+			pr_err_once("variable sized slots not supported\n");
+			return -EINVAL;
+		}
+		tp_len = ph.h3->tp_len;
+		break;
 	case TPACKET_V2:
 		tp_len = ph.h2->tp_len;
 		break;
@@ -1961,6 +2044,9 @@ static int tpacket_fill_skb(struct packet_sock *po, struct sk_buff *skb,
 		off_max = po->tx_ring.frame_size - tp_len;
 		if (sock->type == SOCK_DGRAM) {
 			switch (po->tp_version) {
+			case TPACKET_V3:
+				off = ph.h3->tp_net;
+				break;
 			case TPACKET_V2:
 				off = ph.h2->tp_net;
 				break;
@@ -1970,6 +2056,9 @@ static int tpacket_fill_skb(struct packet_sock *po, struct sk_buff *skb,
 			}
 		} else {
 			switch (po->tp_version) {
+			case TPACKET_V3:
+				off = ph.h3->tp_mac;
+				break;
 			case TPACKET_V2:
 				off = ph.h2->tp_mac;
 				break;
@@ -3576,12 +3665,6 @@ static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 	/* Added to avoid minimal code churn */
 	struct tpacket_req *req = &req_u->req;
 
-	/* Opening a Tx-ring is NOT supported in TPACKET_V3 */
-	if (!closing && tx_ring && (po->tp_version > TPACKET_V2)) {
-		WARN(1, "Tx-ring is not supported.\n");
-		goto out;
-	}
-
 	rb = tx_ring ? &po->tx_ring : &po->rx_ring;
 	rb_queue = tx_ring ? &sk->sk_write_queue : &sk->sk_receive_queue;
 
@@ -3628,6 +3711,16 @@ static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 		if (unlikely((rb->frames_per_block * req->tp_block_nr) !=
 					req->tp_frame_nr))
 			goto out;
+		/*
+		 * The V3 tx ring is made of frames like the V2 one: each
+		 * frame is sent once user space hands it over, there is no
+		 * block to retire and no per block private area.
+		 */
+		if (tx_ring && po->tp_version == TPACKET_V3 &&
+		    (req_u->req3.tp_retire_blk_tov ||
+		     req_u->req3.tp_sizeof_priv ||
+		     req_u->req3.tp_feature_req_word))
+			goto out;
 
 		err = -ENOMEM;
 		order = get_order(req->tp_block_size);
@@ -3636,12 +3729,9 @@ static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 			goto out;
 		switch (po->tp_version) {
 		case TPACKET_V3:
-		/* Transmit path is not supported. We checked
-		 * it above but just being paranoid
-		 */
 			if (!tx_ring)
 				init_prb_bdqc(po, rb, pg_vec, req_u, tx_ring);
-				break;
+			break;
 		default:
 			break;
 		}
@@ -3698,7 +3788,7 @@ static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 	}
 	spin_unlock(&po->bind_lock);
 	if (closing && (po->tp_version > TPACKET_V2)) {
-		/* Because we don't support block-based V3 on tx-ring */
+		/* The tx ring has no block retire timer */
 		if (!tx_ring)
 			prb_shutdown_retire_blk_timer(po, tx_ring, rb_queue);
 	}
@@ -71,6 +71,9 @@ struct packet_ring_buffer {
 
 extern struct mutex fanout_mutex;
 #define PACKET_FANOUT_MAX	256
+/* Flow table of PACKET_FANOUT_CPU_FLOW */
+#define PACKET_FANOUT_FLOWS	1024
+#define PACKET_FANOUT_FLOW_IDLE	HZ
 
 struct packet_fanout {
 #ifdef CONFIG_NET_NS
@@ -84,6 +87,8 @@ struct packet_fanout {
 	struct list_head	list;
 	struct sock		*arr[PACKET_FANOUT_MAX];
 	int			next[PACKET_FANOUT_MAX];
+	u32			*flows;
+	unsigned int		flow_gen;
 	spinlock_t		lock;
 	atomic_t		sk_ref;
 	struct packet_type	prot_hook ____cacheline_aligned_in_smp;
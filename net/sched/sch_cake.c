@@ -179,6 +179,9 @@ struct cake_sched_data {
 	u16		cur_flow;
 
 	struct qdisc_watchdog watchdog;
+
+	/* per cpu staging of senders, as root qdisc */
+	struct qdisc_stage *stage;
 };
 
 enum {
@@ -546,6 +549,7 @@ static struct sk_buff *cake_dequeue(struct Qdisc *sch)
 	int i;
 	codel_time_t delay;
 
+	qdisc_stage_poll(q->stage);
 begin:
 	if(!sch->q.qlen)
 		return NULL;
@@ -648,8 +652,11 @@ retry:
 
 static void cake_reset(struct Qdisc *sch)
 {
+	struct cake_sched_data *q = qdisc_priv(sch);
 	int c;
 
+	if(q->stage)
+		qdisc_stage_purge(q->stage);
 	for(c = 0; c < CAKE_MAX_CLASSES; c++)
 		cake_clear_class(sch, c);
 }
@@ -1037,6 +1044,9 @@ static void cake_destroy(struct Qdisc *sch)
 
 	qdisc_watchdog_cancel(&q->watchdog);
 
+	if(q->stage)
+		qdisc_stage_destroy(q->stage);
+
 	if(q->classes) {
 		u32 i;
 		for(i=0; i < CAKE_MAX_CLASSES; i++) {
@@ -1104,6 +1114,17 @@ static int cake_init(struct Qdisc *sch, struct nlattr *opt)
 
 	sch->flags &= ~TCQ_F_CAN_BYPASS;
 
+	/* As root, senders stage packets per cpu rather than wait for the
+	 * root lock; the shaper and the flows see them at the next dequeue.
+	 */
+	if(sch->parent == TC_H_ROOT) {
+		q->stage = qdisc_stage_create(sch, cake_enqueue,
+					      QDISC_STAGE_BATCH);
+		if(!q->stage)
+			goto nomem;
+		qdisc_stage_attach(q->stage);
+	}
+
 	return 0;
 
 nomem:
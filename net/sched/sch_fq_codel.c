@@ -40,6 +40,10 @@
  * head drops only.
  * ECN capability is on by default.
  * Low memory footprint (64 bytes per flow)
+ *
+ * As root qdisc, senders stage packets per cpu instead of contending on
+ * the root lock, and they enter the flows in batches before dequeue.
+ * (stage_batch 0 disables staging)
  */
 
 struct fq_codel_flow {
@@ -65,6 +69,9 @@ struct fq_codel_sched_data {
 
 	struct list_head new_flows;	/* list of new flows */
 	struct list_head old_flows;	/* list of old flows */
+
+	struct qdisc_stage *stage;	/* per cpu staging, as root qdisc */
+	u32		stage_batch;	/* packets staged per cpu before waiting */
 };
 
 static unsigned int fq_codel_hash(const struct fq_codel_sched_data *q,
@@ -237,6 +244,7 @@ static struct sk_buff *fq_codel_dequeue(struct Qdisc *sch)
 	struct list_head *head;
 	u32 prev_drop_count, prev_ecn_mark;
 
+	qdisc_stage_poll(q->stage);
 begin:
 	head = &q->new_flows;
 	if (list_empty(head)) {
@@ -283,8 +291,11 @@ begin:
 
 static void fq_codel_reset(struct Qdisc *sch)
 {
+	struct fq_codel_sched_data *q = qdisc_priv(sch);
 	struct sk_buff *skb;
 
+	if (q->stage)
+		qdisc_stage_purge(q->stage);
 	while ((skb = fq_codel_dequeue(sch)) != NULL)
 		kfree_skb(skb);
 }
@@ -296,8 +307,36 @@ static const struct nla_policy fq_codel_policy[TCA_FQ_CODEL_MAX + 1] = {
 	[TCA_FQ_CODEL_ECN]	= { .type = NLA_U32 },
 	[TCA_FQ_CODEL_FLOWS]	= { .type = NLA_U32 },
 	[TCA_FQ_CODEL_QUANTUM]	= { .type = NLA_U32 },
+	[TCA_FQ_CODEL_STAGE_BATCH] = { .type = NLA_U32 },
 };
 
+/* Stage the packets of senders when root qdisc and stage_batch is set */
+static int fq_codel_stage_change(struct Qdisc *sch)
+{
+	struct fq_codel_sched_data *q = qdisc_priv(sch);
+	struct qdisc_stage *stage = q->stage;
+
+	if (q->stage_batch && sch->parent == TC_H_ROOT) {
+		if (stage) {
+			stage->batch = q->stage_batch;
+			return 0;
+		}
+		stage = qdisc_stage_create(sch, fq_codel_enqueue,
+					   q->stage_batch);
+		if (!stage)
+			return -ENOMEM;
+		q->stage = stage;
+		qdisc_stage_attach(stage);
+	} else if (stage) {
+		sch_tree_lock(sch);
+		qdisc_stage_drain(stage);
+		q->stage = NULL;
+		sch_tree_unlock(sch);
+		qdisc_stage_destroy(stage);
+	}
+	return 0;
+}
+
 static int fq_codel_change(struct Qdisc *sch, struct nlattr *opt)
 {
 	struct fq_codel_sched_data *q = qdisc_priv(sch);
@@ -341,6 +380,9 @@ static int fq_codel_change(struct Qdisc *sch, struct nlattr *opt)
 	if (tb[TCA_FQ_CODEL_QUANTUM])
 		q->quantum = max(256U, nla_get_u32(tb[TCA_FQ_CODEL_QUANTUM]));
 
+	if (tb[TCA_FQ_CODEL_STAGE_BATCH])
+		q->stage_batch = nla_get_u32(tb[TCA_FQ_CODEL_STAGE_BATCH]);
+
 	while (sch->q.qlen > sch->limit) {
 		struct sk_buff *skb = fq_codel_dequeue(sch);
 
@@ -351,7 +393,11 @@ static int fq_codel_change(struct Qdisc *sch, struct nlattr *opt)
 	q->cstats.drop_count = 0;
 
 	sch_tree_unlock(sch);
-	return 0;
+
+	/* fq_codel_init() sets up the stage once the flows are allocated */
+	if (!q->flows)
+		return 0;
+	return fq_codel_stage_change(sch);
 }
 
 static void *fq_codel_zalloc(size_t sz)
@@ -377,6 +423,8 @@ static void fq_codel_destroy(struct Qdisc *sch)
 {
 	struct fq_codel_sched_data *q = qdisc_priv(sch);
 
+	if (q->stage)
+		qdisc_stage_destroy(q->stage);
 	tcf_destroy_chain(&q->filter_list);
 	fq_codel_free(q->backlogs);
 	fq_codel_free(q->flows);
@@ -396,6 +444,7 @@ static int fq_codel_init(struct Qdisc *sch, struct nlattr *opt)
 	codel_params_init(&q->cparams);
 	codel_stats_init(&q->cstats);
 	q->cparams.ecn = true;
+	q->stage_batch = QDISC_STAGE_BATCH;
 
 	if (opt) {
 		int err = fq_codel_change(sch, opt);
@@ -419,6 +468,11 @@ static int fq_codel_init(struct Qdisc *sch, struct nlattr *opt)
 			INIT_LIST_HEAD(&flow->flowchain);
 			codel_vars_init(&flow->cvars);
 		}
+		if (fq_codel_stage_change(sch)) {
+			fq_codel_free(q->backlogs);
+			fq_codel_free(q->flows);
+			return -ENOMEM;
+		}
 	}
 	if (sch->limit >= 1)
 		sch->flags |= TCQ_F_CAN_BYPASS;
@@ -447,7 +501,9 @@ static int fq_codel_dump(struct Qdisc *sch, struct sk_buff *skb)
 	    nla_put_u32(skb, TCA_FQ_CODEL_QUANTUM,
 			q->quantum) ||
 	    nla_put_u32(skb, TCA_FQ_CODEL_FLOWS,
-			q->flows_cnt))
+			q->flows_cnt) ||
+	    nla_put_u32(skb, TCA_FQ_CODEL_STAGE_BATCH,
+			q->stage_batch))
 		goto nla_put_failure;
 
 	nla_nest_end(skb, opts);
@@ -205,6 +205,143 @@ void __qdisc_run(struct Qdisc *q)
 	qdisc_run_end(q);
 }
 
+/* Per cpu staging of packets for a root qdisc.
+ *
+ * - senders queue packets on their own cpu's stage, see
+ *   __dev_xmit_skb_staged(). The per cpu list lock is only taken by
+ *   other cpus when they drain the stage.
+ * - the holder of the root lock moves all staged packets into the qdisc
+ *   with its enqueue function, then runs the qdisc.
+ * - a sender finding the root lock held sets QDISC_STAGE_MISSED and
+ *   leaves its packet to the holder, which drains again before dequeuing
+ *   (qdisc_stage_poll()) and after releasing the lock.
+ */
+struct qdisc_stage *qdisc_stage_create(struct Qdisc *sch,
+			int (*enqueue)(struct sk_buff *skb, struct Qdisc *sch),
+			unsigned int batch)
+{
+	struct qdisc_stage *stage;
+	int cpu;
+
+	stage = kzalloc(sizeof(*stage), GFP_KERNEL);
+	if (!stage)
+		return NULL;
+	stage->cpu = alloc_percpu(struct sk_buff_head);
+	if (!stage->cpu) {
+		kfree(stage);
+		return NULL;
+	}
+	for_each_possible_cpu(cpu)
+		skb_queue_head_init(per_cpu_ptr(stage->cpu, cpu));
+	stage->qdisc = sch;
+	stage->enqueue = enqueue;
+	stage->batch = batch;
+	return stage;
+}
+EXPORT_SYMBOL(qdisc_stage_create);
+
+/* Under RTNL: make senders on all tx queues of the device stage their
+ * packets, once the qdisc is the root qdisc of the queue they send on.
+ */
+void qdisc_stage_attach(struct qdisc_stage *stage)
+{
+	struct net_device *dev = qdisc_dev(stage->qdisc);
+	unsigned int i;
+
+	for (i = 0; i < dev->num_tx_queues; i++)
+		rcu_assign_pointer(netdev_get_tx_queue(dev, i)->qdisc_stage,
+				   stage);
+}
+EXPORT_SYMBOL(qdisc_stage_attach);
+
+void qdisc_stage_purge(struct qdisc_stage *stage)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		skb_queue_purge(per_cpu_ptr(stage->cpu, cpu));
+}
+EXPORT_SYMBOL(qdisc_stage_purge);
+
+static void qdisc_stage_free_rcu(struct rcu_head *head)
+{
+	struct qdisc_stage *stage = container_of(head, struct qdisc_stage, rcu);
+
+	qdisc_stage_purge(stage);
+	free_percpu(stage->cpu);
+	kfree(stage);
+}
+
+/* Under RTNL: detach the stage from the device and free it once the
+ * senders that could still see it are gone. Packets still staged then
+ * are dropped.
+ */
+void qdisc_stage_destroy(struct qdisc_stage *stage)
+{
+	struct net_device *dev = qdisc_dev(stage->qdisc);
+	struct netdev_queue *txq;
+	unsigned int i;
+
+	for (i = 0; i < dev->num_tx_queues; i++) {
+		txq = netdev_get_tx_queue(dev, i);
+		if (rtnl_dereference(txq->qdisc_stage) == stage)
+			RCU_INIT_POINTER(txq->qdisc_stage, NULL);
+	}
+	call_rcu_bh(&stage->rcu, qdisc_stage_free_rcu);
+}
+EXPORT_SYMBOL(qdisc_stage_destroy);
+
+/* Under qdisc_lock(stage->qdisc) and BH: move the staged packets of all
+ * cpus into the qdisc, each cpu's in the order they were sent.
+ */
+void qdisc_stage_drain(struct qdisc_stage *stage)
+{
+	struct Qdisc *q = stage->qdisc;
+	struct sk_buff_head batch, *list;
+	struct sk_buff *skb;
+	int cpu;
+
+	clear_bit(QDISC_STAGE_MISSED, &stage->state);
+	smp_mb__after_clear_bit();
+
+	__skb_queue_head_init(&batch);
+	for_each_possible_cpu(cpu) {
+		list = per_cpu_ptr(stage->cpu, cpu);
+		if (skb_queue_empty(list))
+			continue;
+		spin_lock(&list->lock);
+		skb_queue_splice_tail_init(list, &batch);
+		spin_unlock(&list->lock);
+	}
+
+	if (unlikely(test_bit(__QDISC_STATE_DEACTIVATED, &q->state))) {
+		__skb_queue_purge(&batch);
+		return;
+	}
+	while ((skb = __skb_dequeue(&batch)) != NULL)
+		stage->enqueue(skb, q);
+}
+EXPORT_SYMBOL(qdisc_stage_drain);
+
+/* Called with qdisc_lock(q) held and BH disabled, returns with the lock
+ * released. Senders that missed the lock meanwhile are served before
+ * leaving, unless another cpu took the lock and serves them.
+ */
+void qdisc_stage_run(struct Qdisc *q, struct qdisc_stage *stage)
+{
+	spinlock_t *root_lock = qdisc_lock(q);
+
+	do {
+		qdisc_stage_drain(stage);
+		if (!test_bit(__QDISC_STATE_DEACTIVATED, &q->state))
+			qdisc_run(q);
+		spin_unlock(root_lock);
+		smp_mb();
+	} while (test_bit(QDISC_STAGE_MISSED, &stage->state) &&
+		 spin_trylock(root_lock));
+}
+EXPORT_SYMBOL(qdisc_stage_run);
+
 unsigned long dev_trans_start(struct net_device *dev)
 {
 	unsigned long val, res = dev->trans_start;
@@ -97,6 +97,7 @@
 #include <net/cls_cgroup.h>
 
 #include <net/sock.h>
+#include <net/busy_poll.h>
 #include <linux/netfilter.h>
 
 #include <linux/if_tun.h>
@@ -252,6 +253,9 @@ static struct inode *sock_alloc_inode(struct super_block *sb)
 	}
 	init_waitqueue_head(&wq->wait);
 	wq->fasync_list = NULL;
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	wq->napi_id = 0;
+#endif
 	RCU_INIT_POINTER(ei->socket.wq, wq);
 
 	ei->socket.state = SS_UNCONNECTED;
@@ -259,6 +263,9 @@ static struct inode *sock_alloc_inode(struct super_block *sb)
 	ei->socket.ops = NULL;
 	ei->socket.sk = NULL;
 	ei->socket.file = NULL;
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	ei->socket.busy_poll = 0;
+#endif
 
 	return &ei->vfs_inode;
 }
@@ -1142,13 +1149,26 @@ EXPORT_SYMBOL(sock_create_lite);
 /* No kernel lock held - perfect */
 static unsigned int sock_poll(struct file *file, poll_table *wait)
 {
+	unsigned int busy_flag = 0;
 	struct socket *sock;
 
 	/*
 	 *      We can't return errors to poll, so it's either yes or no.
 	 */
 	sock = file->private_data;
-	return sock->ops->poll(file, sock, wait);
+
+	/*
+	 * The spinning is done by the system call, see do_select(): this
+	 * only says the socket can be busy polled and, when asked to, runs
+	 * a single pass over its NAPI context.
+	 */
+	if (sock->sk && sk_can_busy_loop(sock->sk)) {
+		busy_flag = POLL_BUSY_LOOP;
+		if (wait && (poll_requested_events(wait) & POLL_BUSY_LOOP))
+			sk_busy_loop(sock->sk, 0);
+	}
+
+	return busy_flag | sock->ops->poll(file, sock, wait);
 }
 
 static int sock_mmap(struct file *file, struct vm_area_struct *vma)
@@ -535,7 +535,9 @@ static void unix_set_peek_off(struct sock *sk, int val)
 	struct unix_sock *u = unix_sk(sk);
 
 	mutex_lock(&u->readlock);
+	unix_state_lock(sk);
 	sk->sk_peek_off = val;
+	unix_state_unlock(sk);
 	mutex_unlock(&u->readlock);
 }
 
@@ -1606,6 +1608,146 @@ out:
 	return err;
 }
 
+/* Largest stream skb: a page of linear data and MAX_SKB_FRAGS pages */
+#define UNIX_STREAM_SKB_MAX	(SKB_MAX_HEAD(0) + MAX_SKB_FRAGS * PAGE_SIZE)
+
+/*
+ * Stream skbs are never modified once they are queued.  The reader, under
+ * u->readlock, claims bytes from the front of the head skb by advancing
+ * 'consumed' under the state lock of the receiving socket, and copies
+ * them out after dropping it, so senders are not held up by the copy.
+ * A sender that gives up on pinned data moves 'end' back.
+ */
+struct unix_stream_cb {
+	struct unix_skb_parms	parms;
+	u32			consumed;
+	u32			end;
+};
+
+#define UNIXSCB(skb)	((struct unix_stream_cb *)(skb)->cb)
+
+static inline unsigned int unix_skb_len(const struct sk_buff *skb)
+{
+	return UNIXSCB(skb)->end - UNIXSCB(skb)->consumed;
+}
+
+/*
+ * Writes this large skip the copy into the socket: the receiver copies
+ * straight out of the pinned sender pages, and the sender sleeps until it
+ * has.  Only data that the writer would have had to wait for anyway, with
+ * at least sk_sndbuf still to go behind it, is sent this way, so a peer
+ * that reads nothing until write() returns is not deadlocked by it.
+ */
+#define UNIX_STREAM_PIN_MIN	(8 * PAGE_SIZE)
+
+struct unix_stream_pin {
+	struct ubuf_info	ubuf;
+	atomic_t		pending;
+	struct completion	done;
+};
+
+static void unix_stream_pin_done(struct ubuf_info *ubuf, bool success)
+{
+	struct unix_stream_pin *pin;
+
+	pin = container_of(ubuf, struct unix_stream_pin, ubuf);
+	if (atomic_dec_and_test(&pin->pending))
+		complete(&pin->done);
+}
+
+/*
+ * Pin up to @len bytes of the iovec, starting @offset bytes in, into the
+ * page fragments of an empty skb.  Returns the number of bytes pinned,
+ * which is short once the fragments run out.
+ */
+static int unix_stream_pin_iovec(struct sk_buff *skb, const struct iovec *iov,
+				 int offset, int len)
+{
+	struct skb_shared_info *shinfo = skb_shinfo(skb);
+	struct page *pages[MAX_SKB_FRAGS];
+	int pinned = 0;
+
+	while (pinned < len && shinfo->nr_frags < MAX_SKB_FRAGS) {
+		unsigned long base;
+		int size, npages, got, i;
+
+		if (offset >= iov->iov_len) {
+			offset -= iov->iov_len;
+			iov++;
+			continue;
+		}
+
+		base = (unsigned long)iov->iov_base + offset;
+		size = min_t(size_t, iov->iov_len - offset, len - pinned);
+		npages = min_t(int, MAX_SKB_FRAGS - shinfo->nr_frags,
+			       PAGE_ALIGN((base & ~PAGE_MASK) + size) >> PAGE_SHIFT);
+		got = get_user_pages_fast(base, npages, 0, pages);
+		if (got <= 0)
+			break;
+		size = min_t(int, size, got * PAGE_SIZE - (base & ~PAGE_MASK));
+
+		skb->len += size;
+		skb->data_len += size;
+		skb->truesize += got * PAGE_SIZE;
+		atomic_add(got * PAGE_SIZE, &skb->sk->sk_wmem_alloc);
+		pinned += size;
+		offset += size;
+
+		for (i = 0; i < got; i++) {
+			int off = base & ~PAGE_MASK;
+			int n = min_t(int, size, PAGE_SIZE - off);
+
+			skb_fill_page_desc(skb, shinfo->nr_frags, pages[i],
+					   off, n);
+			base += n;
+			size -= n;
+		}
+		if (got < npages)
+			break;
+	}
+
+	return pinned ? : -EFAULT;
+}
+
+/*
+ * Wait up to @timeo for the receiver to copy all pinned data.  Whatever
+ * it has not claimed by then is taken back, the return value is the
+ * number of bytes that were not delivered.
+ */
+static int unix_stream_pin_wait(struct sock *other, struct unix_stream_pin *pin,
+				long timeo)
+{
+	struct sk_buff_head cancelled;
+	struct sk_buff *skb, *tmp;
+	int undone = 0;
+
+	if (atomic_dec_and_test(&pin->pending))
+		return 0;
+	if (timeo &&
+	    wait_for_completion_interruptible_timeout(&pin->done, timeo) > 0)
+		return 0;
+
+	/* No reader is half way through a copy while we hold its readlock */
+	__skb_queue_head_init(&cancelled);
+	mutex_lock(&unix_sk(other)->readlock);
+	unix_state_lock(other);
+	skb_queue_walk_safe(&other->sk_receive_queue, skb, tmp) {
+		if (!(skb_shinfo(skb)->tx_flags & SKBTX_DEV_ZEROCOPY) ||
+		    skb_shinfo(skb)->destructor_arg != &pin->ubuf)
+			continue;
+		undone += unix_skb_len(skb);
+		UNIXSCB(skb)->end = UNIXSCB(skb)->consumed;
+		skb_unlink(skb, &other->sk_receive_queue);
+		__skb_queue_tail(&cancelled, skb);
+	}
+	unix_state_unlock(other);
+	mutex_unlock(&unix_sk(other)->readlock);
+	__skb_queue_purge(&cancelled);
+
+	/* Bytes the peer has copied already, but not yet freed */
+	wait_for_completion(&pin->done);
+	return undone;
+}
 
 static int unix_stream_sendmsg(struct kiocb *kiocb, struct socket *sock,
 			       struct msghdr *msg, size_t len)
@@ -1613,12 +1755,14 @@ static int unix_stream_sendmsg(struct kiocb *kiocb, struct socket *sock,
 	struct sock_iocb *siocb = kiocb_to_siocb(kiocb);
 	struct sock *sk = sock->sk;
 	struct sock *other = NULL;
-	int err, size;
+	int err, size, data_len;
 	struct sk_buff *skb;
 	int sent = 0;
 	struct scm_cookie tmp_scm;
 	bool fds_sent = false;
 	int max_level;
+	struct unix_stream_pin pin;
+	bool pinning = false;
 
 	if (NULL == siocb->scm)
 		siocb->scm = &tmp_scm;
@@ -1656,29 +1800,52 @@ static int unix_stream_sendmsg(struct kiocb *kiocb, struct socket *sock,
 		if (size > ((sk->sk_sndbuf >> 1) - 64))
 			size = (sk->sk_sndbuf >> 1) - 64;
 
-		if (size > SKB_MAX_ALLOC)
-			size = SKB_MAX_ALLOC;
-
-		/*
-		 *	Grab a buffer
-		 */
+		if (size > UNIX_STREAM_SKB_MAX)
+			size = UNIX_STREAM_SKB_MAX;
+
+		if (!(msg->msg_flags & MSG_DONTWAIT) &&
+		    size >= UNIX_STREAM_PIN_MIN &&
+		    len - sent - size >= sk->sk_sndbuf) {
+			if (!pinning) {
+				pin.ubuf.callback = unix_stream_pin_done;
+				atomic_set(&pin.pending, 1);
+				init_completion(&pin.done);
+				pinning = true;
+			}
+			data_len = size;
+		} else if (pinning) {
+			/* Only the tail is copied, once the pinned data is */
+			int undone;
+
+			pinning = false;
+			undone = unix_stream_pin_wait(other, &pin,
+						      sock_sndtimeo(sk, 0));
+			if (undone) {
+				sent -= undone;
+				err = signal_pending(current) ?
+				      sock_intr_errno(sock_sndtimeo(sk, 0)) :
+				      -EAGAIN;
+				goto out_err;
+			}
+			continue;
+		} else {
+			/*
+			 *	Grab a buffer: up to a page of linear data,
+			 *	the rest in order-0 pages, so that large writes
+			 *	neither need high order allocations nor get cut
+			 *	into many skbs.
+			 */
+			data_len = max_t(int, 0, size - SKB_MAX_HEAD(0));
+			data_len = min_t(int, size, PAGE_ALIGN(data_len));
+		}
 
-		skb = sock_alloc_send_skb(sk, size, msg->msg_flags&MSG_DONTWAIT,
-					  &err);
+		skb = sock_alloc_send_pskb(sk, size - data_len,
+					   pinning ? 0 : data_len,
+					   msg->msg_flags & MSG_DONTWAIT, &err);
 
 		if (skb == NULL)
 			goto out_err;
 
-		/*
-		 *	If you pass two values to the sock_alloc_send_skb
-		 *	it tries to grab the large buffer with GFP_NOFS
-		 *	(which can fail easily), and if it fails grab the
-		 *	fallback size buffer which is under a page and will
-		 *	succeed. [Alan]
-		 */
-		size = min_t(int, size, skb_tailroom(skb));
-
-
 		/* Only send the fds in the first buffer */
 		err = unix_scm_to_skb(siocb->scm, skb, !fds_sent);
 		if (err < 0) {
@@ -1688,11 +1855,30 @@ static int unix_stream_sendmsg(struct kiocb *kiocb, struct socket *sock,
 		max_level = err + 1;
 		fds_sent = true;
 
-		err = memcpy_fromiovec(skb_put(skb, size), msg->msg_iov, size);
-		if (err) {
-			kfree_skb(skb);
-			goto out_err;
+		if (pinning) {
+			size = unix_stream_pin_iovec(skb, msg->msg_iov, sent,
+						     size);
+			if (size < 0) {
+				err = size;
+				kfree_skb(skb);
+				goto out_err;
+			}
+			skb_shinfo(skb)->destructor_arg = &pin.ubuf;
+			skb_shinfo(skb)->tx_flags |= SKBTX_DEV_ZEROCOPY;
+			atomic_inc(&pin.pending);
+		} else {
+			skb_put(skb, size - data_len);
+			skb->data_len = data_len;
+			skb->len = size;
+			err = skb_copy_datagram_from_iovec(skb, 0, msg->msg_iov,
+							   sent, size);
+			if (err) {
+				kfree_skb(skb);
+				goto out_err;
+			}
 		}
+		UNIXSCB(skb)->consumed = 0;
+		UNIXSCB(skb)->end = size;
 
 		unix_state_lock(other);
 
@@ -1709,6 +1895,9 @@ static int unix_stream_sendmsg(struct kiocb *kiocb, struct socket *sock,
 		sent += size;
 	}
 
+	if (pinning)
+		sent -= unix_stream_pin_wait(other, &pin, sock_sndtimeo(sk, 0));
+
 	scm_destroy(siocb->scm);
 	siocb->scm = NULL;
 
@@ -1722,6 +1911,8 @@ pipe_err:
 		send_sig(SIGPIPE, current, 0);
 	err = -EPIPE;
 out_err:
+	if (pinning)
+		sent -= unix_stream_pin_wait(other, &pin, 0);
 	scm_destroy(siocb->scm);
 	siocb->scm = NULL;
 	return sent ? : err;
@@ -1868,6 +2059,165 @@ out:
 	return err;
 }
 
+/*
+ * Bytes a stream reader has claimed in one go: fully claimed skbs are off
+ * the queue, a partially claimed one stays at its head.
+ */
+struct unix_stream_claim {
+	struct sk_buff_head	skbs;
+	struct sk_buff		*part;
+	unsigned int		part_off;
+	unsigned int		part_len;
+	struct sk_buff		*fds;
+};
+
+/* Never glue messages from different writers */
+static bool unix_stream_creds(struct socket *sock, struct scm_cookie *scm,
+			      struct sk_buff *skb, int *check_creds)
+{
+	if (*check_creds)
+		return UNIXCB(skb).pid == scm->pid &&
+		       uid_eq(UNIXCB(skb).uid, scm->creds.uid) &&
+		       gid_eq(UNIXCB(skb).gid, scm->creds.gid);
+
+	if (test_bit(SOCK_PASSCRED, &sock->flags)) {
+		/* Copy credentials */
+		scm_set_cred(scm, UNIXCB(skb).pid, UNIXCB(skb).uid,
+			     UNIXCB(skb).gid);
+		*check_creds = 1;
+	}
+	return true;
+}
+
+/*
+ * scm_fp_dup() for MSG_PEEK, which runs under the state lock and so
+ * cannot sleep.
+ */
+static struct scm_fp_list *unix_peek_fds(struct scm_fp_list *fpl)
+{
+	struct scm_fp_list *new_fpl;
+	int i;
+
+	new_fpl = kmemdup(fpl, offsetof(struct scm_fp_list, fp[fpl->count]),
+			  GFP_ATOMIC);
+	if (new_fpl) {
+		for (i = 0; i < fpl->count; i++)
+			get_file(fpl->fp[i]);
+		new_fpl->max = new_fpl->count;
+	}
+	return new_fpl;
+}
+
+static void unix_reattach_fds(struct scm_cookie *scm, struct sk_buff *skb)
+{
+	int i;
+
+	UNIXCB(skb).fp = scm->fp;
+	scm->fp = NULL;
+
+	for (i = UNIXCB(skb).fp->count-1; i >= 0; i--)
+		unix_inflight(UNIXCB(skb).fp->fp[i]);
+}
+
+/*
+ * Claim up to @size contiguous bytes from the head of the receive queue,
+ * starting with @skb.  Called with the state lock held, stops early at a
+ * different writer and after an skb that carries fds.
+ */
+static int unix_stream_claim(struct sock *sk, struct socket *sock,
+			     struct scm_cookie *scm, struct sk_buff *skb,
+			     int size, int *check_creds,
+			     struct unix_stream_claim *claim)
+{
+	int claimed = 0;
+
+	__skb_queue_head_init(&claim->skbs);
+	claim->part = NULL;
+	claim->fds = NULL;
+
+	while (skb && claimed < size) {
+		unsigned int start = UNIXSCB(skb)->consumed;
+		unsigned int len;
+		struct sk_buff *next;
+
+		if (!unix_stream_creds(sock, scm, skb, check_creds))
+			break;
+
+		len = min_t(unsigned int, unix_skb_len(skb), size - claimed);
+		UNIXSCB(skb)->consumed += len;
+		claimed += len;
+
+		if (UNIXCB(skb).fp) {
+			unix_detach_fds(scm, skb);
+			claim->fds = skb;
+		}
+
+		next = skb_peek_next(skb, &sk->sk_receive_queue);
+		if (unix_skb_len(skb)) {
+			claim->part = skb_get(skb);
+			claim->part_off = start;
+			claim->part_len = len;
+			break;
+		}
+
+		/* Ours alone now, 'consumed' says where our bytes start */
+		skb_unlink(skb, &sk->sk_receive_queue);
+		UNIXSCB(skb)->consumed = start;
+		__skb_queue_tail(&claim->skbs, skb);
+		if (claim->fds)
+			break;
+		skb = next;
+	}
+
+	return claimed;
+}
+
+/*
+ * Copy claimed bytes to the user, returns how many made it.  If that
+ * faults, the rest goes back to the head of the queue exactly as it was,
+ * fds included: u->readlock keeps anyone else from consuming meanwhile.
+ */
+static int unix_stream_copy_claim(struct sock *sk, struct msghdr *msg,
+				  struct scm_cookie *scm,
+				  struct unix_stream_claim *claim)
+{
+	struct sk_buff *skb;
+	int copied = 0;
+
+	while ((skb = __skb_dequeue(&claim->skbs)) != NULL) {
+		if (skb_copy_datagram_iovec(skb, UNIXSCB(skb)->consumed,
+					    msg->msg_iov, unix_skb_len(skb))) {
+			__skb_queue_head(&claim->skbs, skb);
+			goto fault;
+		}
+		copied += unix_skb_len(skb);
+		consume_skb(skb);
+	}
+
+	if (claim->part) {
+		if (skb_copy_datagram_iovec(claim->part, claim->part_off,
+					    msg->msg_iov, claim->part_len))
+			goto fault;
+		copied += claim->part_len;
+		consume_skb(claim->part);
+	}
+	return copied;
+
+fault:
+	unix_state_lock(sk);
+	if (claim->part)
+		UNIXSCB(claim->part)->consumed = claim->part_off;
+	while ((skb = __skb_dequeue_tail(&claim->skbs)) != NULL)
+		skb_queue_head(&sk->sk_receive_queue, skb);
+	if (claim->fds)
+		unix_reattach_fds(scm, claim->fds);
+	unix_state_unlock(sk);
+
+	if (claim->part)
+		consume_skb(claim->part);
+	return copied;
+}
+
 /*
  *	Sleep until more data has arrived. But check for races..
  */
@@ -1929,10 +2279,6 @@ static int unix_stream_recvmsg(struct kiocb *iocb, struct socket *sock,
 
 	msg->msg_namelen = 0;
 
-	/* Lock the socket to prevent queue disordering
-	 * while sleeps in memcpy_tomsg
-	 */
-
 	if (!siocb->scm) {
 		siocb->scm = &tmp_scm;
 		memset(&tmp_scm, 0, sizeof(tmp_scm));
@@ -1945,7 +2291,8 @@ static int unix_stream_recvmsg(struct kiocb *iocb, struct socket *sock,
 	}
 
 	do {
-		int chunk;
+		struct unix_stream_claim claim;
+		int chunk, n;
 		struct sk_buff *skb, *last;
 
 		unix_state_lock(sk);
@@ -1974,8 +2321,8 @@ again:
 
 			timeo = unix_stream_data_wait(sk, timeo, last);
 
-			if (signal_pending(current)
-			    ||  mutex_lock_interruptible(&u->readlock)) {
+			if (signal_pending(current) ||
+			    mutex_lock_interruptible(&u->readlock)) {
 				err = sock_intr_errno(timeo);
 				goto out;
 			}
@@ -1986,72 +2333,73 @@ again:
 			break;
 		}
 
-		skip = sk_peek_offset(sk, flags);
-		while (skip >= skb->len) {
-			skip -= skb->len;
-			last = skb;
-			skb = skb_peek_next(skb, &sk->sk_receive_queue);
-			if (!skb)
-				goto again;
-		}
+		if (flags & MSG_PEEK) {
+			skip = sk_peek_offset(sk, flags);
+			while (skip >= unix_skb_len(skb)) {
+				skip -= unix_skb_len(skb);
+				last = skb;
+				skb = skb_peek_next(skb, &sk->sk_receive_queue);
+				if (!skb)
+					goto again;
+			}
 
-		unix_state_unlock(sk);
+			if (!unix_stream_creds(sock, siocb->scm, skb,
+					       &check_creds))
+				goto unlock;
 
-		if (check_creds) {
-			/* Never glue messages from different writers */
-			if ((UNIXCB(skb).pid  != siocb->scm->pid) ||
-			    !uid_eq(UNIXCB(skb).uid, siocb->scm->creds.uid) ||
-			    !gid_eq(UNIXCB(skb).gid, siocb->scm->creds.gid))
-				break;
-		} else if (test_bit(SOCK_PASSCRED, &sock->flags)) {
-			/* Copy credentials */
-			scm_set_cred(siocb->scm, UNIXCB(skb).pid, UNIXCB(skb).uid, UNIXCB(skb).gid);
-			check_creds = 1;
+			chunk = min_t(unsigned int, unix_skb_len(skb) - skip,
+				      size);
+			skip += UNIXSCB(skb)->consumed;
+
+			/* It is questionable, see note in unix_dgram_recvmsg.
+			 */
+			if (UNIXCB(skb).fp)
+				siocb->scm->fp = unix_peek_fds(UNIXCB(skb).fp);
+
+			sk_peek_offset_fwd(sk, chunk);
+			skb_get(skb);
+			unix_state_unlock(sk);
+
+			if (sunaddr)
+				unix_copy_addr(msg, skb->sk);
+
+			if (skb_copy_datagram_iovec(skb, skip, msg->msg_iov,
+						    chunk)) {
+				unix_state_lock(sk);
+				sk_peek_offset_bwd(sk, chunk);
+				unix_state_unlock(sk);
+				if (copied == 0)
+					copied = -EFAULT;
+			} else {
+				copied += chunk;
+			}
+			consume_skb(skb);
+			break;
 		}
 
+		chunk = unix_stream_claim(sk, sock, siocb->scm, skb, size,
+					  &check_creds, &claim);
+		unix_state_unlock(sk);
+		if (!chunk)
+			break;
+
 		/* Copy address just once */
 		if (sunaddr) {
+			skb = skb_peek(&claim.skbs) ? : claim.part;
 			unix_copy_addr(msg, skb->sk);
 			sunaddr = NULL;
 		}
 
-		chunk = min_t(unsigned int, skb->len - skip, size);
-		if (memcpy_toiovec(msg->msg_iov, skb->data + skip, chunk)) {
+		n = unix_stream_copy_claim(sk, msg, siocb->scm, &claim);
+		sk_peek_offset_bwd(sk, n);
+		copied += n;
+		size -= n;
+		if (n < chunk) {
 			if (copied == 0)
 				copied = -EFAULT;
 			break;
 		}
-		copied += chunk;
-		size -= chunk;
-
-		/* Mark read part of skb as used */
-		if (!(flags & MSG_PEEK)) {
-			skb_pull(skb, chunk);
-
-			sk_peek_offset_bwd(sk, chunk);
-
-			if (UNIXCB(skb).fp)
-				unix_detach_fds(siocb->scm, skb);
-
-			if (skb->len)
-				break;
-
-			skb_unlink(skb, &sk->sk_receive_queue);
-			consume_skb(skb);
-
-			if (siocb->scm->fp)
-				break;
-		} else {
-			/* It is questionable, see note in unix_dgram_recvmsg.
-			 */
-			if (UNIXCB(skb).fp)
-				siocb->scm->fp = scm_fp_dup(UNIXCB(skb).fp);
-
-			sk_peek_offset_fwd(sk, chunk);
-
-			break;
-		}
-	} while (size);
+	} while (size && !siocb->scm->fp);
 
 	mutex_unlock(&u->readlock);
 	scm_recv(sock, msg, siocb->scm, flags);
@@ -2117,7 +2465,8 @@ long unix_inq_len(struct sock *sk)
 	if (sk->sk_type == SOCK_STREAM ||
 	    sk->sk_type == SOCK_SEQPACKET) {
 		skb_queue_walk(&sk->sk_receive_queue, skb)
-			amount += skb->len;
+			amount += sk->sk_type == SOCK_STREAM ?
+				  unix_skb_len(skb) : skb->len;
 	} else {
 		skb = skb_peek(&sk->sk_receive_queue);
 		if (skb)
@@ -2437,6 +2786,7 @@ static int __init af_unix_init(void)
 	int rc = -1;
 
 	BUILD_BUG_ON(sizeof(struct unix_skb_parms) > FIELD_SIZEOF(struct sk_buff, cb));
+	BUILD_BUG_ON(sizeof(struct unix_stream_cb) > FIELD_SIZEOF(struct sk_buff, cb));
 
 	rc = proto_register(&unix_proto, 1);
 	if (rc != 0) {
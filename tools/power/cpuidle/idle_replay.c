@@ -0,0 +1,566 @@
+/*
+ * idle_replay - replay an idle trace through the menu governor predictors
+ *
+ * Reads the text output of the cpu_idle, irq_handler_entry and
+ * hrtimer_expire_entry/timer_expire_entry trace events (the ftrace "trace"
+ * file or "trace-cmd report") and replays every idle period of every cpu
+ * through a model of the menu governor, once with the next timer and
+ * correction factor/repeating interval predictors only and once with the
+ * per interrupt predictor of CONFIG_IRQ_TIMINGS added.
+ *
+ * The next timer event a real governor would have seen is taken to be the
+ * next timer expiry traced on that cpu.  For each idle period the state
+ * chosen from the predicted duration is compared with the deepest state
+ * whose target residency the measured duration would have satisfied, and
+ * the report gives for every cpu and predictor:
+ *
+ *	exact	chosen state was the ideal one
+ *	deep	chosen state was deeper than the measured residency allowed
+ *	shallow	a deeper state would have paid off
+ *	err_us	mean absolute error of the predicted duration
+ *	exit_us	exit latency paid on average
+ *
+ * The states default to those of the Atom SoCs with S0ix and can be given
+ * as a file with one "<name> <exit latency us> <target residency us>" line
+ * per state, shallowest first.  The menu hrtimer reevaluation of short
+ * predictions is not modelled.
+ *
+ * Usage: idle_replay [-v] [-c cpu] [-s states] [trace]
+ *
+ * License (GPLv2):
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. * See the GNU General Public License for
+ * more details.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_CPUS	64
+#define MAX_STATES	16
+#define MAX_SLEEP_US	4000000ULL
+#define IDLE_EXIT	4294967295U
+
+/* drivers/cpuidle/governors/menu.c */
+#define BUCKETS		6
+#define INTERVALS	8
+#define RESOLUTION	1024
+#define DECAY		8
+#define MAX_INTERESTING	50000
+#define MAX_DEVIATION	60
+
+/* kernel/irq/timings.c */
+#define IRQT_SLOTS		32
+#define IRQT_EWMA_SHIFT		3
+#define IRQT_MIN_SAMPLES	8
+#define IRQT_MAX_INTERVAL	(1 << 20)
+#define IRQT_MAX_MISSED		4
+
+enum { EV_IDLE, EV_WAKE, EV_IRQ, EV_TIMER };
+
+struct event {
+	uint64_t t;		/* us */
+	int type;
+	unsigned int irq;
+};
+
+struct state {
+	char name[32];
+	unsigned int exit_latency;
+	unsigned int target_residency;
+};
+
+struct menu {
+	uint64_t correction_factor[BUCKETS];
+	uint32_t intervals[INTERVALS];
+	int interval_ptr;
+	int bucket;
+	unsigned int expected_us;
+	uint64_t predicted_us;
+	unsigned int exit_us;
+	int last_idx;
+};
+
+struct irqt_stat {
+	unsigned int irq;
+	unsigned int count;
+	uint64_t last;
+	int64_t avg;
+	int64_t var;
+};
+
+enum { PRED_MENU, PRED_IRQ, NR_PREDICTORS };
+
+static const char * const pred_names[NR_PREDICTORS] = {
+	[PRED_MENU] = "menu",
+	[PRED_IRQ] = "menu+irq",
+};
+
+struct result {
+	unsigned long idles, exact, deep, shallow;
+	double err_us, exit_us;
+};
+
+static struct state states[MAX_STATES] = {
+	{ "C1",		1,	4 },
+	{ "C4",		100,	400 },
+	{ "C6",		140,	560 },
+	{ "S0i1",	1200,	4000 },
+	{ "S0i3",	10000,	20000 },
+};
+static int nr_states = 5;
+
+static struct event *events[MAX_CPUS];
+static int nr_events[MAX_CPUS], max_events[MAX_CPUS];
+static struct result results[MAX_CPUS][NR_PREDICTORS];
+static int verbose;
+
+static void add_event(int cpu, uint64_t t, int type, unsigned int irq)
+{
+	struct event *e;
+
+	if (nr_events[cpu] == max_events[cpu]) {
+		max_events[cpu] = max_events[cpu] ? 2 * max_events[cpu] : 4096;
+		events[cpu] = realloc(events[cpu],
+				      max_events[cpu] * sizeof(*e));
+		if (!events[cpu]) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	e = &events[cpu][nr_events[cpu]++];
+	e->t = t;
+	e->type = type;
+	e->irq = irq;
+}
+
+/*
+ * "<task>-<pid> [<cpu>] <flags> <secs>.<usecs>: <event>: <args>"; the
+ * flags column is optional.
+ */
+static void parse_line(char *line)
+{
+	char *p = strchr(line, '['), *end, *ev, *args;
+	unsigned int state, id, irq;
+	double secs = -1;
+	int cpu;
+
+	if (!p)
+		return;
+	cpu = strtol(p + 1, &end, 10);
+	if (end == p + 1 || *end != ']' || cpu < 0 || cpu >= MAX_CPUS)
+		return;
+
+	for (p = end + 1; *p; p = end) {
+		while (*p == ' ')
+			p++;
+		end = strchr(p, ' ');
+		if (!end)
+			return;
+		if (end[-1] == ':') {
+			secs = strtod(p, NULL);
+			p = end;
+			break;
+		}
+	}
+	if (secs < 0)
+		return;
+
+	ev = p + strspn(p, " ");
+	args = strstr(ev, ": ");
+	if (!args)
+		return;
+	*args = '\0';
+	args += 2;
+
+	if (!strcmp(ev, "cpu_idle")) {
+		if (sscanf(args, "state=%u cpu_id=%u", &state, &id) != 2 ||
+		    id >= MAX_CPUS)
+			return;
+		add_event(id, secs * 1e6, state == IDLE_EXIT ? EV_WAKE :
+			  EV_IDLE, 0);
+	} else if (!strcmp(ev, "irq_handler_entry")) {
+		if (sscanf(args, "irq=%u", &irq) == 1)
+			add_event(cpu, secs * 1e6, EV_IRQ, irq);
+	} else if (!strcmp(ev, "hrtimer_expire_entry") ||
+		   !strcmp(ev, "timer_expire_entry")) {
+		add_event(cpu, secs * 1e6, EV_TIMER, 0);
+	}
+}
+
+static int load_states(const char *file)
+{
+	char line[128];
+	FILE *f = fopen(file, "r");
+
+	if (!f) {
+		perror(file);
+		return -1;
+	}
+	nr_states = 0;
+	while (fgets(line, sizeof(line), f)) {
+		struct state *s = &states[nr_states];
+
+		if (line[0] == '#' || line[strspn(line, " \t")] == '\n')
+			continue;
+		if (nr_states == MAX_STATES ||
+		    sscanf(line, "%31s %u %u", s->name, &s->exit_latency,
+			   &s->target_residency) != 3) {
+			fprintf(stderr, "%s: bad line: %s", file, line);
+			fclose(f);
+			return -1;
+		}
+		nr_states++;
+	}
+	fclose(f);
+	if (!nr_states) {
+		fprintf(stderr, "%s: no states\n", file);
+		return -1;
+	}
+	return 0;
+}
+
+static int which_bucket(unsigned int duration)
+{
+	if (duration < 10)
+		return 0;
+	if (duration < 100)
+		return 1;
+	if (duration < 1000)
+		return 2;
+	if (duration < 10000)
+		return 3;
+	if (duration < 100000)
+		return 4;
+	return 5;
+}
+
+/* get_typical_interval() of the menu governor */
+static int typical_interval(struct menu *m)
+{
+	int64_t thresh = INT64_MAX;
+	uint64_t max, avg, stddev;
+	int i, divisor;
+
+	for (;;) {
+		max = avg = stddev = divisor = 0;
+		for (i = 0; i < INTERVALS; i++) {
+			int64_t value = m->intervals[i];
+
+			if (value <= thresh) {
+				avg += value;
+				divisor++;
+				if ((uint64_t)value > max)
+					max = value;
+			}
+		}
+		avg /= divisor;
+		for (i = 0; i < INTERVALS; i++) {
+			int64_t value = m->intervals[i];
+
+			if (value <= thresh) {
+				int64_t diff = value - avg;
+
+				stddev += diff * diff;
+			}
+		}
+		stddev = sqrt(stddev / divisor);
+
+		if ((avg > stddev * 6 && divisor * 4 >= INTERVALS * 3) ||
+		    stddev <= 20) {
+			m->predicted_us = avg;
+			return 1;
+		}
+		if (divisor * 4 <= INTERVALS * 3)
+			return 0;
+		thresh = max - 1;
+	}
+}
+
+static void irqt_record(struct irqt_stat *slots, unsigned int irq, uint64_t t)
+{
+	struct irqt_stat *s = &slots[irq % IRQT_SLOTS];
+	int64_t interval, diff;
+
+	if (s->irq != irq || !s->last) {
+		s->irq = irq;
+		s->count = 0;
+		s->last = t;
+		return;
+	}
+
+	interval = t - s->last;
+	s->last = t;
+	if (interval > IRQT_MAX_INTERVAL) {
+		s->count = 0;
+		return;
+	}
+
+	if (!s->count) {
+		s->avg = interval;
+		s->var = 0;
+	} else {
+		diff = interval - s->avg;
+		s->avg += diff >> IRQT_EWMA_SHIFT;
+		s->var += (diff * diff - s->var) >> IRQT_EWMA_SHIFT;
+	}
+	if (s->count < IRQT_MIN_SAMPLES)
+		s->count++;
+}
+
+static uint64_t irqt_next_event(struct irqt_stat *slots, uint64_t now)
+{
+	uint64_t next = UINT64_MAX;
+	int i;
+
+	for (i = 0; i < IRQT_SLOTS; i++) {
+		struct irqt_stat *s = &slots[i];
+		uint64_t t, missed;
+
+		if (s->count < IRQT_MIN_SAMPLES || s->avg <= 0)
+			continue;
+		if (s->var * 16 > s->avg * s->avg)
+			continue;
+
+		t = s->last + s->avg;
+		if (t <= now) {
+			missed = (now - s->last) / s->avg;
+			if (missed >= IRQT_MAX_MISSED)
+				continue;
+			t = s->last + (missed + 1) * s->avg;
+		}
+		if (t < next)
+			next = t;
+	}
+	return next;
+}
+
+/* menu_select() with a performance multiplier of 1 */
+static int menu_select(struct menu *m, unsigned int expected_us,
+		       uint64_t irq_us)
+{
+	int i;
+
+	m->expected_us = expected_us;
+	m->bucket = which_bucket(expected_us);
+	if (!m->correction_factor[m->bucket])
+		m->correction_factor[m->bucket] = RESOLUTION * DECAY;
+	m->predicted_us = (expected_us * m->correction_factor[m->bucket] +
+			   RESOLUTION * DECAY / 2) / (RESOLUTION * DECAY);
+
+	typical_interval(m);
+	if (irq_us < m->predicted_us)
+		m->predicted_us = irq_us;
+
+	m->last_idx = 0;
+	for (i = 0; i < nr_states; i++) {
+		if (states[i].target_residency > m->predicted_us)
+			continue;
+		if (states[i].exit_latency > m->predicted_us)
+			continue;
+		m->last_idx = i;
+	}
+	m->exit_us = states[m->last_idx].exit_latency;
+	return m->last_idx;
+}
+
+/* menu_update() */
+static void menu_update(struct menu *m, unsigned int last_idle_us)
+{
+	unsigned int measured_us = last_idle_us;
+	uint64_t new_factor;
+
+	if (measured_us > m->exit_us)
+		measured_us -= m->exit_us;
+
+	new_factor = m->correction_factor[m->bucket] * (DECAY - 1) / DECAY;
+	if (m->expected_us > 0 && measured_us < MAX_INTERESTING)
+		new_factor += RESOLUTION * measured_us / m->expected_us;
+	else
+		new_factor += RESOLUTION;
+	if (!new_factor)
+		new_factor = 1;
+	m->correction_factor[m->bucket] = new_factor;
+
+	m->intervals[m->interval_ptr++] = last_idle_us;
+	if (m->interval_ptr >= INTERVALS)
+		m->interval_ptr = 0;
+}
+
+static int ideal_state(uint64_t measured_us)
+{
+	int i, ideal = 0;
+
+	for (i = 0; i < nr_states; i++)
+		if (states[i].target_residency <= measured_us)
+			ideal = i;
+	return ideal;
+}
+
+static void replay_cpu(int cpu)
+{
+	struct irqt_stat slots[IRQT_SLOTS];
+	struct menu menus[NR_PREDICTORS];
+	uint64_t idle_start = 0;
+	int chosen[NR_PREDICTORS];
+	int i, j, next_timer = 0, idle = 0;
+
+	memset(slots, 0, sizeof(slots));
+	memset(menus, 0, sizeof(menus));
+
+	for (i = 0; i < nr_events[cpu]; i++) {
+		struct event *e = &events[cpu][i];
+		uint64_t expected, measured, irq_next;
+		int ideal;
+
+		switch (e->type) {
+		case EV_IRQ:
+			irqt_record(slots, e->irq, e->t);
+			break;
+
+		case EV_IDLE:
+			/* the next timer the tick code would have reported */
+			if (next_timer <= i)
+				next_timer = i + 1;
+			while (next_timer < nr_events[cpu] &&
+			       events[cpu][next_timer].type != EV_TIMER)
+				next_timer++;
+			expected = MAX_SLEEP_US;
+			if (next_timer < nr_events[cpu] &&
+			    events[cpu][next_timer].t - e->t < MAX_SLEEP_US)
+				expected = events[cpu][next_timer].t - e->t;
+
+			irq_next = irqt_next_event(slots, e->t);
+			for (j = 0; j < NR_PREDICTORS; j++)
+				chosen[j] = menu_select(&menus[j], expected,
+					j == PRED_IRQ && irq_next != UINT64_MAX ?
+					irq_next - e->t : UINT64_MAX);
+			idle_start = e->t;
+			idle = 1;
+			break;
+
+		case EV_WAKE:
+			if (!idle)
+				break;
+			idle = 0;
+			measured = e->t - idle_start;
+			ideal = ideal_state(measured);
+
+			for (j = 0; j < NR_PREDICTORS; j++) {
+				struct result *r = &results[cpu][j];
+				struct menu *m = &menus[j];
+
+				r->idles++;
+				if (chosen[j] == ideal)
+					r->exact++;
+				else if (chosen[j] > ideal)
+					r->deep++;
+				else
+					r->shallow++;
+				r->err_us += fabs((double)m->predicted_us -
+						  (double)measured);
+				r->exit_us += m->exit_us;
+
+				if (verbose)
+					printf("cpu%d %.6f %-8s expected %u "
+					       "predicted %llu measured %llu "
+					       "state %s ideal %s\n", cpu,
+					       idle_start / 1e6, pred_names[j],
+					       m->expected_us,
+					       (unsigned long long)m->predicted_us,
+					       (unsigned long long)measured,
+					       states[chosen[j]].name,
+					       states[ideal].name);
+
+				menu_update(m, measured);
+			}
+			break;
+		}
+	}
+}
+
+static void print_result(const char *who, int pred, struct result *r)
+{
+	if (!r->idles)
+		return;
+	printf("%-5s %-9s %8lu %6.1f%% %6.1f%% %7.1f%% %9.1f %9.1f\n", who,
+	       pred_names[pred], r->idles, 100.0 * r->exact / r->idles,
+	       100.0 * r->deep / r->idles, 100.0 * r->shallow / r->idles,
+	       r->err_us / r->idles, r->exit_us / r->idles);
+}
+
+int main(int argc, char **argv)
+{
+	struct result total[NR_PREDICTORS];
+	int opt, cpu, only_cpu = -1, j;
+	char line[1024], name[16];
+	FILE *f = stdin;
+
+	while ((opt = getopt(argc, argv, "vc:s:")) != -1) {
+		switch (opt) {
+		case 'v':
+			verbose = 1;
+			break;
+		case 'c':
+			only_cpu = atoi(optarg);
+			break;
+		case 's':
+			if (load_states(optarg))
+				return 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-v] [-c cpu] [-s states] "
+				"[trace]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind < argc) {
+		f = fopen(argv[optind], "r");
+		if (!f) {
+			perror(argv[optind]);
+			return 1;
+		}
+	}
+	while (fgets(line, sizeof(line), f))
+		if (line[0] != '#')
+			parse_line(line);
+	if (f != stdin)
+		fclose(f);
+
+	memset(total, 0, sizeof(total));
+	printf("%-5s %-9s %8s %7s %7s %8s %9s %9s\n", "cpu", "predictor",
+	       "idles", "exact", "deep", "shallow", "err_us", "exit_us");
+
+	for (cpu = 0; cpu < MAX_CPUS; cpu++) {
+		if (!nr_events[cpu] || (only_cpu >= 0 && cpu != only_cpu))
+			continue;
+		replay_cpu(cpu);
+		snprintf(name, sizeof(name), "%d", cpu);
+		for (j = 0; j < NR_PREDICTORS; j++) {
+			struct result *r = &results[cpu][j];
+
+			print_result(name, j, r);
+			total[j].idles += r->idles;
+			total[j].exact += r->exact;
+			total[j].deep += r->deep;
+			total[j].shallow += r->shallow;
+			total[j].err_us += r->err_us;
+			total[j].exit_us += r->exit_us;
+		}
+	}
+
+	for (j = 0; j < NR_PREDICTORS; j++)
+		print_result("all", j, &total[j]);
+	return 0;
+}
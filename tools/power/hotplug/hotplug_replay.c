@@ -0,0 +1,532 @@
+/*
+ * hotplug_replay - replay an input and load trace through hotplug policies
+ *
+ * Replays a trace of input events, rendered frames and background load
+ * on a model of a phone cpu, once with each of two hotplug policies, and
+ * reports the frame deadline misses and the energy of each:
+ *
+ *	load	a load average driven policy in the style of msm_hotplug:
+ *		one more cpu when the busy fraction of the online cpus,
+ *		averaged over the last history samples, goes over 80%,
+ *		one less when it stays under 40%
+ *	cc	the policy of drivers/cpufreq/cc_hotplug.c: concurrency
+ *		of the last completed sum periods and its trend, the
+ *		current number of runnable tasks and input boost, with
+ *		the same thresholds and hysteresis as the driver
+ *
+ * The trace has one event per line, times in microseconds:
+ *
+ *	<t> input			a touch or key event
+ *	<t> frame <work> <threads>	a frame of <work> us of cpu time in
+ *					each of <threads> parallel threads,
+ *					due one frame period after <t>
+ *	<t> load <threads>		from <t> on, <threads> background
+ *					threads are always runnable
+ *
+ * Runnable threads share the usable cpus equally.  A cpu that is brought
+ * up becomes usable after the bring-up latency and draws busy power
+ * meanwhile; online cpus draw idle power when they have nothing to run
+ * and offline cpus draw nothing.  With -g a synthetic trace of touch
+ * scrolls over light background load is written instead, which is how
+ * the policies are meant to be compared when no trace is at hand.
+ *
+ * Usage: hotplug_replay [-v] [-c cpus] [-u up_us] [-p idle_mw,busy_mw]
+ *			 [-f frame_us] [trace]
+ *	  hotplug_replay -g seconds [-s seed]
+ *
+ * License (GPLv2):
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. * See the GNU General Public License for
+ * more details.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_CPUS	16
+#define MAX_FRAMES	16
+#define MAX_THREADS	8
+#define STEP_US		100
+
+/* drivers/cpufreq/cc_hotplug.c defaults */
+#define CC_SAMPLE_US		20000
+#define CC_UP_THRESHOLD		90
+#define CC_DOWN_THRESHOLD	60
+#define CC_DOWN_HOLD_US		500000
+#define CC_BOOST_CPUS		2
+#define CC_BOOST_US		500000
+/* kernel/sched/consolidation.c sum period, 2^26 ns */
+#define CC_PERIOD_US		67109
+
+/* load average policy */
+#define LOAD_SAMPLE_US		20000
+#define LOAD_HISTORY		5
+#define LOAD_UP			80
+#define LOAD_DOWN		40
+
+enum { EV_INPUT, EV_FRAME, EV_LOAD };
+
+struct event {
+	uint64_t t;
+	int type;
+	unsigned int work;
+	unsigned int threads;
+};
+
+struct frame {
+	uint64_t due;
+	double left[MAX_THREADS];
+	unsigned int threads;
+};
+
+struct policy;
+
+struct sim {
+	const struct policy *policy;
+	uint64_t now;
+	unsigned int online;		/* including those coming up */
+	uint64_t ready[MAX_CPUS];	/* when each online cpu is usable */
+	unsigned int background;
+	struct frame frames[MAX_FRAMES];
+	unsigned int nr_frames;
+	double busy_us;			/* since the last sample */
+	uint64_t last_input;
+
+	/* cc policy */
+	double period_sum;		/* runnable us in the current period */
+	double cc;			/* concurrency of completed periods */
+	double prev_cc;
+	uint64_t below_since;
+
+	/* load policy */
+	unsigned int hist[LOAD_HISTORY];
+	unsigned int hist_cnt;
+
+	/* results */
+	unsigned long frames_total, frames_missed, dropped;
+	unsigned long ups, downs;
+	double energy_uj, online_us;
+};
+
+struct policy {
+	const char *name;
+	uint64_t sample_us;
+	void (*sample)(struct sim *s);
+	void (*input)(struct sim *s);
+};
+
+static unsigned int nr_cpus = 4;
+static unsigned int up_us = 3000;
+static double idle_mw = 25, busy_mw = 600;
+static unsigned int frame_us = 16667;
+static int verbose;
+
+static struct event *events;
+static size_t nr_events;
+
+static unsigned int usable(struct sim *s)
+{
+	unsigned int i, n = 0;
+
+	for (i = 0; i < s->online; i++)
+		if (s->ready[i] <= s->now)
+			n++;
+	return n;
+}
+
+static unsigned int runnable(struct sim *s)
+{
+	unsigned int i, j, n = s->background;
+
+	for (i = 0; i < s->nr_frames; i++)
+		for (j = 0; j < s->frames[i].threads; j++)
+			if (s->frames[i].left[j] > 0)
+				n++;
+	return n;
+}
+
+/* Bring cpus up one after the other, like cpu_up() in a loop */
+static void cpus_up(struct sim *s, unsigned int target)
+{
+	uint64_t t = s->now;
+
+	if (target > nr_cpus)
+		target = nr_cpus;
+	while (s->online < target) {
+		t += up_us;
+		s->ready[s->online++] = t;
+		s->ups++;
+	}
+}
+
+static void cpu_down(struct sim *s)
+{
+	if (s->online > 1) {
+		s->online--;
+		s->downs++;
+	}
+}
+
+static unsigned int div_up(double demand, unsigned int pct)
+{
+	double n = demand * 100 / pct;
+	unsigned int cpus = (unsigned int)n;
+
+	return cpus < n ? cpus + 1 : cpus;
+}
+
+static void cc_sample(struct sim *s)
+{
+	unsigned int up, keep, nr = runnable(s);
+	double demand = s->cc > nr ? s->cc : nr;
+	int boosted = s->last_input &&
+		      s->now < s->last_input + CC_BOOST_US;
+
+	if (s->cc > s->prev_cc)
+		demand += s->cc - s->prev_cc;
+	s->prev_cc = s->cc;
+
+	up = div_up(demand, CC_UP_THRESHOLD);
+	keep = div_up(demand, CC_DOWN_THRESHOLD);
+	if (boosted) {
+		if (up < CC_BOOST_CPUS)
+			up = CC_BOOST_CPUS;
+		if (keep < CC_BOOST_CPUS)
+			keep = CC_BOOST_CPUS;
+	}
+	if (!up)
+		up = 1;
+	if (!keep)
+		keep = 1;
+
+	if (up > s->online) {
+		cpus_up(s, up);
+		s->below_since = 0;
+	} else if (keep < s->online) {
+		if (!s->below_since) {
+			s->below_since = s->now;
+		} else if (s->now >= s->below_since + CC_DOWN_HOLD_US) {
+			cpu_down(s);
+			s->below_since = s->now;
+		}
+	} else {
+		s->below_since = 0;
+	}
+}
+
+static void cc_input(struct sim *s)
+{
+	if (s->online < CC_BOOST_CPUS)
+		cpus_up(s, CC_BOOST_CPUS);
+}
+
+static void load_sample(struct sim *s)
+{
+	unsigned int i, n, load, avg = 0;
+
+	load = s->busy_us * 100 / ((double)LOAD_SAMPLE_US * s->online);
+	s->hist[s->hist_cnt++ % LOAD_HISTORY] = load;
+	n = s->hist_cnt < LOAD_HISTORY ? s->hist_cnt : LOAD_HISTORY;
+	for (i = 0; i < n; i++)
+		avg += s->hist[i];
+	avg /= n;
+
+	if (avg > LOAD_UP)
+		cpus_up(s, s->online + 1);
+	else if (avg < LOAD_DOWN && n == LOAD_HISTORY)
+		cpu_down(s);
+}
+
+static const struct policy policies[] = {
+	{ "load", LOAD_SAMPLE_US, load_sample, NULL },
+	{ "cc", CC_SAMPLE_US, cc_sample, cc_input },
+};
+
+static void add_frame(struct sim *s, const struct event *e)
+{
+	struct frame *f;
+	unsigned int i;
+
+	s->frames_total++;
+	if (s->nr_frames == MAX_FRAMES) {
+		s->frames_missed++;
+		s->dropped++;
+		return;
+	}
+	f = &s->frames[s->nr_frames++];
+	f->due = e->t + frame_us;
+	f->threads = e->threads < MAX_THREADS ? e->threads : MAX_THREADS;
+	for (i = 0; i < f->threads; i++)
+		f->left[i] = e->work;
+}
+
+/* Run every runnable thread for one step and retire finished frames */
+static void step(struct sim *s)
+{
+	unsigned int cpus = usable(s), nr = runnable(s), i, j;
+	double share = nr > cpus ? (double)cpus / nr : 1.0;
+	double busy = nr < cpus ? nr : cpus;
+
+	for (i = 0; i < s->nr_frames; i++)
+		for (j = 0; j < s->frames[i].threads; j++)
+			if (s->frames[i].left[j] > 0)
+				s->frames[i].left[j] -= share * STEP_US;
+
+	s->busy_us += busy * STEP_US;
+	s->period_sum += (double)nr * STEP_US;
+	s->online_us += (double)s->online * STEP_US;
+	s->energy_uj += (busy * busy_mw + (cpus - busy) * idle_mw +
+			 (s->online - cpus) * busy_mw) * STEP_US / 1000;
+
+	s->now += STEP_US;
+
+	for (i = 0; i < s->nr_frames; ) {
+		struct frame *f = &s->frames[i];
+		int done = 1;
+
+		for (j = 0; j < f->threads; j++)
+			if (f->left[j] > 0)
+				done = 0;
+		if (!done) {
+			i++;
+			continue;
+		}
+		if (s->now > f->due) {
+			s->frames_missed++;
+			if (verbose)
+				printf("%s: frame due %llu done %llu, %u cpus\n",
+				       s->policy->name,
+				       (unsigned long long)f->due,
+				       (unsigned long long)s->now, s->online);
+		}
+		*f = s->frames[--s->nr_frames];
+	}
+
+	if (s->now % CC_PERIOD_US < STEP_US) {
+		s->cc = (s->cc + s->period_sum / CC_PERIOD_US) / 2;
+		s->period_sum = 0;
+	}
+}
+
+static void replay(const struct policy *p)
+{
+	struct sim s;
+	uint64_t end, next_sample;
+	size_t i = 0;
+	double secs;
+
+	memset(&s, 0, sizeof(s));
+	s.policy = p;
+	s.online = 1;
+	next_sample = p->sample_us;
+	end = nr_events ? events[nr_events - 1].t + 10 * frame_us : 0;
+
+	while (s.now < end || s.nr_frames) {
+		for (; i < nr_events && events[i].t <= s.now; i++) {
+			const struct event *e = &events[i];
+
+			switch (e->type) {
+			case EV_INPUT:
+				s.last_input = s.now;
+				if (p->input)
+					p->input(&s);
+				break;
+			case EV_FRAME:
+				add_frame(&s, e);
+				break;
+			case EV_LOAD:
+				s.background = e->threads;
+				break;
+			}
+		}
+		step(&s);
+		if (s.now >= next_sample) {
+			p->sample(&s);
+			s.busy_us = 0;
+			next_sample += p->sample_us;
+		}
+	}
+
+	secs = s.now / 1e6;
+	printf("%-5s %8lu %8lu %7.2f%% %8.2f %9.1f %8.1f %6lu %6lu\n",
+	       p->name, s.frames_total, s.frames_missed,
+	       s.frames_total ? 100.0 * s.frames_missed / s.frames_total : 0,
+	       s.online_us / s.now, s.energy_uj / 1000,
+	       s.energy_uj / 1000 / secs, s.ups, s.downs);
+	if (s.dropped)
+		printf("%-5s %lu frames dropped, more than %d pending\n",
+		       p->name, s.dropped, MAX_FRAMES);
+}
+
+static void add_event(uint64_t t, int type, unsigned int work,
+		      unsigned int threads)
+{
+	static size_t alloc;
+
+	if (nr_events == alloc) {
+		alloc = alloc ? 2 * alloc : 4096;
+		events = realloc(events, alloc * sizeof(*events));
+		if (!events) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	events[nr_events].t = t;
+	events[nr_events].type = type;
+	events[nr_events].work = work;
+	events[nr_events].threads = threads;
+	nr_events++;
+}
+
+static int cmp_event(const void *a, const void *b)
+{
+	const struct event *x = a, *y = b;
+
+	return x->t < y->t ? -1 : x->t > y->t;
+}
+
+static void read_trace(FILE *f)
+{
+	char line[256], what[16];
+	unsigned long long t;
+	unsigned int a, b;
+	int n;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		n = sscanf(line, "%llu %15s %u %u", &t, what, &a, &b);
+		if (n >= 2 && !strcmp(what, "input"))
+			add_event(t, EV_INPUT, 0, 0);
+		else if (n == 4 && !strcmp(what, "frame"))
+			add_event(t, EV_FRAME, a, b);
+		else if (n == 3 && !strcmp(what, "load"))
+			add_event(t, EV_LOAD, 0, a);
+		else
+			fprintf(stderr, "hotplug_replay: bad line: %s", line);
+	}
+	qsort(events, nr_events, sizeof(*events), cmp_event);
+}
+
+static unsigned int rnd(unsigned int lo, unsigned int hi)
+{
+	return lo + rand() % (hi - lo + 1);
+}
+
+/*
+ * Touch scrolls every few seconds, each followed by a second or so of
+ * frames of a UI and a render thread, over background threads that come
+ * and go.
+ */
+static void generate(unsigned int secs)
+{
+	uint64_t t = 0, end = (uint64_t)secs * 1000000, scroll, u, len;
+	uint64_t bg = 0;
+
+	printf("# hotplug_replay -g %u\n", secs);
+	while (t < end) {
+		t += rnd(2000, 6000) * 1000ULL;
+		while (bg < t) {
+			printf("%llu load %u\n", (unsigned long long)bg,
+			       rnd(0, 4) ? 0 : rnd(1, 2));
+			bg += rnd(100, 800) * 1000ULL;
+		}
+		scroll = t;
+		len = rnd(150, 400) * 1000ULL;
+		for (u = 0; u < len; u += 10000)
+			printf("%llu input\n", (unsigned long long)(scroll + u));
+		len = rnd(800, 1500) * 1000ULL;
+		for (u = 8000; u < len; u += frame_us)
+			printf("%llu frame %u %u\n",
+			       (unsigned long long)(scroll + u),
+			       rnd(5000, 10000), rnd(2, 3));
+		t = scroll + 1500000;
+	}
+	printf("%llu load 0\n", (unsigned long long)t);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int gen = 0, seed = 1;
+	size_t i;
+	FILE *f = stdin;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "vc:u:p:f:g:s:")) != -1) {
+		switch (opt) {
+		case 'v':
+			verbose = 1;
+			break;
+		case 'c':
+			nr_cpus = atoi(optarg);
+			break;
+		case 'u':
+			up_us = atoi(optarg);
+			break;
+		case 'p':
+			if (sscanf(optarg, "%lf,%lf", &idle_mw, &busy_mw) != 2) {
+				fprintf(stderr, "hotplug_replay: bad power\n");
+				return 1;
+			}
+			break;
+		case 'f':
+			frame_us = atoi(optarg);
+			break;
+		case 'g':
+			gen = atoi(optarg);
+			break;
+		case 's':
+			seed = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-v] [-c cpus] [-u up_us] "
+				"[-p idle_mw,busy_mw] [-f frame_us] [trace]\n"
+				"       %s -g seconds [-s seed]\n",
+				argv[0], argv[0]);
+			return 1;
+		}
+	}
+
+	if (!nr_cpus || nr_cpus > MAX_CPUS || !frame_us) {
+		fprintf(stderr, "hotplug_replay: bad parameters\n");
+		return 1;
+	}
+
+	if (gen) {
+		srand(seed);
+		generate(gen);
+		return 0;
+	}
+
+	if (optind < argc) {
+		f = fopen(argv[optind], "r");
+		if (!f) {
+			perror(argv[optind]);
+			return 1;
+		}
+	}
+	read_trace(f);
+	if (!nr_events) {
+		fprintf(stderr, "hotplug_replay: empty trace\n");
+		return 1;
+	}
+
+	printf("%u cpus, bring-up %u us, %.0f/%.0f mW idle/busy, "
+	       "frame %u us, %zu events\n", nr_cpus, up_us, idle_mw, busy_mw,
+	       frame_us, nr_events);
+	printf("%-5s %8s %8s %8s %8s %9s %8s %6s %6s\n", "", "frames",
+	       "missed", "miss", "cpus", "energy_mJ", "avg_mW", "ups",
+	       "downs");
+	for (i = 0; i < sizeof(policies) / sizeof(policies[0]); i++)
+		replay(&policies[i]);
+	return 0;
+}
@@ -0,0 +1,190 @@
+/*
+ * wakelock_bench - measure the cost of user space wakelock acquire/release
+ *
+ * Each thread repeatedly acquires and releases its own set of wakelocks
+ * through /sys/power/wake_lock and /sys/power/wake_unlock, the way Android
+ * style frameworks do, and the average cost of one acquire and one release
+ * is reported.  With -b the locks of a thread are acquired and released
+ * with one write of several lines each instead of one write per lock.
+ *
+ * Usage: wakelock_bench [-t threads] [-n locks] [-l loops] [-b]
+ *
+ * Needs CONFIG_PM_WAKELOCKS and root.  The wakelocks are named
+ * "wlbench.<thread>.<lock>" and are all released on exit.
+ *
+ * License (GPLv2):
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. * See the GNU General Public License for
+ * more details.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define WAKE_LOCK	"/sys/power/wake_lock"
+#define WAKE_UNLOCK	"/sys/power/wake_unlock"
+#define MAX_THREADS	64
+#define MAX_LOCKS	64
+#define NAME_LEN	32
+
+struct bench {
+	int id;
+	pthread_t thread;
+	double lock_ns;
+	double unlock_ns;
+	int err;
+};
+
+static unsigned int nr_threads = 1;
+static unsigned int nr_locks = 1;
+static unsigned int loops = 10000;
+static int batch;
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+	ssize_t ret = write(fd, buf, len);
+
+	if (ret < 0)
+		return errno;
+	return ret == (ssize_t)len ? 0 : EIO;
+}
+
+static void *bench_run(void *arg)
+{
+	char names[MAX_LOCKS][NAME_LEN], all[MAX_LOCKS * NAME_LEN];
+	size_t lens[MAX_LOCKS], all_len = 0;
+	struct bench *b = arg;
+	int lock_fd, unlock_fd;
+	double start, lock_t = 0, unlock_t = 0;
+	unsigned int i, j;
+
+	lock_fd = open(WAKE_LOCK, O_WRONLY);
+	unlock_fd = open(WAKE_UNLOCK, O_WRONLY);
+	if (lock_fd < 0 || unlock_fd < 0) {
+		b->err = errno;
+		close(lock_fd);
+		close(unlock_fd);
+		return NULL;
+	}
+
+	for (j = 0; j < nr_locks; j++) {
+		lens[j] = snprintf(names[j], NAME_LEN, "wlbench.%d.%u\n",
+				   b->id, j);
+		memcpy(all + all_len, names[j], lens[j]);
+		all_len += lens[j];
+	}
+
+	for (i = 0; i < loops && !b->err; i++) {
+		start = now_ns();
+		if (batch)
+			b->err = write_all(lock_fd, all, all_len);
+		else
+			for (j = 0; j < nr_locks && !b->err; j++)
+				b->err = write_all(lock_fd, names[j], lens[j]);
+		lock_t += now_ns() - start;
+
+		start = now_ns();
+		if (batch && !b->err)
+			b->err = write_all(unlock_fd, all, all_len);
+		else if (!batch)
+			for (j = 0; j < nr_locks && !b->err; j++)
+				b->err = write_all(unlock_fd, names[j],
+						   lens[j]);
+		unlock_t += now_ns() - start;
+	}
+
+	/* leave nothing held behind if a write failed halfway */
+	for (j = 0; j < nr_locks; j++)
+		if (write(unlock_fd, names[j], lens[j]) < 0)
+			continue;
+
+	b->lock_ns = lock_t / ((double)i * nr_locks);
+	b->unlock_ns = unlock_t / ((double)i * nr_locks);
+	close(lock_fd);
+	close(unlock_fd);
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	struct bench benches[MAX_THREADS];
+	double lock_ns = 0, unlock_ns = 0;
+	unsigned int i;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:n:l:b")) != -1) {
+		switch (opt) {
+		case 't':
+			nr_threads = atoi(optarg);
+			break;
+		case 'n':
+			nr_locks = atoi(optarg);
+			break;
+		case 'l':
+			loops = atoi(optarg);
+			break;
+		case 'b':
+			batch = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-t threads] [-n locks] "
+				"[-l loops] [-b]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (!nr_threads || nr_threads > MAX_THREADS || !nr_locks ||
+	    nr_locks > MAX_LOCKS || !loops) {
+		fprintf(stderr, "wakelock_bench: bad parameters\n");
+		return 1;
+	}
+
+	memset(benches, 0, sizeof(benches));
+	for (i = 0; i < nr_threads; i++) {
+		benches[i].id = i;
+		if (pthread_create(&benches[i].thread, NULL, bench_run,
+				   &benches[i])) {
+			perror("pthread_create");
+			return 1;
+		}
+	}
+
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(benches[i].thread, NULL);
+		if (benches[i].err) {
+			fprintf(stderr, "wakelock_bench: thread %u: %s\n", i,
+				strerror(benches[i].err));
+			return 1;
+		}
+		printf("thread %u: acquire %.0f ns, release %.0f ns\n", i,
+		       benches[i].lock_ns, benches[i].unlock_ns);
+		lock_ns += benches[i].lock_ns;
+		unlock_ns += benches[i].unlock_ns;
+	}
+
+	printf("%u threads, %u locks, %u loops%s: acquire %.0f ns, "
+	       "release %.0f ns\n", nr_threads, nr_locks, loops,
+	       batch ? ", batched" : "", lock_ns / nr_threads,
+	       unlock_ns / nr_threads);
+	return 0;
+}
@@ -0,0 +1,550 @@
+/*
+ * wc_sim - replay a sched_switch trace through the workload
+ * consolidation policies and estimate their energy
+ *
+ * The trace is the text output of the sched_switch (and optionally
+ * sched_wakeup) trace events, as read from the ftrace "trace" file or
+ * printed by "trace-cmd report".  From it the number of runnable tasks
+ * of every cpu over time is rebuilt and averaged into a concurrency per
+ * sum period, the same way kernel/sched/consolidation.c does.  At the
+ * end of each period the simulator decides how many groups of the
+ * topology to consolidate on, both with the concurrency threshold used
+ * without energy tables and with the energy cost model, and accounts
+ * the estimated power of each decision and of not consolidating.
+ *
+ * The topology file describes one sched domain with SD_ASYM_CONCURRENCY:
+ *
+ *	asym <percent>		concurrency headroom, as asym_concurrency
+ *	shared_pkg		the groups share a package (no cluster cost)
+ *	group <cpu>[-<cpu>]	a group, in the order consolidation fills them
+ *	<cpu> <idle mW> <cluster mW> <cap>:<mW> ...
+ *				energy table, as in
+ *				/sys/devices/system/cpu/sched_energy
+ *
+ * Usage: wc_sim [-v] [-p period shift] <topology> [trace]
+ *
+ * License (GPLv2):
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. * See the GNU General Public License for
+ * more details.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_CPUS	64
+#define MAX_GROUPS	MAX_CPUS
+#define MAX_CAP_STATES	8
+#define MAX_PID		(1 << 22)
+
+#define CC_RESOLUTION	10
+#define CC_ONE		(1ULL << CC_RESOLUTION)
+
+struct cpu_energy {
+	int valid;
+	unsigned int nr_cap_states;
+	unsigned long cap[MAX_CAP_STATES];
+	unsigned int power[MAX_CAP_STATES];
+	unsigned int idle_power;
+	unsigned int cluster_power;
+};
+
+struct group {
+	int first, last;
+};
+
+struct cpu_state {
+	int curr_pid;		/* running task, 0 when idle */
+	int nr_queued;		/* preempted or woken, not running yet */
+	uint64_t last_ns;	/* last change of nr_running */
+	uint64_t contrib;	/* nr_running * ns in this period */
+	uint64_t sum;		/* decayed concurrency, CC_ONE per task */
+};
+
+static struct cpu_energy energy[MAX_CPUS];
+static struct group groups[MAX_GROUPS];
+static struct cpu_state cpus[MAX_CPUS];
+static int nr_groups, nr_cpus;
+static unsigned int asym = 180;
+static int shared_pkg;
+static int verbose;
+static unsigned int period_shift = 26;
+
+/* cpu + 1 each queued task waits on, 0 when not queued */
+static unsigned short *queued_on;
+
+enum { POL_SPREAD, POL_THRESHOLD, POL_ENERGY, NR_POLICIES };
+
+static const char * const policy_names[NR_POLICIES] = {
+	"spread", "threshold", "energy",
+};
+
+static double energy_mj[NR_POLICIES];
+static unsigned long decisions[NR_POLICIES][MAX_GROUPS + 1];
+static unsigned long nr_periods;
+
+static int ilog2(unsigned long v)
+{
+	int l = -1;
+
+	while (v) {
+		v >>= 1;
+		l++;
+	}
+	return l;
+}
+
+static unsigned long max_cap(int cpu)
+{
+	struct cpu_energy *e = &energy[cpu];
+
+	return e->cap[e->nr_cap_states - 1];
+}
+
+static int parse_topology(const char *file)
+{
+	char line[512];
+	FILE *f;
+	int i;
+
+	f = fopen(file, "r");
+	if (!f) {
+		perror(file);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		struct cpu_energy e;
+		char *p = line;
+		int cpu, a, b, n;
+
+		if (line[0] == '#' || line[strspn(line, " \t")] == '\n')
+			continue;
+
+		if (sscanf(line, "asym %u", &asym) == 1)
+			continue;
+
+		if (!strncmp(line, "shared_pkg", 10)) {
+			shared_pkg = 1;
+			continue;
+		}
+
+		n = sscanf(line, "group %d-%d", &a, &b);
+		if (n >= 1) {
+			if (n == 1)
+				b = a;
+			if (nr_groups == MAX_GROUPS || a < 0 || b < a ||
+			    b >= MAX_CPUS)
+				goto bad;
+			groups[nr_groups].first = a;
+			groups[nr_groups].last = b;
+			nr_groups++;
+			if (b + 1 > nr_cpus)
+				nr_cpus = b + 1;
+			continue;
+		}
+
+		memset(&e, 0, sizeof(e));
+		if (sscanf(p, "%d %u %u%n", &cpu, &e.idle_power,
+			   &e.cluster_power, &n) != 3 ||
+		    cpu < 0 || cpu >= MAX_CPUS)
+			goto bad;
+
+		for (p += n; sscanf(p, " %lu:%u%n",
+				    &e.cap[e.nr_cap_states],
+				    &e.power[e.nr_cap_states], &n) == 2;
+		     p += n) {
+			if (++e.nr_cap_states == MAX_CAP_STATES)
+				break;
+		}
+		if (!e.nr_cap_states)
+			goto bad;
+		e.valid = 1;
+		energy[cpu] = e;
+	}
+	fclose(f);
+
+	if (!nr_groups) {
+		fprintf(stderr, "%s: no groups\n", file);
+		return -1;
+	}
+
+	for (i = 0; i < nr_cpus; i++) {
+		if (!energy[i].valid) {
+			fprintf(stderr, "%s: no energy table for cpu %d\n",
+				file, i);
+			return -1;
+		}
+	}
+	return 0;
+
+bad:
+	fprintf(stderr, "%s: bad line: %s", file, line);
+	fclose(f);
+	return -1;
+}
+
+/* power of a cpu with demand capacity units to serve */
+static double cpu_power(int cpu, double demand)
+{
+	struct cpu_energy *e = &energy[cpu];
+	unsigned int i;
+
+	for (i = 0; i < e->nr_cap_states - 1; i++)
+		if (e->cap[i] >= demand)
+			break;
+
+	if (demand >= e->cap[i])
+		return e->power[i];
+
+	return (e->power[i] * demand + e->idle_power * (e->cap[i] - demand)) /
+		e->cap[i];
+}
+
+/* power of running demand on the first nr groups, < 0 if not capable */
+static double groups_power(int nr, double demand)
+{
+	double cap = 0, power = 0;
+	int g, cpu;
+
+	for (g = 0; g < nr; g++)
+		for (cpu = groups[g].first; cpu <= groups[g].last; cpu++)
+			cap += max_cap(cpu);
+
+	if (demand * 100 > cap * asym)
+		return -1;
+
+	for (g = 0; g < nr; g++) {
+		if (!shared_pkg)
+			power += energy[groups[g].first].cluster_power;
+		for (cpu = groups[g].first; cpu <= groups[g].last; cpu++) {
+			double share = demand * max_cap(cpu) / cap;
+
+			if (share > max_cap(cpu))
+				share = max_cap(cpu);
+			power += cpu_power(cpu, share);
+		}
+	}
+	return power;
+}
+
+/* the decision of __nonshielded_groups() with energy tables */
+static int energy_groups(double demand)
+{
+	double best = groups_power(nr_groups, demand), power;
+	int half = (nr_groups + 1) / 2, ret = 0;
+
+	while (half) {
+		power = groups_power(half, demand);
+		if (power < 0)
+			break;
+		if (best < 0 || power < best) {
+			best = power;
+			ret = half;
+		}
+		half /= 2;
+	}
+	return ret;
+}
+
+/* the decision of __nonshielded_groups() without energy tables */
+static int threshold_groups(void)
+{
+	int sg_weight = groups[0].last - groups[0].first + 1;
+	int half = (nr_groups + 1) / 2, ret = 0;
+	uint64_t sd_cc = 0;
+	int cpu;
+
+	for (cpu = 0; cpu < nr_cpus; cpu++)
+		sd_cc += cpus[cpu].sum * 1024;
+	sd_cc *= 100;
+
+	while (half) {
+		int dst_nr = sg_weight * half, src_nr = nr_cpus;
+		uint64_t thr = (uint64_t)dst_nr * CC_ONE * asym * 1024;
+
+		thr *= dst_nr;
+		src_nr -= dst_nr;
+		if (src_nr <= 0)
+			break;
+		src_nr = ilog2(src_nr) + dst_nr;
+		if (sd_cc * src_nr > thr)
+			break;
+
+		ret = half;
+		half /= 2;
+	}
+	return ret;
+}
+
+static void account(int policy, int nr, double demand, double secs)
+{
+	double power = groups_power(nr ? nr : nr_groups, demand);
+
+	/* an overloaded spread runs everything flat out */
+	if (power < 0) {
+		int cpu;
+
+		power = 0;
+		for (cpu = 0; cpu < nr_cpus; cpu++)
+			power += energy[cpu].power[energy[cpu].nr_cap_states - 1];
+		if (!shared_pkg)
+			power += nr_groups *
+				 (double)energy[groups[0].first].cluster_power;
+	}
+
+	energy_mj[policy] += power * secs;
+	decisions[policy][nr]++;
+}
+
+static void end_period(uint64_t now, uint64_t period_ns)
+{
+	double demand = 0;
+	int cpu, nr[NR_POLICIES];
+
+	for (cpu = 0; cpu < nr_cpus; cpu++) {
+		struct cpu_state *c = &cpus[cpu];
+		int nr_running = !!c->curr_pid + c->nr_queued;
+
+		c->contrib += (now - c->last_ns) * nr_running;
+		c->last_ns = now;
+
+		c->sum = (c->sum + (c->contrib << CC_RESOLUTION) / period_ns) / 2;
+		c->contrib = 0;
+
+		demand += (double)c->sum * max_cap(cpu) / CC_ONE;
+	}
+
+	nr[POL_SPREAD] = 0;
+	nr[POL_THRESHOLD] = threshold_groups();
+	nr[POL_ENERGY] = energy_groups(demand);
+
+	account(POL_SPREAD, nr[POL_SPREAD], demand, period_ns / 1e9);
+	account(POL_THRESHOLD, nr[POL_THRESHOLD], demand, period_ns / 1e9);
+	account(POL_ENERGY, nr[POL_ENERGY], demand, period_ns / 1e9);
+	nr_periods++;
+
+	if (verbose) {
+		printf("%12.6f demand %7.1f groups threshold %d energy %d",
+		       now / 1e9, demand, nr[POL_THRESHOLD], nr[POL_ENERGY]);
+		for (cpu = 0; cpu < nr_cpus; cpu++)
+			printf(" %.2f", (double)cpus[cpu].sum / CC_ONE);
+		printf("\n");
+	}
+}
+
+static void set_nr_running(int cpu, uint64_t now, int queued_delta)
+{
+	struct cpu_state *c = &cpus[cpu];
+
+	c->contrib += (now - c->last_ns) * (!!c->curr_pid + c->nr_queued);
+	c->last_ns = now;
+	c->nr_queued += queued_delta;
+	if (c->nr_queued < 0)
+		c->nr_queued = 0;
+}
+
+static void dequeue_waiting(int pid, uint64_t now)
+{
+	int cpu;
+
+	if (pid <= 0 || pid >= MAX_PID || !queued_on[pid])
+		return;
+
+	cpu = queued_on[pid] - 1;
+	queued_on[pid] = 0;
+	set_nr_running(cpu, now, -1);
+}
+
+static void enqueue_waiting(int pid, int cpu, uint64_t now)
+{
+	if (pid <= 0 || pid >= MAX_PID || cpu >= nr_cpus)
+		return;
+
+	dequeue_waiting(pid, now);
+	queued_on[pid] = cpu + 1;
+	set_nr_running(cpu, now, 1);
+}
+
+/* "... [001] d..3  1234.567890: sched_switch: ..." */
+static int parse_header(const char *line, int *cpu, uint64_t *ns,
+			const char **event)
+{
+	const char *p = strchr(line, '[');
+	unsigned long sec, usec;
+	char *end;
+
+	if (!p)
+		return -1;
+	*cpu = strtol(p + 1, &end, 10);
+	if (*end != ']')
+		return -1;
+
+	for (p = end + 1; *p; p++) {
+		if (sscanf(p, "%lu.%lu:", &sec, &usec) == 2 &&
+		    (p[-1] == ' ' || p[-1] == '\t'))
+			break;
+	}
+	if (!*p)
+		return -1;
+	*ns = sec * 1000000000ULL + usec * 1000ULL;
+
+	*event = strstr(p, ": ");
+	if (!*event)
+		return -1;
+	*event += 2;
+	return 0;
+}
+
+static int replay(FILE *f)
+{
+	uint64_t period_ns = 1ULL << period_shift, period_end = 0, start = 0;
+	char line[1024];
+
+	while (fgets(line, sizeof(line), f)) {
+		const char *ev, *p;
+		uint64_t now;
+		int cpu;
+
+		if (line[0] == '#' || parse_header(line, &cpu, &now, &ev))
+			continue;
+		if (cpu < 0 || cpu >= nr_cpus)
+			continue;
+
+		if (!period_end) {
+			int i;
+
+			start = now;
+			period_end = (now / period_ns + 1) * period_ns;
+			for (i = 0; i < nr_cpus; i++)
+				cpus[i].last_ns = now;
+		}
+		while (now >= period_end) {
+			end_period(period_end, period_ns);
+			period_end += period_ns;
+		}
+
+		if (!strncmp(ev, "sched_switch:", 13)) {
+			int prev_pid, next_pid;
+			char state[8];
+
+			p = strstr(ev, "prev_pid=");
+			if (!p || sscanf(p, "prev_pid=%d", &prev_pid) != 1)
+				continue;
+			p = strstr(ev, "prev_state=");
+			if (!p || sscanf(p, "prev_state=%7s", state) != 1)
+				continue;
+			p = strstr(ev, "next_pid=");
+			if (!p || sscanf(p, "next_pid=%d", &next_pid) != 1)
+				continue;
+
+			set_nr_running(cpu, now, 0);
+			dequeue_waiting(next_pid, now);
+			cpus[cpu].curr_pid = next_pid;
+
+			/* preempted tasks stay runnable on this cpu */
+			if (prev_pid && state[0] == 'R')
+				enqueue_waiting(prev_pid, cpu, now);
+		} else if (!strncmp(ev, "sched_wakeup:", 13) ||
+			   !strncmp(ev, "sched_wakeup_new:", 17)) {
+			int pid, target;
+
+			p = strstr(ev, " pid=");
+			if (!p || sscanf(p, " pid=%d", &pid) != 1)
+				continue;
+			p = strstr(ev, "target_cpu=");
+			if (!p || sscanf(p, "target_cpu=%d", &target) != 1)
+				continue;
+			if (target >= 0 && target < nr_cpus)
+				enqueue_waiting(pid, target, now);
+		}
+	}
+
+	if (!nr_periods) {
+		fprintf(stderr, "no complete period of %llu ns in the trace\n",
+			(unsigned long long)period_ns);
+		return -1;
+	}
+
+	printf("%lu periods of %.1f ms, %.3f s of trace, %d cpus in %d groups\n",
+	       nr_periods, period_ns / 1e6,
+	       (period_end - period_ns - start) / 1e9, nr_cpus, nr_groups);
+	return 0;
+}
+
+static void report(void)
+{
+	int pol, nr;
+
+	printf("\n%-10s %12s %10s  groups used (periods)\n", "policy",
+	       "energy_mJ", "vs_spread");
+	for (pol = 0; pol < NR_POLICIES; pol++) {
+		printf("%-10s %12.1f %9.1f%% ", policy_names[pol],
+		       energy_mj[pol],
+		       energy_mj[POL_SPREAD] ?
+		       100.0 * energy_mj[pol] / energy_mj[POL_SPREAD] : 0);
+		for (nr = 0; nr <= nr_groups; nr++)
+			if (decisions[pol][nr])
+				printf(" %d:%lu", nr ? nr : nr_groups,
+				       decisions[pol][nr]);
+		printf("\n");
+	}
+}
+
+int main(int argc, char **argv)
+{
+	FILE *f = stdin;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "vp:")) != -1) {
+		switch (opt) {
+		case 'v':
+			verbose = 1;
+			break;
+		case 'p':
+			period_shift = atoi(optarg);
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	if (optind >= argc || period_shift < 10 || period_shift > 40)
+		goto usage;
+
+	if (parse_topology(argv[optind]))
+		return 1;
+
+	if (optind + 1 < argc) {
+		f = fopen(argv[optind + 1], "r");
+		if (!f) {
+			perror(argv[optind + 1]);
+			return 1;
+		}
+	}
+
+	queued_on = calloc(MAX_PID, sizeof(*queued_on));
+	if (!queued_on) {
+		perror("calloc");
+		return 1;
+	}
+
+	if (replay(f))
+		return 1;
+	report();
+	return 0;
+
+usage:
+	fprintf(stderr, "usage: %s [-v] [-p period shift] <topology> [trace]\n",
+		argv[0]);
+	return 1;
+}
@@ -0,0 +1,376 @@
+/*
+ * Replay a cpu load trace and measure how the cpufreq governor follows it.
+ *
+ * The trace is a list of phases, one per line:
+ *
+ *	<duration ms> <busy percent>
+ *
+ * A load thread pinned to the cpu under test replays each phase as a
+ * 10ms period busy-looping for the given share and sleeping for the
+ * rest, while a sampler thread polls scaling_cur_freq of that cpu
+ * every millisecond.  For every phase the frequency at its start and
+ * end is reported, along with the time until the governor first
+ * changed frequency and the time until it settled on the final one.
+ *
+ * Combined with the fake cpufreq driver this allows governors to be
+ * compared in a virtual machine, e.g.
+ *
+ *	cpufreq_replay -g interactive ramp.trace
+ *	cpufreq_replay -g schedutil ramp.trace
+ *
+ * Usage: cpufreq_replay [-c cpu] [-g governor] [trace file]
+ *
+ * Without a trace file a built-in idle/burst/idle pattern is replayed.
+ * The test is skipped when the cpu has no cpufreq support.
+ *
+ * License (GPLv2):
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. * See the GNU General Public License for
+ * more details.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_PHASES	256
+#define MAX_SAMPLES	(1 << 20)
+#define PERIOD_US	10000
+#define SAMPLE_US	1000
+
+struct phase {
+	unsigned int duration_ms;
+	unsigned int busy_pct;
+	uint64_t start_ns;
+	uint64_t end_ns;
+};
+
+struct sample {
+	uint64_t time_ns;
+	unsigned int freq;
+};
+
+static struct phase phases[MAX_PHASES];
+static int nr_phases;
+
+static struct sample *samples;
+static volatile int nr_samples;
+static volatile int stop_sampling;
+
+static int cpu;
+static char cpufreq_dir[128];
+
+static const struct phase default_trace[] = {
+	{ .duration_ms = 1000, .busy_pct = 0 },
+	{ .duration_ms = 500, .busy_pct = 100 },
+	{ .duration_ms = 1000, .busy_pct = 0 },
+	{ .duration_ms = 500, .busy_pct = 50 },
+	{ .duration_ms = 1000, .busy_pct = 0 },
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int read_sysfs(const char *name, char *buf, size_t len)
+{
+	char path[192];
+	ssize_t ret;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s", cpufreq_dir, name);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	ret = read(fd, buf, len - 1);
+	close(fd);
+	if (ret <= 0)
+		return -1;
+	buf[ret] = '\0';
+	buf[strcspn(buf, "\n")] = '\0';
+	return 0;
+}
+
+static int write_sysfs(const char *name, const char *val)
+{
+	char path[192];
+	ssize_t ret;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s", cpufreq_dir, name);
+	fd = open(path, O_WRONLY);
+	if (fd < 0)
+		return -1;
+	ret = write(fd, val, strlen(val));
+	close(fd);
+	return ret < 0 ? -1 : 0;
+}
+
+static int pin_to(int target)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(target, &set);
+	return sched_setaffinity(0, sizeof(set), &set);
+}
+
+/* Poll the frequency file at path until told to stop */
+static void *sampler(void *path)
+{
+	char buf[32];
+	int fd, ncpus;
+	ssize_t ret;
+
+	/* stay off the cpu under test if there is another one */
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpus > 1)
+		pin_to(cpu ? 0 : 1);
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror(path);
+		return NULL;
+	}
+
+	while (!stop_sampling && nr_samples < MAX_SAMPLES) {
+		ret = pread(fd, buf, sizeof(buf) - 1, 0);
+		if (ret > 0) {
+			buf[ret] = '\0';
+			samples[nr_samples].time_ns = now_ns();
+			samples[nr_samples].freq = strtoul(buf, NULL, 10);
+			nr_samples++;
+		}
+		usleep(SAMPLE_US);
+	}
+
+	close(fd);
+	return NULL;
+}
+
+static void busy_until(uint64_t end)
+{
+	while (now_ns() < end)
+		;
+}
+
+static void sleep_until(uint64_t end)
+{
+	struct timespec ts = {
+		.tv_sec = end / 1000000000ULL,
+		.tv_nsec = end % 1000000000ULL,
+	};
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+	       EINTR)
+		;
+}
+
+static void replay(void)
+{
+	uint64_t t, end, busy_ns;
+	int i;
+
+	for (i = 0; i < nr_phases; i++) {
+		struct phase *p = &phases[i];
+
+		p->start_ns = now_ns();
+		end = p->start_ns + p->duration_ms * 1000000ULL;
+		busy_ns = PERIOD_US * 1000ULL * p->busy_pct / 100;
+
+		for (t = p->start_ns; t < end; t += PERIOD_US * 1000ULL) {
+			if (busy_ns)
+				busy_until(t + busy_ns);
+			if (busy_ns < PERIOD_US * 1000ULL)
+				sleep_until(t + PERIOD_US * 1000ULL);
+		}
+		p->end_ns = now_ns();
+	}
+}
+
+static int load_trace(const char *file)
+{
+	char line[128];
+	FILE *f;
+
+	f = fopen(file, "r");
+	if (!f) {
+		perror(file);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		struct phase *p = &phases[nr_phases];
+
+		if (line[0] == '#' || line[strspn(line, " \t")] == '\n')
+			continue;
+		if (nr_phases == MAX_PHASES) {
+			fprintf(stderr, "%s: too many phases\n", file);
+			break;
+		}
+		if (sscanf(line, "%u %u", &p->duration_ms, &p->busy_pct) != 2 ||
+		    p->busy_pct > 100) {
+			fprintf(stderr, "%s: bad line: %s", file, line);
+			fclose(f);
+			return -1;
+		}
+		nr_phases++;
+	}
+
+	fclose(f);
+	if (!nr_phases) {
+		fprintf(stderr, "%s: no phases\n", file);
+		return -1;
+	}
+	return 0;
+}
+
+/* Report how the sampled frequency moved during each phase */
+static void report(void)
+{
+	int i, s = 0;
+
+	printf("%5s %8s %5s %10s %10s %10s %9s %9s\n", "phase", "dur_ms",
+	       "busy", "start_khz", "end_khz", "avg_khz", "first_ms",
+	       "settle_ms");
+
+	for (i = 0; i < nr_phases; i++) {
+		struct phase *p = &phases[i];
+		unsigned int start_freq = 0, last_freq = 0;
+		uint64_t first = 0, settle = 0, sum = 0;
+		int n = 0;
+
+		for (; s < nr_samples && samples[s].time_ns < p->end_ns; s++) {
+			struct sample *sm = &samples[s];
+
+			if (sm->time_ns < p->start_ns)
+				continue;
+			if (!n)
+				start_freq = sm->freq;
+			else if (sm->freq != last_freq) {
+				if (!first)
+					first = sm->time_ns - p->start_ns;
+				settle = sm->time_ns - p->start_ns;
+			}
+			last_freq = sm->freq;
+			sum += sm->freq;
+			n++;
+		}
+
+		if (!n) {
+			printf("%5d %8u %4u%% %10s\n", i, p->duration_ms,
+			       p->busy_pct, "no samples");
+			continue;
+		}
+
+		printf("%5d %8u %4u%% %10u %10u %10llu ", i, p->duration_ms,
+		       p->busy_pct, start_freq, last_freq,
+		       (unsigned long long)(sum / n));
+		if (first)
+			printf("%9.1f %9.1f\n", first / 1e6, settle / 1e6);
+		else
+			printf("%9s %9s\n", "-", "-");
+	}
+}
+
+int main(int argc, char **argv)
+{
+	char old_gov[64] = "", buf[64], cur_freq[192];
+	const char *gov = NULL;
+	pthread_t thread;
+	int opt, ret = 0;
+
+	while ((opt = getopt(argc, argv, "c:g:")) != -1) {
+		switch (opt) {
+		case 'c':
+			cpu = atoi(optarg);
+			break;
+		case 'g':
+			gov = optarg;
+			break;
+		default:
+			fprintf(stderr,
+				"usage: %s [-c cpu] [-g governor] [trace]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+
+	if (optind < argc) {
+		if (load_trace(argv[optind]))
+			return 1;
+	} else {
+		nr_phases = sizeof(default_trace) / sizeof(default_trace[0]);
+		memcpy(phases, default_trace, sizeof(default_trace));
+	}
+
+	snprintf(cpufreq_dir, sizeof(cpufreq_dir),
+		 "/sys/devices/system/cpu/cpu%d/cpufreq", cpu);
+	if (read_sysfs("scaling_governor", old_gov, sizeof(old_gov))) {
+		printf("cpufreq_replay: no cpufreq on cpu%d [SKIP]\n", cpu);
+		return 0;
+	}
+
+	if (gov && strcmp(gov, old_gov)) {
+		if (write_sysfs("scaling_governor", gov)) {
+			fprintf(stderr, "cannot select governor %s: %s\n",
+				gov, strerror(errno));
+			return 1;
+		}
+	}
+	if (read_sysfs("scaling_driver", buf, sizeof(buf)))
+		strcpy(buf, "?");
+	printf("cpu%d driver %s governor %s\n", cpu, buf, gov ? gov : old_gov);
+
+	samples = calloc(MAX_SAMPLES, sizeof(*samples));
+	if (!samples) {
+		perror("calloc");
+		ret = 1;
+		goto out;
+	}
+
+	snprintf(cur_freq, sizeof(cur_freq), "%s/scaling_cur_freq",
+		 cpufreq_dir);
+	if (pthread_create(&thread, NULL, sampler, cur_freq)) {
+		perror("pthread_create");
+		ret = 1;
+		goto out;
+	}
+
+	if (pin_to(cpu)) {
+		perror("sched_setaffinity");
+		ret = 1;
+	} else {
+		replay();
+	}
+
+	stop_sampling = 1;
+	pthread_join(thread, NULL);
+
+	if (!ret)
+		report();
+out:
+	if (gov && strcmp(gov, old_gov))
+		write_sysfs("scaling_governor", old_gov);
+	free(samples);
+	return ret;
+}
@@ -0,0 +1,428 @@
+/*
+ * Multi-threaded FUSE request throughput benchmark.
+ *
+ * A minimal passthrough daemon, speaking the raw /dev/fuse protocol so
+ * that no libfuse is needed, exposes a single file "data" backed by a
+ * lower file.  Several daemon threads read requests from the same
+ * /dev/fuse descriptor, while client threads issue small direct reads
+ * against the FUSE file.  The number of completed reads per second is
+ * reported, which is dominated by request queueing and daemon wakeup
+ * cost in fs/fuse/dev.c.
+ *
+ * With -p the daemon instead hands the lower file to the kernel with
+ * FOPEN_PASSTHROUGH, so reads are served without daemon round trips;
+ * comparing both modes shows the cost of the FUSE request path.
+ *
+ * Usage: fuse_mt_bench [-p] [-d daemon threads] [-c client threads]
+ *			[-s seconds] [-b block size] [-t dir]
+ *
+ * Must be run as root (it mounts a fuse filesystem).
+ *
+ * License (GPLv2):
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. * See the GNU General Public License for
+ * more details.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fuse.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DATA_INO	2
+#define DATA_NAME	"data"
+#define FILE_SIZE	(16 << 20)
+#define MAX_WRITE	(128 << 10)
+#define REQ_BUFSIZE	(MAX_WRITE + 4096)
+
+static int fuse_fd;
+static int lower_fd;
+static char mnt_dir[256];
+static char lower_path[256];
+
+static int cfg_daemon_threads = 4;
+static int cfg_client_threads = 4;
+static int cfg_seconds = 5;
+static int cfg_blocksize = 4096;
+static const char *cfg_tmpdir = "/tmp";
+static int cfg_passthrough;
+
+static volatile int stop_clients;
+
+static void fill_attr(struct fuse_attr *attr, uint64_t ino)
+{
+	struct stat st;
+
+	memset(attr, 0, sizeof(*attr));
+	attr->ino = ino;
+	attr->nlink = 1;
+	if (ino == FUSE_ROOT_ID) {
+		attr->mode = S_IFDIR | 0755;
+		attr->nlink = 2;
+		return;
+	}
+
+	if (fstat(lower_fd, &st) == 0) {
+		attr->size = st.st_size;
+		attr->blocks = st.st_blocks;
+		attr->mtime = st.st_mtime;
+	}
+	attr->mode = S_IFREG | 0644;
+}
+
+static int reply(struct fuse_in_header *in, int error, void *arg, size_t len)
+{
+	struct fuse_out_header out;
+	struct iovec iov[2];
+
+	out.unique = in->unique;
+	out.error = error;
+	out.len = sizeof(out) + (error ? 0 : len);
+
+	iov[0].iov_base = &out;
+	iov[0].iov_len = sizeof(out);
+	iov[1].iov_base = arg;
+	iov[1].iov_len = error ? 0 : len;
+
+	if (writev(fuse_fd, iov, 2) < 0 && errno != ENOENT)
+		return -errno;
+	return 0;
+}
+
+static void do_init(struct fuse_in_header *in, struct fuse_init_in *arg)
+{
+	struct fuse_init_out out;
+
+	memset(&out, 0, sizeof(out));
+	out.major = FUSE_KERNEL_VERSION;
+	out.minor = arg->minor < FUSE_KERNEL_MINOR_VERSION ?
+		    arg->minor : FUSE_KERNEL_MINOR_VERSION;
+	out.max_readahead = arg->max_readahead;
+	out.flags = arg->flags & (FUSE_ASYNC_READ | FUSE_BIG_WRITES);
+	if (cfg_passthrough) {
+		if (!(arg->flags & FUSE_PASSTHROUGH)) {
+			fprintf(stderr, "kernel does not support passthrough\n");
+			exit(1);
+		}
+		out.flags |= FUSE_PASSTHROUGH;
+	}
+	out.max_background = 64;
+	out.congestion_threshold = 48;
+	out.max_write = MAX_WRITE;
+	reply(in, 0, &out, sizeof(out));
+}
+
+static void do_lookup(struct fuse_in_header *in, const char *name)
+{
+	struct fuse_entry_out out;
+
+	if (in->nodeid != FUSE_ROOT_ID || strcmp(name, DATA_NAME)) {
+		reply(in, -ENOENT, NULL, 0);
+		return;
+	}
+	memset(&out, 0, sizeof(out));
+	out.nodeid = DATA_INO;
+	out.entry_valid = 3600;
+	out.attr_valid = 3600;
+	fill_attr(&out.attr, DATA_INO);
+	reply(in, 0, &out, sizeof(out));
+}
+
+static void do_getattr(struct fuse_in_header *in)
+{
+	struct fuse_attr_out out;
+
+	memset(&out, 0, sizeof(out));
+	out.attr_valid = 3600;
+	fill_attr(&out.attr, in->nodeid);
+	reply(in, 0, &out, sizeof(out));
+}
+
+static void do_open(struct fuse_in_header *in)
+{
+	struct fuse_open_out out;
+
+	memset(&out, 0, sizeof(out));
+	if (in->nodeid == DATA_INO && cfg_passthrough) {
+		out.open_flags = FOPEN_PASSTHROUGH;
+		out.passthrough_fd = lower_fd;
+	} else if (in->nodeid == DATA_INO) {
+		/* Bypass the page cache so that every read is a FUSE request */
+		out.open_flags = FOPEN_DIRECT_IO;
+	}
+	reply(in, 0, &out, sizeof(out));
+}
+
+static void do_read(struct fuse_in_header *in, struct fuse_read_in *arg,
+		    char *buf)
+{
+	ssize_t ret;
+
+	ret = pread(lower_fd, buf, arg->size, arg->offset);
+	if (ret < 0)
+		reply(in, -errno, NULL, 0);
+	else
+		reply(in, 0, buf, ret);
+}
+
+static void do_write(struct fuse_in_header *in, struct fuse_write_in *arg)
+{
+	struct fuse_write_out out;
+	ssize_t ret;
+
+	ret = pwrite(lower_fd, arg + 1, arg->size, arg->offset);
+	if (ret < 0) {
+		reply(in, -errno, NULL, 0);
+		return;
+	}
+	memset(&out, 0, sizeof(out));
+	out.size = ret;
+	reply(in, 0, &out, sizeof(out));
+}
+
+static void *daemon_thread(void *unused)
+{
+	char *buf = malloc(REQ_BUFSIZE);
+	char *rbuf = malloc(MAX_WRITE);
+
+	if (!buf || !rbuf) {
+		perror("malloc");
+		exit(1);
+	}
+
+	for (;;) {
+		struct fuse_in_header *in = (void *) buf;
+		void *arg = in + 1;
+		ssize_t len;
+
+		len = read(fuse_fd, buf, REQ_BUFSIZE);
+		if (len < 0) {
+			if (errno == EINTR || errno == ENOENT)
+				continue;
+			/* ENODEV: unmounted */
+			break;
+		}
+
+		switch (in->opcode) {
+		case FUSE_INIT:
+			do_init(in, arg);
+			break;
+		case FUSE_LOOKUP:
+			do_lookup(in, arg);
+			break;
+		case FUSE_GETATTR:
+			do_getattr(in);
+			break;
+		case FUSE_OPEN:
+		case FUSE_OPENDIR:
+			do_open(in);
+			break;
+		case FUSE_READ:
+			do_read(in, arg, rbuf);
+			break;
+		case FUSE_WRITE:
+			do_write(in, arg);
+			break;
+		case FUSE_FLUSH:
+		case FUSE_RELEASE:
+		case FUSE_RELEASEDIR:
+		case FUSE_FSYNC:
+			reply(in, 0, NULL, 0);
+			break;
+		case FUSE_FORGET:
+		case FUSE_BATCH_FORGET:
+		case FUSE_INTERRUPT:
+			/* no reply */
+			break;
+		case FUSE_DESTROY:
+			reply(in, 0, NULL, 0);
+			goto out;
+		default:
+			reply(in, -ENOSYS, NULL, 0);
+			break;
+		}
+	}
+out:
+	free(rbuf);
+	free(buf);
+	return NULL;
+}
+
+struct client_stats {
+	pthread_t thread;
+	unsigned long ops;
+	int fd;
+};
+
+static void *client_thread(void *_stats)
+{
+	struct client_stats *stats = _stats;
+	unsigned int seed = (unsigned long) stats;
+	off_t nblocks = FILE_SIZE / cfg_blocksize;
+	char *buf = malloc(cfg_blocksize);
+
+	if (!buf) {
+		perror("malloc");
+		exit(1);
+	}
+
+	while (!stop_clients) {
+		off_t off = (rand_r(&seed) % nblocks) * cfg_blocksize;
+
+		if (pread(stats->fd, buf, cfg_blocksize, off) != cfg_blocksize) {
+			perror("pread");
+			exit(1);
+		}
+		stats->ops++;
+	}
+	free(buf);
+	return NULL;
+}
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-p] [-d daemon threads] "
+		"[-c client threads] [-s seconds] [-b block size] [-t dir]\n",
+		prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct client_stats *clients;
+	pthread_t *daemons;
+	char opts[128], path[300];
+	unsigned long total = 0;
+	double start, elapsed;
+	int c, i;
+
+	while ((c = getopt(argc, argv, "pd:c:s:b:t:")) != -1) {
+		switch (c) {
+		case 'p':
+			cfg_passthrough = 1;
+			break;
+		case 'd':
+			cfg_daemon_threads = atoi(optarg);
+			break;
+		case 'c':
+			cfg_client_threads = atoi(optarg);
+			break;
+		case 's':
+			cfg_seconds = atoi(optarg);
+			break;
+		case 'b':
+			cfg_blocksize = atoi(optarg);
+			break;
+		case 't':
+			cfg_tmpdir = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (cfg_daemon_threads < 1 || cfg_client_threads < 1 ||
+	    cfg_blocksize < 1 || cfg_blocksize > MAX_WRITE)
+		usage(argv[0]);
+
+	snprintf(lower_path, sizeof(lower_path), "%s/fuse_bench_lower.XXXXXX",
+		 cfg_tmpdir);
+	lower_fd = mkstemp(lower_path);
+	if (lower_fd < 0 || ftruncate(lower_fd, FILE_SIZE)) {
+		perror("lower file");
+		return 1;
+	}
+
+	snprintf(mnt_dir, sizeof(mnt_dir), "%s/fuse_bench_mnt.XXXXXX",
+		 cfg_tmpdir);
+	if (!mkdtemp(mnt_dir)) {
+		perror("mkdtemp");
+		return 1;
+	}
+
+	fuse_fd = open("/dev/fuse", O_RDWR);
+	if (fuse_fd < 0) {
+		perror("open /dev/fuse");
+		return 1;
+	}
+	snprintf(opts, sizeof(opts),
+		 "fd=%d,rootmode=40000,user_id=0,group_id=0,allow_other",
+		 fuse_fd);
+	if (mount("fuse_mt_bench", mnt_dir, "fuse", MS_NOSUID | MS_NODEV,
+		  opts)) {
+		perror("mount");
+		return 1;
+	}
+
+	daemons = calloc(cfg_daemon_threads, sizeof(*daemons));
+	clients = calloc(cfg_client_threads, sizeof(*clients));
+	if (!daemons || !clients) {
+		perror("calloc");
+		return 1;
+	}
+	for (i = 0; i < cfg_daemon_threads; i++)
+		pthread_create(&daemons[i], NULL, daemon_thread, NULL);
+
+	snprintf(path, sizeof(path), "%s/" DATA_NAME, mnt_dir);
+	for (i = 0; i < cfg_client_threads; i++) {
+		clients[i].fd = open(path, O_RDONLY);
+		if (clients[i].fd < 0) {
+			perror("open data");
+			return 1;
+		}
+	}
+
+	start = now();
+	for (i = 0; i < cfg_client_threads; i++)
+		pthread_create(&clients[i].thread, NULL, client_thread,
+			       &clients[i]);
+	sleep(cfg_seconds);
+	stop_clients = 1;
+	for (i = 0; i < cfg_client_threads; i++) {
+		pthread_join(clients[i].thread, NULL);
+		close(clients[i].fd);
+		total += clients[i].ops;
+	}
+	elapsed = now() - start;
+
+	printf("%s: daemon threads %d, client threads %d, block size %d: "
+	       "%.0f reads/s, %.1f us/read\n",
+	       cfg_passthrough ? "passthrough" : "fuse", cfg_daemon_threads, cfg_client_threads, cfg_blocksize,
+	       total / elapsed, elapsed * 1e6 * cfg_client_threads / total);
+
+	if (umount2(mnt_dir, MNT_DETACH))
+		perror("umount");
+	close(fuse_fd);
+	for (i = 0; i < cfg_daemon_threads; i++)
+		pthread_join(daemons[i], NULL);
+
+	rmdir(mnt_dir);
+	unlink(lower_path);
+	close(lower_fd);
+	return 0;
+}
@@ -0,0 +1,218 @@
+/*
+ * sem_bench - SysV semaphore handoff rate against the size of the set
+ *
+ * Pairs of processes hand a token back and forth through semaphores of
+ * one set: each waits for its semaphore with semop() and then posts the
+ * semaphore of its partner.  Every other semaphore of the set has a task
+ * sleeping on it that is never woken up, so a set with more semaphores
+ * also has more pending operations.  The handoffs per second and the
+ * average time per handoff are reported for each set size; ideally they
+ * do not depend on it.
+ *
+ * By default the waits are complex operations (two sops, the second one
+ * on a semaphore shared by the pair), -s makes them single sop.
+ *
+ * Usage: sem_bench [-s] [-p pairs] [-t msecs per size] [nsems]...
+ *
+ * License (GPLv2):
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. * See the GNU General Public License for
+ * more details.
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ipc.h>
+#include <sys/mman.h>
+#include <sys/sem.h>
+#include <sys/wait.h>
+
+#define MAX_SIZES	32
+#define MAX_PAIRS	64
+
+static unsigned int sizes[MAX_SIZES] = { 8, 32, 128, 250 };
+static unsigned int nr_sizes = 4;
+static unsigned int pairs = 2;
+static unsigned int msecs = 1000;
+static int simple;
+
+/* Handoffs done by each pair, shared with the children */
+static volatile unsigned long *counts;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Pair p uses the semaphores 3p (token of the first process), 3p + 1
+ * (token of the second one) and 3p + 2 (a counter both of them change).
+ */
+static int handoff(int semid, unsigned int p, int second)
+{
+	unsigned short own = 3 * p + second, other = 3 * p + !second;
+	struct sembuf wait[2] = {
+		{ .sem_num = own, .sem_op = -1 },
+		{ .sem_num = 3 * p + 2, .sem_op = second ? -1 : 1 },
+	};
+	struct sembuf post = { .sem_num = other, .sem_op = 1 };
+
+	for (;;) {
+		if (semop(semid, wait, simple ? 1 : 2))
+			break;
+		if (!second)
+			counts[p]++;
+		if (semop(semid, &post, 1))
+			break;
+	}
+	/* EIDRM when the parent removes the set */
+	return errno == EIDRM || errno == EINVAL ? 0 : 1;
+}
+
+/* Sleep on semaphore @num until the set is removed */
+static int idle(int semid, unsigned short num)
+{
+	struct sembuf wait[2] = {
+		{ .sem_num = num, .sem_op = -1 },
+		{ .sem_num = num, .sem_op = -1 },
+	};
+
+	semop(semid, wait, simple ? 1 : 2);
+	return errno == EIDRM || errno == EINVAL ? 0 : 1;
+}
+
+static int run(unsigned int nsems)
+{
+	struct sembuf start[MAX_PAIRS];
+	unsigned long total = 0;
+	unsigned int i, nchild = 0;
+	double t = 0;
+	int semid, status, ret = 0;
+	pid_t pid;
+
+	if (nsems < 3 * pairs) {
+		fprintf(stderr, "sem_bench: %u semaphores are too few for "
+			"%u pairs\n", nsems, pairs);
+		return 1;
+	}
+	semid = semget(IPC_PRIVATE, nsems, IPC_CREAT | 0600);
+	if (semid < 0) {
+		perror("sem_bench: semget");
+		return 1;
+	}
+	memset((void *)counts, 0, pairs * sizeof(*counts));
+	/* or the children print it again when they exit */
+	fflush(stdout);
+
+	for (i = 0; i < nsems; i++) {
+		/* the counter of a pair has no task */
+		if (i < 3 * pairs && i % 3 == 2)
+			continue;
+		pid = fork();
+		if (pid < 0) {
+			perror("sem_bench: fork");
+			ret = 1;
+			break;
+		}
+		if (!pid) {
+			if (i >= 3 * pairs)
+				exit(idle(semid, i));
+			exit(handoff(semid, i / 3, i % 3));
+		}
+		nchild++;
+	}
+
+	if (!ret) {
+		/* let the idle tasks go to sleep first */
+		usleep(100000);
+		for (i = 0; i < pairs; i++) {
+			start[i].sem_num = 3 * i;
+			start[i].sem_op = 1;
+			start[i].sem_flg = 0;
+		}
+		t = now();
+		if (semop(semid, start, pairs)) {
+			perror("sem_bench: semop");
+			ret = 1;
+		}
+		usleep(msecs * 1000);
+		for (i = 0; i < pairs; i++)
+			total += counts[i];
+		t = now() - t;
+	}
+
+	semctl(semid, 0, IPC_RMID);
+	while (nchild--) {
+		if (wait(&status) < 0 || !WIFEXITED(status) ||
+		    WEXITSTATUS(status))
+			ret = 1;
+	}
+	if (ret) {
+		fprintf(stderr, "sem_bench: %u semaphores: failed\n", nsems);
+		return ret;
+	}
+
+	printf("%5u semaphores, %u pairs, %s: %.0f handoffs/s, "
+	       "%.2f us/handoff\n", nsems, pairs,
+	       simple ? "simple" : "complex", total / t,
+	       total ? t * 1e6 * pairs / total : 0.0);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int i;
+	int c, ret = 0;
+
+	while ((c = getopt(argc, argv, "sp:t:")) != -1) {
+		switch (c) {
+		case 's':
+			simple = 1;
+			break;
+		case 'p':
+			pairs = atoi(optarg);
+			break;
+		case 't':
+			msecs = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-s] [-p pairs] "
+				"[-t msecs] [nsems]...\n", argv[0]);
+			return 1;
+		}
+	}
+	if (!pairs || pairs > MAX_PAIRS || !msecs) {
+		fprintf(stderr, "sem_bench: bad pairs or time\n");
+		return 1;
+	}
+	if (optind < argc) {
+		for (nr_sizes = 0; optind < argc && nr_sizes < MAX_SIZES;
+		     optind++)
+			sizes[nr_sizes++] = atoi(argv[optind]);
+	}
+
+	counts = mmap(NULL, pairs * sizeof(*counts), PROT_READ | PROT_WRITE,
+		      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (counts == MAP_FAILED) {
+		perror("sem_bench: mmap");
+		return 1;
+	}
+
+	for (i = 0; i < nr_sizes; i++)
+		ret |= run(sizes[i]);
+	return ret;
+}
@@ -0,0 +1,165 @@
+/*
+ * mq_ring_bench - POSIX message queue throughput with and without MQ_SPSC
+ *
+ * One process sends messages to a queue with mq_send() and another one
+ * receives them with mq_receive().  The messages per second are reported
+ * for a default queue and for a MQ_SPSC one, first with all messages of
+ * the same priority and then with two priorities that alternate, which
+ * makes a MQ_SPSC queue fall back to the priority tree.
+ *
+ * Usage: mq_ring_bench [-n messages] [-s message size] [-m maxmsg]
+ *
+ * License (GPLv2):
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. * See the GNU General Public License for
+ * more details.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <mqueue.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#ifndef MQ_SPSC
+#define MQ_SPSC		0x40000000
+#endif
+
+#define QUEUE_NAME	"/mq_ring_bench"
+
+static unsigned long nr_msgs = 1000000;
+static long msg_size = 64;
+static long maxmsg = 10;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int receiver(mqd_t mq)
+{
+	char *buf = malloc(msg_size);
+	unsigned long i;
+
+	if (!buf)
+		return 1;
+	for (i = 0; i < nr_msgs; i++) {
+		if (mq_receive(mq, buf, msg_size, NULL) < 0) {
+			perror("mq_ring_bench: mq_receive");
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int run(const char *name, long flags, int mixed)
+{
+	struct mq_attr attr = {
+		.mq_flags = flags,
+		.mq_maxmsg = maxmsg,
+		.mq_msgsize = msg_size,
+	};
+	char *buf;
+	unsigned long i;
+	int status, ret = 0;
+	mqd_t mq;
+	pid_t pid;
+	double t;
+
+	buf = calloc(1, msg_size);
+	if (!buf)
+		return 1;
+	mq_unlink(QUEUE_NAME);
+	mq = mq_open(QUEUE_NAME, O_RDWR | O_CREAT | O_EXCL, 0600, &attr);
+	if (mq == (mqd_t)-1) {
+		perror("mq_ring_bench: mq_open");
+		free(buf);
+		return 1;
+	}
+	mq_getattr(mq, &attr);
+	/* or the child prints it again when it exits */
+	fflush(stdout);
+
+	t = now();
+	pid = fork();
+	if (pid < 0) {
+		perror("mq_ring_bench: fork");
+		ret = 1;
+		goto out;
+	}
+	if (!pid)
+		exit(receiver(mq));
+	for (i = 0; i < nr_msgs; i++) {
+		if (mq_send(mq, buf, msg_size, mixed ? i & 1 : 0)) {
+			perror("mq_ring_bench: mq_send");
+			kill(pid, SIGKILL);
+			ret = 1;
+			break;
+		}
+	}
+	if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+	    WEXITSTATUS(status))
+		ret = 1;
+	t = now() - t;
+
+	if (!ret)
+		printf("%-8s %-15s %s: %.0f msgs/s, %.2f us/msg\n", name,
+		       mixed ? "mixed priority" : "same priority",
+		       attr.mq_flags & MQ_SPSC ? "spsc" : "tree",
+		       nr_msgs / t, t * 1e6 / nr_msgs);
+	else
+		fprintf(stderr, "mq_ring_bench: %s: failed\n", name);
+out:
+	mq_close(mq);
+	mq_unlink(QUEUE_NAME);
+	free(buf);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	int c, ret = 0;
+
+	while ((c = getopt(argc, argv, "n:s:m:")) != -1) {
+		switch (c) {
+		case 'n':
+			nr_msgs = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			msg_size = atol(optarg);
+			break;
+		case 'm':
+			maxmsg = atol(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n messages] "
+				"[-s message size] [-m maxmsg]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (!nr_msgs || msg_size <= 0 || maxmsg <= 0) {
+		fprintf(stderr, "mq_ring_bench: bad messages, size or maxmsg\n");
+		return 1;
+	}
+
+	/* the last column says if the kernel knows MQ_SPSC */
+	ret |= run("default", 0, 0);
+	ret |= run("MQ_SPSC", MQ_SPSC, 0);
+	ret |= run("default", 0, 1);
+	ret |= run("MQ_SPSC", MQ_SPSC, 1);
+	return ret;
+}
@@ -0,0 +1,272 @@
+/*
+ * af_unix_bench - AF_UNIX stream socket throughput and latency
+ *
+ * For each message size, a child process writes messages of that size
+ * into one end of a socketpair() as fast as it can while the parent reads
+ * them, and the throughput is reported; then the two exchange messages
+ * of that size back and forth and the average round trip is reported.
+ * Every byte received is checked against the pattern that was sent, so a
+ * mismatch fails the run.
+ *
+ * Usage: af_unix_bench [-t msecs per size] [-s size]...
+ *
+ * License (GPLv2):
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. * See the GNU General Public License for
+ * more details.
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#define MAX_SIZES	32
+#define MAX_MSG		(4 << 20)
+
+static unsigned int sizes[MAX_SIZES] = {
+	64, 512, 4096, 16384, 65536, 262144, 1048576,
+};
+static unsigned int nr_sizes = 7;
+static unsigned int msecs = 1000;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Byte @off of the stream: not periodic in any power of two */
+static inline unsigned char pattern(unsigned long off)
+{
+	return off % 251;
+}
+
+static void fill(unsigned char *buf, unsigned long off, unsigned int len)
+{
+	unsigned int i;
+
+	for (i = 0; i < len; i++)
+		buf[i] = pattern(off + i);
+}
+
+static int check(const unsigned char *buf, unsigned long off,
+		 unsigned int len)
+{
+	unsigned int i;
+
+	for (i = 0; i < len; i++) {
+		if (buf[i] != pattern(off + i)) {
+			fprintf(stderr, "af_unix_bench: byte %lu is %u, "
+				"expected %u\n", off + i, buf[i],
+				pattern(off + i));
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int write_all(int fd, const unsigned char *buf, unsigned int len)
+{
+	ssize_t ret;
+
+	while (len) {
+		ret = write(fd, buf, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+/* Read exactly @len bytes, 1 on end of stream */
+static int read_all(int fd, unsigned char *buf, unsigned int len)
+{
+	ssize_t ret;
+
+	while (len) {
+		ret = read(fd, buf, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (!ret)
+			return 1;
+		buf += ret;
+		len -= ret;
+	}
+	return 0;
+}
+
+/*
+ * Stream messages of @size bytes until the reader closes its end.  The
+ * pattern is precomputed over one period past the largest offset used,
+ * so that writing does not cost more than reading.
+ */
+static void writer(int fd, unsigned int size, unsigned char *buf)
+{
+	unsigned long off = 0;
+
+	fill(buf, 0, size + 251);
+	for (;;) {
+		if (write_all(fd, buf + off % 251, size))
+			exit(errno == EPIPE ? 0 : 1);
+		off += size;
+	}
+}
+
+static int bench_throughput(unsigned int size, unsigned char *buf,
+			    double *mbps)
+{
+	unsigned long off = 0;
+	double start, elapsed;
+	int fds[2], status, ret = 0;
+	pid_t pid;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+		perror("af_unix_bench: socketpair");
+		return -1;
+	}
+
+	pid = fork();
+	if (pid < 0) {
+		perror("af_unix_bench: fork");
+		return -1;
+	}
+	if (!pid) {
+		close(fds[0]);
+		writer(fds[1], size, buf);
+	}
+	close(fds[1]);
+
+	start = now();
+	do {
+		if (read_all(fds[0], buf, size) || check(buf, off, size)) {
+			ret = -1;
+			break;
+		}
+		off += size;
+		elapsed = now() - start;
+	} while (elapsed * 1000 < msecs);
+
+	close(fds[0]);
+	waitpid(pid, &status, 0);
+	if (ret)
+		return ret;
+
+	*mbps = off / elapsed / 1e6;
+	return 0;
+}
+
+static int bench_latency(unsigned int size, unsigned char *buf, double *us)
+{
+	unsigned long rounds = 0;
+	double start, elapsed;
+	int fds[2], status, ret = 0;
+	pid_t pid;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+		perror("af_unix_bench: socketpair");
+		return -1;
+	}
+
+	fill(buf, 0, size);
+	pid = fork();
+	if (pid < 0) {
+		perror("af_unix_bench: fork");
+		return -1;
+	}
+	if (!pid) {
+		/* echo every message back as it was received */
+		close(fds[0]);
+		while (!read_all(fds[1], buf, size))
+			if (write_all(fds[1], buf, size))
+				exit(1);
+		exit(0);
+	}
+	close(fds[1]);
+
+	start = now();
+	do {
+		if (write_all(fds[0], buf, size) ||
+		    read_all(fds[0], buf, size) || check(buf, 0, size)) {
+			ret = -1;
+			break;
+		}
+		rounds++;
+		elapsed = now() - start;
+	} while (elapsed * 1000 < msecs);
+
+	close(fds[0]);
+	waitpid(pid, &status, 0);
+	if (ret)
+		return ret;
+
+	*us = elapsed * 1e6 / rounds;
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned char *buf;
+	unsigned int i, size;
+	double mbps, us;
+	int opt, user_sizes = 0;
+
+	while ((opt = getopt(argc, argv, "t:s:")) != -1) {
+		switch (opt) {
+		case 't':
+			msecs = atoi(optarg);
+			break;
+		case 's':
+			size = atoi(optarg);
+			if (!size || size > MAX_MSG || user_sizes == MAX_SIZES) {
+				fprintf(stderr, "af_unix_bench: bad size\n");
+				return 1;
+			}
+			sizes[user_sizes++] = size;
+			nr_sizes = user_sizes;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-t msecs] [-s size]...\n",
+				argv[0]);
+			return 1;
+		}
+	}
+
+	buf = malloc(MAX_MSG + 251);
+	if (!buf) {
+		perror("af_unix_bench: malloc");
+		return 1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+
+	for (i = 0; i < nr_sizes; i++) {
+		if (bench_throughput(sizes[i], buf, &mbps) ||
+		    bench_latency(sizes[i], buf, &us))
+			return 1;
+		printf("%8u bytes: %9.1f MB/s, round trip %8.1f us\n",
+		       sizes[i], mbps, us);
+		/* not again in the children */
+		fflush(stdout);
+	}
+	return 0;
+}
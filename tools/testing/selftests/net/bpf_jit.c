@@ -0,0 +1,488 @@
+/*
+ * bpf_jit - compare the BPF JIT against the interpreter
+ *
+ * Random socket filters and a few hand written ones are attached to an
+ * AF_UNIX datagram socket once with /proc/sys/net/core/bpf_jit_enable set
+ * to 0 and once with it set to 1, and the same random packets are sent
+ * through both.  The length of the datagram received, or its absence when
+ * the filter dropped it, is the verdict of the filter and must be the same
+ * for both.
+ *
+ * With -b the packets per second a socket pair passes with a filter
+ * resembling a tcpdump expression attached are measured instead, for the
+ * interpreter and then for the JIT.
+ *
+ * Usage: bpf_jit [-n filters] [-p packets] [-s seed] [-b seconds]
+ *
+ * Needs root, and the JIT (CONFIG_BPF_JIT); the test passes without
+ * running if the sysctl is missing.  The sysctl is restored on exit.
+ *
+ * License (GPLv2):
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. * See the GNU General Public License for
+ * more details.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+
+#define JIT_SYSCTL	"/proc/sys/net/core/bpf_jit_enable"
+#define MAX_INSNS	200
+#define MAX_PKT		200
+
+#define ARRAY_SIZE(a)	(sizeof(a) / sizeof((a)[0]))
+
+struct filter {
+	struct sock_filter insns[MAX_INSNS];
+	unsigned int len;
+};
+
+static unsigned int nr_filters = 2000;
+static unsigned int nr_pkts = 50;
+static unsigned int seed;
+static unsigned int bench_secs;
+
+static char jit_saved[16];
+static int jit_fd = -1;
+
+static unsigned int rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 8) ^ (seed << 13);
+}
+
+static unsigned int rndn(unsigned int n)
+{
+	return rnd() % n;
+}
+
+static int jit_set(const char *val)
+{
+	if (pwrite(jit_fd, val, strlen(val), 0) < 0) {
+		perror("bpf_jit: " JIT_SYSCTL);
+		return -1;
+	}
+	return 0;
+}
+
+static void jit_restore(void)
+{
+	if (jit_fd >= 0 && jit_saved[0])
+		jit_set(jit_saved);
+}
+
+/* Constants around the boundaries the JIT encodes differently */
+static unsigned int rnd_k(void)
+{
+	switch (rndn(8)) {
+	case 0:
+		return rndn(128);
+	case 1:
+		return rnd();
+	case 2:
+		return rndn(256) - 128;
+	case 3:
+		return 0xffffff00 | rndn(256);
+	case 4:
+		return rndn(0x10000);
+	case 5:
+		return 0;
+	case 6:
+		return rndn(40);
+	default:
+		return 1u << rndn(32);
+	}
+}
+
+/*
+ * Packet offsets, including the negative and out of packet ones.  Offsets
+ * just below zero are only valid for the indexed loads, for the absolute
+ * ones they are in the ancillary range.
+ */
+static unsigned int rnd_off(int ind)
+{
+	switch (rndn(10)) {
+	case 0:
+		return SKF_LL_OFF + rndn(40);
+	case 1:
+		return SKF_NET_OFF + rndn(40);
+	case 2:
+		return SKF_LL_OFF - 1 - rndn(3);
+	case 3:
+		return 0x7ffffff0 + rndn(16);
+	case 4:
+		if (ind)
+			return -1 - rndn(5);
+		/* fall through */
+	default:
+		return rndn(MAX_PKT + 10);
+	}
+}
+
+static const unsigned short alu_ops[] = {
+	BPF_ALU | BPF_ADD | BPF_K, BPF_ALU | BPF_ADD | BPF_X,
+	BPF_ALU | BPF_SUB | BPF_K, BPF_ALU | BPF_SUB | BPF_X,
+	BPF_ALU | BPF_MUL | BPF_K, BPF_ALU | BPF_MUL | BPF_X,
+	BPF_ALU | BPF_DIV | BPF_K, BPF_ALU | BPF_DIV | BPF_X,
+	BPF_ALU | BPF_MOD | BPF_K, BPF_ALU | BPF_MOD | BPF_X,
+	BPF_ALU | BPF_AND | BPF_K, BPF_ALU | BPF_AND | BPF_X,
+	BPF_ALU | BPF_OR | BPF_K, BPF_ALU | BPF_OR | BPF_X,
+	BPF_ALU | BPF_XOR | BPF_K, BPF_ALU | BPF_XOR | BPF_X,
+	BPF_ALU | BPF_LSH | BPF_K, BPF_ALU | BPF_LSH | BPF_X,
+	BPF_ALU | BPF_RSH | BPF_K, BPF_ALU | BPF_RSH | BPF_X,
+	BPF_ALU | BPF_NEG, BPF_MISC | BPF_TAX, BPF_MISC | BPF_TXA,
+	BPF_LD | BPF_IMM, BPF_LDX | BPF_IMM,
+};
+
+static const unsigned short ld_ops[] = {
+	BPF_LD | BPF_W | BPF_ABS, BPF_LD | BPF_H | BPF_ABS,
+	BPF_LD | BPF_B | BPF_ABS, BPF_LD | BPF_W | BPF_IND,
+	BPF_LD | BPF_H | BPF_IND, BPF_LD | BPF_B | BPF_IND,
+	BPF_LDX | BPF_B | BPF_MSH, BPF_LD | BPF_W | BPF_LEN,
+	BPF_LDX | BPF_W | BPF_LEN,
+};
+
+/* Ancillary loads that do not depend on the cpu the filter runs on */
+static const unsigned int anc_offs[] = {
+	SKF_AD_PROTOCOL, SKF_AD_PKTTYPE, SKF_AD_IFINDEX, SKF_AD_MARK,
+	SKF_AD_QUEUE, SKF_AD_RXHASH, SKF_AD_ALU_XOR_X, SKF_AD_VLAN_TAG,
+	SKF_AD_VLAN_TAG_PRESENT,
+};
+
+static const unsigned short jmp_ops[] = {
+	BPF_JMP | BPF_JGT | BPF_K, BPF_JMP | BPF_JGE | BPF_K,
+	BPF_JMP | BPF_JEQ | BPF_K, BPF_JMP | BPF_JSET | BPF_K,
+	BPF_JMP | BPF_JGT | BPF_X, BPF_JMP | BPF_JGE | BPF_X,
+	BPF_JMP | BPF_JEQ | BPF_X, BPF_JMP | BPF_JSET | BPF_X,
+};
+
+/*
+ * A random filter the checker accepts: forward jumps within the program,
+ * no division by a constant zero, and scratch memory only read from slots
+ * written before the first jump.  Shifts by a register are masked the same
+ * way by the interpreter and the JIT, as both use the cpu's shift.
+ */
+static void gen_filter(struct filter *f, unsigned int max)
+{
+	unsigned int n = 2 + rndn(max - 2), prologue = rndn(5);
+	unsigned int i, left, stored = 0;
+
+	for (i = 0; i < n - 1; i++) {
+		struct sock_filter *insn = &f->insns[i];
+		unsigned int r = rndn(100);
+
+		insn->jt = insn->jf = 0;
+		left = n - 2 - i;
+		if (left > 255)
+			left = 255;
+
+		if (i < prologue) {
+			insn->code = rndn(2) ? BPF_ST : BPF_STX;
+			insn->k = rndn(BPF_MEMWORDS);
+			stored |= 1 << insn->k;
+		} else if (r < 35) {
+			insn->code = alu_ops[rndn(ARRAY_SIZE(alu_ops))];
+			insn->k = rnd_k();
+			if ((insn->code == (BPF_ALU | BPF_DIV | BPF_K) ||
+			     insn->code == (BPF_ALU | BPF_MOD | BPF_K)) &&
+			    !insn->k)
+				insn->k = 7;
+			/* larger shifts are undefined in the interpreter */
+			if (insn->code == (BPF_ALU | BPF_LSH | BPF_K) ||
+			    insn->code == (BPF_ALU | BPF_RSH | BPF_K))
+				insn->k &= 31;
+		} else if (r < 55) {
+			insn->code = ld_ops[rndn(ARRAY_SIZE(ld_ops))];
+			insn->k = rnd_off(BPF_MODE(insn->code) == BPF_IND);
+			if (BPF_MODE(insn->code) == BPF_IND && rndn(2))
+				insn->k = rndn(30);
+		} else if (r < 60) {
+			insn->code = BPF_LD | BPF_W | BPF_ABS;
+			insn->k = SKF_AD_OFF +
+				  anc_offs[rndn(ARRAY_SIZE(anc_offs))];
+		} else if (r < 80) {
+			insn->code = jmp_ops[rndn(ARRAY_SIZE(jmp_ops))];
+			insn->k = rndn(4) ? rnd_k() : rndn(4);
+			insn->jt = rndn(left + 1);
+			insn->jf = rndn(left + 1);
+		} else if (r < 85) {
+			insn->code = BPF_JMP | BPF_JA;
+			insn->k = rndn(left + 1);
+		} else if (r < 93 && stored) {
+			unsigned int slot;
+
+			do
+				slot = rndn(BPF_MEMWORDS);
+			while (!(stored & (1 << slot)));
+			insn->code = rndn(2) ? BPF_LD | BPF_MEM :
+					       BPF_LDX | BPF_MEM;
+			insn->k = slot;
+		} else if (r < 97) {
+			insn->code = rndn(2) ? BPF_ST : BPF_STX;
+			insn->k = rndn(BPF_MEMWORDS);
+		} else {
+			insn->code = rndn(2) ? BPF_RET | BPF_A : BPF_RET | BPF_K;
+			insn->k = rnd_k();
+		}
+	}
+	f->insns[n - 1] = (struct sock_filter)
+		BPF_STMT(rndn(3) ? BPF_RET | BPF_A : BPF_RET | BPF_K, rnd_k());
+	f->len = n;
+}
+
+/* ip and tcp dst port 80 and tcp[tcpflags] & tcp-syn, on raw ip packets */
+static const struct sock_filter tcp_syn[] = {
+	BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 0),
+	BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 4),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 4, 0, 10),
+	BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 9),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 6, 0, 8),
+	BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 6),
+	BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x1fff, 6, 0),
+	BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 0),
+	BPF_STMT(BPF_LD | BPF_H | BPF_IND, 2),
+	BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 80, 0, 3),
+	BPF_STMT(BPF_LD | BPF_B | BPF_IND, 13),
+	BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x02, 0, 1),
+	BPF_STMT(BPF_RET | BPF_K, 0xffff),
+	BPF_STMT(BPF_RET | BPF_K, 0),
+};
+
+/* uid match the way per-uid filters do it, on a word of the payload */
+static const struct sock_filter uid_match[] = {
+	BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0),
+	BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, 8, 1, 0),
+	BPF_STMT(BPF_RET | BPF_K, 0),
+	BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 4),
+	BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, 10000, 0, 3),
+	BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, 19999, 2, 0),
+	BPF_STMT(BPF_ALU | BPF_MOD | BPF_K, 100),
+	BPF_STMT(BPF_RET | BPF_A, 0),
+	BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+};
+
+static int attach(int fd, const struct sock_filter *insns, unsigned int len)
+{
+	struct sock_fprog prog = {
+		.len = len,
+		.filter = (struct sock_filter *)insns,
+	};
+
+	return setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog,
+			  sizeof(prog));
+}
+
+/* Length received for @len bytes sent through @fds, -1 if dropped */
+static int verdict(int fds[2], const unsigned char *pkt, unsigned int len)
+{
+	unsigned char buf[MAX_PKT];
+	ssize_t ret;
+
+	if (send(fds[1], pkt, len, 0) != (ssize_t)len) {
+		perror("bpf_jit: send");
+		exit(1);
+	}
+	ret = recv(fds[0], buf, sizeof(buf), MSG_DONTWAIT);
+	if (ret < 0 && errno != EAGAIN) {
+		perror("bpf_jit: recv");
+		exit(1);
+	}
+	return ret;
+}
+
+static void rnd_pkt(unsigned char *pkt, unsigned int *len)
+{
+	unsigned int i;
+
+	*len = rndn(MAX_PKT);
+	for (i = 0; i < *len; i++)
+		pkt[i] = rnd();
+	/* look like ipv4/tcp often enough for the fixed filters to match */
+	if (*len >= 40 && rndn(2)) {
+		pkt[0] = 0x45;
+		pkt[6] &= 0xe0;
+		pkt[7] = 0;
+		pkt[9] = 6;
+		pkt[22] = 0;
+		pkt[23] = 80;
+		pkt[33] |= 0x02;
+	}
+}
+
+static int run_filter(const struct sock_filter *insns, unsigned int len,
+		      unsigned int id)
+{
+	unsigned char pkts[nr_pkts][MAX_PKT];
+	unsigned int lens[nr_pkts], i;
+	int results[2][nr_pkts];
+	int jit, fds[2];
+
+	for (i = 0; i < nr_pkts; i++)
+		rnd_pkt(pkts[i], &lens[i]);
+
+	for (jit = 0; jit < 2; jit++) {
+		if (jit_set(jit ? "1" : "0"))
+			exit(1);
+		if (socketpair(AF_UNIX, SOCK_DGRAM, 0, fds)) {
+			perror("bpf_jit: socketpair");
+			exit(1);
+		}
+		if (attach(fds[0], insns, len)) {
+			fprintf(stderr, "bpf_jit: filter %u rejected: %s\n",
+				id, strerror(errno));
+			exit(1);
+		}
+		for (i = 0; i < nr_pkts; i++)
+			results[jit][i] = verdict(fds, pkts[i], lens[i]);
+		close(fds[0]);
+		close(fds[1]);
+	}
+
+	for (i = 0; i < nr_pkts; i++) {
+		if (results[0][i] == results[1][i])
+			continue;
+		fprintf(stderr, "bpf_jit: filter %u packet %u (len %u): "
+			"interpreter %d, jit %d\n", id, i, lens[i],
+			results[0][i], results[1][i]);
+		for (i = 0; i < len; i++)
+			fprintf(stderr, "{ 0x%02x, %u, %u, 0x%08x },\n",
+				insns[i].code, insns[i].jt, insns[i].jf,
+				insns[i].k);
+		return -1;
+	}
+	return 0;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double bench_pps(const struct sock_filter *insns, unsigned int len)
+{
+	unsigned char pkt[64], buf[64];
+	unsigned long pkts = 0;
+	double start, elapsed;
+	int fds[2], i;
+
+	memset(pkt, 0, sizeof(pkt));
+	pkt[0] = 0x45;
+	pkt[9] = 6;
+	pkt[23] = 80;
+	pkt[33] = 0x02;
+
+	if (socketpair(AF_UNIX, SOCK_DGRAM, 0, fds) ||
+	    attach(fds[0], insns, len)) {
+		perror("bpf_jit: bench socket");
+		exit(1);
+	}
+
+	start = now();
+	do {
+		for (i = 0; i < 1000; i++) {
+			if (send(fds[1], pkt, sizeof(pkt), 0) < 0 ||
+			    recv(fds[0], buf, sizeof(buf), 0) < 0) {
+				perror("bpf_jit: bench");
+				exit(1);
+			}
+		}
+		pkts += 1000;
+		elapsed = now() - start;
+	} while (elapsed < bench_secs);
+
+	close(fds[0]);
+	close(fds[1]);
+	return pkts / elapsed;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-n filters] [-p packets] [-s seed] "
+		"[-b seconds]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	struct filter f;
+	double interp, jit;
+	unsigned int i;
+	ssize_t len;
+	int opt;
+
+	seed = time(NULL);
+	while ((opt = getopt(argc, argv, "n:p:s:b:")) != -1) {
+		switch (opt) {
+		case 'n':
+			nr_filters = atoi(optarg);
+			break;
+		case 'p':
+			nr_pkts = atoi(optarg);
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			bench_secs = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!nr_pkts)
+		usage(argv[0]);
+
+	jit_fd = open(JIT_SYSCTL, O_RDWR);
+	if (jit_fd < 0) {
+		fprintf(stderr, "bpf_jit: %s: %s, skipping\n", JIT_SYSCTL,
+			strerror(errno));
+		return 0;
+	}
+	len = pread(jit_fd, jit_saved, sizeof(jit_saved) - 1, 0);
+	if (len <= 0) {
+		perror("bpf_jit: " JIT_SYSCTL);
+		return 1;
+	}
+	jit_saved[len] = '\0';
+	atexit(jit_restore);
+
+	if (bench_secs) {
+		jit_set("0");
+		interp = bench_pps(tcp_syn, ARRAY_SIZE(tcp_syn));
+		jit_set("1");
+		jit = bench_pps(tcp_syn, ARRAY_SIZE(tcp_syn));
+		printf("interpreter %.0f pps, jit %.0f pps (%+.1f%%)\n",
+		       interp, jit, (jit - interp) * 100 / interp);
+		return 0;
+	}
+
+	printf("bpf_jit: seed %u\n", seed);
+	if (run_filter(tcp_syn, ARRAY_SIZE(tcp_syn), 0) ||
+	    run_filter(uid_match, ARRAY_SIZE(uid_match), 1))
+		return 1;
+
+	for (i = 0; i < nr_filters; i++) {
+		gen_filter(&f, i % 10 ? 30 : MAX_INSNS);
+		if (run_filter(f.insns, f.len, i + 2))
+			return 1;
+	}
+	printf("bpf_jit: %u filters, %u packets each: OK\n", nr_filters + 2,
+	       nr_pkts);
+	return 0;
+}
@@ -0,0 +1,81 @@
+#!/bin/sh
+#
+# UDP round trip latency over loopback and over veth between two network
+# namespaces, without busy polling, with SO_BUSY_POLL on blocking reads,
+# and with poll() busy polled through net.core.busy_poll.
+#
+# Both ends of udp_rr busy poll when it is on.  The sysctls are restored
+# on exit.
+#
+# Needs ip.
+#
+# Usage: sh busy_poll_bench.sh [requests] [usecs]
+
+REQS=${1:-100000}
+USECS=${2:-50}
+NSA=bpb_a
+NSB=bpb_b
+
+if [ $(id -u) != 0 ]; then
+	echo "busy_poll_bench must be run as root" >&2
+	exit 0
+fi
+
+if [ ! -e /proc/sys/net/core/busy_poll ]; then
+	echo "busy_poll_bench: the kernel has no busy polling" >&2
+	exit 0
+fi
+
+BUSY_READ=$(cat /proc/sys/net/core/busy_read)
+BUSY_POLL=$(cat /proc/sys/net/core/busy_poll)
+
+cleanup() {
+	echo $BUSY_READ > /proc/sys/net/core/busy_read
+	echo $BUSY_POLL > /proc/sys/net/core/busy_poll
+	ip netns del $NSA 2>/dev/null
+	ip netns del $NSB 2>/dev/null
+}
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+# round trips from $NSA to the udp_rr server at $2 in $NSB, options $3
+rr() {
+	ip netns exec $NSB ./udp_rr -l $3 &
+	sleep 0.5
+	printf "%s: " "$1"
+	ip netns exec $NSA ./udp_rr -c $2 -n $REQS $3
+	wait
+}
+
+# $1 name, $2 namespace of the server, $3 address of the server
+run() {
+	NSB=$2
+	echo 0 > /proc/sys/net/core/busy_poll
+	rr "$1, off" $3 ""
+	rr "$1, SO_BUSY_POLL $USECS" $3 "-b $USECS"
+	echo $USECS > /proc/sys/net/core/busy_poll
+	rr "$1, poll() + busy_poll $USECS" $3 "-b $USECS -P"
+	NSB=bpb_b
+}
+
+ip netns add $NSA || exit 1
+ip netns add $NSB || exit 1
+ip netns exec $NSA ip link set lo up
+ip netns exec $NSB ip link set lo up
+
+ip link add bpbveth_a type veth peer name bpbveth_b || exit 1
+ip link set bpbveth_a netns $NSA
+ip link set bpbveth_b netns $NSB
+ip netns exec $NSA ip addr add 10.203.0.1/24 dev bpbveth_a
+ip netns exec $NSB ip addr add 10.203.0.2/24 dev bpbveth_b
+ip netns exec $NSA ip link set bpbveth_a up
+ip netns exec $NSB ip link set bpbveth_b up
+
+echo 0 > /proc/sys/net/core/busy_read
+
+echo "--------------------"
+echo "$REQS requests, busy polling for $USECS us"
+echo "--------------------"
+
+run "loopback" $NSA 127.0.0.1
+run "veth" $NSB 10.203.0.2
@@ -0,0 +1,74 @@
+#!/bin/sh
+#
+# Capture throughput of packet socket fanout modes.
+#
+# pktgen sends IPv4 UDP packets into one end of a veth pair from one
+# kernel thread per cpu.  veth hands each packet to netif_rx() on the cpu
+# that sent it, so the flows of a thread (a range of UDP source ports) are
+# received on that thread's cpu.  psock_capture is run on the other end
+# with one socket per cpu for each fanout mode.
+#
+# Usage: sh capture_bench.sh [secs] [pkt_size] [flows per cpu]
+
+SECS=${1:-5}
+PKT_SIZE=${2:-64}
+FLOWS=${3:-256}
+CPUS=$(grep -c ^processor /proc/cpuinfo)
+PGDIR=/proc/net/pktgen
+
+if [ $(id -u) != 0 ]; then
+	echo "capture_bench must be run as root" >&2
+	exit 0
+fi
+
+modprobe pktgen 2>/dev/null
+if [ ! -d $PGDIR ]; then
+	echo "capture_bench: pktgen is not available" >&2
+	exit 0
+fi
+
+pgset() {
+	echo "$2" > $1
+	if ! grep -q "Result: OK" $1; then
+		grep "Result:" $1 >&2
+	fi
+}
+
+cleanup() {
+	echo "stop" > $PGDIR/pgctrl
+	for cpu in $(seq 0 $((CPUS - 1))); do
+		echo "rem_device_all" > $PGDIR/kpktgend_$cpu
+	done
+	ip link del cbench0 2>/dev/null
+}
+trap cleanup EXIT
+
+ip link add cbench0 type veth peer name cbench1 || exit 1
+ip link set cbench0 up
+ip link set cbench1 up
+DST_MAC=$(cat /sys/class/net/cbench1/address)
+
+for cpu in $(seq 0 $((CPUS - 1))); do
+	dev=cbench0@$cpu
+	pgset $PGDIR/kpktgend_$cpu "rem_device_all"
+	pgset $PGDIR/kpktgend_$cpu "add_device $dev"
+	pgset $PGDIR/$dev "count 0"
+	# veth modifies the skb, so it cannot be cloned
+	pgset $PGDIR/$dev "clone_skb 0"
+	pgset $PGDIR/$dev "pkt_size $PKT_SIZE"
+	pgset $PGDIR/$dev "delay 0"
+	pgset $PGDIR/$dev "dst 10.255.0.2"
+	pgset $PGDIR/$dev "dst_mac $DST_MAC"
+	pgset $PGDIR/$dev "udp_src_min $((1024 + cpu * FLOWS))"
+	pgset $PGDIR/$dev "udp_src_max $((1024 + (cpu + 1) * FLOWS - 1))"
+done
+
+echo "start" > $PGDIR/pgctrl &
+sleep 1
+
+for mode in hash lb cpu cpu_flow; do
+	echo "--------------------"
+	echo "fanout $mode, $CPUS sockets, $PKT_SIZE byte packets"
+	echo "--------------------"
+	./psock_capture -i cbench1 -m $mode -n $CPUS -t $SECS
+done
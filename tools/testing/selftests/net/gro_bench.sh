@@ -0,0 +1,94 @@
+#!/bin/sh
+#
+# TCP throughput through veth and tun between two network namespaces,
+# with receive GRO off (the netif_rx() backlog) and on (the GRO cells).
+#
+# veth: the sender has TSO off, so its GSO packets are segmented at the
+# device and the segments queue on the peer back to back.
+#
+# tun: tun_relay copies packets between a tun device in each namespace,
+# as a VPN daemon would, with rx-frames 0 and 32 on the receiving one.
+#
+# Needs ip and ethtool.
+#
+# Usage: sh gro_bench.sh [secs]
+
+SECS=${1:-5}
+NSA=grob_a
+NSB=grob_b
+
+if [ $(id -u) != 0 ]; then
+	echo "gro_bench must be run as root" >&2
+	exit 0
+fi
+
+if ! which ethtool > /dev/null; then
+	echo "gro_bench: ethtool is not available" >&2
+	exit 0
+fi
+
+cleanup() {
+	[ -n "$RELAY" ] && kill $RELAY 2>/dev/null
+	ip netns del $NSA 2>/dev/null
+	ip netns del $NSB 2>/dev/null
+	ip tuntap del dev gbtun_a mode tun 2>/dev/null
+	ip tuntap del dev gbtun_b mode tun 2>/dev/null
+}
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+# stream from $NSA to $NSB at 10.201.0.2, print the rate received
+stream() {
+	ip netns exec $NSB ./tcp_stream -l > /tmp/gro_bench.$$ &
+	sleep 0.5
+	ip netns exec $NSA ./tcp_stream -c 10.201.0.2 -t $SECS
+	wait $!
+	echo "$1: $(cat /tmp/gro_bench.$$)"
+	rm -f /tmp/gro_bench.$$
+}
+
+ip netns add $NSA || exit 1
+ip netns add $NSB || exit 1
+ip netns exec $NSA ip link set lo up
+ip netns exec $NSB ip link set lo up
+
+echo "--------------------"
+echo "veth"
+echo "--------------------"
+ip link add gbveth_a type veth peer name gbveth_b || exit 1
+ip link set gbveth_a netns $NSA
+ip link set gbveth_b netns $NSB
+ip netns exec $NSA ip addr add 10.201.0.1/24 dev gbveth_a
+ip netns exec $NSB ip addr add 10.201.0.2/24 dev gbveth_b
+ip netns exec $NSA ip link set gbveth_a up
+ip netns exec $NSB ip link set gbveth_b up
+ip netns exec $NSA ethtool -K gbveth_a tso off > /dev/null
+
+for gro in off on; do
+	ip netns exec $NSB ethtool -K gbveth_b gro $gro
+	stream "gro $gro"
+done
+ip netns exec $NSA ip link del gbveth_a
+
+echo "--------------------"
+echo "tun"
+echo "--------------------"
+ip tuntap add dev gbtun_a mode tun || exit 1
+ip tuntap add dev gbtun_b mode tun || exit 1
+./tun_relay gbtun_a gbtun_b &
+RELAY=$!
+sleep 0.5
+ip link set gbtun_a netns $NSA
+ip link set gbtun_b netns $NSB
+ip netns exec $NSA ip addr add 10.201.0.1/24 dev gbtun_a
+ip netns exec $NSB ip addr add 10.201.0.2/24 dev gbtun_b
+ip netns exec $NSA ip link set gbtun_a up
+ip netns exec $NSB ip link set gbtun_b up
+
+ip netns exec $NSB ethtool -K gbtun_b gro off
+stream "gro off"
+ip netns exec $NSB ethtool -K gbtun_b gro on
+for frames in 0 32; do
+	ip netns exec $NSB ethtool -C gbtun_b rx-frames $frames
+	stream "gro on, rx-frames $frames"
+done
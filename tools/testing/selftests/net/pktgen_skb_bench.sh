@@ -0,0 +1,68 @@
+#!/bin/sh
+#
+# skb allocation and free rate with pktgen on a dummy device.
+#
+# Every packet is a new skb (clone_skb 0).  In start_xmit mode it is built
+# in process context and freed by dummy's xmit.  In netif_receive mode it
+# is built with BHs off and handed to netif_receive_skb(), as a driver's
+# NAPI poll would, and IPv4 drops it as not routable: both ends are in BH
+# context, so the sk_buff heads are recycled by the per cpu cache.
+#
+# Usage: sh pktgen_skb_bench.sh [count] [pkt_sizes]
+
+COUNT=${1:-2000000}
+SIZES=${2:-"64 512 1500"}
+DEV=pgbench0
+PGDIR=/proc/net/pktgen
+THREAD=$PGDIR/kpktgend_0
+
+if [ $(id -u) != 0 ]; then
+	echo "pktgen_skb_bench must be run as root" >&2
+	exit 0
+fi
+
+modprobe pktgen 2>/dev/null
+modprobe dummy numdummies=0 2>/dev/null
+if [ ! -d $PGDIR ]; then
+	echo "pktgen_skb_bench: pktgen is not available" >&2
+	exit 0
+fi
+
+pgset() {
+	echo "$2" > $1
+	if ! grep -q "Result: OK" $1; then
+		grep "Result:" $1 >&2
+	fi
+}
+
+cleanup() {
+	echo "stop" > $PGDIR/pgctrl
+	echo "rem_device_all" > $THREAD
+	ip link del $DEV 2>/dev/null
+}
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+ip link add $DEV type dummy || exit 1
+ip link set $DEV up
+DST_MAC=$(cat /sys/class/net/$DEV/address)
+
+pgset $THREAD "rem_device_all"
+pgset $THREAD "add_device $DEV"
+pgset $PGDIR/$DEV "count $COUNT"
+pgset $PGDIR/$DEV "clone_skb 0"
+pgset $PGDIR/$DEV "delay 0"
+pgset $PGDIR/$DEV "dst 198.18.0.1"
+pgset $PGDIR/$DEV "dst_mac $DST_MAC"
+
+for mode in start_xmit netif_receive; do
+	echo "--------------------"
+	echo "$mode"
+	echo "--------------------"
+	pgset $PGDIR/$DEV "xmit_mode $mode"
+	for size in $SIZES; do
+		pgset $PGDIR/$DEV "pkt_size $size"
+		echo "start" > $PGDIR/pgctrl
+		echo "$size bytes: $(grep -o '[0-9]*pps' $PGDIR/$DEV)"
+	done
+done
@@ -0,0 +1,334 @@
+/*
+ * psock_capture - packet socket capture throughput with fanout
+ *
+ * One process per cpu, pinned to that cpu, opens a packet socket with a
+ * TPACKET_V3 receive ring on an interface and joins a fanout group of the
+ * chosen mode.  Once all of them have joined, the rings are drained and
+ * every socket counts the IPv4 UDP packets it receives for the given
+ * number of seconds.  The number of packets and drops of each socket, the
+ * total rate and the number of flows (UDP source ports) that were seen on
+ * more than one socket are reported.
+ *
+ * Traffic is generated by capture_bench.sh with pktgen over a veth pair,
+ * but any source will do.
+ *
+ * Usage: psock_capture -i ifname [-m hash|lb|cpu|cpu_flow] [-n sockets]
+ *			[-t secs]
+ *
+ * License (GPLv2):
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. * See the GNU General Public License for
+ * more details.
+ */
+
+#define _GNU_SOURCE		/* for sched_setaffinity */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#define BLOCK_SIZE	(1 << 20)
+#define BLOCK_NR	16
+#define FRAME_SIZE	2048
+#define BLOCK_TOV_MS	10
+#define MAX_SOCKS	64
+#define NR_PORTS	65536
+
+struct result {
+	unsigned long packets;
+	unsigned long drops;
+	uint32_t ports[NR_PORTS];	/* packets seen per UDP source port */
+};
+
+static const struct {
+	const char *name;
+	int type;
+} modes[] = {
+	{ "hash",	PACKET_FANOUT_HASH },
+	{ "lb",		PACKET_FANOUT_LB },
+	{ "cpu",	PACKET_FANOUT_CPU },
+	{ "cpu_flow",	PACKET_FANOUT_CPU_FLOW },
+};
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int sock_open(int ifindex, int group, int type, uint8_t **ring)
+{
+	struct sockaddr_ll addr;
+	struct tpacket_req3 req;
+	int fd, val;
+
+	fd = socket(PF_PACKET, SOCK_RAW, htons(ETH_P_IP));
+	if (fd < 0) {
+		perror("psock_capture: socket");
+		return -1;
+	}
+
+	val = TPACKET_V3;
+	if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &val, sizeof(val))) {
+		perror("psock_capture: PACKET_VERSION");
+		return -1;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = BLOCK_SIZE;
+	req.tp_block_nr = BLOCK_NR;
+	req.tp_frame_size = FRAME_SIZE;
+	req.tp_frame_nr = BLOCK_SIZE / FRAME_SIZE * BLOCK_NR;
+	req.tp_retire_blk_tov = BLOCK_TOV_MS;
+	if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req))) {
+		perror("psock_capture: PACKET_RX_RING");
+		return -1;
+	}
+
+	*ring = mmap(NULL, BLOCK_SIZE * BLOCK_NR, PROT_READ | PROT_WRITE,
+		     MAP_SHARED | MAP_LOCKED, fd, 0);
+	if (*ring == MAP_FAILED) {
+		perror("psock_capture: mmap");
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sll_family = AF_PACKET;
+	addr.sll_protocol = htons(ETH_P_IP);
+	addr.sll_ifindex = ifindex;
+	if (bind(fd, (void *) &addr, sizeof(addr))) {
+		perror("psock_capture: bind");
+		return -1;
+	}
+
+	val = group | type << 16;
+	if (setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &val, sizeof(val))) {
+		perror("psock_capture: PACKET_FANOUT");
+		return -1;
+	}
+	return fd;
+}
+
+/* UDP source port of the frame, or -1 if it is not IPv4 UDP */
+static int frame_port(struct tpacket3_hdr *hdr)
+{
+	struct iphdr *iph;
+	struct udphdr *udph;
+
+	if (hdr->tp_snaplen < ETH_HLEN + sizeof(*iph) + sizeof(*udph))
+		return -1;
+
+	iph = (void *) hdr + hdr->tp_mac + ETH_HLEN;
+	if (iph->protocol != IPPROTO_UDP || iph->ihl < 5 ||
+	    hdr->tp_snaplen < ETH_HLEN + iph->ihl * 4 + sizeof(*udph))
+		return -1;
+
+	udph = (void *) iph + iph->ihl * 4;
+	return ntohs(udph->source);
+}
+
+/* Release every block the kernel has handed over, counting it if @res */
+static void walk_blocks(uint8_t *ring, unsigned int *cur, struct result *res)
+{
+	struct tpacket_block_desc *pbd;
+	struct tpacket3_hdr *hdr;
+	unsigned int i;
+	int port;
+
+	for (;;) {
+		pbd = (void *) (ring + *cur * BLOCK_SIZE);
+		if (!(pbd->hdr.bh1.block_status & TP_STATUS_USER))
+			return;
+
+		if (res) {
+			hdr = (void *) pbd + pbd->hdr.bh1.offset_to_first_pkt;
+			for (i = 0; i < pbd->hdr.bh1.num_pkts; i++) {
+				port = frame_port(hdr);
+				if (port >= 0) {
+					res->ports[port]++;
+					res->packets++;
+				}
+				hdr = (void *) hdr + hdr->tp_next_offset;
+			}
+		}
+
+		__sync_synchronize();
+		pbd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+		*cur = (*cur + 1) % BLOCK_NR;
+	}
+}
+
+static void capture(int fd, uint8_t *ring, int start_fd, unsigned int secs,
+		    struct result *res)
+{
+	struct tpacket_stats_v3 st;
+	socklen_t len = sizeof(st);
+	struct pollfd pfd;
+	unsigned int cur = 0;
+	double end;
+	char c;
+
+	/* wait for all sockets to have joined, then drop what came before */
+	if (read(start_fd, &c, 1) < 0)
+		exit(1);
+	walk_blocks(ring, &cur, NULL);
+	getsockopt(fd, SOL_PACKET, PACKET_STATISTICS, &st, &len);
+
+	pfd.fd = fd;
+	pfd.events = POLLIN | POLLERR;
+	end = now() + secs;
+	while (now() < end) {
+		walk_blocks(ring, &cur, res);
+		poll(&pfd, 1, BLOCK_TOV_MS);
+	}
+	walk_blocks(ring, &cur, res);
+
+	len = sizeof(st);
+	if (!getsockopt(fd, SOL_PACKET, PACKET_STATISTICS, &st, &len))
+		res->drops = st.tp_drops;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s -i ifname [-m hash|lb|cpu|cpu_flow] "
+		"[-n sockets] [-t secs]\n", prog);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int i, j, nsocks, secs = 5, seen, split = 0, flows = 0;
+	int opt, type = -1, ifindex = 0, group, ready[2], start[2];
+	int fd, status, failed = 0;
+	unsigned long total = 0;
+	struct result *res;
+	cpu_set_t mask;
+	uint8_t *ring;
+	pid_t pid;
+	char c;
+
+	nsocks = sysconf(_SC_NPROCESSORS_ONLN);
+	while ((opt = getopt(argc, argv, "i:m:n:t:")) != -1) {
+		switch (opt) {
+		case 'i':
+			ifindex = if_nametoindex(optarg);
+			if (!ifindex) {
+				fprintf(stderr, "psock_capture: no device %s\n",
+					optarg);
+				return 1;
+			}
+			break;
+		case 'm':
+			for (i = 0; i < sizeof(modes) / sizeof(modes[0]); i++)
+				if (!strcmp(optarg, modes[i].name))
+					type = modes[i].type;
+			if (type < 0)
+				usage(argv[0]);
+			break;
+		case 'n':
+			nsocks = atoi(optarg);
+			break;
+		case 't':
+			secs = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (!ifindex || !nsocks || nsocks > MAX_SOCKS)
+		usage(argv[0]);
+	if (type < 0)
+		type = PACKET_FANOUT_HASH;
+
+	res = mmap(NULL, nsocks * sizeof(*res), PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (res == MAP_FAILED) {
+		perror("psock_capture: mmap");
+		return 1;
+	}
+	if (pipe(ready) || pipe(start)) {
+		perror("psock_capture: pipe");
+		return 1;
+	}
+
+	group = getpid() & 0xffff;
+	for (i = 0; i < nsocks; i++) {
+		pid = fork();
+		if (pid < 0) {
+			perror("psock_capture: fork");
+			return 1;
+		}
+		if (pid)
+			continue;
+
+		close(ready[0]);
+		close(start[1]);
+		CPU_ZERO(&mask);
+		CPU_SET(i, &mask);
+		if (sched_setaffinity(0, sizeof(mask), &mask))
+			fprintf(stderr, "psock_capture: not pinned to cpu %u\n",
+				i);
+
+		fd = sock_open(ifindex, group, type, &ring);
+		if (fd < 0)
+			exit(1);
+		close(ready[1]);
+		capture(fd, ring, start[0], secs, &res[i]);
+		exit(0);
+	}
+
+	/* every child closes its end of @ready once it has joined */
+	close(ready[1]);
+	close(start[0]);
+	while (read(ready[0], &c, 1) > 0)
+		;
+	close(start[1]);
+
+	while (wait(&status) > 0)
+		if (!WIFEXITED(status) || WEXITSTATUS(status))
+			failed = 1;
+	if (failed)
+		return 1;
+
+	for (i = 0; i < nsocks; i++) {
+		printf("socket %2u: %10lu packets %8lu drops\n", i,
+		       res[i].packets, res[i].drops);
+		total += res[i].packets;
+	}
+	for (j = 0; j < NR_PORTS; j++) {
+		seen = 0;
+		for (i = 0; i < nsocks; i++)
+			if (res[i].ports[j])
+				seen++;
+		if (seen)
+			flows++;
+		if (seen > 1)
+			split++;
+	}
+	printf("total: %.0f pps, %u flows, %u split across sockets\n",
+	       (double) total / secs, flows, split);
+	return 0;
+}
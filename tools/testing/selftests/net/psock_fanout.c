@@ -19,6 +19,7 @@
  *   - PACKET_FANOUT_LB
  *   - PACKET_FANOUT_CPU
  *   - PACKET_FANOUT_ROLLOVER
+ *   - PACKET_FANOUT_CPU_FLOW
  *
  * Todo:
  * - functionality: PACKET_FANOUT_FLAG_DEFRAG
@@ -267,6 +268,55 @@ static int set_cpuaffinity(int cpuid)
 	return 0;
 }
 
+/* A flow stays on the socket of the cpu it started on, a new one does not */
+static int test_datapath_cpu_flow(int port_off)
+{
+	const int expect0[] = { 0, 0 };
+	const int expect1[] = { 10, 0 };
+	const int expect2[] = { 15, 0 };
+	const int expect3[] = { 15, 5 };
+	char *rings[2];
+	int fds[2], fds_udp[2][2], ret;
+
+	fprintf(stderr, "test: datapath 0x%hx\n", PACKET_FANOUT_CPU_FLOW);
+
+	set_cpuaffinity(0);
+	fds[0] = sock_fanout_open(PACKET_FANOUT_CPU_FLOW, 20);
+	fds[1] = sock_fanout_open(PACKET_FANOUT_CPU_FLOW, 20);
+	if (fds[0] == -1 || fds[1] == -1) {
+		fprintf(stderr, "ERROR: failed open\n");
+		exit(1);
+	}
+	rings[0] = sock_fanout_open_ring(fds[0]);
+	rings[1] = sock_fanout_open_ring(fds[1]);
+	pair_udp_open(fds_udp[0], PORT_BASE);
+	pair_udp_open(fds_udp[1], PORT_BASE + port_off);
+	ret = sock_fanout_read(fds, rings, expect0);
+
+	pair_udp_send(fds_udp[0], 10);
+	ret |= sock_fanout_read(fds, rings, expect1);
+
+	set_cpuaffinity(1);
+	pair_udp_send(fds_udp[0], 5);
+	ret |= sock_fanout_read(fds, rings, expect2);
+	pair_udp_send(fds_udp[1], 5);
+	ret |= sock_fanout_read(fds, rings, expect3);
+
+	if (munmap(rings[1], RING_NUM_FRAMES * getpagesize()) ||
+	    munmap(rings[0], RING_NUM_FRAMES * getpagesize())) {
+		fprintf(stderr, "close rings\n");
+		exit(1);
+	}
+	if (close(fds_udp[1][1]) || close(fds_udp[1][0]) ||
+	    close(fds_udp[0][1]) || close(fds_udp[0][0]) ||
+	    close(fds[1]) || close(fds[0])) {
+		fprintf(stderr, "close datapath\n");
+		exit(1);
+	}
+
+	return ret;
+}
+
 int main(int argc, char **argv)
 {
 	const int expect_hash[2][2]	= { { 15, 5 },  { 20, 5 } };
@@ -304,6 +354,9 @@ int main(int argc, char **argv)
 		ret |= test_datapath(PACKET_FANOUT_CPU, port_off,
 				     expect_cpu1[0], expect_cpu1[1]);
 
+	if (!set_cpuaffinity(1))
+		ret |= test_datapath_cpu_flow(port_off);
+
 	if (ret)
 		return 1;
 
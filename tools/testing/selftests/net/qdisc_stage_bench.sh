@@ -0,0 +1,89 @@
+#!/bin/sh
+#
+# Throughput and latency under load of fq_codel and cake on a veth device
+# sent to by one TCP stream per cpu, between two network namespaces.
+#
+# As root qdisc, fq_codel and cake stage the packets of senders per cpu
+# instead of having them wait for the qdisc root lock.  fq_codel under a
+# prio qdisc, which does not stage, is run for comparison.  The latency
+# is that of pings sent during the load, through the same qdisc.
+#
+# Needs ip and tc.  cake is skipped if tc does not know it.
+#
+# Usage: sh qdisc_stage_bench.sh [secs] [streams]
+
+SECS=${1:-5}
+STREAMS=${2:-$(grep -c ^processor /proc/cpuinfo)}
+NSA=qsb_a
+NSB=qsb_b
+DEV=qsbveth_a
+
+if [ $(id -u) != 0 ]; then
+	echo "qdisc_stage_bench must be run as root" >&2
+	exit 0
+fi
+
+cleanup() {
+	ip netns del $NSA 2>/dev/null
+	ip netns del $NSB 2>/dev/null
+	rm -f /tmp/qdisc_stage_bench.$$.*
+}
+trap cleanup EXIT
+trap 'exit 1' INT TERM
+
+# $STREAMS streams and a ping from $NSA to $NSB, print the total rate
+# received and the ping round trip times
+load() {
+	for i in $(seq 1 $STREAMS); do
+		ip netns exec $NSB ./tcp_stream -l -p $((5200 + i)) \
+			> /tmp/qdisc_stage_bench.$$.$i &
+	done
+	sleep 0.5
+	for i in $(seq 1 $STREAMS); do
+		ip netns exec $NSA ./tcp_stream -c 10.202.0.2 \
+			-p $((5200 + i)) -t $SECS &
+	done
+	rtt=$(ip netns exec $NSA ping -q -i 0.02 -w $SECS 10.202.0.2 | \
+	      tail -1 | cut -d' ' -f4)
+	wait
+	rate=$(cat /tmp/qdisc_stage_bench.$$.* | \
+	       awk '{ sum += $1 } END { printf "%.1f", sum }')
+	echo "$1: $rate Mbit/s, ping min/avg/max/mdev $rtt ms"
+	rm -f /tmp/qdisc_stage_bench.$$.*
+}
+
+ip netns add $NSA || exit 1
+ip netns add $NSB || exit 1
+ip netns exec $NSA ip link set lo up
+ip netns exec $NSB ip link set lo up
+
+ip link add $DEV type veth peer name qsbveth_b || exit 1
+ip link set $DEV netns $NSA
+ip link set qsbveth_b netns $NSB
+ip netns exec $NSA ip addr add 10.202.0.1/24 dev $DEV
+ip netns exec $NSB ip addr add 10.202.0.2/24 dev qsbveth_b
+# veth has no queue by default
+ip netns exec $NSA ip link set $DEV txqueuelen 1000
+ip netns exec $NSA ip link set $DEV up
+ip netns exec $NSB ip link set qsbveth_b up
+
+echo "--------------------"
+echo "$STREAMS streams, $SECS seconds"
+echo "--------------------"
+
+ip netns exec $NSA tc qdisc add dev $DEV root handle 1: prio bands 2 \
+	priomap 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 || exit 1
+ip netns exec $NSA tc qdisc add dev $DEV parent 1:1 fq_codel || exit 1
+load "prio + fq_codel"
+ip netns exec $NSA tc qdisc del dev $DEV root
+
+ip netns exec $NSA tc qdisc add dev $DEV root fq_codel || exit 1
+load "fq_codel"
+ip netns exec $NSA tc qdisc del dev $DEV root
+
+if ip netns exec $NSA tc qdisc add dev $DEV root cake 2>/dev/null; then
+	load "cake"
+	ip netns exec $NSA tc qdisc del dev $DEV root
+else
+	echo "cake: not supported by tc"
+fi
@@ -0,0 +1,165 @@
+/*
+ * tcp_stream - bulk TCP throughput between two hosts or namespaces
+ *
+ * Usage: tcp_stream -l [-p port]
+ *	  tcp_stream -c addr [-p port] [-t secs] [-s write size]
+ *
+ * The server accepts one connection, reads it to the end and prints the
+ * rate it received at.  The client writes as fast as it can for the
+ * given number of seconds.
+ *
+ * License (GPLv2):
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. * See the GNU General Public License for
+ * more details.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#define BUF_SIZE	(1 << 20)
+
+static char buf[BUF_SIZE];
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int server(struct sockaddr_in *addr)
+{
+	unsigned long long bytes = 0;
+	double start, end;
+	int fd, conn, one = 1;
+	ssize_t ret;
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		perror("tcp_stream: socket");
+		return 1;
+	}
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(fd, (void *) addr, sizeof(*addr)) || listen(fd, 1)) {
+		perror("tcp_stream: bind");
+		return 1;
+	}
+
+	conn = accept(fd, NULL, NULL);
+	if (conn < 0) {
+		perror("tcp_stream: accept");
+		return 1;
+	}
+
+	start = end = now();
+	while ((ret = read(conn, buf, BUF_SIZE)) != 0) {
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("tcp_stream: read");
+			return 1;
+		}
+		bytes += ret;
+		end = now();
+	}
+
+	printf("%.1f Mbit/s\n", end > start ?
+	       bytes * 8 / (end - start) / 1e6 : 0.0);
+	close(conn);
+	close(fd);
+	return 0;
+}
+
+static int client(struct sockaddr_in *addr, unsigned int secs,
+		  unsigned int size)
+{
+	double end;
+	ssize_t ret;
+	int fd;
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		perror("tcp_stream: socket");
+		return 1;
+	}
+	if (connect(fd, (void *) addr, sizeof(*addr))) {
+		perror("tcp_stream: connect");
+		return 1;
+	}
+
+	end = now() + secs;
+	while (now() < end) {
+		ret = write(fd, buf, size);
+		if (ret < 0 && errno != EINTR) {
+			perror("tcp_stream: write");
+			return 1;
+		}
+	}
+	close(fd);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int secs = 5, size = 65536;
+	struct sockaddr_in addr;
+	int opt, listening = 0;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(5201);
+
+	while ((opt = getopt(argc, argv, "lc:p:t:s:")) != -1) {
+		switch (opt) {
+		case 'l':
+			listening = 1;
+			break;
+		case 'c':
+			if (inet_pton(AF_INET, optarg, &addr.sin_addr) != 1) {
+				fprintf(stderr, "tcp_stream: bad address\n");
+				return 1;
+			}
+			break;
+		case 'p':
+			addr.sin_port = htons(atoi(optarg));
+			break;
+		case 't':
+			secs = atoi(optarg);
+			break;
+		case 's':
+			size = atoi(optarg);
+			if (!size || size > BUF_SIZE) {
+				fprintf(stderr, "tcp_stream: bad size\n");
+				return 1;
+			}
+			break;
+		default:
+			goto usage;
+		}
+	}
+
+	if (listening)
+		return server(&addr);
+	if (addr.sin_addr.s_addr)
+		return client(&addr, secs, size);
+usage:
+	fprintf(stderr, "usage: %s -l [-p port]\n"
+		"       %s -c addr [-p port] [-t secs] [-s size]\n",
+		argv[0], argv[0]);
+	return 1;
+}
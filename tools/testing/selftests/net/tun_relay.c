@@ -0,0 +1,107 @@
+/*
+ * tun_relay - forward packets between two tun devices, like a VPN daemon
+ *
+ * Usage: tun_relay tunA tunB
+ *
+ * Attaches to the two (existing or new) tun devices and copies every
+ * packet read from one to the other until killed.  Packets are read in
+ * bursts while they are available, so that a device with rx-frames set
+ * (ethtool -C) gets them written back to back.
+ *
+ * License (GPLv2):
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. * See the GNU General Public License for
+ * more details.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/if.h>
+#include <linux/if_tun.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#define MAX_PKT		65536
+#define BURST		64
+
+static char pkt[MAX_PKT];
+
+static int tun_open(const char *name)
+{
+	struct ifreq ifr;
+	int fd;
+
+	fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK);
+	if (fd < 0) {
+		perror("tun_relay: /dev/net/tun");
+		return -1;
+	}
+
+	memset(&ifr, 0, sizeof(ifr));
+	ifr.ifr_flags = IFF_TUN | IFF_NO_PI;
+	strncpy(ifr.ifr_name, name, IFNAMSIZ - 1);
+	if (ioctl(fd, TUNSETIFF, &ifr)) {
+		perror("tun_relay: TUNSETIFF");
+		return -1;
+	}
+	return fd;
+}
+
+/* Forward up to a burst of packets from @in to @out */
+static int relay(int in, int out)
+{
+	ssize_t len;
+	int i;
+
+	for (i = 0; i < BURST; i++) {
+		len = read(in, pkt, sizeof(pkt));
+		/* EIO while a device is down */
+		if (len < 0)
+			return errno == EAGAIN || errno == EIO ? 0 : -1;
+		/* and a full device queue drops, as a real link would */
+		if (write(out, pkt, len) < 0 && errno != EIO &&
+		    errno != ENOBUFS && errno != EAGAIN)
+			return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct pollfd pfd[2];
+
+	if (argc != 3) {
+		fprintf(stderr, "usage: %s tunA tunB\n", argv[0]);
+		return 1;
+	}
+
+	pfd[0].fd = tun_open(argv[1]);
+	pfd[1].fd = tun_open(argv[2]);
+	if (pfd[0].fd < 0 || pfd[1].fd < 0)
+		return 1;
+	pfd[0].events = pfd[1].events = POLLIN;
+
+	for (;;) {
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("tun_relay: poll");
+			return 1;
+		}
+		if ((pfd[0].revents & POLLIN) && relay(pfd[0].fd, pfd[1].fd))
+			break;
+		if ((pfd[1].revents & POLLIN) && relay(pfd[1].fd, pfd[0].fd))
+			break;
+	}
+	perror("tun_relay");
+	return 1;
+}
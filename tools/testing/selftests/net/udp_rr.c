@@ -0,0 +1,216 @@
+/*
+ * udp_rr - UDP request/response round trip latency
+ *
+ * Usage: udp_rr -l [-p port] [-b usecs] [-P]
+ *	  udp_rr -c addr [-p port] [-n requests] [-s size] [-b usecs] [-P]
+ *
+ * The server sends every datagram it receives back, until it receives an
+ * empty one.  The client sends a request, waits for the response and
+ * prints the average, median and 99th percentile round trip times.
+ *
+ * -b sets SO_BUSY_POLL on the socket to the given time, -P waits for
+ * each datagram with poll() before reading it (busy polled only if the
+ * net.core.busy_poll sysctl is set).
+ *
+ * License (GPLv2):
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. * See the GNU General Public License for
+ * more details.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL	46
+#endif
+
+#define BUF_SIZE	65536
+
+static char buf[BUF_SIZE];
+static int busy_poll = -1;
+static int use_poll;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int open_socket(void)
+{
+	int fd;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0) {
+		perror("udp_rr: socket");
+		return -1;
+	}
+	if (busy_poll >= 0 && setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL,
+					 &busy_poll, sizeof(busy_poll))) {
+		perror("udp_rr: SO_BUSY_POLL");
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static ssize_t receive(int fd, struct sockaddr_in *from)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	socklen_t len = sizeof(*from);
+	ssize_t ret;
+
+	for (;;) {
+		if (use_poll && poll(&pfd, 1, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		ret = recvfrom(fd, buf, BUF_SIZE, 0, (void *) from,
+			       from ? &len : NULL);
+		if (ret >= 0 || errno != EINTR)
+			return ret;
+	}
+}
+
+static int server(struct sockaddr_in *addr)
+{
+	struct sockaddr_in from;
+	ssize_t ret;
+	int fd;
+
+	fd = open_socket();
+	if (fd < 0)
+		return 1;
+	if (bind(fd, (void *) addr, sizeof(*addr))) {
+		perror("udp_rr: bind");
+		return 1;
+	}
+
+	while ((ret = receive(fd, &from)) > 0) {
+		if (sendto(fd, buf, ret, 0, (void *) &from,
+			   sizeof(from)) < 0) {
+			perror("udp_rr: sendto");
+			return 1;
+		}
+	}
+	if (ret < 0) {
+		perror("udp_rr: recvfrom");
+		return 1;
+	}
+	return 0;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+static int client(struct sockaddr_in *addr, unsigned long n, size_t size)
+{
+	double *rtt, start, sum = 0;
+	unsigned long i;
+	int fd;
+
+	rtt = malloc(n * sizeof(*rtt));
+	fd = open_socket();
+	if (!rtt || fd < 0)
+		return 1;
+	if (connect(fd, (void *) addr, sizeof(*addr))) {
+		perror("udp_rr: connect");
+		return 1;
+	}
+
+	for (i = 0; i < n; i++) {
+		start = now();
+		if (send(fd, buf, size, 0) < 0) {
+			perror("udp_rr: send");
+			return 1;
+		}
+		if (receive(fd, NULL) < 0) {
+			perror("udp_rr: recv");
+			return 1;
+		}
+		rtt[i] = (now() - start) * 1e6;
+		sum += rtt[i];
+	}
+	/* stop the server */
+	send(fd, buf, 0, 0);
+
+	qsort(rtt, n, sizeof(*rtt), cmp_double);
+	printf("%lu round trips: avg %.1f us, median %.1f us, "
+	       "99%% %.1f us\n", n, sum / n, rtt[n / 2], rtt[n * 99 / 100]);
+	free(rtt);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct sockaddr_in addr = {
+		.sin_family = AF_INET,
+		.sin_port = htons(5300),
+		.sin_addr.s_addr = htonl(INADDR_ANY),
+	};
+	unsigned long n = 100000;
+	size_t size = 64;
+	int c, listen = 0;
+
+	while ((c = getopt(argc, argv, "lc:p:n:s:b:P")) != -1) {
+		switch (c) {
+		case 'l':
+			listen = 1;
+			break;
+		case 'c':
+			if (!inet_aton(optarg, &addr.sin_addr)) {
+				fprintf(stderr, "udp_rr: bad address\n");
+				return 1;
+			}
+			break;
+		case 'p':
+			addr.sin_port = htons(atoi(optarg));
+			break;
+		case 'n':
+			n = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			size = atoi(optarg);
+			break;
+		case 'b':
+			busy_poll = atoi(optarg);
+			break;
+		case 'P':
+			use_poll = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s -l [-p port] [-b usecs] [-P]\n"
+				"       %s -c addr [-p port] [-n requests] "
+				"[-s size] [-b usecs] [-P]\n", argv[0], argv[0]);
+			return 1;
+		}
+	}
+	if (!n || !size || size > BUF_SIZE) {
+		fprintf(stderr, "udp_rr: bad requests or size\n");
+		return 1;
+	}
+
+	return listen ? server(&addr) : client(&addr, n, size);
+}